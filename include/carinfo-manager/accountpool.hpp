@@ -83,7 +83,9 @@ class AccountPool : public BasicPool {
 	bool empty() const;
 	int clear();
 	int load(std::istream &is);
+	int load(std::istream &is, size_t threads);
 	int save(std::ostream &os) const;
+	int save(std::string &out, size_t indent) const;
 	std::vector<Account> list() const;
 
 	bool operator==(const AccountPool &ap) const;
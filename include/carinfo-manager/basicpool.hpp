@@ -30,5 +30,6 @@ class BasicPool {
 	virtual bool empty() const = 0;
 	virtual int clear() = 0;
 	virtual int load(std::istream &is) = 0;
+	virtual int load(std::istream &is, size_t threads) = 0;
 	virtual int save(std::ostream &os) const = 0;
 };
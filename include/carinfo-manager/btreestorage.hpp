@@ -0,0 +1,115 @@
+/**
+ * @file include/carinfo-manager/btreestorage.hpp
+ * @brief Declaration of class BTreeStorage
+ *
+ * @details
+ * This file contains the declaration of the BTreeStorage class.
+ * The BTreeStorage class is a StorageBackend that keeps its records in a B+tree of fixed-size pages in a single file.
+ * Only the pages held by its buffer pool are in memory, so the data set may be much larger than RAM:
+ *     - `open` opens (or creates) the file and sizes the buffer pool from a memory budget.
+ *     - `get`, `put`, `erase` and `scan` work on the tree; pages are loaded on demand and evicted with the CLOCK
+ *       algorithm, dirty pages are written to a journal when evicted or flushed.
+ *     - `flush` makes the changes a checkpoint: the journal is synced, then copied into the file. After a crash the
+ *       tree is as of the last successful flush, a checkpoint the crash interrupted is completed by `open`.
+ *     - `hitCount` and `missCount` report how often a page was found in the buffer pool.
+ * Deletes are lazy: emptied pages are left in the tree and are not reused. Every operation locks the whole tree.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#pragma once
+#pragma execution_character_set("utf-8")
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "carinfo-manager/storagebackend.hpp"
+
+class BTreeStorage : public StorageBackend {
+  public:
+	static constexpr size_t PAGE_SIZE = 4096;
+	// largest key + value accepted, so that a page always holds at least four entries
+	static constexpr size_t MAX_ENTRY_SIZE = 1000;
+	static constexpr size_t MIN_FRAMES = 16;
+
+  private:
+	class Node {
+	  public:
+		bool leaf;
+		uint32_t next;  // next leaf, 0 for the last one
+		std::vector<std::string> keys;
+		std::vector<std::string> values;      // leaf only
+		std::vector<uint32_t> children;       // internal only, keys.size() + 1 children
+	};
+
+	class Frame {
+	  public:
+		uint32_t page;
+		Node node;
+		bool dirty;
+		bool referenced;
+		size_t pins;
+	};
+
+	std::string path;
+	std::fstream file;
+	uint32_t root;
+	uint32_t page_count;
+	uint32_t checkpoint;  // number of the last checkpoint, in the meta page
+	std::string journal_path;
+	std::fstream journal;
+	std::unordered_map<uint32_t, std::streamoff> journal_pages;  // offset of each page journaled since the checkpoint
+	std::streamoff journal_end;
+	size_t frame_budget;
+	std::vector<std::unique_ptr<Frame>> frames;
+	std::unordered_map<uint32_t, Frame *> page_table;
+	size_t clock_hand;
+	std::atomic<size_t> hits;
+	std::atomic<size_t> misses;
+	std::recursive_mutex mtx;
+
+	Frame *fetch(uint32_t page);
+	Frame *new_page(bool leaf);
+	Frame *victim();
+	void release_frames();
+	void unpin(Frame *frame);
+	void read_page(uint32_t page, Node &node);
+	static void encode_page(const Node &node, char *buf);
+	void encode_meta(char *buf, uint32_t number) const;
+	void write_page(uint32_t page, const char *buf);
+	void journal_page(uint32_t page, const char *buf);
+	void write_back(Frame &frame);
+	void apply_journal(const std::unordered_map<uint32_t, std::streamoff> &pages);
+	void reset_journal();
+	void recover();
+	void init_file();
+	bool insert(uint32_t page,
+				const std::string &key,
+				const std::string &value,
+				std::string &separator,
+				uint32_t &right);
+	uint32_t find_leaf(const std::string &key);
+
+  public:
+	BTreeStorage();
+	BTreeStorage(const BTreeStorage &) = delete;
+	~BTreeStorage();
+	int open(const std::string &path, size_t bufferPoolBytes);
+	int get(const std::string &key, std::string &value) override;
+	int put(const std::string &key, const std::string &value) override;
+	int erase(const std::string &key) override;
+	int scan(const std::string &prefix,
+			 const std::function<bool(const std::string &key, const std::string &value)> &fn) override;
+	int clear() override;
+	int flush() override;
+	size_t hitCount() const;
+	size_t missCount() const;
+	size_t frameCount() const;
+
+	BTreeStorage &operator=(const BTreeStorage &) = delete;
+};
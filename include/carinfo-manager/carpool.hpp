@@ -3,10 +3,13 @@
  * @brief Declaration of class Color, class Car, and class CarPool.
  * 
  * @details
- * This file contains the declarations of the Color, Car, and CarPool classes.
+ * This file contains the declarations of the Color, Car, CarPatch, and CarPool classes.
  * The Color class represents a color with red, green, and blue components.
  * The Car class represents a car with an ID, type, color, year, and image path.
+ * The CarPatch class lists the fields of a car to change, see CarPool::patchCar.
  * The CarPool class represents a collection of cars and provides various operations on them.
+ * The CarPool class can cache the compact JSON of its cars, so that the cars written again and again are not
+ * serialized each time, see CarPool::setFragmentCache.
  * 
  * @author donghy23@mails.tsinghua.edu.cn
  * @version 1.0
@@ -14,12 +17,20 @@
 
 #pragma once
 #pragma execution_character_set("utf-8")
+#include <atomic>
 #include <cstdint>
+#include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <set>
 #include <string>
 #include <vector>
 #include "carinfo-manager/basicpool.hpp"
+#include "carinfo-manager/fragmentcache.hpp"
+#include "carinfo-manager/parallelloader.hpp"
+#include "carinfo-manager/storagebackend.hpp"
 
 class Car {
   private:
@@ -63,12 +74,57 @@ class Car {
 	const static Car NULL_CAR;
 };
 
+class CarPatch {
+  public:
+	// unset fields are left unchanged
+	std::optional<std::string> id;
+	std::optional<std::string> type;
+	std::optional<std::string> owner;
+	std::optional<std::string> color;
+	std::optional<int> year;
+	std::optional<std::string> img_path;
+};
+
 class CarPool : public BasicPool {
   private:
 	std::map<std::string, Car> carpool_byid;
 	std::multimap<std::string, Car> carpool_byowner;
 	std::multimap<std::string, Car> carpool_bycolor;
 	std::multimap<std::string, Car> carpool_bytype;
+	// number of cars referencing each image path, guarded by img_mutex so that it can be read from other threads
+	std::map<std::string, size_t> img_refcount;
+	mutable std::mutex img_mutex;
+
+	// segmented layout, see saveSegments; segments == 0 means the carpool is not tracking changes
+	size_t segments;
+	size_t disk_segments;    // number of segment files written by the last manifest
+	size_t disk_generation;  // generation of the segment files of the last manifest
+	std::vector<std::set<std::string>> segment_ids;
+	std::set<size_t> dirty_segments;
+	bool manifest_dirty;
+
+	void ref_image(const std::string &img_path, size_t count = 1);
+	void unref_image(const std::string &img_path);
+	void mark_dirty(const std::string &id, bool present);
+	void rebuild_segments();
+	int load_records(const std::vector<ParallelLoader::Record> &records, size_t threads);
+
+	// out-of-core storage, see attachStorage; when set, the maps above stay empty
+	std::unique_ptr<StorageBackend> storage;
+
+	// bumped after every change of the cars, see getVersion
+	std::atomic<uint64_t> version;
+
+	// compact JSON of the cars, see setFragmentCache; nullptr if not cached, and always for copies
+	std::unique_ptr<FragmentCache> fragment_cache;
+	void forget_fragments(const std::string &id = "");
+
+	bool storage_find(const std::string &id, Car &car) const;
+	bool storage_add(const Car &car);
+	bool storage_remove(const Car &car);
+	bool storage_patch(const Car &car, const Car &patched);
+	void storage_query(const std::string &prefix, CarPool &result) const;
+	int add_car(const Car &car);
 
   public:
 	CarPool();
@@ -77,10 +133,12 @@ class CarPool : public BasicPool {
 	CarPool(const CarPool &cp);
 	~CarPool();
 	int addCar(const Car &car);
+	int addCars(std::vector<Car> cars);
 	int removeCar(const Car &car);
 	int removeCar(const std::string &id);
 	int updateCar(const Car &original_car, const Car &new_car);
 	int updateCar(const std::string &id, const Car &new_car);
+	int patchCar(const std::string &id, const CarPatch &patch);
 	CarPool getCarbyId(const std::string &id) const;
 	CarPool getCarbyColor(const std::string &color) const;
 	CarPool getCarbyOwner(const std::string &owner) const;
@@ -89,12 +147,38 @@ class CarPool : public BasicPool {
 				   const std::string &color = "",
 				   const std::string &owner = "",
 				   const std::string &type = "") const;
+	size_t imageRefCount(const std::string &img_path) const;
 	size_t size() const;
 	bool empty() const;
 	int clear();
 	int load(std::istream &is);
+	int load(std::istream &is, size_t threads);
 	int save(std::ostream &os) const;
+	int save(std::string &out, size_t indent) const;
+	int saveById(const std::vector<std::string> &ids, std::string &out, size_t indent, size_t &found) const;
+	int saveCar(const std::string &id,
+				const std::string &color,
+				const std::string &owner,
+				const std::string &type,
+				std::string &out,
+				size_t indent,
+				size_t &found) const;
+	int setSegments(size_t segment_count);
+	size_t segmentCount() const;
+	size_t dirtySegmentCount() const;
+	int loadSegments(const std::string &dir, size_t threads);
+	int saveSegments(const std::string &dir);
+	static size_t segmentOf(const std::string &id, size_t segment_count);
+	int attachStorage(std::unique_ptr<StorageBackend> backend);
+	bool hasStorage() const;
+	int flushStorage();
+	uint64_t getVersion() const;
+	void setFragmentCache(size_t capacityBytes);
+	const FragmentCache *fragmentCache() const;
 	std::vector<Car> list() const;
+	void forEachCar(const std::function<void(const Car &)> &fn) const;
+	static int parseCar(const std::string &record, Car &car);
+	static bool carFits(const Car &car);
 
 	// operator std::vector<Car>() const;
 	bool operator==(const CarPool &cp) const;
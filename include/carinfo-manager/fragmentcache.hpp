@@ -0,0 +1,76 @@
+/**
+ * @file include/carinfo-manager/fragmentcache.hpp
+ * @brief Declaration of class FragmentCache
+ *
+ * @details
+ * This file contains the declaration of the FragmentCache class.
+ * The FragmentCache class keeps the compact JSON of recently serialized cars, keyed by car ID, up to a byte budget,
+ * and evicts the least recently used ones first, so that the cars asked for again and again are copied into a response
+ * instead of being serialized each time.
+ *     - `get` returns the JSON of a car, or nullptr if it is not cached.
+ *     - `generation` and `put` cache the JSON of a car, unless the cache was invalidated in between.
+ *     - `accepts` tells whether a response of a given number of cars should use the cache.
+ *     - `invalidate` drops the JSON of a car when it changes, `clear` drops all of it.
+ *     - `hitCount`, `missCount`, `evictionCount`, `byteCount` and `entryCount` report the state of the cache.
+ * A reader takes the generation before it reads a car and passes it to `put`, which drops the JSON if any car was
+ * invalidated since: the car read may be the version an invalidation has just replaced. All methods are thread-safe.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#pragma once
+#pragma execution_character_set("utf-8")
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class FragmentCache {
+  public:
+	// bytes charged per entry on top of its ID and JSON, for the list and hash nodes and the shared buffer
+	static constexpr size_t ENTRY_OVERHEAD = 160;
+	// responses with more cars than capacity / (MAX_RESULT_FRACTION * ENTRY_OVERHEAD) are written without the cache,
+	// so that one scan of all the cars cannot flush it
+	static constexpr size_t MAX_RESULT_FRACTION = 4;
+
+  private:
+	class Entry {
+	  public:
+		std::string id;
+		std::shared_ptr<const std::string> fragment;
+	};
+
+	size_t capacity;
+	size_t bytes;
+	uint64_t gen;  // bumped by every invalidation
+	std::list<Entry> lru;  // most recently used first
+	std::unordered_map<std::string, std::list<Entry>::iterator> entries;
+	mutable std::mutex mtx;
+	std::atomic<size_t> hits;
+	std::atomic<size_t> misses;
+	std::atomic<size_t> evictions;
+
+	static size_t charge(const Entry &entry);
+
+  public:
+	FragmentCache(size_t capacityBytes);
+	FragmentCache(const FragmentCache &) = delete;
+	~FragmentCache();
+	std::shared_ptr<const std::string> get(const std::string &id);
+	uint64_t generation() const;
+	void put(const std::string &id, std::shared_ptr<const std::string> fragment, uint64_t generation);
+	bool accepts(size_t cars) const;
+	void invalidate(const std::string &id);
+	void clear();
+	size_t hitCount() const;
+	size_t missCount() const;
+	size_t evictionCount() const;
+	size_t byteCount() const;
+	size_t entryCount() const;
+
+	FragmentCache &operator=(const FragmentCache &) = delete;
+};
@@ -6,6 +6,7 @@
  * This file contains the declaration of the Hash class. The Hash class provides functionality to hash a string with a salt using the SHA-256 algorithm.
  * The class includes private member variables for storing the data, salt, and hash. It also includes private member functions for performing various operations related to the SHA-256 algorithm.
  * Public member functions are provided to set the data and salt, retrieve the hash, and perform other operations related to hashing.
+ * Data that does not fit in memory can be hashed incrementally with `update` and `finish`, independently of the data and salt.
  * The Hash class is designed to be used in the Carinfo-Manager project.
  * 
  * @author donghy23@mails.tsinghua.edu.cn & kibonga@github.com
@@ -23,6 +24,13 @@ class Hash {
 	std::string data, salt, hash;
 	void sha256();
 
+	// state of the incremental hashing, see update
+	uint32_t state[8];
+	uint8_t buffer[64];
+	size_t buffered;
+	uint64_t total;
+	void reset_state();
+
   private:
 	const static uint32_t K[64];
 	const static int a, b, c, d, e, f, g, h;
@@ -45,4 +53,6 @@ class Hash {
 	void setData(std::string data);
 	void setSalt(std::string salt);
 	std::string getHash();
+	void update(const char *bytes, size_t length);
+	std::string finish();
 };
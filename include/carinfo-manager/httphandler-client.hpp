@@ -7,6 +7,10 @@
  * The ClientHttpHandler class provides static methods to handle HTTP requests from the client side.
  * The AccountVerifyResult enum represents the result of account verification.
  * The HttpResult class represents the result of an HTTP request.
+ * Car queries and car images are cached with their ETags and revalidated with `If-None-Match`, so unchanged results
+ * are not downloaded again.
+ * The session token issued by /login is sent with the requests of the account, so the server can skip checking its
+ * password.
  * 
  * @author donghy23@mails.tsinghua.edu.cn
  * @version 1.0
@@ -14,9 +18,12 @@
 
 #pragma once
 #pragma execution_character_set("utf-8")
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include "carinfo-manager/accountpool.hpp"
 #include "carinfo-manager/carpool.hpp"
+#include "carinfo-manager/responsecache.hpp"
 #include "cpp-httplib/httplib.h"
 #include "json/json.hpp"
 
@@ -46,8 +53,31 @@ class ClientHttpHandler {
 		operator bool() const { return status == 200; }
 	};
 
+	// memory budget of the responses kept to revalidate /get_carinfo and /get_carimg
+	static constexpr size_t RESPONSE_CACHE_BYTES = 64 << 20;
+
   private:
+	class SessionTokenStore {
+	  public:
+		std::mutex mtx;
+		std::unordered_map<std::string, std::string> tokens;  // by "ip:port\nusername"
+	};
+
 	static nlohmann::json parse_resp_content(const httplib::Response &resp);
+	static ResponseCache &response_cache();
+	static SessionTokenStore &session_tokens();
+	static void store_session_token(const std::string &ip,
+									int port,
+									const Account &acc,
+									const std::string &token);
+	static void add_session_token(httplib::MultipartFormDataItems &items,
+								  const std::string &ip,
+								  int port,
+								  const Account &acc);
+	static httplib::Result post_cached(httplib::Client &client,
+									   const std::string &path,
+									   const httplib::MultipartFormDataItems &items,
+									   const std::string &cache_key);
 
   public:
 	ClientHttpHandler();
@@ -90,6 +120,13 @@ class ClientHttpHandler {
 										 const int new_car_year,
 										 const std::string &new_car_img,
 										 const std::string &new_car_img_type);
+	static HttpResult handler_patch_car(const std::string &ip,
+										const int port,
+										const Account &acc,
+										const std::string &car_id,
+										const CarPatch &patch,
+										const std::string &new_car_img = "",
+										const std::string &new_car_img_type = "");
 	static HttpResult handler_search_account(const std::string &ip,
 											 const int port,
 											 const Account &acc,
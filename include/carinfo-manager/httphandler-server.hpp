@@ -5,6 +5,11 @@
  * @details
  * This file contains the declaration of the ServerHttpHandler class, which handles HTTP requests for car information management.
  * The ServerHttpHandler class provides methods for handling various types of requests, such as testing the connection, login or password change, car management, and account management.
+ * Many cars can be fetched by their IDs in one /get_cars request, and many car changes sent in one /batch request,
+ * which is authenticated once and applied without other changes interleaving.
+ * Each change of the cars is saved before the cars are unlocked, so that saves see no change half made. The car
+ * queries share the lock, so they run together but never see a change half made either.
+ * The cars and accounts of a response are serialized straight into its body, as compact JSON unless an indent is given.
  * 
  * @author donghy23@mails.tsinghua.edu.cn
  * @version 1.0
@@ -12,22 +17,88 @@
 
 #pragma once
 #pragma execution_character_set("utf-8")
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <vector>
 #include "carinfo-manager/accountpool.hpp"
 #include "carinfo-manager/carpool.hpp"
+#include "carinfo-manager/imagecache.hpp"
+#include "carinfo-manager/imagepack.hpp"
+#include "carinfo-manager/imagestore.hpp"
+#include "carinfo-manager/imagewriter.hpp"
+#include "carinfo-manager/requestparams.hpp"
+#include "carinfo-manager/sessiontokens.hpp"
 #include "cpp-httplib/httplib.h"
 #include "json/json.hpp"
 
 class ServerHttpHandler {
+  public:
+	// most car IDs of a /get_cars request
+	static constexpr size_t MAX_CAR_IDS = 1000;
+
   private:
 	AccountPool &accountpool;
 	CarPool &carpool;
 	std::string imgDir;  // end with '/'
+	ImagePack *imgpack;  // nullptr if the images are stored as files
+	ImageStore imagestore;
+	mutable ImageCache imagecache;
+	size_t maxUploadBytes;
+	std::string etag_epoch;  // differs between server runs, whose carpool versions restart from 0
+	SessionTokens *sessions;  // nullptr if /login issues no tokens
+	mutable std::shared_mutex car_mtx;  // exclusive for the changes of the cars, so that a batch is applied as a whole
+	size_t json_indent;       // indent of the JSON responses, 0 for compact JSON
+	std::function<void()> save_cars;  // persists the car data, called with car_mtx held
 
   private:
-	nlohmann::json parse_post_body(const httplib::Request &req) const;
+	int read_multipart(const httplib::Request &req,
+					   const httplib::ContentReader &content_reader,
+					   const std::string &img_field,
+					   httplib::MultipartFormDataMap &fields,
+					   std::optional<ImageStore::Upload> &upload);
+	std::shared_ptr<const void> open_image(const std::string &img_path,
+										   const char *&img_data,
+										   size_t &img_size) const;
+	std::string query_etag(const std::string &car_id,
+						   const std::string &car_owner,
+						   const std::string &car_color,
+						   const std::string &car_type) const;
+	bool image_validators(const std::string &img_path, std::string &etag, std::string &last_modified) const;
+	bool not_modified(const httplib::Request &req,
+					  const std::string &etag,
+					  const std::string &last_modified = "") const;
+	int dump_indent() const;
+	void persist_cars();
+	bool read_credentials(const RequestParams &params, SessionTokens::Session &session) const;
+	AccountPool::AccountVerifyResult authenticate(const RequestParams &params,
+												  SessionTokens::Session &session,
+												  bool with_type = false) const;
+	int store_image(const nlohmann::json &op, std::optional<std::string> &img_path);
+	int apply_operation(const nlohmann::json &op,
+						int img_status,
+						const std::optional<std::string> &img_path,
+						std::vector<std::function<int()>> &undo,
+						std::vector<std::string> &released);
 
   public:
-	ServerHttpHandler(AccountPool &accountpool, CarPool &carpool, std::string imgDir);
+	ServerHttpHandler(AccountPool &accountpool,
+					  CarPool &carpool,
+					  std::string imgDir,
+					  size_t imgCacheBytes = 0,
+					  size_t maxUploadBytes = SIZE_MAX,
+					  ImageWriter *imgWriter = nullptr,
+					  size_t imgFanout = 0,
+					  ImagePack *imgPack = nullptr,
+					  SessionTokens *sessions = nullptr,
+					  size_t jsonIndent = 0,
+					  std::function<void()> saveCars = nullptr);
+	const ImageCache &imageCache() const;
+	const ImageStore &imageStore() const;
+	ImageStore &imageStore();
+	std::shared_mutex &carLock();
 	// test connection
 	void handler_test_connection(const httplib::Request &req, httplib::Response &res) const;
 	// login or change password
@@ -35,10 +106,19 @@ class ServerHttpHandler {
 	void handler_change_password(const httplib::Request &req, httplib::Response &res);
 	// car management
 	void handler_get_carinfo(const httplib::Request &req, httplib::Response &res) const;
+	void handler_get_cars(const httplib::Request &req, httplib::Response &res) const;
 	void handler_get_carimg(const httplib::Request &req, httplib::Response &res) const;
-	void handler_add_car(const httplib::Request &req, httplib::Response &res);
+	void handler_add_car(const httplib::Request &req,
+						 httplib::Response &res,
+						 const httplib::ContentReader &content_reader);
 	void handler_remove_car(const httplib::Request &req, httplib::Response &res);
-	void handler_update_car(const httplib::Request &req, httplib::Response &res);
+	void handler_update_car(const httplib::Request &req,
+							httplib::Response &res,
+							const httplib::ContentReader &content_reader);
+	void handler_patch_car(const httplib::Request &req,
+						   httplib::Response &res,
+						   const httplib::ContentReader &content_reader);
+	void handler_batch(const httplib::Request &req, httplib::Response &res);
 	// account management
 	void handler_get_accountinfo(const httplib::Request &req, httplib::Response &res) const;
 	void handler_get_all_account(const httplib::Request &req, httplib::Response &res) const;
@@ -0,0 +1,64 @@
+/**
+ * @file include/carinfo-manager/imagecache.hpp
+ * @brief Declaration of class ImageCache
+ *
+ * @details
+ * This file contains the declaration of the ImageCache class.
+ * The ImageCache class keeps the bytes of recently requested image files in memory, up to a byte budget, and evicts
+ * the least recently used images first. Images are handed out as shared, immutable buffers, so a response can keep
+ * sending an image after it has been evicted or invalidated.
+ *     - `get` returns the bytes of an image file, reading the file on a miss.
+ *     - `accepts` tells whether an image of a given size would be cached at all.
+ *     - `invalidate` drops an image, e.g. when no car references it anymore.
+ *     - `hitCount`, `missCount`, `evictionCount`, `byteCount` and `entryCount` report the state of the cache.
+ * All methods are thread-safe.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#pragma once
+#pragma execution_character_set("utf-8")
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class ImageCache {
+  public:
+	// images larger than capacity / MAX_ENTRY_FRACTION are not cached, so one image cannot flush the cache
+	static constexpr size_t MAX_ENTRY_FRACTION = 4;
+
+  private:
+	class Entry {
+	  public:
+		std::string path;
+		std::shared_ptr<const std::string> img;
+	};
+
+	size_t capacity;
+	size_t bytes;
+	std::list<Entry> lru;  // most recently used first
+	std::unordered_map<std::string, std::list<Entry>::iterator> entries;
+	mutable std::mutex mtx;
+	std::atomic<size_t> hits;
+	std::atomic<size_t> misses;
+	std::atomic<size_t> evictions;
+
+  public:
+	ImageCache(size_t capacityBytes);
+	ImageCache(const ImageCache &) = delete;
+	~ImageCache();
+	std::shared_ptr<const std::string> get(const std::string &img_path);
+	bool accepts(size_t img_size) const;
+	void invalidate(const std::string &img_path);
+	size_t hitCount() const;
+	size_t missCount() const;
+	size_t evictionCount() const;
+	size_t byteCount() const;
+	size_t entryCount() const;
+
+	ImageCache &operator=(const ImageCache &) = delete;
+};
@@ -0,0 +1,131 @@
+/**
+ * @file include/carinfo-manager/imagepack.hpp
+ * @brief Declaration of class ImagePack
+ *
+ * @details
+ * This file contains the declaration of the ImagePack class.
+ * The ImagePack class stores images as records appended to a few large segment files instead of one file per image,
+ * which saves an inode and a directory lookup per image when most images are small. The location of every image is
+ * kept in an in-memory index, rebuilt from the segments when the pack is opened, and images are read through a memory
+ * mapping of their segment.
+ *     - An image has the path `packDir + name`, e.g. `data/imgpack/<sha256>.jpg`, although no such file exists. Cars
+ *       hold this path like the path of an image file.
+ *     - `open` loads the index, `append` and `appendFile` add an image, `touch` tells whether an image is stored and
+ *       marks it as recently used, `read` returns its bytes, `flush` makes the appended images durable.
+ *     - `start` starts a background thread that compacts a segment once the images no car references make up more
+ *       than `deadPercent` of it: the live images are copied to the end of the pack and the segment file is removed.
+ *     - `imageCount`, `segmentCount`, `byteCount`, `compactionCount` and `reclaimedBytes` report the state of the pack.
+ * All methods are thread-safe.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#pragma once
+#pragma execution_character_set("utf-8")
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include "carinfo-manager/carpool.hpp"
+#include "carinfo-manager/mappedfile.hpp"
+
+class ImagePack {
+  public:
+	// images stored more recently than this are kept, their car may not have been added yet
+	static constexpr std::chrono::seconds GRACE_PERIOD = std::chrono::seconds(60);
+
+  private:
+	class Entry {
+	  public:
+		uint32_t segment;
+		uint64_t offset;  // of the image bytes in the segment
+		uint64_t length;
+		int64_t mtime;  // seconds since the epoch, refreshed by `touch`
+	};
+
+	class Segment {
+	  public:
+		uint64_t size;                              // bytes appended so far
+		std::shared_ptr<const MappedFile> mapping;  // may end before size, remapped on demand
+	};
+
+	const CarPool &carpool;
+	std::string packDir;  // end with '/'
+	uint64_t segmentBytes;
+	size_t deadPercent;
+	std::chrono::milliseconds passInterval;
+
+	std::unordered_map<std::string, Entry> index;  // by image name
+	std::map<uint32_t, Segment> segments;
+	mutable std::mutex mtx;  // index and segments
+	uint32_t active;         // the segment appended to
+	uint64_t active_size;    // bytes of the active segment
+	std::ofstream out;       // open on the active segment
+	std::mutex append_mtx;   // active, active_size and out, taken before mtx
+
+	std::thread worker;
+	std::mutex worker_mtx;
+	std::condition_variable cv;
+	bool stopping;
+	std::atomic<size_t> compactions;
+	std::atomic<uint64_t> reclaimed;
+
+	std::string segment_path(uint32_t segment) const;
+	std::string name_of(const std::string &img_path) const;
+	bool load_segment(uint32_t segment);
+	bool open_active(uint32_t segment);
+	bool append_record(const std::string &name,
+					   int64_t mtime,
+					   const std::function<bool(std::ofstream &)> &write_bytes,
+					   uint64_t length,
+					   bool sync,
+					   Entry &entry);
+	int store(const std::string &img_path,
+			  const std::function<bool(std::ofstream &)> &write_bytes,
+			  uint64_t length,
+			  bool sync);
+	bool is_live(const std::string &name, int64_t mtime, int64_t now) const;
+	bool compact(uint32_t segment);
+	void compact_pass();
+	bool wait(std::chrono::milliseconds duration);
+	void run();
+
+  public:
+	ImagePack(const CarPool &carpool,
+			  const std::string &packDir,
+			  uint64_t segmentBytes,
+			  size_t deadPercent,
+			  std::chrono::milliseconds passInterval);
+	ImagePack(const ImagePack &) = delete;
+	~ImagePack();
+	int open();
+	void start();
+	void stop();
+	std::string pathOf(const std::string &name) const;
+	bool owns(const std::string &img_path) const;
+	bool touch(const std::string &img_path, size_t img_size);
+	int append(const std::string &img_path, const char *bytes, size_t size, bool sync);
+	int appendFile(const std::string &img_path, const std::string &file_path, size_t size, bool sync);
+	int flush();
+	std::shared_ptr<const void> read(const std::string &img_path,
+									 const char *&img_data,
+									 size_t &img_size,
+									 int64_t &mtime);
+	void forEachImage(const std::function<void(const std::string &img_path)> &fn) const;
+	size_t imageCount() const;
+	size_t segmentCount() const;
+	uint64_t byteCount() const;
+	size_t compactionCount() const;
+	uint64_t reclaimedBytes() const;
+
+	ImagePack &operator=(const ImagePack &) = delete;
+};
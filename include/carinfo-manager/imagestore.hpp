@@ -0,0 +1,121 @@
+/**
+ * @file include/carinfo-manager/imagestore.hpp
+ * @brief Declaration of class ImageStore
+ *
+ * @details
+ * This file contains the declaration of the ImageStore class.
+ * The ImageStore class stores uploaded car images under the SHA-256 of their bytes, so identical images uploaded for
+ * many cars share one file, and the file of a car does not change with its plate number. The cars hold the paths, so
+ * the references to a file are counted by the CarPool, and unreferenced files are removed by the ImageSweeper.
+ *     - `put` stores an image and returns its path. Storing an image that is already stored writes nothing.
+ *     - `Upload` receives an image chunk by chunk into a temporary file, hashing it on the way, and `commit` moves it
+ *       into place. Only one chunk of the image is in memory at a time.
+ *     - With an ImageWriter, the writes of an upload run on its I/O threads and `commit` returns according to its
+ *       durability policy. `await` waits until a committed image is in place, so a read never misses a stored image.
+ *     - `storedCount` and `deduplicatedCount` report how many uploads were written and how many were not.
+ *     - With a fan-out of n, an image is stored n directory levels deep, each level named by the next two hex digits of
+ *       its hash, e.g. `img/3f/a2/3fa2....jpg` for n = 2, for file systems where a directory of many files is slow.
+ *     - With an ImagePack, images are appended to its segments instead of being stored as files. Uploads are still
+ *       received into a temporary file, which is copied into the pack when it is committed.
+ *     - `migrate` moves the images of another layout or backend into this one and points their cars to the new paths.
+ *     - `removeUnused` removes an image file no car references, for the ImageSweeper. It is serialized against `put`
+ *       and `commit` reusing the file, which refresh its modification time, so a reused file is never removed.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#pragma once
+#pragma execution_character_set("utf-8")
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "carinfo-manager/carpool.hpp"
+#include "carinfo-manager/hash.hpp"
+#include "carinfo-manager/imagepack.hpp"
+#include "carinfo-manager/imagewriter.hpp"
+
+class ImageStore {
+  public:
+	class Upload {
+	  public:
+		// bytes handed to the ImageWriter at a time
+		static constexpr size_t CHUNK_BYTES = 256 << 10;
+
+	  private:
+		// shared with the queued writes, which may outlive the Upload
+		class File {
+		  public:
+			std::string tmp_path;
+			std::ofstream os;
+			std::atomic<bool> failed;
+		};
+
+		ImageStore &store;
+		size_t lane;
+		std::shared_ptr<File> file;
+		std::string chunk;  // not yet handed to the ImageWriter
+		Hash hash;
+		size_t length;
+		bool committed;
+
+		void flush();
+
+		friend class ImageStore;
+
+	  public:
+		Upload(ImageStore &store);
+		Upload(const Upload &) = delete;
+		~Upload();
+		bool write(const char *bytes, size_t size);
+		size_t size() const;
+
+		Upload &operator=(const Upload &) = delete;
+	};
+
+  private:
+	std::string imgDir;  // end with '/'
+	size_t fanout;       // directory levels below imgDir, see pathOf
+	std::atomic<size_t> stored;
+	std::atomic<size_t> deduplicated;
+	std::atomic<size_t> uploads;  // names the temporary files of the uploads
+	ImageWriter *writer;          // nullptr to write on the calling thread
+	ImagePack *pack;              // nullptr to store the images as files
+	// committed images not yet in place, with the number of the latest commit of each
+	std::unordered_map<std::string, std::pair<uint64_t, std::shared_future<int>>> pending;
+	uint64_t commits;
+	mutable std::mutex pending_mtx;
+	mutable std::mutex reuse_mtx;  // serializes the reuse of a stored file against its removal by removeUnused
+
+	bool refresh_existing(const std::string &img_path, size_t img_size) const;
+	void make_parent(const std::string &img_path) const;
+	int finish(Upload::File &file, const std::string &img_path, size_t img_size, bool sync);
+
+  public:
+	// largest supported fan-out, 256^3 directories
+	static constexpr size_t MAX_FANOUT = 3;
+
+	ImageStore(const std::string &imgDir,
+			   ImageWriter *writer = nullptr,
+			   size_t fanout = 0,
+			   ImagePack *pack = nullptr);
+	ImageStore(const ImageStore &) = delete;
+	~ImageStore();
+	int put(const std::string &img, const std::string &img_type, std::string &img_path);
+	int commit(Upload &upload, const std::string &img_type, std::string &img_path);
+	void await(const std::string &img_path) const;
+	std::string pathOf(const std::string &digest, const std::string &img_type) const;
+	int migrate(CarPool &carpool, size_t &moved, ImagePack *oldPack = nullptr);
+	bool removeUnused(const std::string &img_path, const CarPool &carpool, std::chrono::seconds grace);
+	static bool isDigest(const std::string &name);
+	size_t storedCount() const;
+	size_t deduplicatedCount() const;
+
+	ImageStore &operator=(const ImageStore &) = delete;
+};
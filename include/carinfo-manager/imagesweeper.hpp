@@ -0,0 +1,70 @@
+/**
+ * @file include/carinfo-manager/imagesweeper.hpp
+ * @brief Declaration of class ImageSweeper
+ *
+ * @details
+ * This file contains the declaration of the ImageSweeper class.
+ * The ImageSweeper class removes image files that are no longer referenced by any car. It runs on a background
+ * thread and walks the image directory a few files at a time, so the server does not have to wait for a full sweep
+ * before it starts serving. A file that looks unused is removed through `ImageStore::removeUnused` with the car lock
+ * held, so neither a car change nor an upload reusing the file can take a reference to it meanwhile.
+ *     - `start` starts the background thread.
+ *     - `stop` stops the background thread and waits for it to exit.
+ *     - `removedCount` returns the number of image files removed so far.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#pragma once
+#pragma execution_character_set("utf-8")
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include "carinfo-manager/carpool.hpp"
+#include "carinfo-manager/imagestore.hpp"
+
+class ImageSweeper {
+  public:
+	// files written more recently than this are left alone, their car may not have been added yet
+	static constexpr std::chrono::seconds GRACE_PERIOD = std::chrono::seconds(60);
+
+  private:
+	const CarPool &carpool;
+	ImageStore &store;
+	std::shared_mutex &carLock;  // held exclusively by every change of the cars
+	std::string imgDir;  // end with '/'
+	size_t batchSize;
+	std::chrono::milliseconds batchInterval;
+	std::chrono::milliseconds passInterval;
+
+	std::thread worker;
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool stopping;
+	std::atomic<size_t> removed;
+
+	bool wait(std::chrono::milliseconds duration);
+	void sweep_pass();
+	void run();
+
+  public:
+	ImageSweeper(const CarPool &carpool,
+				 ImageStore &store,
+				 std::shared_mutex &carLock,
+				 const std::string &imgDir,
+				 size_t batchSize,
+				 std::chrono::milliseconds batchInterval,
+				 std::chrono::milliseconds passInterval);
+	ImageSweeper(const ImageSweeper &) = delete;
+	~ImageSweeper();
+	void start();
+	void stop();
+	size_t removedCount() const;
+
+	ImageSweeper &operator=(const ImageSweeper &) = delete;
+};
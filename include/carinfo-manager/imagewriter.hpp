@@ -0,0 +1,78 @@
+/**
+ * @file include/carinfo-manager/imagewriter.hpp
+ * @brief Declaration of class ImageWriter
+ *
+ * @details
+ * This file contains the declaration of the ImageWriter class.
+ * The ImageWriter class runs the disk writes of the ImageStore on dedicated I/O threads, so a request thread receiving
+ * an upload hands its chunks over instead of waiting for the disk. Each thread serves one lane, and the jobs of a lane
+ * run in the order they were submitted, so all writes of one upload go through one lane. The queued jobs are bounded
+ * by a byte budget: `submit` blocks while the queue is full, which slows the uploads down to the speed of the disk.
+ *     - `start` starts the I/O threads.
+ *     - `stop` runs the queued jobs and stops the I/O threads.
+ *     - `submit` queues a job on a lane.
+ *     - `durability` tells when a stored image is acknowledged, see `Durability`.
+ *     - `syncFile` and `syncDirectory` flush a file or a directory entry to the disk.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#pragma once
+#pragma execution_character_set("utf-8")
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class ImageWriter {
+  public:
+	// when `ImageStore::commit` returns
+	enum class Durability {
+		QUEUED,   // as soon as the image is queued, before it is written
+		WRITTEN,  // once the image file is in place, possibly still in the OS cache
+		SYNCED    // once the image file and its directory entry are flushed to the disk
+	};
+
+  private:
+	class Job {
+	  public:
+		size_t bytes;
+		std::function<void()> run;
+	};
+
+	size_t laneCount;
+	size_t queueBytes;
+	Durability policy;
+
+	std::vector<std::thread> workers;
+	std::vector<std::deque<Job>> lanes;
+	std::mutex mtx;
+	std::condition_variable work;   // a lane has a job, or the writer stops
+	std::condition_variable space;  // queued bytes were released
+	size_t queued;                  // bytes of the queued and running jobs
+	bool stopping;
+	std::atomic<size_t> stalls;
+
+	void run(size_t lane);
+
+  public:
+	ImageWriter(size_t threadCount, size_t queueBytes, Durability durability);
+	ImageWriter(const ImageWriter &) = delete;
+	~ImageWriter();
+	void start();
+	void stop();
+	void submit(size_t lane, size_t bytes, std::function<void()> job);
+	size_t threadCount() const;
+	Durability durability() const;
+	size_t queuedBytes();
+	size_t stallCount() const;
+	static bool syncFile(const std::string &path);
+	static bool syncDirectory(const std::string &dir);
+
+	ImageWriter &operator=(const ImageWriter &) = delete;
+};
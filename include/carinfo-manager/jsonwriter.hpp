@@ -0,0 +1,56 @@
+/**
+ * @file include/carinfo-manager/jsonwriter.hpp
+ * @brief Declaration of class JsonWriter
+ *
+ * @details
+ * This file contains the declaration of the JsonWriter class.
+ * The JsonWriter class writes JSON text straight into a string, without building a nlohmann::json document first, so
+ * that the cars and accounts of a response are serialized into its body with one pass and no allocation per field.
+ *     - `beginObject`, `endObject`, `beginArray` and `endArray` open and close a container.
+ *     - `key` writes the name of the next member of an object.
+ *     - `value` and `null` write a value, a member of an array or the value of the last key.
+ *     - `raw` writes a value that is already JSON text, e.g. a cached fragment.
+ * With an indent of 0 the text is compact, otherwise it has the layout of nlohmann::json::dump(indent), so files
+ * written by the older code are written the same. Keys are written in the order they are given; the writer does not
+ * check that the calls form valid JSON.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#pragma once
+#pragma execution_character_set("utf-8")
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class JsonWriter {
+  private:
+	std::string &out;
+	size_t indent;
+	std::vector<bool> empty;  // per open container, true until its first member is written
+	bool after_key;
+
+	void begin_value();
+	void begin_container(char open);
+	void end_container(char close);
+	void newline();
+
+  public:
+	JsonWriter(std::string &out, size_t indent = 0);
+	JsonWriter(const JsonWriter &) = delete;
+	~JsonWriter();
+	JsonWriter &beginObject();
+	JsonWriter &endObject();
+	JsonWriter &beginArray();
+	JsonWriter &endArray();
+	JsonWriter &key(std::string_view name);
+	JsonWriter &value(std::string_view text);
+	JsonWriter &value(int64_t number);
+	JsonWriter &null();
+	JsonWriter &raw(std::string_view json);
+	static void appendString(std::string &out, std::string_view text);
+
+	JsonWriter &operator=(const JsonWriter &) = delete;
+};
@@ -0,0 +1,38 @@
+/**
+ * @file include/carinfo-manager/mappedfile.hpp
+ * @brief Declaration of class MappedFile
+ *
+ * @details
+ * This file contains the declaration of the MappedFile class.
+ * The MappedFile class maps a whole file read-only into memory, with `mmap` on POSIX systems and a file mapping on
+ * Windows. The pages are read by the kernel on demand and shared with the page cache, so a large file can be sent
+ * without being copied into a buffer of the process.
+ *     - `isOpen` tells whether the file could be mapped.
+ *     - `data` and `size` give the mapped bytes.
+ * The file must not be truncated while it is mapped; the image files are only ever replaced by a rename or removed,
+ * which leaves an existing mapping intact.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#pragma once
+#pragma execution_character_set("utf-8")
+#include <string>
+
+class MappedFile {
+  private:
+	const char *addr;
+	size_t length;
+	bool opened;
+
+  public:
+	MappedFile(const std::string &path);
+	MappedFile(const MappedFile &) = delete;
+	~MappedFile();
+	bool isOpen() const;
+	const char *data() const;
+	size_t size() const;
+
+	MappedFile &operator=(const MappedFile &) = delete;
+};
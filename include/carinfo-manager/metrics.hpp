@@ -0,0 +1,102 @@
+/**
+ * @file include/carinfo-manager/metrics.hpp
+ * @brief Declaration of class Metrics
+ *
+ * @details
+ * This file contains the declaration of the Metrics class.
+ * The Metrics class counts the requests of each route of the server by status code, with a latency histogram and the
+ * number of requests in flight, times the saves of the data files, and renders all of it, together with the gauges
+ * and counters read from the other parts of the server, in the Prometheus text format for /metrics.
+ *     - `addRoute` and `addTimer` register a route or a timed operation, before the server starts.
+ *     - `addGauge` and `addCounter` register a value read when the metrics are rendered.
+ *     - `begin` and `end` record a request, `time` records a timed operation.
+ *     - `render` renders the metrics.
+ * Each thread records into a shard of its own, whose counters only it writes, so recording takes no lock and shares no
+ * cache line with the other threads; `render` adds the shards up. The latency histograms have HDR-style buckets, four
+ * linear ones per power of two from 16 us to 67 s, which bounds the error of a quantile to 25%.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#pragma once
+#pragma execution_character_set("utf-8")
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class Metrics {
+  public:
+	static constexpr size_t MAX_ROUTES = 32;
+	static constexpr size_t MAX_TIMERS = 8;
+	static constexpr size_t BUCKETS = 90;  // 89 bounds from 16 us to 2^26 us, and +Inf
+	static constexpr size_t STATUSES = 13;  // the status codes the server answers with, and any other
+
+  private:
+	class Histogram {
+	  public:
+		std::array<std::atomic<uint64_t>, BUCKETS> buckets{};
+		std::atomic<uint64_t> count{0};
+		std::atomic<uint64_t> sum_us{0};
+	};
+
+	class RouteCell {
+	  public:
+		std::atomic<uint64_t> started{0};
+		std::array<std::atomic<uint64_t>, STATUSES> statuses{};
+		Histogram latency;
+	};
+
+	class Shard {
+	  public:
+		std::array<RouteCell, MAX_ROUTES> routes;
+		std::array<Histogram, MAX_TIMERS> timers;
+		size_t active = 0;  // route of the request being served + 1, 0 if none
+		std::chrono::steady_clock::time_point began;
+	};
+
+	class Value {
+	  public:
+		std::string name;
+		std::string help;
+		bool counter;
+		std::function<double()> read;
+	};
+
+	const uint64_t id;  // tells the shards of different instances apart in the thread-local cache
+	std::vector<std::string> routes;  // routes[0] counts the requests to other paths
+	std::unordered_map<std::string, size_t> route_index;
+	std::vector<std::string> timers;
+	std::vector<Value> values;
+
+	std::vector<std::unique_ptr<Shard>> shards;
+	mutable std::mutex shards_mtx;
+
+	Shard &shard();
+	static void observe(Histogram &histogram, std::chrono::steady_clock::duration elapsed);
+
+  public:
+	Metrics();
+	Metrics(const Metrics &) = delete;
+	~Metrics();
+	bool addRoute(const std::string &path);
+	size_t addTimer(const std::string &name);
+	void addGauge(const std::string &name, const std::string &help, std::function<double()> read);
+	void addCounter(const std::string &name, const std::string &help, std::function<double()> read);
+	void begin(const std::string &path);
+	void end(int status);
+	void time(size_t timer, std::chrono::steady_clock::duration elapsed);
+	std::string render() const;
+	static size_t bucketOf(uint64_t us);
+	static uint64_t bucketBound(size_t bucket);
+
+	Metrics &operator=(const Metrics &) = delete;
+};
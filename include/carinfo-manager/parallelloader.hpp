@@ -0,0 +1,42 @@
+/**
+ * @file include/carinfo-manager/parallelloader.hpp
+ * @brief Declaration of class ParallelLoader
+ *
+ * @details
+ * This file contains the declaration of the ParallelLoader class.
+ * The ParallelLoader class provides static helpers used by the pools to load their data files on several threads:
+ *     - `splitRecords` splits the text of a top-level JSON object into raw key/value records without building a DOM.
+ *     - `run` splits a range of records into chunks and calls a worker for each chunk on its own thread.
+ *     - `threadCount` resolves a configured thread count (0 means one thread per hardware core).
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#pragma once
+#pragma execution_character_set("utf-8")
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class ParallelLoader {
+  public:
+	class Record {
+	  public:
+		std::string_view key;    // raw JSON string, including the quotes
+		std::string_view value;  // raw JSON value
+	};
+
+	// minimum number of records handed to one worker thread
+	static constexpr size_t MIN_CHUNK_SIZE = 256;
+
+  public:
+	static size_t threadCount(size_t requested);
+	static int splitRecords(const std::string &text, std::vector<Record> &records);
+	static int run(size_t record_count,
+				   size_t threads,
+				   const std::function<int(size_t chunk, size_t begin, size_t end)> &worker);
+	static size_t chunkCount(size_t record_count, size_t threads);
+};
@@ -0,0 +1,55 @@
+/**
+ * @file include/carinfo-manager/ratelimiter.hpp
+ * @brief Declaration of class RateLimiter
+ *
+ * @details
+ * This file contains the declaration of the RateLimiter class.
+ * The RateLimiter class limits the request rate of each client with a token bucket: a client may send `burst`
+ * requests at once, and one more every `1 / rate` seconds after that.
+ *     - `admit` takes a token from the bucket of a client, or tells how long until the next one.
+ * Clients are told apart by their address. A bucket that has filled up again is the same as a new one, so such
+ * buckets are dropped once the table grows, which keeps it as large as the clients active within `burst / rate`
+ * seconds. All methods are thread-safe.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#pragma once
+#pragma execution_character_set("utf-8")
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class RateLimiter {
+  private:
+	class Bucket {
+	  public:
+		double tokens;
+		std::chrono::steady_clock::time_point refilled;
+	};
+
+	double rate;   // tokens per second
+	double burst;  // size of a bucket
+	std::unordered_map<std::string, Bucket> buckets;
+	size_t prune_at;  // size of the table at which the full buckets are dropped
+	std::mutex mtx;
+
+	std::atomic<size_t> admitted;
+	std::atomic<size_t> limited;
+
+	void prune(std::chrono::steady_clock::time_point now);
+
+  public:
+	RateLimiter(double rate, double burst);
+	RateLimiter(const RateLimiter &) = delete;
+	~RateLimiter();
+	bool admit(const std::string &client, std::chrono::seconds &retry_after);
+	size_t clientCount();
+	size_t admittedCount() const;
+	size_t limitedCount() const;
+
+	RateLimiter &operator=(const RateLimiter &) = delete;
+};
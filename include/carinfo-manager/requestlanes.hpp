@@ -0,0 +1,86 @@
+/**
+ * @file include/carinfo-manager/requestlanes.hpp
+ * @brief Declaration of class RequestLanes
+ *
+ * @details
+ * This file contains the declaration of the RequestLanes class.
+ * The RequestLanes class keeps expensive requests from taking every worker thread of the server. Each request is
+ * classified into a lane, and each lane has a budget of requests running at once and of requests waiting for one of
+ * them; a request beyond both is turned away at once instead of holding a thread.
+ *     - `POINT_READ` for lookups by ID and logins, normally not limited.
+ *     - `SCAN` for queries that walk the cars or accounts.
+ *     - `MUTATION` for changes of the cars or accounts, which are saved before the response.
+ *     - `IMAGE` for requests reading or uploading an image.
+ * A thread waiting in a lane is a thread lost to the others, so the worker pool needs `reservedThreads` threads on top
+ * of the ones left for point reads. `Ticket` holds a place in a lane for its lifetime. All methods are thread-safe.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#pragma once
+#pragma execution_character_set("utf-8")
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include "cpp-httplib/httplib.h"
+
+class RequestLanes {
+  public:
+	enum class Lane { POINT_READ, SCAN, MUTATION, IMAGE };
+	static constexpr size_t LANE_COUNT = 4;
+
+	class Budget {
+	  public:
+		size_t workers;  // requests running at once, 0 for no limit
+		size_t queue;    // requests waiting for one of them
+	};
+
+	class Ticket {
+	  private:
+		RequestLanes &lanes;
+		Lane lane;
+		bool admitted;
+
+	  public:
+		Ticket(RequestLanes &lanes, Lane lane);
+		Ticket(const Ticket &) = delete;
+		~Ticket();
+		bool isAdmitted() const;
+
+		Ticket &operator=(const Ticket &) = delete;
+	};
+
+  private:
+	class State {
+	  public:
+		Budget budget;
+		size_t running = 0;
+		size_t waiting = 0;
+		std::condition_variable freed;
+		std::atomic<size_t> served{0};
+		std::atomic<size_t> queued{0};
+		std::atomic<size_t> rejected{0};
+	};
+
+	std::array<State, LANE_COUNT> lanes;
+	std::mutex mtx;
+
+	bool enter(Lane lane);
+	void leave(Lane lane);
+
+  public:
+	RequestLanes(const std::array<Budget, LANE_COUNT> &budgets);
+	RequestLanes(const RequestLanes &) = delete;
+	~RequestLanes();
+	static Lane classify(const httplib::Request &req);
+	static const char *laneName(Lane lane);
+	size_t reservedThreads() const;
+	size_t servedCount(Lane lane) const;
+	size_t queuedCount(Lane lane) const;
+	size_t rejectedCount(Lane lane) const;
+
+	RequestLanes &operator=(const RequestLanes &) = delete;
+};
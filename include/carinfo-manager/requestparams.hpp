@@ -0,0 +1,38 @@
+/**
+ * @file include/carinfo-manager/requestparams.hpp
+ * @brief Declaration of class RequestParams
+ *
+ * @details
+ * This file contains the declaration of the RequestParams class.
+ * The RequestParams class is a read-only view over the multipart fields of a request. Fields are returned by reference
+ * to the buffers httplib has already filled, so reading a parameter copies nothing.
+ *     - `contains` checks that every required field is present.
+ *     - `get` returns the value of a field.
+ *     - `getInt` and `getAccountType` parse a field and report whether it is valid.
+ * The view must not outlive the fields it was built on.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#pragma once
+#pragma execution_character_set("utf-8")
+#include <initializer_list>
+#include <string>
+#include "carinfo-manager/accountpool.hpp"
+#include "cpp-httplib/httplib.h"
+
+class RequestParams {
+  private:
+	const httplib::MultipartFormDataMap &fields;
+
+	const std::string *find(const char *name) const;
+
+  public:
+	RequestParams(const httplib::MultipartFormDataMap &fields);
+	~RequestParams();
+	bool contains(std::initializer_list<const char *> names) const;
+	const std::string &get(const char *name) const;
+	bool getInt(const char *name, int &value) const;
+	bool getAccountType(const char *name, Account::AccountType &type) const;
+};
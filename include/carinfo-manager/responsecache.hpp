@@ -0,0 +1,50 @@
+/**
+ * @file include/carinfo-manager/responsecache.hpp
+ * @brief Declaration of class ResponseCache
+ *
+ * @details
+ * This file contains the declaration of the ResponseCache class.
+ * The ResponseCache class keeps the bodies of responses the client has received together with their ETags, up to a
+ * byte budget, evicting the least recently used responses first. The client sends the ETag back in `If-None-Match`
+ * and reuses the cached body when the server answers 304 (Not Modified).
+ *     - `lookup` returns the cached response of a request, if any.
+ *     - `store` caches a response, replacing an older one of the same request.
+ * All methods are thread-safe.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#pragma once
+#pragma execution_character_set("utf-8")
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class ResponseCache {
+  public:
+	class Entry {
+	  public:
+		std::string etag;
+		std::string body;
+	};
+
+  private:
+	size_t capacity;
+	size_t bytes;
+	// most recently used first
+	std::list<std::pair<std::string, std::shared_ptr<const Entry>>> lru;
+	std::unordered_map<std::string, decltype(lru)::iterator> entries;
+	mutable std::mutex mtx;
+
+  public:
+	ResponseCache(size_t capacityBytes);
+	ResponseCache(const ResponseCache &) = delete;
+	~ResponseCache();
+	std::shared_ptr<const Entry> lookup(const std::string &key);
+	void store(const std::string &key, const std::string &etag, const std::string &body);
+
+	ResponseCache &operator=(const ResponseCache &) = delete;
+};
@@ -0,0 +1,62 @@
+/**
+ * @file include/carinfo-manager/sessiontokens.hpp
+ * @brief Declaration of class SessionTokens
+ *
+ * @details
+ * This file contains the declaration of the SessionTokens class.
+ * The SessionTokens class issues the session tokens returned by /login and verifies them without looking the account
+ * up. A token carries the username, the account type and the expiry time, signed with HMAC-SHA256 under a server key:
+ *     `<hex(username)>.<account type>.<expiry in ms since the epoch>.<hex(HMAC)>`
+ *     - `issue` signs a token for an account.
+ *     - `verify` checks the signature, the expiry and the revocation list, and returns the session of a valid token.
+ *     - `revoke` invalidates every token issued so far for an account, e.g. when it is updated or removed.
+ * A revocation is kept only until the tokens it invalidates have expired, so the list stays as short as the accounts
+ * changed within one token lifetime. All methods are thread-safe.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#pragma once
+#pragma execution_character_set("utf-8")
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "carinfo-manager/accountpool.hpp"
+#include "carinfo-manager/hash.hpp"
+
+class SessionTokens {
+  public:
+	class Session {
+	  public:
+		std::string username;
+		Account::AccountType type;
+	};
+
+  private:
+	Hash inner_pad;  // the key XOR ipad, already hashed
+	Hash outer_pad;  // the key XOR opad, already hashed
+	std::chrono::milliseconds ttl;
+
+	// username -> tokens expiring at or before this time, in ms since the epoch, are revoked
+	std::unordered_map<std::string, int64_t> revoked;
+	std::atomic<size_t> revoked_size;  // lets verify skip the lock while nothing is revoked
+	mutable std::mutex mtx;
+
+	std::string mac(const std::string &message) const;
+
+  public:
+	SessionTokens(const std::string &key, std::chrono::seconds ttl);
+	SessionTokens(const SessionTokens &) = delete;
+	~SessionTokens();
+	std::string issue(const std::string &username, Account::AccountType type) const;
+	bool verify(const std::string &token, Session &session) const;
+	void revoke(const std::string &username);
+	size_t revokedCount() const;
+	static std::string randomKey();
+
+	SessionTokens &operator=(const SessionTokens &) = delete;
+};
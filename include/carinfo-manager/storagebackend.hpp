@@ -0,0 +1,37 @@
+/**
+ * @file include/carinfo-manager/storagebackend.hpp
+ * @brief Declaration of class StorageBackend
+ *
+ * @details
+ * This file contains the declaration of the StorageBackend class.
+ * The StorageBackend class is an abstract, ordered key-value store that a pool can keep its records in instead of
+ * its in-memory maps. Keys and values are byte strings; keys are ordered bytewise, so records sharing a prefix can be
+ * scanned together.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#pragma once
+#pragma execution_character_set("utf-8")
+#include <functional>
+#include <string>
+
+class StorageBackend {
+  public:
+	StorageBackend() {}
+
+	virtual ~StorageBackend() {}
+
+	// returns 0 and fills value if the key exists
+	virtual int get(const std::string &key, std::string &value) = 0;
+	// inserts the key, or replaces its value
+	virtual int put(const std::string &key, const std::string &value) = 0;
+	virtual int erase(const std::string &key) = 0;
+	// calls fn for every key starting with prefix, in key order, until fn returns false; fn must not modify the store
+	virtual int scan(const std::string &prefix,
+					 const std::function<bool(const std::string &key, const std::string &value)> &fn) = 0;
+	virtual int clear() = 0;
+	// makes every change so far durable
+	virtual int flush() = 0;
+};
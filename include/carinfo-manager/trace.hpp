@@ -0,0 +1,46 @@
+/**
+ * @file include/carinfo-manager/trace.hpp
+ * @brief Declaration of class Trace
+ *
+ * @details
+ * This file contains the declaration of the Trace class.
+ * The Trace class records how long the stages of a request take, to find out where the time of a slow one went. Like
+ * MyLogger it is used through static methods, so the pools can record spans without being handed a tracer.
+ *     - `Span` records the time from its construction to its destruction.
+ *     - `record` records a span whose start and end were taken apart, e.g. in two hooks of httplib.
+ *     - `configure` sets how many spans each thread keeps, 0 to record nothing.
+ *     - `dumpChrome` renders the recent spans as Chrome trace-event JSON, for chrome://tracing or ui.perfetto.dev.
+ * Each thread writes its spans into a ring buffer of its own, so recording takes no lock; the oldest spans of a thread
+ * are overwritten once its ring is full. A span's name must be a string literal, it is stored as a pointer.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#pragma once
+#pragma execution_character_set("utf-8")
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class Trace {
+  public:
+	class Span {
+	  private:
+		const char *name;
+		int64_t begin;
+
+	  public:
+		Span(const char *name);
+		Span(const Span &) = delete;
+		~Span();
+
+		Span &operator=(const Span &) = delete;
+	};
+
+	static void configure(size_t spansPerThread);
+	static bool enabled();
+	static int64_t now();
+	static void record(const char *name, int64_t begin, int64_t end);
+	static std::string dumpChrome();
+};
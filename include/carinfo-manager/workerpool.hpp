@@ -0,0 +1,70 @@
+/**
+ * @file include/carinfo-manager/workerpool.hpp
+ * @brief Declaration of class WorkerPool
+ *
+ * @details
+ * This file contains the declaration of the WorkerPool class.
+ * The WorkerPool class is the task queue of the HTTP server, installed through `httplib::Server::new_task_queue` in
+ * place of httplib's ThreadPool, which keeps every task in one list behind one mutex. Each worker thread owns a deque
+ * of its own: new tasks are dealt to the deques in turn, and a worker whose deque is empty steals the oldest task of
+ * another one, so a connection is not left waiting behind a slow one while other workers are idle.
+ *     - `enqueue` queues a task, or rejects it if the queued tasks reach the bound.
+ *     - `shutdown` runs the queued tasks and stops the worker threads.
+ * The worker threads can be pinned to the CPUs, worker `i` to CPU `i` modulo the number of CPUs.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#pragma once
+#pragma execution_character_set("utf-8")
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "cpp-httplib/httplib.h"
+
+class WorkerPool : public httplib::TaskQueue {
+  private:
+	class Worker {
+	  public:
+		std::deque<std::function<void()>> tasks;
+		std::mutex mtx;
+	};
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::vector<std::thread> threads;
+	size_t maxQueued;
+
+	std::atomic<size_t> next;     // the deque the next task is dealt to
+	std::atomic<size_t> pending;  // tasks queued and not yet taken by a worker
+	std::mutex sleep_mtx;
+	std::condition_variable wake;  // a task was queued, or the pool stops
+	bool stopping;
+
+	std::atomic<size_t> executed;
+	std::atomic<size_t> steals;
+	std::atomic<size_t> rejected;
+
+	bool take(size_t self, std::function<void()> &task);
+	void run(size_t self);
+
+  public:
+	WorkerPool(size_t threadCount, size_t maxQueued = 0, bool pinThreads = false);
+	WorkerPool(const WorkerPool &) = delete;
+	~WorkerPool() override;
+	bool enqueue(std::function<void()> fn) override;
+	void shutdown() override;
+	size_t threadCount() const;
+	size_t queuedCount() const;
+	size_t executedCount() const;
+	size_t stealCount() const;
+	size_t rejectedCount() const;
+	static bool pinThread(std::thread &thread, size_t cpu);
+
+	WorkerPool &operator=(const WorkerPool &) = delete;
+};
@@ -5,6 +5,8 @@
  * @details
  * This file contains the declaration of the UpdateCarWindow class.
  * The UpdateCarWindow class provides a window to update a car.
+ * The current fields of the car can be loaded into the window, and only the fields that differ from them are sent, so
+ * the image is only uploaded when a new one is chosen.
  * 
  * @author donghy23@mails.tsinghua.edu.cn
  * @version 1.0
@@ -17,6 +19,7 @@
 #include <QWidget>
 #include <string>
 #include "carinfo-manager/accountpool.hpp"
+#include "carinfo-manager/carpool.hpp"
 #include "carinfo-manager/qwidget-with-subwindows.hpp"
 
 class UpdateCarWindow : public QWidgetWithSubWindows {
@@ -34,14 +37,16 @@ class UpdateCarWindow : public QWidgetWithSubWindows {
 	std::string ip;
 	int port;
 	Account acc;
+	Car loadedCar;  // the car as last loaded, NULL_CAR if none
 	QLabel *titleLabel, *usernameLabel, *accounttypeLabel;
 	QLabel *originalCarIdLabel, *newCarIdLabel, *newCarOwnerLabel, *newCarTypeLabel,
 		*newCarColorLabel, *newCarYearLabel, *newCarImgPathLabel;
 	QLineEdit *originalCarIdLineEdit, *newCarIdLineEdit, *newCarOwnerLineEdit, *newCarTypeLineEdit,
 		*newCarColorLineEdit, *newCarYearLineEdit, *newCarImgPathLineEdit;
-	QPushButton *carImgSelectButton, *updateCarButton;
+	QPushButton *loadCarButton, *carImgSelectButton, *updateCarButton;
 
   private slots:
+	void loadCar();
 	void getCarImgPath();
 	void updateCar();
 };
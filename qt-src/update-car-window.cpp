@@ -13,6 +13,7 @@
 #include <QFileDialog>
 #include <QMessageBox>
 #include <fstream>
+#include <sstream>
 #include <string>
 #include "carinfo-manager/httphandler-client.hpp"
 
@@ -21,7 +22,7 @@ UpdateCarWindow::UpdateCarWindow(QWidget *parent,
 								 const int port,
 								 const Account &acc,
 								 QWidgetWithSubWindows *parentWindow)
-	: QWidgetWithSubWindows(parent, parentWindow), ip(ip), port(port), acc(acc) {
+	: QWidgetWithSubWindows(parent, parentWindow), ip(ip), port(port), acc(acc), loadedCar(Car::NULL_CAR) {
 	this->setWindowTitle("修改车辆");
 	this->setFixedSize(320, 460);
 
@@ -40,7 +41,10 @@ UpdateCarWindow::UpdateCarWindow(QWidget *parent,
 	originalCarIdLabel = new QLabel("原车牌号：", this);
 	originalCarIdLabel->setGeometry(50, 100, 70, 30);
 	originalCarIdLineEdit = new QLineEdit(this);
-	originalCarIdLineEdit->setGeometry(120, 100, 150, 30);
+	originalCarIdLineEdit->setGeometry(120, 100, 110, 30);
+	loadCarButton = new QPushButton("读取", this);
+	loadCarButton->setGeometry(230, 100, 40, 30);
+	connect(loadCarButton, &QPushButton::clicked, this, &UpdateCarWindow::loadCar);
 
 	newCarIdLabel = new QLabel("新车牌号：", this);
 	newCarIdLabel->setGeometry(50, 140, 70, 30);
@@ -85,6 +89,38 @@ UpdateCarWindow::~UpdateCarWindow() {
 	removeFromParent();
 }
 
+void UpdateCarWindow::loadCar() {
+	std::string originalCarId = originalCarIdLineEdit->text().toStdString();
+	if (originalCarId.empty()) {
+		QMessageBox::warning(this, "错误", "请填写原车牌号");
+		return;
+	}
+
+	auto res = ClientHttpHandler::handler_get_carinfo(ip, port, acc, originalCarId, "", "", "");
+	if (!res) {
+		QMessageBox::critical(
+			this, "错误", std::string("查询失败\n错误信息：" + res.message).c_str());
+		return;
+	}
+	std::stringstream ss;
+	ss << res.json_obj.dump(4);
+	CarPool searchRes;
+	searchRes.load(ss);
+	std::vector<Car> cars = searchRes.getCarbyId(originalCarId).list();
+	if (cars.empty()) {
+		QMessageBox::warning(this, "错误", "车辆不存在");
+		return;
+	}
+
+	loadedCar = cars[0];
+	newCarIdLineEdit->setText(QString::fromStdString(loadedCar.getId()));
+	newCarOwnerLineEdit->setText(QString::fromStdString(loadedCar.getOwner()));
+	newCarTypeLineEdit->setText(QString::fromStdString(loadedCar.getType()));
+	newCarColorLineEdit->setText(QString::fromStdString(loadedCar.getColor()));
+	newCarYearLineEdit->setText(QString::number(loadedCar.getYear()));
+	newCarImgPathLineEdit->clear();
+}
+
 void UpdateCarWindow::getCarImgPath() {
 	QString imgPath =
 		QFileDialog::getOpenFileName(this, "选择图片", "", "Images (*.png *.jpg *.jpeg)");
@@ -93,59 +129,74 @@ void UpdateCarWindow::getCarImgPath() {
 }
 
 void UpdateCarWindow::updateCar() {
-	if (originalCarIdLineEdit->text().isEmpty() || newCarIdLineEdit->text().isEmpty() ||
-		newCarOwnerLineEdit->text().isEmpty() || newCarTypeLineEdit->text().isEmpty() ||
-		newCarColorLineEdit->text().isEmpty() || newCarYearLineEdit->text().isEmpty() ||
-		newCarImgPathLineEdit->text().isEmpty()) {
-		QMessageBox::warning(this, "错误", "请填写完整信息");
+	if (originalCarIdLineEdit->text().isEmpty()) {
+		QMessageBox::warning(this, "错误", "请填写原车牌号");
 		return;
 	}
 
-	std::string originalCarId = originalCarIdLineEdit->text().toStdString(),
-				newCarId = newCarIdLineEdit->text().toStdString(),
-				newCarOwner = newCarOwnerLineEdit->text().toStdString(),
-				newCarType = newCarTypeLineEdit->text().toStdString(),
-				newCarColor = newCarColorLineEdit->text().toStdString(),
-				newCarImgPath = newCarImgPathLineEdit->text().toLocal8Bit().data(),
+	// a field is sent if it is filled in and differs from the loaded car
+	std::string originalCarId = originalCarIdLineEdit->text().toStdString();
+	bool loaded = loadedCar != Car::NULL_CAR && loadedCar.getId() == originalCarId;
+	CarPatch patch;
+	auto patchField = [&](QLineEdit *lineEdit, const std::string &current, std::optional<std::string> &field) {
+		std::string text = lineEdit->text().toStdString();
+		if (!text.empty() && !(loaded && text == current))
+			field = text;
+	};
+	patchField(newCarIdLineEdit, loadedCar.getId(), patch.id);
+	patchField(newCarOwnerLineEdit, loadedCar.getOwner(), patch.owner);
+	patchField(newCarTypeLineEdit, loadedCar.getType(), patch.type);
+	patchField(newCarColorLineEdit, loadedCar.getColor(), patch.color);
+	if (!newCarYearLineEdit->text().isEmpty()) {
+		bool ok = false;
+		int newCarYear = newCarYearLineEdit->text().toInt(&ok);
+		if (!ok) {
+			QMessageBox::critical(this, "错误", "年份不合法");
+			return;
+		}
+		if (!(loaded && newCarYear == loadedCar.getYear()))
+			patch.year = newCarYear;
+	}
+
+	std::string newCarImgPath = newCarImgPathLineEdit->text().toLocal8Bit().data(),
 				newCarImgType = "", newCarImgData = "";
-	int newCarYear = newCarYearLineEdit->text().toInt();
+	if (!newCarImgPath.empty()) {
+		if (newCarImgPath.find_last_of('.') != std::string::npos) {
+			newCarImgType = newCarImgPath.substr(newCarImgPath.find_last_of('.'));
+			if (newCarImgType != ".png" && newCarImgType != ".jpg" && newCarImgType != ".jpeg") {
+				QMessageBox::critical(this, "错误", "图片格式不支持");
+				return;
+			}
+		}
+		else {
+			QMessageBox::critical(this, "错误", "图片路径不合法");
+			return;
+		}
 
-	if (newCarImgPath.find_last_of('.') != std::string::npos) {
-		newCarImgType = newCarImgPath.substr(newCarImgPath.find_last_of('.'));
-		if (newCarImgType != ".png" && newCarImgType != ".jpg" && newCarImgType != ".jpeg") {
-			QMessageBox::critical(this, "错误", "图片格式不支持");
+		std::ifstream imgFile(newCarImgPath, std::ios::binary);
+		if (imgFile.is_open()) {
+			newCarImgData = std::string(std::istreambuf_iterator<char>(imgFile),
+										std::istreambuf_iterator<char>());
+			imgFile.close();
+		}
+		else {
+			QMessageBox::critical(this, "错误", "打开图片失败");
 			return;
 		}
 	}
-	else {
-		QMessageBox::critical(this, "错误", "图片路径不合法");
-		return;
-	}
 
-	std::ifstream imgFile(newCarImgPath, std::ios::binary);
-	if (imgFile.is_open()) {
-		newCarImgData =
-			std::string(std::istreambuf_iterator<char>(imgFile), std::istreambuf_iterator<char>());
-		imgFile.close();
-	}
-	else {
-		QMessageBox::critical(this, "错误", "打开图片失败");
+	if (!patch.id && !patch.owner && !patch.type && !patch.color && !patch.year &&
+		newCarImgType.empty()) {
+		QMessageBox::warning(this, "错误", "没有需要修改的信息");
 		return;
 	}
 
-	auto res = ClientHttpHandler::handler_update_car(ip,
-													 port,
-													 acc,
-													 originalCarId,
-													 newCarId,
-													 newCarOwner,
-													 newCarType,
-													 newCarColor,
-													 newCarYear,
-													 newCarImgData,
-													 newCarImgType);
-	if (res)
+	auto res = ClientHttpHandler::handler_patch_car(
+		ip, port, acc, originalCarId, patch, newCarImgData, newCarImgType);
+	if (res) {
 		QMessageBox::information(this, "成功", "修改成功");
+		loadedCar = Car::NULL_CAR;
+	}
 	else
 		QMessageBox::critical(
 			this, "错误", std::string("修改车辆失败\n错误信息：" + res.message).c_str());
@@ -17,7 +17,10 @@
 #include "carinfo-manager/accountpool.hpp"
 #include <assert.h>
 #include <fstream>
+#include "carinfo-manager/jsonwriter.hpp"
 #include "carinfo-manager/log.hpp"
+#include "carinfo-manager/parallelloader.hpp"
+#include "carinfo-manager/trace.hpp"
 #include "json/json.hpp"
 using json = nlohmann::json;
 
@@ -378,12 +381,12 @@ AccountPool AccountPool::getAccountLike(const std::string &username) const {
 		if (it->first.find(username) != std::string::npos)
 			ap.addAccount(it->second);
 	}
-	std::stringstream ss;
-	ap.save(ss);
+	std::string result;
+	ap.save(result, 0);
 	MyLogger::log("carinfo-manager-logger",
 				  MyLogger::LOG_LEVEL::DEBUG,
 				  "[AccountPool Get Account Like] \n- Username: " + username +
-					  "\n- AccountPool: " + ss.str());
+					  "\n- AccountPool: " + result);
 	return ap;
 }
 
@@ -399,6 +402,7 @@ AccountPool AccountPool::getAccountLike(const std::string &username) const {
  */
 AccountPool::AccountVerifyResult AccountPool::verifyAccount(const std::string &username,
 															const std::string &passwd_hash) const {
+	Trace::Span span("AccountPool::verifyAccount");
 	if (accountpool.find(username) == accountpool.end()) {
 		MyLogger::log("carinfo-manager-logger",
 					  MyLogger::LOG_LEVEL::DEBUG,
@@ -427,6 +431,7 @@ AccountPool::AccountVerifyResult AccountPool::verifyAccount(const std::string &u
  * @return The account type associated with the username. If the username is not found in the account pool, returns Account::AccountType::NONETYPE.
  */
 Account::AccountType AccountPool::getAccountType(const std::string &username) const {
+	Trace::Span span("AccountPool::getAccountType");
 	if (accountpool.find(username) == accountpool.end()) {
 		MyLogger::log(
 			"carinfo-manager-logger",
@@ -497,8 +502,23 @@ int AccountPool::clear() {
  * @brief Loads account data from an input stream.
  * 
  * This function reads account data from the specified input stream and populates the AccountPool object with the loaded accounts.
+ * It is equivalent to `load(is, 1)`.
  * 
  * @param is The input stream to read from.
+ * @return Returns 0 if the accounts are loaded successfully, else an error code (see `load(is, threads)`).
+ */
+int AccountPool::load(std::istream &is) {
+	return load(is, 1);
+}
+
+/**
+ * @brief Loads account data from an input stream on several threads.
+ * 
+ * The input is split into records without building a JSON DOM. The records are divided into chunks, every chunk is
+ * parsed on a worker thread into an AccountPool fragment, and the fragments are then spliced into this AccountPool.
+ * 
+ * @param is The input stream to read from.
+ * @param threads The number of worker threads, 0 for one thread per hardware core.
  * @return Returns 0 if the accounts are loaded successfully, else an error code:
  *         - 0x50: The input stream is invalid.
  *         - 0x51: An error occurred while clearing the account pool.
@@ -506,9 +526,10 @@ int AccountPool::clear() {
  *         - 0x53: The loaded data is missing required fields.
  *         - 0x54: The loaded data has incorrect field types.
  *         - 0x55: An error occurred while adding an account to the account pool.
+ *         - 0x56: The input is not a well-formed JSON object.
  *         - 0x5F: An unknown error occurred.
  */
-int AccountPool::load(std::istream &is) {
+int AccountPool::load(std::istream &is, size_t threads) {
 	if (!is) {
 		MyLogger::log("carinfo-manager-logger",
 					  MyLogger::LOG_LEVEL::ERROR,
@@ -522,44 +543,79 @@ int AccountPool::load(std::istream &is) {
 						  "[AccountPool Load] \n- Stuatus: 0x51");
 			return 0x51;
 		}
-		json load_json_obj = json::parse(is);
-		for (json::iterator it = load_json_obj.begin(); it != load_json_obj.end(); it++) {
-			if (!it.value().is_object()) {
-				MyLogger::log("carinfo-manager-logger",
-							  MyLogger::LOG_LEVEL::ERROR,
-							  "[AccountPool Load] \n- Stuatus: 0x52");
-				return 0x52;
-			}
-			if (!it.value().contains("username") || !it.value().contains("passwd_hash") ||
-				!it.value().contains("account_type")) {
-				MyLogger::log("carinfo-manager-logger",
-							  MyLogger::LOG_LEVEL::ERROR,
-							  "[AccountPool Load] \n- Stuatus: 0x53");
-				return 0x53;
-			}
-			if (!it.value()["username"].is_string() || !it.value()["passwd_hash"].is_string() ||
-				!it.value()["account_type"].is_number_integer()) {
-				MyLogger::log("carinfo-manager-logger",
-							  MyLogger::LOG_LEVEL::ERROR,
-							  "[AccountPool Load] \n- Stuatus: 0x54");
-				return 0x54;
-			}
-			Account acc(std::string(it.key()),
-						std::string(it.value()["passwd_hash"]),
-						(Account::AccountType)(int)(it.value()["account_type"]));
-			if (addAccount(acc) != 0) {
+		std::string text((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+		std::vector<ParallelLoader::Record> records;
+		if (ParallelLoader::splitRecords(text, records) != 0) {
+			MyLogger::log("carinfo-manager-logger",
+						  MyLogger::LOG_LEVEL::ERROR,
+						  "[AccountPool Load] \n- Stuatus: 0x56");
+			return 0x56;
+		}
+
+		threads = ParallelLoader::threadCount(threads);
+		std::vector<AccountPool> fragments(ParallelLoader::chunkCount(records.size(), threads));
+		int status_code = ParallelLoader::run(
+			records.size(), threads, [&](size_t chunk, size_t begin, size_t end) {
+				try {
+					AccountPool &fragment = fragments[chunk];
+					for (size_t i = begin; i < end; i++) {
+						json acc_json_obj = json::parse(records[i].value);
+						if (!acc_json_obj.is_object())
+							return 0x52;
+						if (!acc_json_obj.contains("username") ||
+							!acc_json_obj.contains("passwd_hash") ||
+							!acc_json_obj.contains("account_type"))
+							return 0x53;
+						if (!acc_json_obj["username"].is_string() ||
+							!acc_json_obj["passwd_hash"].is_string() ||
+							!acc_json_obj["account_type"].is_number_integer())
+							return 0x54;
+						Account acc(json::parse(records[i].key).get<std::string>(),
+									std::string(acc_json_obj["passwd_hash"]),
+									(Account::AccountType)(int)(acc_json_obj["account_type"]));
+						if (!fragment.accountpool.emplace(acc.getUsername(), acc).second)
+							return 0x55;
+						if (acc.getAccountType() == Account::AccountType::ADMIN)
+							fragment.adminpool.emplace(acc.getUsername(), acc);
+						else if (acc.getAccountType() == Account::AccountType::USER)
+							fragment.userpool.emplace(acc.getUsername(), acc);
+						fragment.sz++;
+					}
+					return 0;
+				}
+				catch (...) {
+					return 0x5F;
+				}
+			});
+		if (status_code != 0) {
+			clear();
+			MyLogger::log("carinfo-manager-logger",
+						  MyLogger::LOG_LEVEL::ERROR,
+						  "[AccountPool Load] \n- Stuatus: " + std::to_string(status_code));
+			return status_code;
+		}
+
+		for (AccountPool &fragment : fragments) {
+			accountpool.merge(fragment.accountpool);
+			if (!fragment.accountpool.empty()) {
+				clear();
 				MyLogger::log("carinfo-manager-logger",
 							  MyLogger::LOG_LEVEL::ERROR,
 							  "[AccountPool Load] \n- Stuatus: 0x55");
 				return 0x55;
 			}
+			adminpool.merge(fragment.adminpool);
+			userpool.merge(fragment.userpool);
+			sz += fragment.sz;
 		}
 		MyLogger::log("carinfo-manager-logger",
 					  MyLogger::LOG_LEVEL::DEBUG,
-					  "[AccountPool Load] \n- Stuatus: 0");
+					  "[AccountPool Load] \n- Threads: " + std::to_string(fragments.size()) +
+						  "\n- Accounts: " + std::to_string(sz) + "\n- Stuatus: 0");
 		return 0;
 	}
 	catch (...) {
+		clear();
 		MyLogger::log("carinfo-manager-logger",
 					  MyLogger::LOG_LEVEL::ERROR,
 					  "[AccountPool Load] \n- Stuatus: 0x5F");
@@ -582,17 +638,45 @@ int AccountPool::save(std::ostream &os) const {
 					  "[AccountPool Save] \n- Stuatus: 0x60");
 		return 0x60;
 	}
+	std::string text;
+	int status_code = save(text, 4);
+	if (status_code == 0)
+		os << text;
+	return status_code;
+}
+
+/**
+ * Saves the AccountPool to a string, in the format of the account file.
+ * 
+ * The accounts are appended to the string directly, without building a JSON document first.
+ * 
+ * @param out The string to append the accounts to.
+ * @param indent The number of spaces per level, 0 for compact JSON.
+ * @return Returns 0 if the AccountPool is successfully saved, else an error code:
+ *         - 0x6F: An unknown error occurred.
+ */
+int AccountPool::save(std::string &out, size_t indent) const {
+	Trace::Span span("AccountPool::save");
 	try {
-		// Write size
-		json save_json_obj;
-		for (auto it = accountpool.begin(); it != accountpool.end(); it++) {
-			json acc_json_obj;
-			acc_json_obj["username"] = it->second.getUsername();
-			acc_json_obj["passwd_hash"] = it->second.getPasswdHash();
-			acc_json_obj["account_type"] = (int)it->second.getAccountType();
-			save_json_obj[it->first] = acc_json_obj;
+		// an empty accountpool is written as null, the keys in the order of nlohmann::json, which sorts them
+		JsonWriter writer(out, indent);
+		if (accountpool.empty())
+			writer.null();
+		else {
+			writer.beginObject();
+			for (auto it = accountpool.begin(); it != accountpool.end(); it++) {
+				writer.key(it->first)
+					.beginObject()
+					.key("account_type")
+					.value((int)it->second.getAccountType())
+					.key("passwd_hash")
+					.value(it->second.getPasswdHash())
+					.key("username")
+					.value(it->second.getUsername())
+					.endObject();
+			}
+			writer.endObject();
 		}
-		os << save_json_obj.dump(4);
 		MyLogger::log("carinfo-manager-logger",
 					  MyLogger::LOG_LEVEL::DEBUG,
 					  "[AccountPool Save] \n- Stuatus: 0");
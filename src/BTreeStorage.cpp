@@ -0,0 +1,906 @@
+/**
+ * @file src/BTreeStorage.cpp
+ * @brief Implementation of class BTreeStorage
+ *
+ * @details
+ * This file contains the implementation of the BTreeStorage class.
+ * Page 0 of the file holds the meta data (magic, root page, page count). Every other page is a node:
+ *     - a leaf holds sorted key/value entries and the page of the next leaf, so that scans can walk the leaves;
+ *     - an internal node holds sorted separator keys and one more child page than keys. A key equal to a separator
+ *       belongs to the right child.
+ * The buffer pool decodes pages into frames. A frame is pinned while an operation uses it and is never evicted while
+ * pinned; the CLOCK hand skips frames referenced since its last visit. If every frame is pinned the pool grows beyond
+ * its budget, and the extra frames are released again once the operation has unpinned them.
+ * The file itself is only changed by a checkpoint, so that a crash leaves it as of the last successful flush:
+ *     - a dirty page leaving the buffer pool, evicted or flushed, is appended to the journal (`<path>.wal`) and read
+ *       back from there until the next checkpoint;
+ *     - flush appends the meta page last and syncs the journal, which commits the checkpoint, then copies the journaled
+ *       pages into the file, syncs it and empties the journal;
+ *     - open replays a committed journal, which a crash may have left half copied, and discards one without its meta
+ *       page. A journal record carries the number of its checkpoint and a checksum, so that stale or torn records end
+ *       the journal.
+ * Changes made after the last successful flush are lost in a crash.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#include "carinfo-manager/btreestorage.hpp"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include "carinfo-manager/imagewriter.hpp"
+#include "carinfo-manager/log.hpp"
+
+namespace {
+
+const char MAGIC[4] = {'C', 'M', 'B', 'T'};
+const size_t NODE_HEADER_SIZE = 7;  // type, entry count, next leaf or first child
+const size_t RECORD_HEADER_SIZE = 16;  // page, checkpoint, checksum of a journal record
+
+// unpins a frame when leaving the scope
+template <class F>
+class PinGuard {
+  private:
+	F *frame;
+
+  public:
+	PinGuard(F *frame) : frame(frame) {}
+	PinGuard(const PinGuard &) = delete;
+	~PinGuard() {
+		frame->pins--;
+	}
+	PinGuard &operator=(const PinGuard &) = delete;
+};
+
+void put_u16(char *buf, size_t &pos, uint16_t v) {
+	buf[pos++] = char(v & 0xFF);
+	buf[pos++] = char(v >> 8);
+}
+
+void put_u32(char *buf, size_t &pos, uint32_t v) {
+	for (int i = 0; i < 4; i++)
+		buf[pos++] = char((v >> (8 * i)) & 0xFF);
+}
+
+uint16_t get_u16(const char *buf, size_t &pos) {
+	uint16_t v = uint16_t(uint8_t(buf[pos])) | uint16_t(uint8_t(buf[pos + 1])) << 8;
+	pos += 2;
+	return v;
+}
+
+uint32_t get_u32(const char *buf, size_t &pos) {
+	uint32_t v = 0;
+	for (int i = 0; i < 4; i++)
+		v |= uint32_t(uint8_t(buf[pos + i])) << (8 * i);
+	pos += 4;
+	return v;
+}
+
+// FNV-1a checksum of a journal record: its page, its checkpoint and the page image
+uint64_t record_checksum(const char *record, size_t page_size) {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	auto mix = [&hash](const char *data, size_t size) {
+		for (size_t i = 0; i < size; i++) {
+			hash ^= uint8_t(data[i]);
+			hash *= 0x100000001b3ULL;
+		}
+	};
+	mix(record, 8);
+	mix(record + RECORD_HEADER_SIZE, page_size);
+	return hash;
+}
+
+template <class N>
+size_t entry_size(const N &node, size_t i) {
+	return node.leaf ? 4 + node.keys[i].size() + node.values[i].size() : 6 + node.keys[i].size();
+}
+
+template <class N>
+size_t node_size(const N &node) {
+	size_t size = NODE_HEADER_SIZE;
+	for (size_t i = 0; i < node.keys.size(); i++)
+		size += entry_size(node, i);
+	return size;
+}
+
+// index of the first entry of the right half when splitting a node in two halves of about the same size
+template <class N>
+size_t split_point(const N &node) {
+	size_t half = node_size(node) / 2, size = NODE_HEADER_SIZE, i = 0;
+	while (i < node.keys.size() && size < half)
+		size += entry_size(node, i++);
+	return std::clamp<size_t>(i, 1, node.keys.size() - 1);
+}
+
+}  // namespace
+
+/**
+ * @brief Constructs a new BTreeStorage object. No file is attached until `open` is called.
+ */
+BTreeStorage::BTreeStorage()
+	: root(0), page_count(0), checkpoint(0), journal_end(0), frame_budget(MIN_FRAMES), clock_hand(0), hits(0),
+	  misses(0) {}
+
+/**
+ * @brief Destroys the BTreeStorage object, writing back the dirty pages.
+ */
+BTreeStorage::~BTreeStorage() {
+	if (file.is_open())
+		flush();
+}
+
+/**
+ * @brief Opens the storage file, creating an empty tree if the file does not exist or is empty.
+ * A journal committed before a crash is copied into the file first.
+ *
+ * @param path The path of the storage file.
+ * @param bufferPoolBytes The memory budget of the buffer pool, at least MIN_FRAMES pages are kept.
+ * @return Returns 0 on success, else an error code:
+ *         - 0xD2: If the file cannot be opened, read or written.
+ *         - 0xD3: If the file is not a storage file.
+ *         - 0xDF: If an unknown exception occurs.
+ */
+int BTreeStorage::open(const std::string &path, size_t bufferPoolBytes) {
+	std::lock_guard<std::recursive_mutex> lock(mtx);
+	try {
+		this->path = path;
+		journal_path = path + ".wal";
+		frame_budget = std::max(MIN_FRAMES, bufferPoolBytes / PAGE_SIZE);
+		frames.clear();
+		page_table.clear();
+		clock_hand = 0;
+		// create the file if needed, then reopen it for reading and writing
+		if (file.is_open())
+			file.close();
+		std::ofstream(path, std::ios::binary | std::ios::app).close();
+		file.open(path, std::ios::binary | std::ios::in | std::ios::out);
+		if (!file.is_open()) {
+			MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[BTreeStorage Open] \n- Path: " + path + "\n- Status: 0xD2");
+			return 0xD2;
+		}
+		if (journal.is_open())
+			journal.close();
+		std::ofstream(journal_path, std::ios::binary | std::ios::app).close();
+		journal.open(journal_path, std::ios::binary | std::ios::in | std::ios::out);
+		std::string dir = std::filesystem::path(path).parent_path().string();
+		if (!journal.is_open() || !ImageWriter::syncDirectory(dir.empty() ? "." : dir)) {
+			MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[BTreeStorage Open] \n- Path: " + journal_path + "\n- Status: 0xD2");
+			return 0xD2;
+		}
+		file.seekg(0, std::ios::end);
+		if (file.tellg() == std::streampos(0)) {
+			checkpoint = 0;
+			init_file();
+		}
+		else {
+			recover();
+			char meta[PAGE_SIZE];
+			file.seekg(0);
+			if (!file.read(meta, PAGE_SIZE))
+				throw std::runtime_error("short meta page");
+			if (std::memcmp(meta, MAGIC, 4) != 0)
+				throw std::runtime_error("bad magic");
+			size_t pos = 8;
+			root = get_u32(meta, pos);
+			page_count = get_u32(meta, pos);
+			checkpoint = get_u32(meta, pos);
+			if (root == 0 || root >= page_count)
+				throw std::runtime_error("bad root");
+		}
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[BTreeStorage Open] \n- Path: " + path + "\n- Pages: " + std::to_string(page_count) + "\n- Frames: " + std::to_string(frame_budget) + "\n- Status: 0");
+		return 0;
+	}
+	catch (const std::ios_base::failure &) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[BTreeStorage Open] \n- Path: " + path + "\n- Status: 0xD2");
+		return 0xD2;
+	}
+	catch (const std::runtime_error &) {
+		file.close();
+		journal.close();
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[BTreeStorage Open] \n- Path: " + path + "\n- Status: 0xD3");
+		return 0xD3;
+	}
+	catch (...) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[BTreeStorage Open] \n- Path: " + path + "\n- Status: 0xDF");
+		return 0xDF;
+	}
+}
+
+/**
+ * @brief Writes an empty tree (meta page and one empty leaf) to the file, as a new checkpoint, and empties the journal.
+ */
+void BTreeStorage::init_file() {
+	frames.clear();
+	page_table.clear();
+	clock_hand = 0;
+	reset_journal();
+	if (!ImageWriter::syncFile(journal_path))
+		throw std::ios_base::failure("cannot sync journal");
+	root = 1;
+	page_count = 2;
+	checkpoint++;
+	char buf[PAGE_SIZE];
+	Node leaf;
+	leaf.leaf = true;
+	leaf.next = 0;
+	encode_page(leaf, buf);
+	write_page(1, buf);
+	encode_meta(buf, checkpoint);
+	write_page(0, buf);
+	file.flush();
+	if (!file)
+		throw std::ios_base::failure("cannot flush");
+}
+
+/**
+ * @brief Encodes the meta page.
+ *
+ * @param buf The page buffer to fill.
+ * @param number The number of the checkpoint the meta page belongs to.
+ */
+void BTreeStorage::encode_meta(char *buf, uint32_t number) const {
+	std::memset(buf, 0, PAGE_SIZE);
+	std::memcpy(buf, MAGIC, 4);
+	size_t pos = 4;
+	put_u32(buf, pos, 1);  // format version
+	put_u32(buf, pos, root);
+	put_u32(buf, pos, page_count);
+	put_u32(buf, pos, number);
+}
+
+/**
+ * @brief Reads and decodes a node page, from the journal if it was journaled since the last checkpoint.
+ *
+ * @param page The page number.
+ * @param node The node to fill.
+ */
+void BTreeStorage::read_page(uint32_t page, Node &node) {
+	if (page == 0 || page >= page_count)
+		throw std::runtime_error("page out of range");
+	char buf[PAGE_SIZE];
+	auto journaled = journal_pages.find(page);
+	std::fstream &source = journaled != journal_pages.end() ? journal : file;
+	source.seekg(journaled != journal_pages.end() ? journaled->second + std::streamoff(RECORD_HEADER_SIZE)
+												  : std::streamoff(page) * PAGE_SIZE);
+	if (!source.read(buf, PAGE_SIZE)) {
+		source.clear();
+		throw std::ios_base::failure("cannot read page");
+	}
+	size_t pos = 0;
+	node.leaf = buf[pos++] == 1;
+	uint16_t count = get_u16(buf, pos);
+	node.keys.assign(count, std::string());
+	node.values.clear();
+	node.children.clear();
+	if (node.leaf) {
+		node.next = get_u32(buf, pos);
+		node.values.assign(count, std::string());
+	}
+	else {
+		node.next = 0;
+		node.children.push_back(get_u32(buf, pos));
+	}
+	for (uint16_t i = 0; i < count; i++) {
+		if (pos + 6 > PAGE_SIZE)
+			throw std::runtime_error("corrupt page");
+		uint16_t key_size = get_u16(buf, pos);
+		uint16_t value_size = node.leaf ? get_u16(buf, pos) : 0;
+		if (pos + key_size + value_size + (node.leaf ? 0 : 4) > PAGE_SIZE)
+			throw std::runtime_error("corrupt page");
+		node.keys[i].assign(buf + pos, key_size);
+		pos += key_size;
+		if (node.leaf) {
+			node.values[i].assign(buf + pos, value_size);
+			pos += value_size;
+		}
+		else
+			node.children.push_back(get_u32(buf, pos));
+	}
+}
+
+/**
+ * @brief Encodes a node page.
+ *
+ * @param node The node.
+ * @param buf The page buffer to fill.
+ */
+void BTreeStorage::encode_page(const Node &node, char *buf) {
+	std::memset(buf, 0, PAGE_SIZE);
+	size_t pos = 0;
+	buf[pos++] = node.leaf ? 1 : 2;
+	put_u16(buf, pos, uint16_t(node.keys.size()));
+	put_u32(buf, pos, node.leaf ? node.next : node.children[0]);
+	for (size_t i = 0; i < node.keys.size(); i++) {
+		put_u16(buf, pos, uint16_t(node.keys[i].size()));
+		if (node.leaf)
+			put_u16(buf, pos, uint16_t(node.values[i].size()));
+		std::memcpy(buf + pos, node.keys[i].data(), node.keys[i].size());
+		pos += node.keys[i].size();
+		if (node.leaf) {
+			std::memcpy(buf + pos, node.values[i].data(), node.values[i].size());
+			pos += node.values[i].size();
+		}
+		else
+			put_u32(buf, pos, node.children[i + 1]);
+	}
+}
+
+/**
+ * @brief Writes a page image into the file, in place.
+ *
+ * @param page The page number.
+ * @param buf The page image.
+ */
+void BTreeStorage::write_page(uint32_t page, const char *buf) {
+	file.seekp(std::streamoff(page) * PAGE_SIZE);
+	if (!file.write(buf, PAGE_SIZE)) {
+		file.clear();
+		throw std::ios_base::failure("cannot write page");
+	}
+}
+
+/**
+ * @brief Appends a page image to the journal, for the next checkpoint.
+ *
+ * @param page The page number, 0 for the meta page that commits the checkpoint.
+ * @param buf The page image.
+ */
+void BTreeStorage::journal_page(uint32_t page, const char *buf) {
+	char record[RECORD_HEADER_SIZE + PAGE_SIZE];
+	size_t pos = 0;
+	put_u32(record, pos, page);
+	put_u32(record, pos, checkpoint + 1);
+	std::memcpy(record + RECORD_HEADER_SIZE, buf, PAGE_SIZE);
+	uint64_t checksum = record_checksum(record, PAGE_SIZE);
+	put_u32(record, pos, uint32_t(checksum));
+	put_u32(record, pos, uint32_t(checksum >> 32));
+	journal.seekp(journal_end);
+	if (!journal.write(record, sizeof(record))) {
+		journal.clear();
+		throw std::ios_base::failure("cannot write journal");
+	}
+	journal_pages[page] = journal_end;
+	journal_end += sizeof(record);
+}
+
+/**
+ * @brief Journals the page of a dirty frame, which is clean afterwards.
+ *
+ * @param frame The frame.
+ */
+void BTreeStorage::write_back(Frame &frame) {
+	char buf[PAGE_SIZE];
+	encode_page(frame.node, buf);
+	journal_page(frame.page, buf);
+	frame.dirty = false;
+}
+
+/**
+ * @brief Copies journaled pages into the file and syncs it, which completes a committed checkpoint.
+ *
+ * @param pages The page numbers and journal offsets of the latest images of the checkpoint.
+ */
+void BTreeStorage::apply_journal(const std::unordered_map<uint32_t, std::streamoff> &pages) {
+	char buf[PAGE_SIZE];
+	for (const auto &[page, offset] : pages) {
+		journal.seekg(offset + std::streamoff(RECORD_HEADER_SIZE));
+		if (!journal.read(buf, PAGE_SIZE)) {
+			journal.clear();
+			throw std::ios_base::failure("cannot read journal");
+		}
+		write_page(page, buf);
+	}
+	file.flush();
+	if (!file || !ImageWriter::syncFile(path))
+		throw std::ios_base::failure("cannot sync file");
+}
+
+/**
+ * @brief Empties the journal. Nothing is journaled since the last checkpoint afterwards.
+ */
+void BTreeStorage::reset_journal() {
+	journal.close();
+	journal.open(journal_path, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc);
+	if (!journal.is_open())
+		throw std::ios_base::failure("cannot truncate journal");
+	journal_pages.clear();
+	journal_end = 0;
+}
+
+/**
+ * @brief Completes the checkpoint of a journal left by a crash, or discards the journal if it was not committed.
+ *
+ * The journal is read up to its first torn record or record of another checkpoint; the checkpoint is committed if
+ * those records include a meta page, and only the records up to the last meta page belong to it. A checkpoint older
+ * than the one in the file is stale and ignored.
+ */
+void BTreeStorage::recover() {
+	char meta[PAGE_SIZE];
+	uint32_t file_checkpoint = 0;
+	file.seekg(0);
+	if (file.read(meta, PAGE_SIZE) && std::memcmp(meta, MAGIC, 4) == 0) {
+		size_t pos = 16;
+		file_checkpoint = get_u32(meta, pos);
+	}
+	file.clear();
+	std::unordered_map<uint32_t, std::streamoff> pages, committed;
+	uint32_t run = 0;
+	char record[RECORD_HEADER_SIZE + PAGE_SIZE];
+	journal.seekg(0);
+	for (std::streamoff offset = 0; journal.read(record, sizeof(record)); offset += sizeof(record)) {
+		size_t pos = 0;
+		uint32_t page = get_u32(record, pos);
+		uint32_t record_checkpoint = get_u32(record, pos);
+		uint64_t checksum = get_u32(record, pos);
+		checksum |= uint64_t(get_u32(record, pos)) << 32;
+		if (checksum != record_checksum(record, PAGE_SIZE) || (offset != 0 && record_checkpoint != run))
+			break;
+		run = record_checkpoint;
+		pages[page] = offset;
+		if (page == 0)
+			committed = pages;
+	}
+	journal.clear();
+	if (!committed.empty() && run >= file_checkpoint) {
+		apply_journal(committed);
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::INFO, "[BTreeStorage Recover] \n- Path: " + path + "\n- Checkpoint: " + std::to_string(run) + "\n- Pages Written: " + std::to_string(committed.size()) + "\n- Status: 0");
+	}
+	reset_journal();
+	if (!ImageWriter::syncFile(journal_path))
+		throw std::ios_base::failure("cannot sync journal");
+}
+
+/**
+ * @brief Finds a frame to reuse, writing it back if it is dirty, or adds a frame if the pool is not full yet.
+ *
+ * @return The frame, no longer in the page table.
+ */
+BTreeStorage::Frame *BTreeStorage::victim() {
+	if (frames.size() < frame_budget) {
+		frames.push_back(std::make_unique<Frame>());
+		return frames.back().get();
+	}
+	// two sweeps: the first clears the reference bits
+	for (size_t step = 0; step < 2 * frames.size(); step++) {
+		Frame *frame = frames[clock_hand].get();
+		clock_hand = (clock_hand + 1) % frames.size();
+		if (frame->pins != 0)
+			continue;
+		if (frame->referenced) {
+			frame->referenced = false;
+			continue;
+		}
+		if (frame->dirty)
+			write_back(*frame);
+		page_table.erase(frame->page);
+		return frame;
+	}
+	frames.push_back(std::make_unique<Frame>());
+	return frames.back().get();
+}
+
+/**
+ * @brief Gives back the frames added beyond the budget while every frame was pinned, writing back the dirty ones.
+ * Frames still pinned, by an enclosing scan, are kept until a later operation.
+ */
+void BTreeStorage::release_frames() {
+	if (frames.size() <= frame_budget)
+		return;
+	for (size_t i = frames.size(); i-- > 0 && frames.size() > frame_budget;) {
+		Frame *frame = frames[i].get();
+		if (frame->pins != 0)
+			continue;
+		if (frame->dirty)
+			write_back(*frame);
+		page_table.erase(frame->page);
+		frames.erase(frames.begin() + i);
+	}
+	clock_hand %= frames.size();
+}
+
+/**
+ * @brief Pins the frame of a page, loading the page if it is not in the buffer pool.
+ *
+ * @param page The page number.
+ * @return The pinned frame.
+ */
+BTreeStorage::Frame *BTreeStorage::fetch(uint32_t page) {
+	auto it = page_table.find(page);
+	if (it != page_table.end()) {
+		hits++;
+		it->second->referenced = true;
+		it->second->pins++;
+		return it->second;
+	}
+	misses++;
+	Frame *frame = victim();
+	frame->page = 0;
+	frame->dirty = false;
+	frame->pins = 0;
+	read_page(page, frame->node);
+	frame->page = page;
+	frame->referenced = true;
+	frame->pins = 1;
+	page_table[page] = frame;
+	return frame;
+}
+
+/**
+ * @brief Appends a new empty node page to the file.
+ *
+ * @param leaf True for a leaf, false for an internal node.
+ * @return The pinned frame of the new page.
+ */
+BTreeStorage::Frame *BTreeStorage::new_page(bool leaf) {
+	Frame *frame = victim();
+	frame->page = page_count++;
+	frame->node.leaf = leaf;
+	frame->node.next = 0;
+	frame->node.keys.clear();
+	frame->node.values.clear();
+	frame->node.children.clear();
+	frame->dirty = true;
+	frame->referenced = true;
+	frame->pins = 1;
+	page_table[frame->page] = frame;
+	return frame;
+}
+
+/**
+ * @brief Finds the leaf that holds, or would hold, a key.
+ *
+ * @param key The key.
+ * @return The page number of the leaf.
+ */
+uint32_t BTreeStorage::find_leaf(const std::string &key) {
+	uint32_t page = root;
+	while (true) {
+		Frame *frame = fetch(page);
+		PinGuard guard(frame);
+		const Node &node = frame->node;
+		if (node.leaf)
+			return page;
+		page = node.children[std::upper_bound(node.keys.begin(), node.keys.end(), key) - node.keys.begin()];
+	}
+}
+
+/**
+ * @brief Inserts an entry into the subtree rooted at a page, splitting nodes that overflow.
+ *
+ * @param page The root page of the subtree.
+ * @param key The key.
+ * @param value The value.
+ * @param separator Set to the first key of the new right node if the root of the subtree was split.
+ * @param right Set to the page of the new right node if the root of the subtree was split.
+ * @return True if the root of the subtree was split.
+ */
+bool BTreeStorage::insert(uint32_t page,
+						  const std::string &key,
+						  const std::string &value,
+						  std::string &separator,
+						  uint32_t &right) {
+	Frame *frame = fetch(page);
+	PinGuard guard(frame);
+	Node &node = frame->node;
+	if (node.leaf) {
+		size_t i = std::lower_bound(node.keys.begin(), node.keys.end(), key) - node.keys.begin();
+		if (i < node.keys.size() && node.keys[i] == key)
+			node.values[i] = value;
+		else {
+			node.keys.insert(node.keys.begin() + i, key);
+			node.values.insert(node.values.begin() + i, value);
+		}
+	}
+	else {
+		size_t i = std::upper_bound(node.keys.begin(), node.keys.end(), key) - node.keys.begin();
+		std::string child_separator;
+		uint32_t child_right;
+		if (!insert(node.children[i], key, value, child_separator, child_right))
+			return false;
+		node.keys.insert(node.keys.begin() + i, child_separator);
+		node.children.insert(node.children.begin() + i + 1, child_right);
+	}
+	frame->dirty = true;
+	if (node_size(node) <= PAGE_SIZE)
+		return false;
+
+	Frame *sibling = new_page(node.leaf);
+	PinGuard sibling_guard(sibling);
+	Node &other = sibling->node;
+	size_t mid = split_point(node);
+	if (node.leaf) {
+		other.keys.assign(node.keys.begin() + mid, node.keys.end());
+		other.values.assign(node.values.begin() + mid, node.values.end());
+		node.keys.resize(mid);
+		node.values.resize(mid);
+		other.next = node.next;
+		node.next = sibling->page;
+		separator = other.keys.front();
+	}
+	else {
+		// the middle key moves up
+		separator = node.keys[mid];
+		other.keys.assign(node.keys.begin() + mid + 1, node.keys.end());
+		other.children.assign(node.children.begin() + mid + 1, node.children.end());
+		node.keys.resize(mid);
+		node.children.resize(mid + 1);
+	}
+	right = sibling->page;
+	return true;
+}
+
+/**
+ * @brief Retrieves the value of a key.
+ *
+ * @param key The key.
+ * @param value Filled with the value if the key exists.
+ * @return Returns 0 if the key exists, else an error code:
+ *         - 0xD0: If the key does not exist.
+ *         - 0xD2: If a page cannot be read or written.
+ *         - 0xD3: If a page is corrupt.
+ *         - 0xDF: If an unknown exception occurs.
+ */
+int BTreeStorage::get(const std::string &key, std::string &value) {
+	std::lock_guard<std::recursive_mutex> lock(mtx);
+	try {
+		bool found;
+		{
+			Frame *frame = fetch(find_leaf(key));
+			PinGuard guard(frame);
+			const Node &node = frame->node;
+			auto it = std::lower_bound(node.keys.begin(), node.keys.end(), key);
+			found = it != node.keys.end() && *it == key;
+			if (found)
+				value = node.values[it - node.keys.begin()];
+		}
+		release_frames();
+		return found ? 0 : 0xD0;
+	}
+	catch (const std::ios_base::failure &) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[BTreeStorage Get] \n- Path: " + path + "\n- Status: 0xD2");
+		return 0xD2;
+	}
+	catch (const std::runtime_error &) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[BTreeStorage Get] \n- Path: " + path + "\n- Status: 0xD3");
+		return 0xD3;
+	}
+	catch (...) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[BTreeStorage Get] \n- Path: " + path + "\n- Status: 0xDF");
+		return 0xDF;
+	}
+}
+
+/**
+ * @brief Inserts a key, or replaces its value.
+ *
+ * @param key The key.
+ * @param value The value.
+ * @return Returns 0 on success, else an error code:
+ *         - 0xD1: If the key and value together are longer than MAX_ENTRY_SIZE.
+ *         - 0xD2: If a page cannot be read or written.
+ *         - 0xD3: If a page is corrupt.
+ *         - 0xDF: If an unknown exception occurs.
+ */
+int BTreeStorage::put(const std::string &key, const std::string &value) {
+	std::lock_guard<std::recursive_mutex> lock(mtx);
+	if (key.size() + value.size() > MAX_ENTRY_SIZE) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[BTreeStorage Put] \n- Path: " + path + "\n- Entry Size: " + std::to_string(key.size() + value.size()) + "\n- Status: 0xD1");
+		return 0xD1;
+	}
+	try {
+		std::string separator;
+		uint32_t right;
+		if (insert(root, key, value, separator, right)) {
+			Frame *frame = new_page(false);
+			PinGuard guard(frame);
+			frame->node.keys.push_back(separator);
+			frame->node.children = {root, right};
+			root = frame->page;
+		}
+		release_frames();
+		return 0;
+	}
+	catch (const std::ios_base::failure &) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[BTreeStorage Put] \n- Path: " + path + "\n- Status: 0xD2");
+		return 0xD2;
+	}
+	catch (const std::runtime_error &) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[BTreeStorage Put] \n- Path: " + path + "\n- Status: 0xD3");
+		return 0xD3;
+	}
+	catch (...) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[BTreeStorage Put] \n- Path: " + path + "\n- Status: 0xDF");
+		return 0xDF;
+	}
+}
+
+/**
+ * @brief Removes a key. The leaf is not merged with its neighbours, even if it becomes empty.
+ *
+ * @param key The key.
+ * @return Returns 0 if the key was removed, else an error code:
+ *         - 0xD0: If the key does not exist.
+ *         - 0xD2: If a page cannot be read or written.
+ *         - 0xD3: If a page is corrupt.
+ *         - 0xDF: If an unknown exception occurs.
+ */
+int BTreeStorage::erase(const std::string &key) {
+	std::lock_guard<std::recursive_mutex> lock(mtx);
+	try {
+		bool found;
+		{
+			Frame *frame = fetch(find_leaf(key));
+			PinGuard guard(frame);
+			Node &node = frame->node;
+			auto it = std::lower_bound(node.keys.begin(), node.keys.end(), key);
+			found = it != node.keys.end() && *it == key;
+			if (found) {
+				node.values.erase(node.values.begin() + (it - node.keys.begin()));
+				node.keys.erase(it);
+				frame->dirty = true;
+			}
+		}
+		release_frames();
+		return found ? 0 : 0xD0;
+	}
+	catch (const std::ios_base::failure &) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[BTreeStorage Erase] \n- Path: " + path + "\n- Status: 0xD2");
+		return 0xD2;
+	}
+	catch (const std::runtime_error &) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[BTreeStorage Erase] \n- Path: " + path + "\n- Status: 0xD3");
+		return 0xD3;
+	}
+	catch (...) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[BTreeStorage Erase] \n- Path: " + path + "\n- Status: 0xDF");
+		return 0xDF;
+	}
+}
+
+/**
+ * @brief Calls a function for every key starting with a prefix, in key order, by walking the leaves.
+ *
+ * The function may read the storage, but must not modify it.
+ *
+ * @param prefix The prefix, empty for every key.
+ * @param fn The function, called with each key and value; returning false stops the scan.
+ * @return Returns 0 on success, else an error code:
+ *         - 0xD2: If a page cannot be read or written.
+ *         - 0xD3: If a page is corrupt.
+ *         - 0xDF: If an unknown exception occurs.
+ */
+int BTreeStorage::scan(const std::string &prefix,
+					   const std::function<bool(const std::string &key, const std::string &value)> &fn) {
+	std::lock_guard<std::recursive_mutex> lock(mtx);
+	try {
+		uint32_t page = find_leaf(prefix);
+		bool first = true;
+		while (page != 0) {
+			Frame *frame = fetch(page);
+			PinGuard guard(frame);
+			const Node &node = frame->node;
+			size_t i = first ? std::lower_bound(node.keys.begin(), node.keys.end(), prefix) - node.keys.begin() : 0;
+			first = false;
+			for (; i < node.keys.size(); i++) {
+				// stop the scan at the first key without the prefix, or when the function asks to
+				if (node.keys[i].compare(0, prefix.size(), prefix) != 0 || !fn(node.keys[i], node.values[i]))
+					break;
+			}
+			page = i < node.keys.size() ? 0 : node.next;
+		}
+		release_frames();
+		return 0;
+	}
+	catch (const std::ios_base::failure &) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[BTreeStorage Scan] \n- Path: " + path + "\n- Status: 0xD2");
+		return 0xD2;
+	}
+	catch (const std::runtime_error &) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[BTreeStorage Scan] \n- Path: " + path + "\n- Status: 0xD3");
+		return 0xD3;
+	}
+	catch (...) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[BTreeStorage Scan] \n- Path: " + path + "\n- Status: 0xDF");
+		return 0xDF;
+	}
+}
+
+/**
+ * @brief Removes every key, truncating the file to an empty tree.
+ *
+ * @return Returns 0 on success, else an error code:
+ *         - 0xD2: If the file cannot be rewritten.
+ *         - 0xDF: If an unknown exception occurs.
+ */
+int BTreeStorage::clear() {
+	std::lock_guard<std::recursive_mutex> lock(mtx);
+	try {
+		file.close();
+		file.open(path, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc);
+		if (!file.is_open())
+			throw std::ios_base::failure("cannot truncate");
+		init_file();
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[BTreeStorage Clear] \n- Path: " + path + "\n- Status: 0");
+		return 0;
+	}
+	catch (const std::ios_base::failure &) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[BTreeStorage Clear] \n- Path: " + path + "\n- Status: 0xD2");
+		return 0xD2;
+	}
+	catch (...) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[BTreeStorage Clear] \n- Path: " + path + "\n- Status: 0xDF");
+		return 0xDF;
+	}
+}
+
+/**
+ * @brief Writes back every dirty page and the meta page as a checkpoint: they are journaled and the journal synced,
+ * then copied into the file, which is synced before the journal is emptied. Without changes nothing is written.
+ *
+ * @return Returns 0 on success, else an error code:
+ *         - 0xD2: If a page cannot be written.
+ *         - 0xDF: If an unknown exception occurs.
+ */
+int BTreeStorage::flush() {
+	std::lock_guard<std::recursive_mutex> lock(mtx);
+	try {
+		for (auto &frame : frames) {
+			if (frame->page != 0 && frame->dirty)
+				write_back(*frame);
+		}
+		if (journal_pages.empty())
+			return 0;
+		// the meta page commits the checkpoint once the journal is synced
+		char meta[PAGE_SIZE];
+		encode_meta(meta, checkpoint + 1);
+		journal_page(0, meta);
+		journal.flush();
+		if (!journal || !ImageWriter::syncFile(journal_path))
+			throw std::ios_base::failure("cannot sync journal");
+		size_t written = journal_pages.size() - 1;
+		apply_journal(journal_pages);
+		checkpoint++;
+		reset_journal();
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[BTreeStorage Flush] \n- Path: " + path + "\n- Checkpoint: " + std::to_string(checkpoint) + "\n- Pages Written: " + std::to_string(written) + "\n- Status: 0");
+		return 0;
+	}
+	catch (const std::ios_base::failure &) {
+		file.clear();
+		journal.clear();
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[BTreeStorage Flush] \n- Path: " + path + "\n- Status: 0xD2");
+		return 0xD2;
+	}
+	catch (...) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[BTreeStorage Flush] \n- Path: " + path + "\n- Status: 0xDF");
+		return 0xDF;
+	}
+}
+
+/**
+ * @brief Retrieves the number of page accesses served by the buffer pool.
+ *
+ * @return The number of buffer pool hits since the storage was created.
+ */
+size_t BTreeStorage::hitCount() const {
+	return hits.load();
+}
+
+/**
+ * @brief Retrieves the number of page accesses that had to read the file.
+ *
+ * @return The number of buffer pool misses since the storage was created.
+ */
+size_t BTreeStorage::missCount() const {
+	return misses.load();
+}
+
+/**
+ * @brief Retrieves the number of frames of the buffer pool.
+ *
+ * @return The number of frames allocated so far.
+ */
+size_t BTreeStorage::frameCount() const {
+	return frames.size();
+}
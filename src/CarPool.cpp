@@ -14,12 +14,220 @@
  * @version 1.0
  */
 
+#include "carinfo-manager/btreestorage.hpp"
 #include "carinfo-manager/carpool.hpp"
+#include "carinfo-manager/imagewriter.hpp"
+#include "carinfo-manager/jsonwriter.hpp"
 #include "carinfo-manager/log.hpp"
+#include "carinfo-manager/parallelloader.hpp"
+#include "carinfo-manager/trace.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
 #include <fstream>
+#include <stdexcept>
 #include "json/json.hpp"
 using nlohmann::json;
 
+namespace {
+
+/**
+ * @brief Builds a car from its JSON record in car.json.
+ * 
+ * @param obj The JSON record.
+ * @param car The car to fill.
+ * @return Returns 0 on success, else the CarPool::load error code (0xB2, 0xB3 or 0xB4).
+ */
+int parse_car(const json &obj, Car &car) {
+	if (!obj.is_object())
+		return 0xB2;
+	if (!obj.contains("id") || !obj.contains("type") || !obj.contains("owner") ||
+		!obj.contains("color") || !obj.contains("year") || !obj.contains("img_path"))
+		return 0xB3;
+	if (!obj["id"].is_string() || !obj["type"].is_string() || !obj["owner"].is_string() ||
+		!obj["color"].is_string() || !obj["year"].is_number_integer() ||
+		!obj["img_path"].is_string())
+		return 0xB4;
+	car = Car(std::string(obj["id"]),
+			  std::string(obj["type"]),
+			  std::string(obj["owner"]),
+			  std::string(obj["color"]),
+			  int(obj["year"]),
+			  std::string(obj["img_path"]));
+	return 0;
+}
+
+/**
+ * @brief Writes the JSON object of a car.
+ * 
+ * @param writer The writer.
+ * @param car The car.
+ */
+void write_car_fields(JsonWriter &writer, const Car &car) {
+	// in the order of nlohmann::json, which sorts the keys
+	writer.beginObject()
+		.key("color")
+		.value(car.getColor())
+		.key("id")
+		.value(car.getId())
+		.key("img_path")
+		.value(car.getImagePath())
+		.key("owner")
+		.value(car.getOwner())
+		.key("type")
+		.value(car.getType())
+		.key("year")
+		.value(car.getYear())
+		.endObject();
+}
+
+/**
+ * @brief Writes one member of car.json, the car keyed by its ID.
+ * 
+ * @param writer The writer, inside the object of the cars.
+ * @param car The car.
+ * @param cache If not nullptr, the compact JSON of the car is taken from this cache, or cached after it is written.
+ *              Must be nullptr unless the writer writes compact JSON.
+ * @param generation The generation of `cache` taken before the car was read.
+ */
+void write_car_record(JsonWriter &writer, const Car &car, FragmentCache *cache, uint64_t generation) {
+	writer.key(car.getId());
+	if (cache == nullptr) {
+		write_car_fields(writer, car);
+		return;
+	}
+	std::shared_ptr<const std::string> fragment = cache->get(car.getId());
+	if (fragment == nullptr) {
+		std::string text;
+		JsonWriter fragment_writer(text);
+		write_car_fields(fragment_writer, car);
+		fragment = std::make_shared<const std::string>(std::move(text));
+		cache->put(car.getId(), fragment, generation);
+	}
+	writer.raw(*fragment);
+}
+
+// called with each car to write, see write_cars
+using CarVisitor = std::function<void(const Car &)>;
+
+// bytes of car.json buffered before they are written to the stream
+constexpr size_t SAVE_BUFFER_BYTES = 64 * 1024;
+
+/**
+ * @brief Writes cars in the format of car.json, an object of the cars keyed by ID, or null if there are none.
+ * 
+ * @param out The string to append the text to.
+ * @param indent The indent of the text, 0 for compact text, 4 for the layout of car.json.
+ * @param os If not nullptr, the text is moved from `out` to this stream every SAVE_BUFFER_BYTES and at the end.
+ * @param cache If not nullptr and the text is compact, the JSON of the cars is taken from this cache when it can be.
+ * @param generation The generation of `cache` taken before the cars were read.
+ * @param cars The number of cars to write. Too many for the cache are written without it, see FragmentCache::accepts.
+ * @param for_each Calls the function it is given with every car to write.
+ */
+void write_cars(std::string &out,
+				size_t indent,
+				std::ostream *os,
+				FragmentCache *cache,
+				uint64_t generation,
+				size_t cars,
+				const std::function<void(const CarVisitor &)> &for_each) {
+	JsonWriter writer(out, indent);
+	if (indent != 0 || (cache != nullptr && !cache->accepts(cars)))
+		cache = nullptr;
+	bool first = true;
+	for_each([&](const Car &car) {
+		if (first)
+			writer.beginObject();
+		first = false;
+		write_car_record(writer, car, cache, generation);
+		if (os != nullptr && out.size() >= SAVE_BUFFER_BYTES) {
+			os->write(out.data(), out.size());
+			out.clear();
+		}
+	});
+	if (first)
+		writer.null();
+	else
+		writer.endObject();
+	if (os != nullptr) {
+		os->write(out.data(), out.size());
+		out.clear();
+	}
+}
+
+/**
+ * @brief Builds the path of a segment file of the segmented layout.
+ * 
+ * @param dir The directory of the layout, ending with '/'.
+ * @param generation The generation of the layout, 0 for a layout written before generations were recorded.
+ * @param segment The segment index.
+ * @return The path, e.g. `dir/segment-3-0007.json`, or `dir/segment-0007.json` for generation 0.
+ */
+std::string segment_path(const std::string &dir, size_t generation, size_t segment) {
+	char name[64];
+	if (generation == 0)
+		std::snprintf(name, sizeof(name), "segment-%04zu.json", segment);
+	else
+		std::snprintf(name, sizeof(name), "segment-%zu-%04zu.json", generation, segment);
+	return dir + name;
+}
+
+/**
+ * @brief Builds a temporary path next to a file, unique to this write, to write the file before it is renamed over.
+ * 
+ * @param path The path of the file.
+ * @return The path, e.g. `dir/segment-0007.json.<time>-<serial>.tmp`.
+ */
+std::string temp_path(const std::string &path) {
+	static std::atomic<uint64_t> serial(0);
+	return path + "." + std::to_string(std::chrono::system_clock::now().time_since_epoch().count()) + "-" +
+		   std::to_string(serial++) + ".tmp";
+}
+
+// key of the car count in the storage backend
+const std::string STORAGE_COUNT_KEY = "n";
+
+/**
+ * @brief Builds a key of the storage backend.
+ *
+ * Cars are stored under "i\0<id>"; the indexes by color, owner, type and image path are empty values under
+ * "<tag>\0<field>\0<id>", so that the cars sharing a field value are found with a prefix scan.
+ *
+ * @param tag 'i' for the car itself, 'c', 'o', 't' or 'm' for an index entry.
+ * @param field The indexed field, unused for 'i'.
+ * @param id The ID of the car, empty to build the scan prefix of an index.
+ * @return The key.
+ */
+std::string storage_key(char tag, const std::string &field, const std::string &id) {
+	std::string key(1, tag);
+	key += '\0';
+	if (tag != 'i') {
+		key += field;
+		key += '\0';
+	}
+	return key + id;
+}
+
+/**
+ * @brief Builds the value of a car in the storage backend.
+ *
+ * @param car The car.
+ * @return The JSON record of the car.
+ */
+std::string storage_record(const Car &car) {
+	json obj = {{"id", car.getId()},
+				{"type", car.getType()},
+				{"owner", car.getOwner()},
+				{"color", car.getColor()},
+				{"year", car.getYear()},
+				{"img_path", car.getImagePath()}};
+	return obj.dump();
+}
+
+}  // namespace
+
 Car::Car() {
 	car_id = "";
 	car_type = "";
@@ -149,6 +357,11 @@ CarPool::CarPool() {
 	carpool_bytype = std::multimap<std::string, Car>();
 	carpool_byowner = std::multimap<std::string, Car>();
 	sz = 0;
+	segments = 0;
+	disk_segments = 0;
+	disk_generation = 0;
+	manifest_dirty = false;
+	version = 0;
 }
 
 /**
@@ -165,6 +378,11 @@ CarPool::CarPool(Car *begin, Car *end) {
 	carpool_bytype = std::multimap<std::string, Car>();
 	carpool_byowner = std::multimap<std::string, Car>();
 	sz = 0;
+	segments = 0;
+	disk_segments = 0;
+	disk_generation = 0;
+	manifest_dirty = false;
+	version = 0;
 	for (Car *i = begin; i != end; i++)
 		addCar(*i);
 }
@@ -182,6 +400,11 @@ CarPool::CarPool(const std::vector<Car> &cars) {
 	carpool_bytype = std::multimap<std::string, Car>();
 	carpool_byowner = std::multimap<std::string, Car>();
 	sz = 0;
+	segments = 0;
+	disk_segments = 0;
+	disk_generation = 0;
+	manifest_dirty = false;
+	version = 0;
 	for (Car car : cars)
 		addCar(car);
 }
@@ -190,6 +413,7 @@ CarPool::CarPool(const std::vector<Car> &cars) {
  * @brief Constructs a new CarPool object by copying an existing CarPool object.
  * 
  * This constructor initializes the CarPool object by copying the contents of the provided CarPool object.
+ * The copy is not bound to the segmented layout of `cp` and does not track changes.
  * 
  * @param cp The CarPool object to be copied.
  */
@@ -198,7 +422,14 @@ CarPool::CarPool(const CarPool &cp) {
 	carpool_bycolor = cp.carpool_bycolor;
 	carpool_bytype = cp.carpool_bytype;
 	carpool_byowner = cp.carpool_byowner;
+	std::lock_guard<std::mutex> lock(cp.img_mutex);
+	img_refcount = cp.img_refcount;
 	sz = cp.sz;
+	segments = 0;
+	disk_segments = 0;
+	disk_generation = 0;
+	manifest_dirty = false;
+	version = 0;
 }
 
 /**
@@ -211,27 +442,140 @@ CarPool::~CarPool() {
 	carpool_bycolor.clear();
 	carpool_bytype.clear();
 	carpool_byowner.clear();
+	img_refcount.clear();
 	sz = 0;
 }
 
+/**
+ * @brief Adds references to an image path.
+ * 
+ * @param img_path The image path.
+ * @param count The number of references to add.
+ */
+void CarPool::ref_image(const std::string &img_path, size_t count) {
+	std::lock_guard<std::mutex> lock(img_mutex);
+	img_refcount[img_path] += count;
+}
+
+/**
+ * @brief Drops a reference to an image path, forgetting the path when no car references it anymore.
+ * 
+ * @param img_path The image path.
+ */
+void CarPool::unref_image(const std::string &img_path) {
+	std::lock_guard<std::mutex> lock(img_mutex);
+	auto it = img_refcount.find(img_path);
+	if (it != img_refcount.end() && --it->second == 0)
+		img_refcount.erase(it);
+}
+
+/**
+ * @brief Retrieves the number of cars referencing an image path.
+ * 
+ * This function is thread-safe with respect to the mutations of the carpool, so the image sweeper can call it while
+ * requests are being served.
+ * 
+ * @param img_path The image path.
+ * @return The number of cars whose image path is `img_path`.
+ */
+size_t CarPool::imageRefCount(const std::string &img_path) const {
+	if (storage) {
+		size_t count = 0;
+		storage->scan(storage_key('m', img_path, ""), [&count](const std::string &, const std::string &) {
+			count++;
+			return true;
+		});
+		return count;
+	}
+	std::lock_guard<std::mutex> lock(img_mutex);
+	auto it = img_refcount.find(img_path);
+	return it == img_refcount.end() ? 0 : it->second;
+}
+
+/**
+ * @brief Records that a car was added or removed, marking its segment dirty.
+ *
+ * Does nothing if the carpool is not using the segmented layout.
+ *
+ * @param id The ID of the car.
+ * @param present True if the car was added, false if it was removed.
+ */
+void CarPool::mark_dirty(const std::string &id, bool present) {
+	if (segments == 0)
+		return;
+	size_t segment = segmentOf(id, segments);
+	if (present)
+		segment_ids[segment].insert(id);
+	else
+		segment_ids[segment].erase(id);
+	dirty_segments.insert(segment);
+}
+
+/**
+ * @brief Reassigns every car to its segment and marks every segment dirty.
+ */
+void CarPool::rebuild_segments() {
+	segment_ids.assign(segments, std::set<std::string>());
+	for (auto it = carpool_byid.begin(); it != carpool_byid.end(); it++)
+		segment_ids[segmentOf(it->first, segments)].emplace_hint(
+			segment_ids[segmentOf(it->first, segments)].end(), it->first);
+	dirty_segments.clear();
+	for (size_t i = 0; i < segments; i++)
+		dirty_segments.insert(i);
+}
+
 /**
  * Adds a car to the carpool.
  * 
+ * The car must fit in one storage entry, see carFits, whichever backend is used, so that a carpool can always be
+ * moved to car.btree.
+ * 
  * @param car The car object to be added.
  * @return Returns 0 if the car is added successfully, else an error code:
  *         - 0x70: If the car with the same ID already exists in the carpool.
+ *         - 0x72: If the car is too large, the carpool is not changed.
  *         - 0x7F: If an unknown exception occurs while adding the car.
  */
 int CarPool::addCar(const Car &car) {
+	if (!carFits(car)) {
+		MyLogger::log("carinfo-manager-logger",
+					  MyLogger::LOG_LEVEL::ERROR,
+					  "[CarPool Add Car] \n- Car ID: " + car.getId() + "\n- Status: 0x72");
+		return 0x72;
+	}
+	return add_car(car);
+}
+
+/**
+ * @brief Adds a car to the carpool without checking its size.
+ * 
+ * Used for the cars that are already in a carpool: query results and a car put back by patchCar, which may hold cars
+ * stored before the size was checked.
+ * 
+ * @param car The car object to be added.
+ * @return Returns 0 if the car is added successfully, else an error code, see addCar.
+ */
+int CarPool::add_car(const Car &car) {
+	Trace::Span span("CarPool::addCar");
 	try {
-		if (carpool_byid.find(car.getId()) != carpool_byid.end()){
+		Car existing;
+		if (storage ? storage_find(car.getId(), existing) : carpool_byid.find(car.getId()) != carpool_byid.end()){
 			MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[CarPool Add Car] \n- Car ID: " + car.getId() + "\n- Car Owner: " + car.getOwner() + "\n- Car Type: " + car.getType() + "\n- Car Color: " + car.getColor() + "\n- Car Year: " + std::to_string(car.getYear()) + "\n- Car Image Path: " + car.getImagePath() + "\n- Status: 0x70");
 			return 0x70;}
-		carpool_byid[car.getId()] = car;
-		carpool_bycolor.insert(std::make_pair(car.getColor(), car));
-		carpool_bytype.insert(std::make_pair(car.getType(), car));
-		carpool_byowner.insert(std::make_pair(car.getOwner(), car));
-		sz++;
+		if (storage) {
+			if (!storage_add(car))
+				throw std::runtime_error("storage");
+		}
+		else {
+			carpool_byid[car.getId()] = car;
+			carpool_bycolor.insert(std::make_pair(car.getColor(), car));
+			carpool_bytype.insert(std::make_pair(car.getType(), car));
+			carpool_byowner.insert(std::make_pair(car.getOwner(), car));
+			ref_image(car.getImagePath());
+			mark_dirty(car.getId(), true);
+			sz++;
+		}
+		version++;
 		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[CarPool Add Car] \n- Car ID: " + car.getId() + "\n- Car Owner: " + car.getOwner() + "\n- Car Type: " + car.getType() + "\n- Car Color: " + car.getColor() + "\n- Car Year: " + std::to_string(car.getYear()) + "\n- Car Image Path: " + car.getImagePath() + "\n- Status: 0");
 		return 0;
 	}
@@ -241,6 +585,90 @@ int CarPool::addCar(const Car &car) {
 	}
 }
 
+/**
+ * @brief Adds many cars to the carpool at once.
+ * 
+ * The cars are sorted by ID and by every indexed field, then inserted into the indexes in order with position hints,
+ * which avoids a full tree search per car. Unlike addCar, nothing is logged per car. Cars whose ID is already in the
+ * carpool, or appears earlier in `cars`, are skipped.
+ * 
+ * @param cars The cars to be added.
+ * @return Returns 0 if every car is added successfully, else an error code:
+ *         - 0x71: If some cars were skipped because of duplicate IDs, the other cars are added.
+ *         - 0x7F: If an unknown exception occurs while adding the cars.
+ */
+int CarPool::addCars(std::vector<Car> cars) {
+	try {
+		std::stable_sort(cars.begin(), cars.end(), [](const Car &a, const Car &b) { return a < b; });
+		if (storage) {
+			// sorted keys keep the storage writes on neighbouring pages
+			size_t skipped = 0;
+			for (const Car &car : cars) {
+				Car existing;
+				if (storage_find(car.getId(), existing)) {
+					skipped++;
+					continue;
+				}
+				if (!storage_add(car))
+					throw std::runtime_error("storage");
+			}
+			version++;
+			MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[CarPool Add Cars] \n- Added: " + std::to_string(cars.size() - skipped) + "\n- Skipped: " + std::to_string(skipped) + "\n- Status: " + (skipped ? "0x71" : "0"));
+			return skipped ? 0x71 : 0;
+		}
+		std::vector<const Car *> added;
+		added.reserve(cars.size());
+		for (const Car &car : cars) {
+			if (!added.empty() && added.back()->getId() == car.getId())
+				continue;
+			// appending past the largest key needs no search
+			auto hint = carpool_byid.end();
+			if (!carpool_byid.empty() && !(carpool_byid.rbegin()->first < car.getId())) {
+				hint = carpool_byid.lower_bound(car.getId());
+				if (hint != carpool_byid.end() && hint->first == car.getId())
+					continue;
+			}
+			carpool_byid.emplace_hint(hint, car.getId(), car);
+			added.push_back(&car);
+		}
+
+		auto insert_sorted = [&added](std::multimap<std::string, Car> &index,
+									  std::string (Car::*field)() const) {
+			std::vector<const Car *> order = added;
+			std::stable_sort(order.begin(), order.end(), [field](const Car *a, const Car *b) {
+				return (a->*field)() < (b->*field)();
+			});
+			for (const Car *car : order) {
+				std::string key = (car->*field)();
+				auto hint = index.end();
+				if (!index.empty() && key < index.rbegin()->first)
+					hint = index.upper_bound(key);
+				index.emplace_hint(hint, std::move(key), *car);
+			}
+		};
+		insert_sorted(carpool_bycolor, &Car::getColor);
+		insert_sorted(carpool_bytype, &Car::getType);
+		insert_sorted(carpool_byowner, &Car::getOwner);
+		{
+			std::lock_guard<std::mutex> lock(img_mutex);
+			for (const Car *car : added)
+				img_refcount[car->getImagePath()]++;
+		}
+		for (const Car *car : added)
+			mark_dirty(car->getId(), true);
+		sz += added.size();
+		version++;
+
+		size_t skipped = cars.size() - added.size();
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[CarPool Add Cars] \n- Added: " + std::to_string(added.size()) + "\n- Skipped: " + std::to_string(skipped) + "\n- Status: " + (skipped ? "0x71" : "0"));
+		return skipped ? 0x71 : 0;
+	}
+	catch (...) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[CarPool Add Cars] \n- Status: 0x7F");
+		return 0x7F;
+	}
+}
+
 /**
  * Removes a car from the car pool.
  *
@@ -262,7 +690,20 @@ int CarPool::removeCar(const Car &car) {
  *        - 0x8F: If an unknown exception occurs while removing the car.
  */
 int CarPool::removeCar(const std::string &id) {
+	Trace::Span span("CarPool::removeCar");
 	try {
+		if (storage) {
+			Car car;
+			if (!storage_find(id, car)){
+				MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[CarPool Remove Car] \n- Car ID: " + id + "\n- Status: 0x80");
+				return 0x80;}
+			if (!storage_remove(car))
+				throw std::runtime_error("storage");
+			version++;
+			forget_fragments(id);
+			MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[CarPool Remove Car] \n- Car ID: " + id + "\n- Status: 0");
+			return 0;
+		}
 		auto it_id = carpool_byid.find(id);
 		if (it_id == carpool_byid.end()){
 			MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[CarPool Remove Car] \n- Car ID: " + id + "\n- Status: 0x80");
@@ -294,7 +735,11 @@ int CarPool::removeCar(const std::string &id) {
 				break;
 			}
 		}
+		unref_image(car.getImagePath());
+		mark_dirty(car.getId(), false);
 		sz--;
+		version++;
+		forget_fragments(id);
 		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[CarPool Remove Car] \n- Car ID: " + id + "\n- Status: 0");
 		return 0;
 	}
@@ -316,10 +761,18 @@ int CarPool::removeCar(const std::string &id) {
  * @return Returns 0 if the update is successful, else an error code:
  *         - 0x90: If the removal of the original car is successful but the addition of the new car fails.
  *         - 0x91: If the addition of the new car fails.
+ *         - 0x95: If the new car is too large, see carFits. The original car is kept.
  *         - 0x9F: If an exception occurs during the update process.
  */
 int CarPool::updateCar(const Car &original_car, const Car &new_car) {
 	try {
+		if (!carFits(new_car)) {
+			MyLogger::log("carinfo-manager-logger",
+						  MyLogger::LOG_LEVEL::ERROR,
+						  "[CarPool Update Car] \n- Original Car ID: " + original_car.getId() + "\n- New Car ID: " + new_car.getId() +
+							  "\n- Status: 0x95");
+			return 0x95;
+		}
 		if (removeCar(original_car)){
 			MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[CarPool Update Car] \n- Original Car ID: " + original_car.getId() + "\n- New Car ID: " + new_car.getId() + "\n- New Car Owner: " + new_car.getOwner() + "\n- New Car Type: " + new_car.getType() + "\n- New Car Color: " + new_car.getColor() + "\n- New Car Year: " + std::to_string(new_car.getYear()) + "\n- New Car Image Path: " + new_car.getImagePath() + "\n- Status: 0x90");
 			return 0x90;}
@@ -345,10 +798,19 @@ int CarPool::updateCar(const Car &original_car, const Car &new_car) {
  * @return Returns 0 if the car was successfully updated, else an error code:
  *         - 0x90: If the removal of the original car is successful but the addition of the new car fails.
  *         - 0x91: If the addition of the new car fails.
+ *         - 0x95: If the new car is too large, see carFits. The original car is kept.
  *         - 0x9F: If an exception occurs during the update process.
  */
 int CarPool::updateCar(const std::string &id, const Car &new_car) {
+	Trace::Span span("CarPool::updateCar");
 	try {
+		if (!carFits(new_car)) {
+			MyLogger::log("carinfo-manager-logger",
+						  MyLogger::LOG_LEVEL::ERROR,
+						  "[CarPool Update Car] \n- Original Car ID: " + id + "\n- New Car ID: " + new_car.getId() +
+							  "\n- Status: 0x95");
+			return 0x95;
+		}
 		if (removeCar(id)){
 			MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[CarPool Update Car] \n- Original Car ID: " + id + "\n- New Car ID: " + new_car.getId() + "\n- New Car Owner: " + new_car.getOwner() + "\n- New Car Type: " + new_car.getType() + "\n- New Car Color: " + new_car.getColor() + "\n- New Car Year: " + std::to_string(new_car.getYear()) + "\n- New Car Image Path: " + new_car.getImagePath() + "\n- Status: 0x90");
 			return 0x90;}
@@ -364,6 +826,110 @@ int CarPool::updateCar(const std::string &id, const Car &new_car) {
 	}
 }
 
+/**
+ * @brief Changes some fields of a car, leaving the others as they are.
+ * 
+ * Unlike updateCar, only the indexes whose field changes are re-keyed, the entries of the other indexes are updated in
+ * place, and the image reference is only moved if the image path changes. A change of ID moves the car to its new key
+ * like updateCar does.
+ * 
+ * @param id The ID of the car to be changed.
+ * @param patch The fields to change.
+ * @return Returns 0 if the car was successfully changed, else an error code:
+ *         - 0x92: If the car with the specified ID does not exist in the carpool.
+ *         - 0x93: If the new ID belongs to another car.
+ *         - 0x94: If the car moved to its new ID cannot be added. The car is left as it was.
+ *         - 0x95: If the patched car is too large, see carFits. The car is left as it was.
+ *         - 0x9F: If an exception occurs during the update process.
+ */
+int CarPool::patchCar(const std::string &id, const CarPatch &patch) {
+	Trace::Span span("CarPool::patchCar");
+	try {
+		Car car;
+		auto it_id = carpool_byid.end();
+		if (storage ? !storage_find(id, car) : (it_id = carpool_byid.find(id)) == carpool_byid.end()){
+			MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[CarPool Patch Car] \n- Car ID: " + id + "\n- Status: 0x92");
+			return 0x92;}
+		if (!storage)
+			car = it_id->second;
+		Car patched = car;
+		if (patch.id)
+			patched.setId(*patch.id);
+		if (patch.type)
+			patched.setType(*patch.type);
+		if (patch.owner)
+			patched.setOwner(*patch.owner);
+		if (patch.color)
+			patched.setColor(*patch.color);
+		if (patch.year)
+			patched.setYear(*patch.year);
+		if (patch.img_path)
+			patched.setImagePath(*patch.img_path);
+		if (!carFits(patched)) {
+			MyLogger::log("carinfo-manager-logger",
+						  MyLogger::LOG_LEVEL::ERROR,
+						  "[CarPool Patch Car] \n- Car ID: " + id + "\n- Status: 0x95");
+			return 0x95;
+		}
+
+		if (patched.getId() != id) {
+			Car existing;
+			if (storage ? storage_find(patched.getId(), existing) : carpool_byid.find(patched.getId()) != carpool_byid.end()){
+				MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[CarPool Patch Car] \n- Car ID: " + id + "\n- New Car ID: " + patched.getId() + "\n- Status: 0x93");
+				return 0x93;}
+			if (removeCar(id) != 0)
+				throw std::runtime_error("move");
+			if (addCar(patched) != 0) {
+				// put the car back as it was
+				if (add_car(car) != 0)
+					throw std::runtime_error("restore");
+				MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[CarPool Patch Car] \n- Car ID: " + id + "\n- New Car ID: " + patched.getId() + "\n- Status: 0x94");
+				return 0x94;
+			}
+		}
+		else if (storage) {
+			if (!storage_patch(car, patched))
+				throw std::runtime_error("storage");
+			version++;
+			forget_fragments(id);
+		}
+		else {
+			// the indexes hold copies of the car: re-key the entry if its field changed, else overwrite it
+			auto patch_index = [&](std::multimap<std::string, Car> &index, const std::string &key, const std::string &new_key) {
+				auto range = index.equal_range(key);
+				for (auto it = range.first; it != range.second; it++) {
+					if (it->second.getId() != id)
+						continue;
+					if (key == new_key)
+						it->second = patched;
+					else {
+						index.erase(it);
+						index.emplace(new_key, patched);
+					}
+					return;
+				}
+			};
+			patch_index(carpool_bycolor, car.getColor(), patched.getColor());
+			patch_index(carpool_byowner, car.getOwner(), patched.getOwner());
+			patch_index(carpool_bytype, car.getType(), patched.getType());
+			it_id->second = patched;
+			if (patched.getImagePath() != car.getImagePath()) {
+				ref_image(patched.getImagePath());
+				unref_image(car.getImagePath());
+			}
+			mark_dirty(id, true);
+			version++;
+			forget_fragments(id);
+		}
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[CarPool Patch Car] \n- Car ID: " + id + "\n- New Car ID: " + patched.getId() + "\n- New Car Owner: " + patched.getOwner() + "\n- New Car Type: " + patched.getType() + "\n- New Car Color: " + patched.getColor() + "\n- New Car Year: " + std::to_string(patched.getYear()) + "\n- New Car Image Path: " + patched.getImagePath() + "\n- Status: 0");
+		return 0;
+	}
+	catch (...) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[CarPool Patch Car] \n- Car ID: " + id + "\n- Status: 0x9F");
+		return 0x9F;
+	}
+}
+
 /**
  * Retrieves a CarPool object containing the car with the specified ID.
  *
@@ -372,11 +938,16 @@ int CarPool::updateCar(const std::string &id, const Car &new_car) {
  */
 CarPool CarPool::getCarbyId(const std::string &id) const {
 	CarPool cars;
-	if (carpool_byid.find(id) != carpool_byid.end())
-		cars.addCar(carpool_byid.at(id));
-	std::stringstream ss;
-	cars.save(ss);
-	MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[CarPool Get Car by ID] \n- Car ID: " + id + "\n- Result: " + ss.str());
+	Car car;
+	if (storage) {
+		if (storage_find(id, car))
+			cars.add_car(car);
+	}
+	else if (carpool_byid.find(id) != carpool_byid.end())
+		cars.add_car(carpool_byid.at(id));
+	std::string result;
+	cars.save(result, 0);
+	MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[CarPool Get Car by ID] \n- Car ID: " + id + "\n- Result: " + result);
 	return cars;
 }
 
@@ -388,12 +959,16 @@ CarPool CarPool::getCarbyId(const std::string &id) const {
  */
 CarPool CarPool::getCarbyColor(const std::string &color) const {
 	CarPool cars;
-	auto it_bg = carpool_bycolor.lower_bound(color), it_ed = carpool_bycolor.upper_bound(color);
-	for (auto it = it_bg; it != it_ed; it++)
-		cars.addCar(it->second);
-	std::stringstream ss;
-	cars.save(ss);
-	MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[CarPool Get Car by Color] \n- Car Color: " + color + "\n- Result: " + ss.str());
+	if (storage)
+		storage_query(storage_key('c', color, ""), cars);
+	else {
+		auto it_bg = carpool_bycolor.lower_bound(color), it_ed = carpool_bycolor.upper_bound(color);
+		for (auto it = it_bg; it != it_ed; it++)
+			cars.add_car(it->second);
+	}
+	std::string result;
+	cars.save(result, 0);
+	MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[CarPool Get Car by Color] \n- Car Color: " + color + "\n- Result: " + result);
 	return cars;
 }
 
@@ -405,12 +980,16 @@ CarPool CarPool::getCarbyColor(const std::string &color) const {
  */
 CarPool CarPool::getCarbyOwner(const std::string &owner) const {
 	CarPool cars;
-	auto it_bg = carpool_byowner.lower_bound(owner), it_ed = carpool_byowner.upper_bound(owner);
-	for (auto it = it_bg; it != it_ed; it++)
-		cars.addCar(it->second);
-	std::stringstream ss;
-	cars.save(ss);
-	MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[CarPool Get Car by Owner] \n- Car Owner: " + owner + "\n- Result: " + ss.str());
+	if (storage)
+		storage_query(storage_key('o', owner, ""), cars);
+	else {
+		auto it_bg = carpool_byowner.lower_bound(owner), it_ed = carpool_byowner.upper_bound(owner);
+		for (auto it = it_bg; it != it_ed; it++)
+			cars.add_car(it->second);
+	}
+	std::string result;
+	cars.save(result, 0);
+	MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[CarPool Get Car by Owner] \n- Car Owner: " + owner + "\n- Result: " + result);
 	return cars;
 }
 
@@ -422,12 +1001,16 @@ CarPool CarPool::getCarbyOwner(const std::string &owner) const {
  */
 CarPool CarPool::getCarbyType(const std::string &type) const {
 	CarPool cars;
-	auto it_bg = carpool_bytype.lower_bound(type), it_ed = carpool_bytype.upper_bound(type);
-	for (auto it = it_bg; it != it_ed; it++)
-		cars.addCar(it->second);
-	std::stringstream ss;
-	cars.save(ss);
-	MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[CarPool Get Car by Type] \n- Car Type: " + type + "\n- Result: " + ss.str());
+	if (storage)
+		storage_query(storage_key('t', type, ""), cars);
+	else {
+		auto it_bg = carpool_bytype.lower_bound(type), it_ed = carpool_bytype.upper_bound(type);
+		for (auto it = it_bg; it != it_ed; it++)
+			cars.add_car(it->second);
+	}
+	std::string result;
+	cars.save(result, 0);
+	MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[CarPool Get Car by Type] \n- Car Type: " + type + "\n- Result: " + result);
 	return cars;
 }
 
@@ -444,8 +1027,30 @@ CarPool CarPool::getCar(const std::string &id,
 						const std::string &color,
 						const std::string &owner,
 						const std::string &type) const {
+	Trace::Span span("CarPool::getCar");
 	std::string _id = id, _color = color, _type = type, _owner = owner;
-	CarPool cars = *this;
+	CarPool cars;
+	if (!storage)
+		cars = *this;
+	else if (!_id.empty()) {
+		// narrow down with the storage first, the remaining criteria are applied in memory
+		cars = getCarbyId(_id);
+		_id = "";
+	}
+	else if (!_owner.empty()) {
+		cars = getCarbyOwner(_owner);
+		_owner = "";
+	}
+	else if (!_color.empty()) {
+		cars = getCarbyColor(_color);
+		_color = "";
+	}
+	else if (!_type.empty()) {
+		cars = getCarbyType(_type);
+		_type = "";
+	}
+	else
+		forEachCar([&cars](const Car &car) { cars.add_car(car); });
 	while (!_id.empty() || !_color.empty() || !_type.empty() || !_owner.empty()) {
 		if (_id != "") {
 			cars = cars.getCarbyId(_id);
@@ -464,9 +1069,9 @@ CarPool CarPool::getCar(const std::string &id,
 			_type = "";
 		}
 	}
-	std::stringstream ss;
-	cars.save(ss);
-	MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[CarPool Get Car] \n- Car ID: " + id + "\n- Car Owner: " + owner + "\n- Car Type: " + type + "\n- Car Color: " + color + "\n- Result: " + ss.str());
+	std::string result;
+	cars.save(result, 0);
+	MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[CarPool Get Car] \n- Car ID: " + id + "\n- Car Owner: " + owner + "\n- Car Type: " + type + "\n- Car Color: " + color + "\n- Result: " + result);
 	return cars;
 }
 
@@ -505,7 +1110,17 @@ int CarPool::clear() {
 		carpool_bycolor.clear();
 		carpool_bytype.clear();
 		carpool_byowner.clear();
+		{
+			std::lock_guard<std::mutex> lock(img_mutex);
+			img_refcount.clear();
+		}
 		sz = 0;
+		if (segments != 0)
+			rebuild_segments();
+		if (storage && (storage->clear() != 0 || storage->put(STORAGE_COUNT_KEY, "0") != 0))
+			throw std::runtime_error("storage");
+		version++;
+		forget_fragments();
 		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[CarPool Clear] \n- Status: 0");
 		return 0;
 	}
@@ -519,8 +1134,24 @@ int CarPool::clear() {
  * @brief Loads car data from an input stream.
  * 
  * This function reads car data from the provided input stream and populates the CarPool object with the loaded cars.
+ * It is equivalent to `load(is, 1)`.
+ * 
+ * @param is The input stream to read car data from.
+ * @return Returns 0 if the car data is successfully loaded, otherwise returns an error code (see `load(is, threads)`).
+ */
+int CarPool::load(std::istream &is) {
+	return load(is, 1);
+}
+
+/**
+ * @brief Loads car data from an input stream on several threads.
+ * 
+ * The input is split into records without building a JSON DOM. The records are divided into chunks, every chunk is
+ * parsed on a worker thread into a CarPool fragment with its own indexes, and the fragments are then spliced into
+ * this CarPool without copying the cars again.
  * 
  * @param is The input stream to read car data from.
+ * @param threads The number of worker threads, 0 for one thread per hardware core.
  * @return Returns 0 if the car data is successfully loaded, otherwise returns an error code:
  *         - 0xB0: If the input stream is not valid.
  *         - 0xB1: If there is an error while clearing the existing car data in the CarPool object.
@@ -528,9 +1159,10 @@ int CarPool::clear() {
  *         - 0xB3: If the JSON object does not contain the required fields.
  *         - 0xB4: If the JSON object contains fields with incorrect types.
  *         - 0xB5: If there is an error while adding a car to the CarPool object.
+ *         - 0xB6: If the input is not a well-formed JSON object.
  *         - 0xBF: If an unknown exception occurs while loading the car data.
  */
-int CarPool::load(std::istream &is) {
+int CarPool::load(std::istream &is, size_t threads) {
 	if (!is){
 		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[CarPool Load] \n- Status: 0xB0");
 		return 0xB0;}
@@ -538,65 +1170,127 @@ int CarPool::load(std::istream &is) {
 		if (clear() != 0){
 			MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[CarPool Load] \n- Status: 0xB1");
 			return 0xB1;}
-		json load_json_obj = json::parse(is);
-		for (auto it = load_json_obj.begin(); it != load_json_obj.end(); it++) {
-			if (!it.value().is_object()){
-				MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[CarPool Load] \n- Status: 0xB2");
-				return 0xB2;}
-			if (!it.value().contains("id") || !it.value().contains("type") ||
-				!it.value().contains("owner") || !it.value().contains("color") ||
-				!it.value().contains("year") || !it.value().contains("img_path")){
-					MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[CarPool Load] \n- Status: 0xB3");
-				return 0xB3;}
-			if (!it.value()["id"].is_string() || !it.value()["type"].is_string() ||
-				!it.value()["owner"].is_string() || !it.value()["color"].is_string() ||
-				!it.value()["year"].is_number_integer() || !it.value()["img_path"].is_string()){
-					MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[CarPool Load] \n- Status: 0xB4");
-				return 0xB4;}
-			Car car(std::string(it.value()["id"]),
-					std::string(it.value()["type"]),
-					std::string(it.value()["owner"]),
-					std::string(it.value()["color"]),
-					int(it.value()["year"]),
-					std::string(it.value()["img_path"]));
-			if (addCar(car)){
-				MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[CarPool Load] \n- Status: 0xB5");
-				return 0xB5;}
+		std::string text((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+		std::vector<ParallelLoader::Record> records;
+		if (ParallelLoader::splitRecords(text, records) != 0){
+			MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[CarPool Load] \n- Status: 0xB6");
+			return 0xB6;}
+
+		int status_code;
+		if (storage) {
+			// parse in memory, then write the cars to the storage in order of ID
+			CarPool loaded;
+			status_code = loaded.load_records(records, threads);
+			loaded.forEachCar([&](const Car &car) {
+				if (status_code == 0 && !storage_add(car))
+					status_code = 0xBF;
+			});
 		}
-		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[CarPool Load] \n- Status: 0");
+		else
+			status_code = load_records(records, threads);
+		if (status_code != 0){
+			MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[CarPool Load] \n- Status: " + std::to_string(status_code));
+			return status_code;}
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[CarPool Load] \n- Threads: " + std::to_string(ParallelLoader::chunkCount(records.size(), ParallelLoader::threadCount(threads))) + "\n- Cars: " + std::to_string(sz) + "\n- Status: 0");
 		return 0;
 	}
 	catch (...) {
+		clear();
 		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[CarPool Load] \n- Status: 0xBF");
 		return 0xBF;
 	}
 }
 
+/**
+ * @brief Parses records of car.json into this CarPool on several threads.
+ * 
+ * The records are divided into chunks, every chunk is parsed on a worker thread into a CarPool fragment with its own
+ * indexes, and the fragments are then spliced into this CarPool without copying the cars again. On failure the
+ * CarPool is cleared. Nothing is logged, the callers report the status code.
+ * 
+ * @param records The records, as split by ParallelLoader::splitRecords.
+ * @param threads The number of worker threads, 0 for one thread per hardware core.
+ * @return Returns 0 on success, else an error code (0xB2 to 0xB5, or 0xBF, as in `load`).
+ */
+int CarPool::load_records(const std::vector<ParallelLoader::Record> &records, size_t threads) {
+	try {
+		threads = ParallelLoader::threadCount(threads);
+		std::vector<CarPool> fragments(ParallelLoader::chunkCount(records.size(), threads));
+		int status_code = ParallelLoader::run(records.size(), threads, [&](size_t chunk, size_t begin, size_t end) {
+			try {
+				CarPool &fragment = fragments[chunk];
+				for (size_t i = begin; i < end; i++) {
+					Car car;
+					int parse_status = parse_car(json::parse(records[i].value), car);
+					if (parse_status != 0)
+						return parse_status;
+					if (!fragment.carpool_byid.emplace(car.getId(), car).second)
+						return 0xB5;
+					fragment.carpool_bycolor.emplace(car.getColor(), car);
+					fragment.carpool_bytype.emplace(car.getType(), car);
+					fragment.carpool_byowner.emplace(car.getOwner(), car);
+					fragment.img_refcount[car.getImagePath()]++;
+					fragment.sz++;
+				}
+				return 0;
+			}
+			catch (...) {
+				return 0xBF;
+			}
+		});
+		if (status_code != 0){
+			clear();
+			return status_code;}
+
+		for (CarPool &fragment : fragments) {
+			carpool_byid.merge(fragment.carpool_byid);
+			if (!fragment.carpool_byid.empty()){
+				clear();
+				return 0xB5;}
+			carpool_bycolor.merge(fragment.carpool_bycolor);
+			carpool_bytype.merge(fragment.carpool_bytype);
+			carpool_byowner.merge(fragment.carpool_byowner);
+			{
+				std::lock_guard<std::mutex> lock(img_mutex);
+				for (const auto &ref : fragment.img_refcount)
+					img_refcount[ref.first] += ref.second;
+			}
+			sz += fragment.sz;
+		}
+		if (segments != 0)
+			rebuild_segments();
+		version++;
+		forget_fragments();
+		return 0;
+	}
+	catch (...) {
+		clear();
+		return 0xBF;
+	}
+}
+
 /**
  * Saves the CarPool object to an output stream.
  * 
+ * The cars are written one at a time in the format of car.json, without building a JSON document of the whole
+ * carpool first.
+ * 
  * @param os The output stream to save the CarPool object to.
  * @return Returns 0 if the CarPool object is successfully saved, else an error code:
  *         - 0xC0: If the output stream is not valid.
  *         - 0xCF: If an unknown exception occurs during the saving process.
  */
 int CarPool::save(std::ostream &os) const {
+	Trace::Span span("CarPool::save");
 	if (!os){
 		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[CarPool Save] \n- Status: 0xC0");
 		return 0xC0;}
 	try {
-		json save_json_obj;
-		for (auto it = carpool_byid.begin(); it != carpool_byid.end(); it++) {
-			json car_json_obj;
-			car_json_obj["id"] = it->second.getId();
-			car_json_obj["type"] = it->second.getType();
-			car_json_obj["owner"] = it->second.getOwner();
-			car_json_obj["color"] = it->second.getColor();
-			car_json_obj["year"] = it->second.getYear();
-			car_json_obj["img_path"] = it->second.getImagePath();
-			save_json_obj[it->first] = car_json_obj;
-		}
-		os << save_json_obj.dump(4);
+		std::string buffer;
+		write_cars(buffer, 4, &os, nullptr, 0, 0, [&](const CarVisitor &write) { forEachCar(write); });
+		if (!os){
+			MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[CarPool Save] \n- Status: 0xCF");
+			return 0xCF;}
 		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[CarPool Save] \n- Status: 0");
 		return 0;
 	}
@@ -606,6 +1300,682 @@ int CarPool::save(std::ostream &os) const {
 	}
 }
 
+/**
+ * Saves the CarPool object to a string, in the format of car.json.
+ * 
+ * The cars are appended to the string as they are visited, so a response body is written without an intermediate
+ * stream or JSON document.
+ * 
+ * @param out The string to append the cars to.
+ * @param indent The number of spaces per level, 0 for compact JSON.
+ * @return Returns 0 if the CarPool object is successfully saved, else an error code:
+ *         - 0xCF: If an unknown exception occurs during the saving process.
+ */
+int CarPool::save(std::string &out, size_t indent) const {
+	Trace::Span span("CarPool::save");
+	try {
+		FragmentCache *cache = fragment_cache.get();
+		uint64_t generation = cache != nullptr ? cache->generation() : 0;
+		write_cars(out, indent, nullptr, cache, generation, size(), [&](const CarVisitor &write) {
+			forEachCar(write);
+		});
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[CarPool Save] \n- Status: 0");
+		return 0;
+	}
+	catch (...) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[CarPool Save] \n- Status: 0xCF");
+		return 0xCF;
+	}
+}
+
+/**
+ * Saves the cars with the given IDs to a string, in the format of `save`.
+ * 
+ * Each ID is looked up directly, so no CarPool is built for the result. Missing IDs are skipped, the cars are written
+ * in the order of `ids`, which should not repeat an ID.
+ * 
+ * @param ids The IDs of the cars.
+ * @param out The string to append the cars to.
+ * @param indent The number of spaces per level, 0 for compact JSON.
+ * @param found Set to the number of cars written.
+ * @return Returns 0 if the cars are successfully saved, else an error code:
+ *         - 0xCF: If an unknown exception occurs during the saving process.
+ */
+int CarPool::saveById(const std::vector<std::string> &ids, std::string &out, size_t indent, size_t &found) const {
+	Trace::Span span("CarPool::saveById");
+	found = 0;
+	try {
+		FragmentCache *cache = fragment_cache.get();
+		uint64_t generation = cache != nullptr ? cache->generation() : 0;
+		write_cars(out, indent, nullptr, cache, generation, ids.size(), [&](const CarVisitor &write) {
+			Car stored;
+			for (const std::string &id : ids) {
+				const Car *car = nullptr;
+				if (storage) {
+					if (storage_find(id, stored))
+						car = &stored;
+				}
+				else {
+					auto it = carpool_byid.find(id);
+					if (it != carpool_byid.end())
+						car = &it->second;
+				}
+				if (car != nullptr) {
+					write(*car);
+					found++;
+				}
+			}
+		});
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[CarPool Save by ID] \n- IDs: " + std::to_string(ids.size()) + "\n- Found: " + std::to_string(found) + "\n- Status: 0");
+		return 0;
+	}
+	catch (...) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[CarPool Save by ID] \n- Status: 0xCF");
+		return 0xCF;
+	}
+}
+
+/**
+ * Saves the cars matching the given criteria to a string, in the format of `save`.
+ * 
+ * The result is that of `getCar`, written in order of ID. Without a storage backend no CarPool is built for it: the
+ * cars are taken from the index of the first criterion among ID, owner, color and type, checked against the others,
+ * and written from the carpool itself, so that the fragment cache serves them.
+ * 
+ * @param id The ID of the cars, empty to match any.
+ * @param color The color of the cars, empty to match any.
+ * @param owner The owner of the cars, empty to match any.
+ * @param type The type of the cars, empty to match any.
+ * @param out The string to append the cars to.
+ * @param indent The number of spaces per level, 0 for compact JSON.
+ * @param found Set to the number of cars written.
+ * @return Returns 0 if the cars are successfully saved, else an error code:
+ *         - 0xCF: If an unknown exception occurs during the saving process.
+ */
+int CarPool::saveCar(const std::string &id,
+					 const std::string &color,
+					 const std::string &owner,
+					 const std::string &type,
+					 std::string &out,
+					 size_t indent,
+					 size_t &found) const {
+	Trace::Span span("CarPool::saveCar");
+	found = 0;
+	try {
+		FragmentCache *cache = fragment_cache.get();
+		uint64_t generation = cache != nullptr ? cache->generation() : 0;
+		if (storage) {
+			CarPool cars = getCar(id, color, owner, type);
+			write_cars(out, indent, nullptr, cache, generation, cars.size(), [&](const CarVisitor &write) {
+				cars.forEachCar(write);
+			});
+			found = cars.size();
+		}
+		else {
+			auto matches = [&](const Car &car) {
+				return (id.empty() || car.getId() == id) && (color.empty() || car.getColor() == color) &&
+					   (owner.empty() || car.getOwner() == owner) && (type.empty() || car.getType() == type);
+			};
+			std::vector<const Car *> selected;
+			if (!id.empty()) {
+				auto it = carpool_byid.find(id);
+				if (it != carpool_byid.end() && matches(it->second))
+					selected.push_back(&it->second);
+			}
+			else if (!owner.empty() || !color.empty() || !type.empty()) {
+				const auto &index = !owner.empty() ? carpool_byowner : !color.empty() ? carpool_bycolor : carpool_bytype;
+				auto range = index.equal_range(!owner.empty() ? owner : !color.empty() ? color : type);
+				for (auto it = range.first; it != range.second; it++) {
+					if (matches(it->second))
+						selected.push_back(&it->second);
+				}
+				// an index keeps the cars of a key in the order they were added
+				std::sort(selected.begin(), selected.end(), [](const Car *a, const Car *b) {
+					return a->getId() < b->getId();
+				});
+			}
+			else {
+				selected.reserve(carpool_byid.size());
+				for (const auto &entry : carpool_byid)
+					selected.push_back(&entry.second);
+			}
+			write_cars(out, indent, nullptr, cache, generation, selected.size(), [&](const CarVisitor &write) {
+				for (const Car *car : selected)
+					write(*car);
+			});
+			found = selected.size();
+		}
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[CarPool Save Car] \n- Car ID: " + id + "\n- Car Owner: " + owner + "\n- Car Type: " + type + "\n- Car Color: " + color + "\n- Found: " + std::to_string(found) + "\n- Status: 0");
+		return 0;
+	}
+	catch (...) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[CarPool Save Car] \n- Status: 0xCF");
+		return 0xCF;
+	}
+}
+
+/**
+ * @brief Switches the carpool to the segmented layout used by `saveSegments`.
+ * 
+ * The cars are partitioned into `segment_count` segments by a hash of their ID. From now on every added or removed
+ * car marks its segment dirty. All segments start dirty, so the next `saveSegments` writes the whole layout, which
+ * also migrates a carpool loaded from car.json or re-partitions one loaded with a different segment count.
+ * 
+ * @param segment_count The number of segments, 0 to stop tracking changes.
+ * @return Returns 0 on success, else an error code:
+ *         - 0xC1: If the carpool is kept in a storage backend.
+ *         - 0xCF: If an unknown exception occurs.
+ */
+int CarPool::setSegments(size_t segment_count) {
+	if (storage && segment_count != 0) {
+		MyLogger::log("carinfo-manager-logger",
+					  MyLogger::LOG_LEVEL::ERROR,
+					  "[CarPool Set Segments] \n- Segments: " + std::to_string(segment_count) + "\n- Status: 0xC1");
+		return 0xC1;
+	}
+	try {
+		segments = segment_count;
+		manifest_dirty = true;
+		if (segments == 0) {
+			segment_ids.clear();
+			dirty_segments.clear();
+		}
+		else
+			rebuild_segments();
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[CarPool Set Segments] \n- Segments: " + std::to_string(segments) + "\n- Status: 0");
+		return 0;
+	}
+	catch (...) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[CarPool Set Segments] \n- Segments: " + std::to_string(segment_count) + "\n- Status: 0xCF");
+		return 0xCF;
+	}
+}
+
+/**
+ * @brief Retrieves the number of segments of the segmented layout.
+ * 
+ * @return The number of segments, 0 if the carpool is not using the segmented layout.
+ */
+size_t CarPool::segmentCount() const {
+	return segments;
+}
+
+/**
+ * @brief Retrieves the number of segments changed since the last `saveSegments`.
+ * 
+ * @return The number of dirty segments.
+ */
+size_t CarPool::dirtySegmentCount() const {
+	return dirty_segments.size();
+}
+
+/**
+ * @brief Computes the segment of a car ID (FNV-1a hash of the ID modulo the number of segments).
+ * 
+ * The hash is fixed so that the same ID always lands in the same segment file, whatever the platform.
+ * 
+ * @param id The ID of the car.
+ * @param segment_count The number of segments, must not be 0.
+ * @return The segment index, in [0, segment_count).
+ */
+size_t CarPool::segmentOf(const std::string &id, size_t segment_count) {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (unsigned char ch : id) {
+		hash ^= ch;
+		hash *= 0x100000001b3ULL;
+	}
+	return size_t(hash % segment_count);
+}
+
+/**
+ * @brief Loads car data from a segmented layout written by `saveSegments`.
+ * 
+ * The directory holds manifest.json, which records the number of segments and the generation of the segment files,
+ * and one file per segment of that generation in the format of car.json. The records of all segments are parsed
+ * together on `threads` threads. After loading, the carpool tracks changes with the segment count of the manifest.
+ * A segment whose file is missing, or does not hold exactly the cars that hash to it, is marked dirty so that the
+ * next `saveSegments` repairs it. Temporary files and segment files of other generations, left by a save that was cut
+ * short, are removed.
+ * 
+ * @param dir The directory of the layout, ending with '/'.
+ * @param threads The number of worker threads, 0 for one thread per hardware core.
+ * @return Returns 0 if the car data is successfully loaded, otherwise returns an error code:
+ *         - 0xB1: If there is an error while clearing the existing car data in the CarPool object.
+ *         - 0xB2 to 0xB6: As in `load`.
+ *         - 0xB7: If the manifest is missing or invalid.
+ *         - 0xBF: If an unknown exception occurs while loading the car data.
+ */
+int CarPool::loadSegments(const std::string &dir, size_t threads) {
+	try {
+		std::ifstream manifest_file(dir + "manifest.json");
+		json manifest = json::parse(manifest_file, nullptr, false);
+		manifest_file.close();
+		if (manifest.is_discarded() || !manifest.is_object() || !manifest.contains("segments") ||
+			!manifest["segments"].is_number_unsigned() || manifest["segments"] == 0 ||
+			(manifest.contains("generation") && !manifest["generation"].is_number_unsigned())) {
+			MyLogger::log("carinfo-manager-logger",
+						  MyLogger::LOG_LEVEL::ERROR,
+						  "[CarPool Load Segments] \n- Directory: " + dir + "\n- Status: 0xB7");
+			return 0xB7;
+		}
+		size_t segment_count = manifest["segments"];
+		size_t generation = manifest.value("generation", size_t(0));
+		// the temporary files and the uncommitted or replaced generations of saves cut short by a crash
+		std::set<std::string> current;
+		for (size_t i = 0; i < segment_count; i++)
+			current.insert(std::filesystem::path(segment_path(dir, generation, i)).filename().string());
+		std::error_code ec;
+		for (const auto &entry : std::filesystem::directory_iterator(dir, ec)) {
+			std::string name = entry.path().filename().string();
+			bool stale_segment = name.rfind("segment-", 0) == 0 && entry.path().extension() == ".json" &&
+								 current.count(name) == 0;
+			if (entry.path().extension() == ".tmp" || stale_segment)
+				std::filesystem::remove(entry.path(), ec);
+		}
+
+		segments = 0;
+		if (clear() != 0) {
+			MyLogger::log("carinfo-manager-logger",
+						  MyLogger::LOG_LEVEL::ERROR,
+						  "[CarPool Load Segments] \n- Directory: " + dir + "\n- Status: 0xB1");
+			return 0xB1;
+		}
+		std::vector<std::string> texts(segment_count);
+		std::vector<ParallelLoader::Record> records;
+		std::vector<size_t> record_counts(segment_count, 0);
+		std::vector<bool> missing(segment_count, false);
+		for (size_t i = 0; i < segment_count; i++) {
+			std::ifstream segment_file(segment_path(dir, generation, i), std::ios::binary);
+			if (!segment_file.is_open()) {
+				missing[i] = true;
+				continue;
+			}
+			texts[i].assign(std::istreambuf_iterator<char>(segment_file), std::istreambuf_iterator<char>());
+			size_t before = records.size();
+			if (ParallelLoader::splitRecords(texts[i], records) != 0) {
+				MyLogger::log("carinfo-manager-logger",
+							  MyLogger::LOG_LEVEL::ERROR,
+							  "[CarPool Load Segments] \n- Segment: " + segment_path(dir, generation, i) +
+								  "\n- Status: 0xB6");
+				return 0xB6;
+			}
+			record_counts[i] = records.size() - before;
+		}
+		int status_code = load_records(records, threads);
+		if (status_code != 0) {
+			MyLogger::log("carinfo-manager-logger",
+						  MyLogger::LOG_LEVEL::ERROR,
+						  "[CarPool Load Segments] \n- Directory: " + dir + "\n- Status: " + std::to_string(status_code));
+			return status_code;
+		}
+
+		segments = segment_count;
+		disk_segments = segment_count;
+		disk_generation = generation;
+		manifest_dirty = false;
+		rebuild_segments();
+		dirty_segments.clear();
+		for (size_t i = 0; i < segment_count; i++) {
+			if (missing[i] || segment_ids[i].size() != record_counts[i])
+				dirty_segments.insert(i);
+		}
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[CarPool Load Segments] \n- Directory: " + dir + "\n- Segments: " + std::to_string(segments) + "\n- Dirty Segments: " + std::to_string(dirty_segments.size()) + "\n- Cars: " + std::to_string(sz) + "\n- Status: 0");
+		return 0;
+	}
+	catch (...) {
+		segments = 0;
+		clear();
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[CarPool Load Segments] \n- Directory: " + dir + "\n- Status: 0xBF");
+		return 0xBF;
+	}
+}
+
+/**
+ * @brief Saves the segments changed since the last save.
+ * 
+ * Every dirty segment is written in the format of car.json to a temporary file of its own, which then replaces the
+ * segment file, so a crash never leaves a half-written segment behind. A save after a single update rewrites one
+ * segment, about size() / segmentCount() cars, instead of the whole carpool.
+ * When the segment count changed, cars move between segments, so the whole layout is written as a new generation of
+ * segment files next to the old one. Once they are synced, the rename of the new manifest commits the generation, and
+ * only then are the files of the old generation removed: a crash leaves either the old or the new layout, and
+ * `loadSegments` removes the files of the other. Like the other changes of the carpool, a save must not run alongside
+ * a change: the caller serializes them.
+ * 
+ * @param dir The directory of the layout, ending with '/'. It is created if needed.
+ * @return Returns 0 if the segments are successfully saved, else an error code:
+ *         - 0xC1: If the carpool is not using the segmented layout (see `setSegments`).
+ *         - 0xC2: If a segment file or the manifest cannot be written, the segments not written stay dirty.
+ *         - 0xCF: If an unknown exception occurs during the saving process.
+ */
+int CarPool::saveSegments(const std::string &dir) {
+	Trace::Span span("CarPool::saveSegments");
+	if (segments == 0) {
+		MyLogger::log("carinfo-manager-logger",
+					  MyLogger::LOG_LEVEL::ERROR,
+					  "[CarPool Save Segments] \n- Directory: " + dir + "\n- Status: 0xC1");
+		return 0xC1;
+	}
+	try {
+		namespace fs = std::filesystem;
+		std::error_code ec;
+		fs::create_directories(dir, ec);
+		auto replace_file = [&](const std::string &path, const std::function<void(std::ostream &)> &write) {
+			std::string tmp_path = temp_path(path);
+			std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+			write(file);
+			file.close();
+			std::error_code rename_ec;
+			if (file)
+				fs::rename(tmp_path, path, rename_ec);
+			if (!file || rename_ec) {
+				fs::remove(tmp_path, rename_ec);
+				return false;
+			}
+			return true;
+		};
+
+		// a new segment count is written as a new generation, all of its segments being dirty
+		size_t generation = manifest_dirty ? disk_generation + 1 : disk_generation;
+		// the segments are taken clean before they are written, so that a change made meanwhile marks its segment
+		// dirty again instead of being lost; the segments not written are put back
+		std::set<size_t> pending;
+		pending.swap(dirty_segments);
+		size_t written = 0;
+		try {
+			for (auto it = pending.begin(); it != pending.end();) {
+				const std::set<std::string> &ids = segment_ids[*it];
+				bool ok = replace_file(segment_path(dir, generation, *it), [&](std::ostream &os) {
+					// same layout as save
+					std::string buffer;
+					write_cars(buffer, 4, &os, nullptr, 0, 0, [&](const CarVisitor &write) {
+						for (const std::string &id : ids)
+							write(carpool_byid.at(id));
+					});
+				});
+				if (!ok) {
+					MyLogger::log("carinfo-manager-logger",
+								  MyLogger::LOG_LEVEL::ERROR,
+								  "[CarPool Save Segments] \n- Segment: " + segment_path(dir, generation, *it) +
+									  "\n- Status: 0xC2");
+					dirty_segments.insert(pending.begin(), pending.end());
+					return 0xC2;
+				}
+				it = pending.erase(it);
+				written++;
+			}
+		}
+		catch (...) {
+			dirty_segments.insert(pending.begin(), pending.end());
+			throw;
+		}
+
+		if (manifest_dirty) {
+			// the new generation is on the disk before the manifest points to it
+			bool ok = true;
+			for (size_t i = 0; i < segments && ok; i++)
+				ok = ImageWriter::syncFile(segment_path(dir, generation, i));
+			ok = ok && ImageWriter::syncDirectory(dir) &&
+				 replace_file(dir + "manifest.json", [&](std::ostream &os) {
+					 os << json({{"segments", segments}, {"generation", generation}}).dump(4);
+				 }) &&
+				 ImageWriter::syncFile(dir + "manifest.json") && ImageWriter::syncDirectory(dir);
+			if (!ok) {
+				MyLogger::log("carinfo-manager-logger",
+							  MyLogger::LOG_LEVEL::ERROR,
+							  "[CarPool Save Segments] \n- Manifest: " + dir + "manifest.json\n- Status: 0xC2");
+				return 0xC2;
+			}
+			for (size_t i = 0; i < disk_segments; i++)
+				fs::remove(segment_path(dir, disk_generation, i), ec);
+			disk_segments = segments;
+			disk_generation = generation;
+			manifest_dirty = false;
+		}
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[CarPool Save Segments] \n- Directory: " + dir + "\n- Written Segments: " + std::to_string(written) + "\n- Status: 0");
+		return 0;
+	}
+	catch (...) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[CarPool Save Segments] \n- Directory: " + dir + "\n- Status: 0xCF");
+		return 0xCF;
+	}
+}
+
+/**
+ * @brief Moves the carpool onto a storage backend, so that only the pages held by the backend are in memory.
+ * 
+ * If the backend already holds a carpool, the cars in memory are dropped and the stored cars are used. Otherwise the
+ * cars in memory are written to the backend, which migrates a carpool loaded from car.json. From now on every
+ * operation reads and writes the backend; the segmented layout is not used.
+ * 
+ * @param backend The storage backend, opened.
+ * @return Returns 0 on success, else an error code:
+ *         - 0xE0: If the backend cannot be read or written.
+ *         - 0xE2: If a car in memory is too large for the backend, see carFits. Nothing is written and the carpool
+ *                 is left as it was.
+ *         - 0xEF: If an unknown exception occurs.
+ */
+int CarPool::attachStorage(std::unique_ptr<StorageBackend> backend) {
+	try {
+		setSegments(0);
+		std::string count;
+		if (backend->get(STORAGE_COUNT_KEY, count) == 0) {
+			clear();
+			storage = std::move(backend);
+			sz = std::stoull(count);
+		}
+		else {
+			std::vector<Car> cars = list();
+			for (const Car &car : cars) {
+				if (!carFits(car)) {
+					MyLogger::log("carinfo-manager-logger",
+								  MyLogger::LOG_LEVEL::ERROR,
+								  "[CarPool Attach Storage] \n- Car ID: " + car.getId() + "\n- Status: 0xE2");
+					return 0xE2;
+				}
+			}
+			clear();
+			storage = std::move(backend);
+			if (storage->put(STORAGE_COUNT_KEY, "0") != 0 ||
+				(!cars.empty() && addCars(std::move(cars)) != 0) || storage->flush() != 0) {
+				storage.reset();
+				clear();
+				MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[CarPool Attach Storage] \n- Status: 0xE0");
+				return 0xE0;
+			}
+		}
+		version++;
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[CarPool Attach Storage] \n- Cars: " + std::to_string(sz) + "\n- Status: 0");
+		return 0;
+	}
+	catch (...) {
+		storage.reset();
+		clear();
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[CarPool Attach Storage] \n- Status: 0xEF");
+		return 0xEF;
+	}
+}
+
+/**
+ * @brief Checks if the carpool is kept in a storage backend.
+ * 
+ * @return True if `attachStorage` succeeded, otherwise false.
+ */
+bool CarPool::hasStorage() const {
+	return bool(storage);
+}
+
+/**
+ * @brief Retrieves the version of the carpool.
+ * 
+ * The version changes after every change of the cars, so a query result computed at one version is still valid as
+ * long as the version is the same. It is read without locking and can be compared from other threads.
+ * 
+ * @return The number of changes since the carpool was created.
+ */
+uint64_t CarPool::getVersion() const {
+	return version.load();
+}
+
+/**
+ * @brief Caches the compact JSON of the cars written by `save`, `saveById` and `saveCar`.
+ * 
+ * A car is cached the first time it is written and dropped when it changes, so a response with cars written before is
+ * assembled from their cached JSON. Copies of the carpool, e.g. query results, do not share the cache.
+ * 
+ * @param capacityBytes The byte budget of the cache, 0 to cache nothing.
+ */
+void CarPool::setFragmentCache(size_t capacityBytes) {
+	if (capacityBytes == 0)
+		fragment_cache.reset();
+	else
+		fragment_cache = std::make_unique<FragmentCache>(capacityBytes);
+}
+
+/**
+ * @brief Retrieves the cache of the compact JSON of the cars, e.g. to report its statistics.
+ * 
+ * @return The cache, or nullptr if the JSON of the cars is not cached.
+ */
+const FragmentCache *CarPool::fragmentCache() const {
+	return fragment_cache.get();
+}
+
+/**
+ * @brief Drops the cached JSON of a changed car. Called after the version is bumped, see FragmentCache.
+ * 
+ * @param id The ID of the car, empty to drop the JSON of every car.
+ */
+void CarPool::forget_fragments(const std::string &id) {
+	if (!fragment_cache)
+		return;
+	if (id.empty())
+		fragment_cache->clear();
+	else
+		fragment_cache->invalidate(id);
+}
+
+/**
+ * @brief Makes every change to the storage backend durable.
+ * 
+ * @return Returns 0 on success, else an error code:
+ *         - 0xE0: If the backend cannot be written.
+ *         - 0xE1: If the carpool has no storage backend.
+ */
+int CarPool::flushStorage() {
+	Trace::Span span("CarPool::flushStorage");
+	if (!storage){
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[CarPool Flush Storage] \n- Status: 0xE1");
+		return 0xE1;}
+	if (storage->flush() != 0){
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[CarPool Flush Storage] \n- Status: 0xE0");
+		return 0xE0;}
+	return 0;
+}
+
+/**
+ * @brief Reads a car from the storage backend.
+ * 
+ * @param id The ID of the car.
+ * @param car Filled with the car if it exists.
+ * @return True if the car exists.
+ */
+bool CarPool::storage_find(const std::string &id, Car &car) const {
+	std::string value;
+	if (storage->get(storage_key('i', "", id), value) != 0)
+		return false;
+	return parse_car(json::parse(value), car) == 0;
+}
+
+/**
+ * @brief Writes a new car and its index entries to the storage backend.
+ * 
+ * @param car The car, whose ID must not be stored yet.
+ * @return True on success.
+ */
+bool CarPool::storage_add(const Car &car) {
+	const std::string &id = car.getId();
+	if (storage->put(storage_key('i', "", id), storage_record(car)) != 0 ||
+		storage->put(storage_key('c', car.getColor(), id), "") != 0 ||
+		storage->put(storage_key('o', car.getOwner(), id), "") != 0 ||
+		storage->put(storage_key('t', car.getType(), id), "") != 0 ||
+		storage->put(storage_key('m', car.getImagePath(), id), "") != 0)
+		return false;
+	sz++;
+	return storage->put(STORAGE_COUNT_KEY, std::to_string(sz)) == 0;
+}
+
+/**
+ * @brief Removes a car and its index entries from the storage backend.
+ * 
+ * @param car The stored car.
+ * @return True on success.
+ */
+bool CarPool::storage_remove(const Car &car) {
+	const std::string &id = car.getId();
+	if (storage->erase(storage_key('i', "", id)) != 0 ||
+		storage->erase(storage_key('c', car.getColor(), id)) != 0 ||
+		storage->erase(storage_key('o', car.getOwner(), id)) != 0 ||
+		storage->erase(storage_key('t', car.getType(), id)) != 0 ||
+		storage->erase(storage_key('m', car.getImagePath(), id)) != 0)
+		return false;
+	sz--;
+	return storage->put(STORAGE_COUNT_KEY, std::to_string(sz)) == 0;
+}
+
+/**
+ * @brief Rewrites a stored car whose ID is unchanged, moving only the index entries whose field changed.
+ * 
+ * @param car The stored car.
+ * @param patched The new fields of the car, with the same ID.
+ * @return True on success.
+ */
+bool CarPool::storage_patch(const Car &car, const Car &patched) {
+	const std::string &id = car.getId();
+	if (storage->put(storage_key('i', "", id), storage_record(patched)) != 0)
+		return false;
+	auto move_entry = [&](char tag, const std::string &field, const std::string &new_field) {
+		return field == new_field || (storage->erase(storage_key(tag, field, id)) == 0 &&
+									  storage->put(storage_key(tag, new_field, id), "") == 0);
+	};
+	return move_entry('c', car.getColor(), patched.getColor()) &&
+		   move_entry('o', car.getOwner(), patched.getOwner()) &&
+		   move_entry('t', car.getType(), patched.getType()) &&
+		   move_entry('m', car.getImagePath(), patched.getImagePath());
+}
+
+/**
+ * @brief Adds the cars of an index of the storage backend to a carpool.
+ * 
+ * @param prefix The scan prefix of the index entries, as built by storage_key with an empty ID.
+ * @param result The carpool to add the cars to.
+ */
+void CarPool::storage_query(const std::string &prefix, CarPool &result) const {
+	std::vector<std::string> ids;
+	storage->scan(prefix, [&](const std::string &key, const std::string &) {
+		ids.push_back(key.substr(prefix.size()));
+		return true;
+	});
+	for (const std::string &id : ids) {
+		Car car;
+		if (storage_find(id, car))
+			result.add_car(car);
+	}
+}
+
+/**
+ * @brief Tells whether a car fits in one entry of car.btree.
+ * 
+ * The record of the car, with its key, must not be larger than BTreeStorage::MAX_ENTRY_SIZE; the index entries are
+ * always smaller. addCar, updateCar and patchCar enforce this for every backend.
+ * 
+ * @param car The car.
+ * @return true if the car fits.
+ */
+bool CarPool::carFits(const Car &car) {
+	return storage_key('i', "", car.getId()).size() + storage_record(car).size() <= BTreeStorage::MAX_ENTRY_SIZE;
+}
+
 /**
  * Retrieves a list of cars in the carpool.
  *
@@ -615,12 +1985,48 @@ int CarPool::save(std::ostream &os) const {
  */
 std::vector<Car> CarPool::list() const {
 	std::vector<Car> cars;
-	for (auto it = carpool_byid.begin(); it != carpool_byid.end(); it++)
-		cars.push_back(it->second);
+	forEachCar([&cars](const Car &car) { cars.push_back(car); });
 	MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[CarPool List] \n- Status: 0");
 	return cars;
 }
 
+/**
+ * Calls a function for every car in the carpool, in order of ID, without copying the cars.
+ *
+ * @param fn The function to call.
+ */
+void CarPool::forEachCar(const std::function<void(const Car &)> &fn) const {
+	if (storage) {
+		storage->scan(storage_key('i', "", ""), [&fn](const std::string &, const std::string &value) {
+			Car car;
+			if (parse_car(json::parse(value), car) == 0)
+				fn(car);
+			return true;
+		});
+		return;
+	}
+	for (auto it = carpool_byid.begin(); it != carpool_byid.end(); it++)
+		fn(it->second);
+}
+
+/**
+ * @brief Builds a car from the text of its JSON record, as found in car.json.
+ * 
+ * @param record The text of the JSON record.
+ * @param car The car to fill.
+ * @return Returns 0 on success, else an error code:
+ *         - 0xB2: If the record is not a JSON object.
+ *         - 0xB3: If the record does not contain the required fields.
+ *         - 0xB4: If the record contains fields with incorrect types.
+ *         - 0xB6: If the record is not well-formed JSON.
+ */
+int CarPool::parseCar(const std::string &record, Car &car) {
+	json obj = json::parse(record, nullptr, false);
+	if (obj.is_discarded())
+		return 0xB6;
+	return parse_car(obj, car);
+}
+
 /**
  * @brief Compares two CarPool objects for equality.
  * 
@@ -658,10 +2064,27 @@ bool CarPool::operator!=(const CarPool &cp) const {
  * @return True if the size of the carpool is less than the size of the carpool in the provided CarPool object, otherwise false.
  */
 CarPool &CarPool::operator=(const CarPool &cp) {
+	if (this == &cp)
+		return *this;
+	if (storage) {
+		clear();
+		cp.forEachCar([this](const Car &car) { storage_add(car); });
+		version++;
+		forget_fragments();
+		return *this;
+	}
 	sz = cp.sz;
 	carpool_byid = cp.carpool_byid;
 	carpool_bycolor = cp.carpool_bycolor;
 	carpool_bytype = cp.carpool_bytype;
 	carpool_byowner = cp.carpool_byowner;
+	{
+		std::scoped_lock lock(img_mutex, cp.img_mutex);
+		img_refcount = cp.img_refcount;
+	}
+	if (segments != 0)
+		rebuild_segments();
+	version++;
+	forget_fragments();
 	return *this;
 }
@@ -0,0 +1,179 @@
+/**
+ * @file src/FragmentCache.cpp
+ * @brief Implementation of class FragmentCache
+ *
+ * @details
+ * This file contains the implementation of the FragmentCache class.
+ * The cache is a list ordered by recency plus a hash map from car ID to list node, like the ImageCache. Fragments are
+ * handed out as shared buffers, so a response can copy one after the lock is released, even if it is evicted meanwhile.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#include "carinfo-manager/fragmentcache.hpp"
+
+/**
+ * @brief Constructs a new FragmentCache object.
+ *
+ * @param capacityBytes The byte budget of the cached fragments, see `byteCount`.
+ */
+FragmentCache::FragmentCache(size_t capacityBytes)
+	: capacity(capacityBytes), bytes(0), gen(0), hits(0), misses(0), evictions(0) {}
+
+/**
+ * @brief Destroys the FragmentCache object.
+ */
+FragmentCache::~FragmentCache() {}
+
+/**
+ * @brief Retrieves the JSON of a car.
+ *
+ * @param id The ID of the car.
+ * @return The compact JSON of the car, or nullptr if it is not cached.
+ */
+std::shared_ptr<const std::string> FragmentCache::get(const std::string &id) {
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		auto it = entries.find(id);
+		if (it != entries.end()) {
+			lru.splice(lru.begin(), lru, it->second);
+			hits++;
+			return it->second->fragment;
+		}
+	}
+	misses++;
+	return nullptr;
+}
+
+/**
+ * @brief Retrieves the generation of the cache, to pass to `put`.
+ *
+ * @return The number of invalidations since the cache was created.
+ */
+uint64_t FragmentCache::generation() const {
+	std::lock_guard<std::mutex> lock(mtx);
+	return gen;
+}
+
+/**
+ * @brief Caches the JSON of a car, evicting the least recently used fragments beyond the budget.
+ *
+ * @param id The ID of the car.
+ * @param fragment The compact JSON of the car.
+ * @param generation The generation taken before the car was read. If a car was invalidated since, nothing is cached.
+ */
+void FragmentCache::put(const std::string &id, std::shared_ptr<const std::string> fragment, uint64_t generation) {
+	std::lock_guard<std::mutex> lock(mtx);
+	if (generation != gen || entries.find(id) != entries.end())
+		return;
+	lru.push_front(Entry{id, std::move(fragment)});
+	size_t entry_bytes = charge(lru.front());
+	if (entry_bytes > capacity) {
+		lru.pop_front();
+		return;
+	}
+	entries[id] = lru.begin();
+	bytes += entry_bytes;
+	while (bytes > capacity) {
+		bytes -= charge(lru.back());
+		entries.erase(lru.back().id);
+		lru.pop_back();
+		evictions++;
+	}
+}
+
+/**
+ * @brief Tells whether a response should use the cache. A response larger than a fraction of the budget would evict
+ * the cars of the other responses before its own are asked for again, and would mostly miss.
+ *
+ * @param cars The number of cars of the response.
+ * @return true if the response should be written with the cache, false otherwise.
+ */
+bool FragmentCache::accepts(size_t cars) const {
+	return cars <= capacity / (MAX_RESULT_FRACTION * ENTRY_OVERHEAD);
+}
+
+/**
+ * @brief Drops the JSON of a car, e.g. when the car changes or is removed.
+ *
+ * @param id The ID of the car.
+ */
+void FragmentCache::invalidate(const std::string &id) {
+	std::lock_guard<std::mutex> lock(mtx);
+	gen++;
+	auto it = entries.find(id);
+	if (it == entries.end())
+		return;
+	bytes -= charge(*it->second);
+	lru.erase(it->second);
+	entries.erase(it);
+}
+
+/**
+ * @brief Drops the JSON of every car, e.g. when the cars are reloaded.
+ */
+void FragmentCache::clear() {
+	std::lock_guard<std::mutex> lock(mtx);
+	gen++;
+	entries.clear();
+	lru.clear();
+	bytes = 0;
+}
+
+/**
+ * @brief Retrieves the number of cars served from the cache.
+ *
+ * @return The number of hits since the cache was created.
+ */
+size_t FragmentCache::hitCount() const {
+	return hits.load();
+}
+
+/**
+ * @brief Retrieves the number of cars that had to be serialized.
+ *
+ * @return The number of misses since the cache was created.
+ */
+size_t FragmentCache::missCount() const {
+	return misses.load();
+}
+
+/**
+ * @brief Retrieves the number of fragments evicted to stay within the budget.
+ *
+ * @return The number of evictions since the cache was created.
+ */
+size_t FragmentCache::evictionCount() const {
+	return evictions.load();
+}
+
+/**
+ * @brief Retrieves the memory held by the cache: the IDs and JSON of the cached cars, and ENTRY_OVERHEAD per car.
+ *
+ * @return The number of bytes held by the cache.
+ */
+size_t FragmentCache::byteCount() const {
+	std::lock_guard<std::mutex> lock(mtx);
+	return bytes;
+}
+
+/**
+ * @brief Retrieves the number of cached cars.
+ *
+ * @return The number of entries of the cache.
+ */
+size_t FragmentCache::entryCount() const {
+	std::lock_guard<std::mutex> lock(mtx);
+	return entries.size();
+}
+
+/**
+ * @brief Computes the bytes an entry is charged against the budget. The ID is stored twice, in the list and the map.
+ *
+ * @param entry The entry.
+ * @return The bytes of the entry.
+ */
+size_t FragmentCache::charge(const Entry &entry) {
+	return 2 * entry.id.size() + entry.fragment->size() + ENTRY_OVERHEAD;
+}
@@ -12,6 +12,7 @@
  */
 
 #include "carinfo-manager/hash.hpp"
+#include <algorithm>
 #include <iomanip>
 #include <sstream>
 #include <vector>
@@ -154,15 +155,38 @@ void Hash::sha256() {
 	hash = ss.str();
 }
 
-Hash::Hash() : data(""), salt(""), hash("") {}
+/**
+ * Resets the incremental hashing to the initial SHA-256 state.
+ */
+void Hash::reset_state() {
+	const uint32_t initial[8] = {0x6a09e667,
+								 0xbb67ae85,
+								 0x3c6ef372,
+								 0xa54ff53a,
+								 0x510e527f,
+								 0x9b05688c,
+								 0x1f83d9ab,
+								 0x5be0cd19};
+	memcpy(state, initial, sizeof(state));
+	buffered = 0;
+	total = 0;
+}
+
+Hash::Hash() : data(""), salt(""), hash("") {
+	reset_state();
+}
 
 Hash::Hash(std::string data, std::string salt)
 	: data(data), salt(salt), hash("") {
+	reset_state();
 	sha256();
 }
 
 Hash::Hash(const Hash &hashObj)
-	: data(hashObj.data), salt(hashObj.salt), hash(hashObj.hash) {}
+	: data(hashObj.data), salt(hashObj.salt), hash(hashObj.hash), buffered(hashObj.buffered), total(hashObj.total) {
+	memcpy(state, hashObj.state, sizeof(state));
+	memcpy(buffer, hashObj.buffer, sizeof(buffer));
+}
 
 Hash::~Hash() {}
 
@@ -202,3 +226,58 @@ void Hash::setSalt(std::string salt) {
 std::string Hash::getHash() {
 	return hash;
 }
+
+/**
+ * @brief Feeds bytes to the incremental hashing.
+ * 
+ * The bytes are hashed block by block as they arrive, so a stream of any size is hashed with 64 bytes of buffer.
+ * The incremental hashing does not use the data and salt of the object.
+ * 
+ * @param bytes The bytes to be hashed.
+ * @param length The number of bytes.
+ */
+void Hash::update(const char *bytes, size_t length) {
+	total += length;
+	while (length > 0) {
+		size_t n = std::min(length, sizeof(buffer) - buffered);
+		memcpy(buffer + buffered, bytes, n);
+		buffered += n;
+		bytes += n;
+		length -= n;
+		if (buffered == sizeof(buffer)) {
+			compress_block(state, buffer);
+			buffered = 0;
+		}
+	}
+}
+
+/**
+ * @brief Finishes the incremental hashing.
+ * 
+ * Pads the bytes fed by `update` as SHA-256 requires, then resets the incremental hashing so that the object can
+ * hash another stream. Unlike `getHash`, the padding is correct for every length, so the digest always equals the
+ * standard SHA-256 of the bytes.
+ * 
+ * @return The SHA-256 of the bytes fed since the last call, in hex.
+ */
+std::string Hash::finish() {
+	uint64_t bit_length = total * 8;
+	buffer[buffered++] = 0x80;
+	if (buffered > sizeof(buffer) - 8) {
+		memset(buffer + buffered, 0, sizeof(buffer) - buffered);
+		compress_block(state, buffer);
+		buffered = 0;
+	}
+	memset(buffer + buffered, 0, sizeof(buffer) - 8 - buffered);
+	for (int i = 0; i < 8; i++)
+		buffer[sizeof(buffer) - 8 + i] = static_cast<uint8_t>(bit_length >> (56 - 8 * i));
+	compress_block(state, buffer);
+
+	// formatted by hand, a stringstream costs as much as hashing a short message
+	static const char digits[] = "0123456789abcdef";
+	std::string digest(64, '0');
+	for (size_t i = 0; i < 64; ++i)
+		digest[i] = digits[(state[i / 8] >> (28 - 4 * (i % 8))) & 0x0F];
+	reset_state();
+	return digest;
+}
@@ -0,0 +1,144 @@
+/**
+ * @file src/ImageCache.cpp
+ * @brief Implementation of class ImageCache
+ *
+ * @details
+ * This file contains the implementation of the ImageCache class.
+ * The cache is a list ordered by recency plus a hash map from path to list node. Files are read without holding the
+ * lock, so a slow disk read does not block the hits of other threads; if two threads miss on the same image, both
+ * read it and the first one to finish inserts it.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#include "carinfo-manager/imagecache.hpp"
+#include <fstream>
+#include "carinfo-manager/log.hpp"
+
+/**
+ * @brief Constructs a new ImageCache object.
+ *
+ * @param capacityBytes The byte budget of the cached images, 0 to disable caching.
+ */
+ImageCache::ImageCache(size_t capacityBytes)
+	: capacity(capacityBytes), bytes(0), hits(0), misses(0), evictions(0) {}
+
+/**
+ * @brief Destroys the ImageCache object.
+ */
+ImageCache::~ImageCache() {}
+
+/**
+ * @brief Retrieves the bytes of an image file, from the cache if possible.
+ *
+ * @param img_path The path of the image file.
+ * @return The bytes of the image, or nullptr if the file cannot be read.
+ */
+std::shared_ptr<const std::string> ImageCache::get(const std::string &img_path) {
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		auto it = entries.find(img_path);
+		if (it != entries.end()) {
+			lru.splice(lru.begin(), lru, it->second);
+			hits++;
+			return it->second->img;
+		}
+	}
+	misses++;
+
+	std::ifstream is(img_path, std::ios::binary);
+	if (!is.is_open())
+		return nullptr;
+	auto img = std::make_shared<const std::string>(std::istreambuf_iterator<char>(is),
+												   std::istreambuf_iterator<char>());
+	if (!accepts(img->size()))
+		return img;
+
+	std::lock_guard<std::mutex> lock(mtx);
+	if (entries.find(img_path) != entries.end())
+		return img;
+	lru.push_front(Entry{img_path, img});
+	entries[img_path] = lru.begin();
+	bytes += img->size();
+	while (bytes > capacity) {
+		bytes -= lru.back().img->size();
+		entries.erase(lru.back().path);
+		lru.pop_back();
+		evictions++;
+	}
+	return img;
+}
+
+/**
+ * @brief Tells whether an image would be cached. Larger images are better streamed from the file.
+ *
+ * @param img_size The size of the image in bytes.
+ * @return true if an image of this size is kept in the cache, false otherwise.
+ */
+bool ImageCache::accepts(size_t img_size) const {
+	return img_size <= capacity / MAX_ENTRY_FRACTION;
+}
+
+/**
+ * @brief Drops an image from the cache. Responses still sending it keep their buffer.
+ *
+ * @param img_path The path of the image file.
+ */
+void ImageCache::invalidate(const std::string &img_path) {
+	std::lock_guard<std::mutex> lock(mtx);
+	auto it = entries.find(img_path);
+	if (it == entries.end())
+		return;
+	bytes -= it->second->img->size();
+	lru.erase(it->second);
+	entries.erase(it);
+	MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[ImageCache Invalidate] \n- Image Path: " + img_path);
+}
+
+/**
+ * @brief Retrieves the number of requests served from the cache.
+ *
+ * @return The number of hits since the cache was created.
+ */
+size_t ImageCache::hitCount() const {
+	return hits.load();
+}
+
+/**
+ * @brief Retrieves the number of requests that had to read the file.
+ *
+ * @return The number of misses since the cache was created.
+ */
+size_t ImageCache::missCount() const {
+	return misses.load();
+}
+
+/**
+ * @brief Retrieves the number of images evicted to stay within the budget.
+ *
+ * @return The number of evictions since the cache was created.
+ */
+size_t ImageCache::evictionCount() const {
+	return evictions.load();
+}
+
+/**
+ * @brief Retrieves the total size of the cached images.
+ *
+ * @return The number of bytes held by the cache.
+ */
+size_t ImageCache::byteCount() const {
+	std::lock_guard<std::mutex> lock(mtx);
+	return bytes;
+}
+
+/**
+ * @brief Retrieves the number of cached images.
+ *
+ * @return The number of entries of the cache.
+ */
+size_t ImageCache::entryCount() const {
+	std::lock_guard<std::mutex> lock(mtx);
+	return entries.size();
+}
@@ -0,0 +1,686 @@
+/**
+ * @file src/ImagePack.cpp
+ * @brief Implementation of class ImagePack
+ *
+ * @details
+ * This file contains the implementation of the ImagePack class.
+ * A segment is the file `packDir + "segment-<n>.pack"`, a sequence of records, each a 24-byte header (magic, name
+ * length, image length and modification time, little-endian) followed by the image name and the image bytes. When the
+ * pack is opened the segments are read in order, so the record written last wins when an image was copied by a
+ * compaction, and a torn record at the end of a segment is cut off.
+ * Appends are serialised by `append_mtx` and reach the page cache before the image is published in the index, so a
+ * mapping made afterwards sees them. Reads only take `mtx`. A compaction copies the live images of a segment with the
+ * same appends, flushes the pack to the disk, then removes the segment file; responses still sending one of its images
+ * keep their mapping of the removed file.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#include "carinfo-manager/imagepack.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+#include "carinfo-manager/imagewriter.hpp"
+#include "carinfo-manager/log.hpp"
+
+namespace {
+
+const char MAGIC[4] = {'C', 'M', 'I', 'P'};
+const size_t HEADER_SIZE = 24;
+const size_t MAX_NAME_SIZE = 255;
+const size_t COPY_CHUNK_BYTES = 256 << 10;
+
+void put_u32(char *buf, size_t &pos, uint32_t v) {
+	for (int i = 0; i < 4; i++)
+		buf[pos++] = char((v >> (8 * i)) & 0xFF);
+}
+
+void put_u64(char *buf, size_t &pos, uint64_t v) {
+	for (int i = 0; i < 8; i++)
+		buf[pos++] = char((v >> (8 * i)) & 0xFF);
+}
+
+uint32_t get_u32(const char *buf, size_t &pos) {
+	uint32_t v = 0;
+	for (int i = 0; i < 4; i++)
+		v |= uint32_t(uint8_t(buf[pos++])) << (8 * i);
+	return v;
+}
+
+uint64_t get_u64(const char *buf, size_t &pos) {
+	uint64_t v = 0;
+	for (int i = 0; i < 8; i++)
+		v |= uint64_t(uint8_t(buf[pos++])) << (8 * i);
+	return v;
+}
+
+int64_t now_seconds() {
+	return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch())
+		.count();
+}
+
+}  // namespace
+
+/**
+ * @brief Constructs a new ImagePack object. The pack is empty until `open` is called.
+ *
+ * @param carpool The CarPool holding the image references.
+ * @param packDir The directory of the segment files, ending with '/'.
+ * @param segmentBytes The size at which a new segment is started.
+ * @param deadPercent The share of unreferenced bytes, in percent, above which a segment is compacted.
+ * @param passInterval The sleep between two compaction passes.
+ */
+ImagePack::ImagePack(const CarPool &carpool,
+					 const std::string &packDir,
+					 uint64_t segmentBytes,
+					 size_t deadPercent,
+					 std::chrono::milliseconds passInterval)
+	: carpool(carpool),
+	  packDir(packDir),
+	  segmentBytes(segmentBytes),
+	  deadPercent(deadPercent),
+	  passInterval(passInterval),
+	  active(1),
+	  active_size(0),
+	  stopping(false),
+	  compactions(0),
+	  reclaimed(0) {}
+
+/**
+ * @brief Destroys the ImagePack object, stopping the background thread.
+ */
+ImagePack::~ImagePack() {
+	stop();
+}
+
+/**
+ * @brief Builds the path of a segment file.
+ *
+ * @param segment The number of the segment.
+ * @return The path of the segment file.
+ */
+std::string ImagePack::segment_path(uint32_t segment) const {
+	std::string number = std::to_string(segment);
+	return packDir + "segment-" + std::string(number.size() < 8 ? 8 - number.size() : 0, '0') + number + ".pack";
+}
+
+/**
+ * @brief Extracts the image name from the path of an image of the pack.
+ *
+ * @param img_path The path of the image.
+ * @return The image name, or an empty string if the path is not in the pack.
+ */
+std::string ImagePack::name_of(const std::string &img_path) const {
+	if (img_path.size() <= packDir.size() || img_path.compare(0, packDir.size(), packDir) != 0 ||
+		img_path.find('/', packDir.size()) != std::string::npos ||
+		img_path.size() - packDir.size() > MAX_NAME_SIZE)
+		return "";
+	return img_path.substr(packDir.size());
+}
+
+/**
+ * @brief Reads the records of a segment into the index, cutting off a torn record at its end.
+ *
+ * @param segment The number of the segment.
+ * @return true if the segment was read, false if it cannot be opened.
+ */
+bool ImagePack::load_segment(uint32_t segment) {
+	namespace fs = std::filesystem;
+	std::string path = segment_path(segment);
+	std::error_code ec;
+	uint64_t file_size = fs::file_size(path, ec);
+	std::ifstream in(path, std::ios::binary);
+	if (ec || !in.is_open())
+		return false;
+	uint64_t pos = 0;
+	char header[HEADER_SIZE];
+	std::string name;
+	while (pos + HEADER_SIZE <= file_size) {
+		in.seekg(std::streamoff(pos));
+		if (!in.read(header, HEADER_SIZE) || std::memcmp(header, MAGIC, 4) != 0)
+			break;
+		size_t field = 4;
+		uint32_t name_size = get_u32(header, field);
+		uint64_t length = get_u64(header, field);
+		int64_t mtime = int64_t(get_u64(header, field));
+		if (name_size == 0 || name_size > MAX_NAME_SIZE || length > file_size ||
+			pos + HEADER_SIZE + name_size + length > file_size)
+			break;
+		name.resize(name_size);
+		if (!in.read(name.data(), name_size))
+			break;
+		index[name] = Entry{segment, pos + HEADER_SIZE + name_size, length, mtime};
+		pos += HEADER_SIZE + name_size + length;
+	}
+	if (pos < file_size) {
+		in.close();
+		fs::resize_file(path, pos, ec);
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::WARN, "[ImagePack Load] \n- Segment: " + path + "\n- Torn bytes cut off: " + std::to_string(file_size - pos));
+	}
+	segments[segment].size = pos;
+	return true;
+}
+
+/**
+ * @brief Makes a segment the one appended to, creating its file if needed. The caller holds `append_mtx`.
+ *
+ * @param segment The number of the segment.
+ * @return true if the segment file is open, false otherwise.
+ */
+bool ImagePack::open_active(uint32_t segment) {
+	out.close();
+	out.clear();
+	out.open(segment_path(segment), std::ios::binary | std::ios::app);
+	active = segment;
+	std::lock_guard<std::mutex> lock(mtx);
+	active_size = segments[segment].size;
+	return out.is_open();
+}
+
+/**
+ * @brief Opens the pack: reads the segment files into the index and opens the last one for appends.
+ *
+ * @return Returns 0 on success, else an error code:
+ *         - 0xF3: If the pack directory or a segment file cannot be opened.
+ *         - 0xFF: If an unknown exception occurs.
+ */
+int ImagePack::open() {
+	namespace fs = std::filesystem;
+	try {
+		std::lock_guard<std::mutex> append_lock(append_mtx);
+		std::error_code ec;
+		fs::create_directories(packDir, ec);
+		std::vector<uint32_t> found;
+		for (fs::directory_iterator it(packDir, ec), end; !ec && it != end; it.increment(ec)) {
+			std::string file_name = it->path().filename().string();
+			uint32_t segment = 0;
+			auto parsed = std::from_chars(file_name.data() + std::min<size_t>(8, file_name.size()),
+										  file_name.data() + file_name.size(),
+										  segment);
+			if (parsed.ec == std::errc() && segment != 0 && packDir + file_name == segment_path(segment))
+				found.push_back(segment);
+		}
+		bool opened = !ec;
+		std::sort(found.begin(), found.end());
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			for (size_t i = 0; opened && i < found.size(); i++)
+				opened = load_segment(found[i]);
+		}
+		if (opened)
+			opened = open_active(found.empty() ? 1 : found.back());
+		if (!opened) {
+			MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[ImagePack Open] \n- Pack Dir: " + packDir + "\n- Status: 0xF3");
+			return 0xF3;
+		}
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::INFO, "[ImagePack Open] \n- Pack Dir: " + packDir + "\n- Segments: " + std::to_string(found.size()) + "\n- Images: " + std::to_string(imageCount()) + "\n- Status: 0");
+		return 0;
+	}
+	catch (...) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[ImagePack Open] \n- Pack Dir: " + packDir + "\n- Status: 0xFF");
+		return 0xFF;
+	}
+}
+
+/**
+ * @brief Starts the compaction thread. Does nothing if it is already running.
+ */
+void ImagePack::start() {
+	std::lock_guard<std::mutex> lock(worker_mtx);
+	if (worker.joinable())
+		return;
+	stopping = false;
+	worker = std::thread(&ImagePack::run, this);
+}
+
+/**
+ * @brief Stops the compaction thread and waits for it to exit.
+ */
+void ImagePack::stop() {
+	{
+		std::lock_guard<std::mutex> lock(worker_mtx);
+		stopping = true;
+	}
+	cv.notify_all();
+	if (worker.joinable())
+		worker.join();
+}
+
+/**
+ * @brief Builds the path of an image of the pack.
+ *
+ * @param name The name of the image, e.g. "<sha256>.jpg".
+ * @return The path held by the cars.
+ */
+std::string ImagePack::pathOf(const std::string &name) const {
+	return packDir + name;
+}
+
+/**
+ * @brief Tells whether a path names an image of the pack, stored or not.
+ *
+ * @param img_path The path of the image.
+ * @return true if the path is in the pack directory, false otherwise.
+ */
+bool ImagePack::owns(const std::string &img_path) const {
+	return !name_of(img_path).empty();
+}
+
+/**
+ * @brief Refreshes the modification time of a stored image, which also tells whether it is stored.
+ *
+ * @param img_path The path of the image.
+ * @param img_size The size of the image in bytes.
+ * @return true if an image of this size is stored at the path, false otherwise.
+ */
+bool ImagePack::touch(const std::string &img_path, size_t img_size) {
+	std::string name = name_of(img_path);
+	std::lock_guard<std::mutex> lock(mtx);
+	auto it = index.find(name);
+	if (it == index.end() || it->second.length != img_size)
+		return false;
+	it->second.mtime = now_seconds();
+	return true;
+}
+
+/**
+ * @brief Appends a record to the active segment, starting a new segment when it is full. The caller holds
+ * `append_mtx`.
+ *
+ * A record that cannot be written completely is cut off again, so the segment never holds a torn record in its middle.
+ *
+ * @param name The name of the image.
+ * @param mtime The modification time recorded for the image.
+ * @param write_bytes Writes the image bytes to the segment.
+ * @param length The number of bytes write_bytes writes.
+ * @param sync Whether to flush the segment to the disk.
+ * @param entry Set to the location of the image.
+ * @return true if the record was written, false otherwise.
+ */
+bool ImagePack::append_record(const std::string &name,
+							  int64_t mtime,
+							  const std::function<bool(std::ofstream &)> &write_bytes,
+							  uint64_t length,
+							  bool sync,
+							  Entry &entry) {
+	uint64_t record_size = HEADER_SIZE + name.size() + length;
+	bool new_segment = false;
+	if (active_size != 0 && active_size + record_size > segmentBytes) {
+		if (!open_active(active + 1))
+			return false;
+		new_segment = true;
+	}
+	char header[HEADER_SIZE];
+	std::memcpy(header, MAGIC, 4);
+	size_t pos = 4;
+	put_u32(header, pos, uint32_t(name.size()));
+	put_u64(header, pos, length);
+	put_u64(header, pos, uint64_t(mtime));
+	out.write(header, HEADER_SIZE);
+	out.write(name.data(), name.size());
+	bool written = out && write_bytes(out) && out.flush();
+	if (written && sync)
+		written = ImageWriter::syncFile(segment_path(active)) && (!new_segment || ImageWriter::syncDirectory(packDir));
+	if (!written) {
+		std::error_code ec;
+		out.close();
+		out.clear();
+		std::filesystem::resize_file(segment_path(active), active_size, ec);
+		out.open(segment_path(active), std::ios::binary | std::ios::app);
+		return false;
+	}
+	entry = Entry{active, active_size + HEADER_SIZE + name.size(), length, mtime};
+	active_size += record_size;
+	std::lock_guard<std::mutex> lock(mtx);
+	segments[active].size = active_size;
+	return true;
+}
+
+/**
+ * @brief Stores an image, unless it is already stored, and publishes it in the index.
+ *
+ * @param img_path The path of the image.
+ * @param write_bytes Writes the image bytes to the segment.
+ * @param length The number of bytes write_bytes writes.
+ * @param sync Whether to flush the segment to the disk before returning.
+ * @return Returns 0 on success, else an error code:
+ *         - 0xF2: If the path is not in the pack or the image cannot be appended.
+ */
+int ImagePack::store(const std::string &img_path,
+					 const std::function<bool(std::ofstream &)> &write_bytes,
+					 uint64_t length,
+					 bool sync) {
+	std::string name = name_of(img_path);
+	std::lock_guard<std::mutex> append_lock(append_mtx);
+	// a concurrent commit of the same bytes may have stored it first
+	if (!name.empty() && touch(img_path, length))
+		return 0;
+	Entry entry;
+	if (name.empty() || !append_record(name, now_seconds(), write_bytes, length, sync, entry)) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[ImagePack Append] \n- Image Path: " + img_path + "\n- Status: 0xF2");
+		return 0xF2;
+	}
+	std::lock_guard<std::mutex> lock(mtx);
+	index[name] = entry;
+	return 0;
+}
+
+/**
+ * @brief Stores an image from memory, unless it is already stored.
+ *
+ * @param img_path The path of the image, see `pathOf`.
+ * @param bytes The bytes of the image.
+ * @param size The number of bytes.
+ * @param sync Whether to flush the segment to the disk before returning.
+ * @return Returns 0 on success, else an error code:
+ *         - 0xF2: If the path is not in the pack or the image cannot be appended.
+ *         - 0xFF: If an unknown exception occurs.
+ */
+int ImagePack::append(const std::string &img_path, const char *bytes, size_t size, bool sync) {
+	try {
+		return store(
+			img_path, [bytes, size](std::ofstream &os) { return bool(os.write(bytes, size)); }, size, sync);
+	}
+	catch (...) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[ImagePack Append] \n- Image Path: " + img_path + "\n- Status: 0xFF");
+		return 0xFF;
+	}
+}
+
+/**
+ * @brief Stores an image from a file, unless it is already stored. The file is copied a chunk at a time.
+ *
+ * @param img_path The path of the image, see `pathOf`.
+ * @param file_path The path of the file holding the image.
+ * @param size The size of the file.
+ * @param sync Whether to flush the segment to the disk before returning.
+ * @return Returns 0 on success, else an error code:
+ *         - 0xF2: If the path is not in the pack, or the file cannot be read or appended.
+ *         - 0xFF: If an unknown exception occurs.
+ */
+int ImagePack::appendFile(const std::string &img_path, const std::string &file_path, size_t size, bool sync) {
+	try {
+		auto copy = [&file_path, size](std::ofstream &os) {
+			std::ifstream in(file_path, std::ios::binary);
+			std::vector<char> chunk(std::min(size, COPY_CHUNK_BYTES));
+			size_t left = size;
+			while (left != 0 && in && os) {
+				size_t part = std::min(left, chunk.size());
+				if (!in.read(chunk.data(), part))
+					return false;
+				os.write(chunk.data(), part);
+				left -= part;
+			}
+			return left == 0 && bool(os);
+		};
+		return store(img_path, copy, size, sync);
+	}
+	catch (...) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[ImagePack Append] \n- Image Path: " + img_path + "\n- Status: 0xFF");
+		return 0xFF;
+	}
+}
+
+/**
+ * @brief Flushes the images appended so far to the disk.
+ *
+ * @return Returns 0 on success, else an error code:
+ *         - 0xF2: If the active segment cannot be flushed.
+ */
+int ImagePack::flush() {
+	std::lock_guard<std::mutex> append_lock(append_mtx);
+	if (!out.flush() || !ImageWriter::syncFile(segment_path(active)) || !ImageWriter::syncDirectory(packDir)) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[ImagePack Flush] \n- Segment: " + segment_path(active) + "\n- Status: 0xF2");
+		return 0xF2;
+	}
+	return 0;
+}
+
+/**
+ * @brief Finds the bytes of a stored image without copying them.
+ *
+ * @param img_path The path of the image.
+ * @param img_data Set to the first byte of the image.
+ * @param img_size Set to the size of the image.
+ * @param mtime Set to the modification time of the image, in seconds since the epoch.
+ * @return std::shared_ptr<const void> The mapping of the segment, which must outlive the use of the bytes, or nullptr
+ * if the image is not stored.
+ */
+std::shared_ptr<const void> ImagePack::read(const std::string &img_path,
+											const char *&img_data,
+											size_t &img_size,
+											int64_t &mtime) {
+	std::string name = name_of(img_path);
+	std::lock_guard<std::mutex> lock(mtx);
+	auto it = index.find(name);
+	if (it == index.end())
+		return nullptr;
+	const Entry &entry = it->second;
+	auto segment = segments.find(entry.segment);
+	if (segment == segments.end())
+		return nullptr;
+	std::shared_ptr<const MappedFile> &mapping = segment->second.mapping;
+	if (!mapping || mapping->size() < entry.offset + entry.length) {
+		auto remapped = std::make_shared<const MappedFile>(segment_path(entry.segment));
+		if (!remapped->isOpen() || remapped->size() < entry.offset + entry.length)
+			return nullptr;
+		mapping = remapped;
+	}
+	img_data = mapping->data() + entry.offset;
+	img_size = size_t(entry.length);
+	mtime = entry.mtime;
+	return mapping;
+}
+
+/**
+ * @brief Calls a function for every stored image.
+ *
+ * @param fn The function, called with the path of each image. It may use the pack.
+ */
+void ImagePack::forEachImage(const std::function<void(const std::string &img_path)> &fn) const {
+	std::vector<std::string> names;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		names.reserve(index.size());
+		for (const auto &image : index)
+			names.push_back(image.first);
+	}
+	for (const auto &name : names)
+		fn(pathOf(name));
+}
+
+/**
+ * @brief Tells whether an image must be kept.
+ *
+ * @param name The name of the image.
+ * @param mtime The modification time of the image.
+ * @param now The current time, in seconds since the epoch.
+ * @return true if a car references the image or it was stored recently, false otherwise.
+ */
+bool ImagePack::is_live(const std::string &name, int64_t mtime, int64_t now) const {
+	return now - mtime < GRACE_PERIOD.count() || carpool.imageRefCount(pathOf(name)) != 0;
+}
+
+/**
+ * @brief Copies the live images of a segment to the end of the pack and removes the segment file.
+ *
+ * The images no car references are dropped from the index. The copies are flushed to the disk before the segment file
+ * is removed, so a crash in between leaves both copies, of which `open` keeps the newer one.
+ *
+ * @param segment The number of the segment.
+ * @return true if the segment was compacted, false if an image cannot be copied. The segment is kept then.
+ */
+bool ImagePack::compact(uint32_t segment) {
+	{
+		std::lock_guard<std::mutex> append_lock(append_mtx);
+		if (segment == active && !open_active(active + 1))
+			return false;
+	}
+	std::vector<std::pair<std::string, Entry>> located;
+	uint64_t segment_size = 0;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		for (const auto &image : index)
+			if (image.second.segment == segment)
+				located.push_back(image);
+		segment_size = segments[segment].size;
+	}
+	uint64_t copied = 0;
+	size_t dropped = 0;
+	for (const auto &[name, old_entry] : located) {
+		const char *img_data = nullptr;
+		size_t img_size = 0;
+		int64_t mtime = 0;
+		{
+			// deciding and dropping under one lock, so `touch` cannot keep an image that is dropped right after
+			std::lock_guard<std::mutex> lock(mtx);
+			auto it = index.find(name);
+			if (it == index.end() || it->second.segment != segment || it->second.offset != old_entry.offset)
+				continue;
+			if (!is_live(name, it->second.mtime, now_seconds())) {
+				index.erase(it);
+				dropped++;
+				continue;
+			}
+		}
+		std::shared_ptr<const void> mapping = read(pathOf(name), img_data, img_size, mtime);
+		if (!mapping)
+			return false;
+		std::lock_guard<std::mutex> append_lock(append_mtx);
+		Entry entry;
+		if (!append_record(
+				name,
+				mtime,
+				[img_data, img_size](std::ofstream &os) { return bool(os.write(img_data, img_size)); },
+				img_size,
+				false,
+				entry))
+			return false;
+		std::lock_guard<std::mutex> lock(mtx);
+		auto it = index.find(name);
+		if (it != index.end() && it->second.segment == segment && it->second.offset == old_entry.offset) {
+			entry.mtime = it->second.mtime;
+			it->second = entry;
+			copied += HEADER_SIZE + name.size() + img_size;
+		}
+	}
+	if (flush() != 0)
+		return false;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		segments.erase(segment);
+	}
+	std::error_code ec;
+	std::filesystem::remove(segment_path(segment), ec);
+	compactions++;
+	reclaimed += segment_size > copied ? segment_size - copied : 0;
+	MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::INFO, "[ImagePack Compact] \n- Segment: " + segment_path(segment) + "\n- Copied bytes: " + std::to_string(copied) + "\n- Dropped images: " + std::to_string(dropped) + "\n- Reclaimed bytes: " + std::to_string(segment_size > copied ? segment_size - copied : 0) + (ec ? "\n- Segment file left: " + ec.message() : ""));
+	return true;
+}
+
+/**
+ * @brief Compacts every segment whose unreferenced bytes exceed `deadPercent` of its size.
+ */
+void ImagePack::compact_pass() {
+	// the liveness is only estimated here, without holding the lock for every lookup; `compact` checks again
+	std::vector<std::pair<std::string, Entry>> images;
+	std::map<uint32_t, uint64_t> sizes;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		images.assign(index.begin(), index.end());
+		for (const auto &segment : segments)
+			sizes[segment.first] = segment.second.size;
+	}
+	std::map<uint32_t, uint64_t> live;
+	int64_t now = now_seconds();
+	for (const auto &[name, entry] : images)
+		if (is_live(name, entry.mtime, now))
+			live[entry.segment] += HEADER_SIZE + name.size() + entry.length;
+	for (const auto &[segment, size] : sizes) {
+		uint64_t dead = size - std::min(size, live[segment]);
+		if (dead == 0 || dead * 100 <= size * deadPercent)
+			continue;
+		{
+			std::lock_guard<std::mutex> lock(worker_mtx);
+			if (stopping)
+				return;
+		}
+		if (!compact(segment))
+			MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[ImagePack Compact] \n- Segment: " + segment_path(segment) + "\n- Status: 0xF4");
+	}
+}
+
+/**
+ * @brief Sleeps for the given duration or until the pack is stopped.
+ *
+ * @param duration The duration to sleep.
+ * @return True if the compaction thread should keep running, false if it was stopped.
+ */
+bool ImagePack::wait(std::chrono::milliseconds duration) {
+	std::unique_lock<std::mutex> lock(worker_mtx);
+	cv.wait_for(lock, duration, [this]() { return stopping; });
+	return !stopping;
+}
+
+/**
+ * @brief The body of the compaction thread.
+ */
+void ImagePack::run() {
+	do {
+		compact_pass();
+	} while (wait(passInterval));
+}
+
+/**
+ * @brief Retrieves the number of stored images.
+ *
+ * @return The number of images in the index.
+ */
+size_t ImagePack::imageCount() const {
+	std::lock_guard<std::mutex> lock(mtx);
+	return index.size();
+}
+
+/**
+ * @brief Retrieves the number of segment files.
+ *
+ * @return The number of segments, including the one appended to.
+ */
+size_t ImagePack::segmentCount() const {
+	std::lock_guard<std::mutex> lock(mtx);
+	return segments.size();
+}
+
+/**
+ * @brief Retrieves the size of the pack on the disk.
+ *
+ * @return The bytes of all segments, live or not.
+ */
+uint64_t ImagePack::byteCount() const {
+	std::lock_guard<std::mutex> lock(mtx);
+	uint64_t bytes = 0;
+	for (const auto &segment : segments)
+		bytes += segment.second.size;
+	return bytes;
+}
+
+/**
+ * @brief Retrieves the number of compactions since the pack was opened.
+ *
+ * @return The number of segments compacted.
+ */
+size_t ImagePack::compactionCount() const {
+	return compactions.load();
+}
+
+/**
+ * @brief Retrieves the number of bytes freed by compactions since the pack was opened.
+ *
+ * @return The bytes of the compacted segments minus the bytes copied out of them.
+ */
+uint64_t ImagePack::reclaimedBytes() const {
+	return reclaimed.load();
+}
@@ -0,0 +1,534 @@
+/**
+ * @file src/ImageStore.cpp
+ * @brief Implementation of class ImageStore
+ *
+ * @details
+ * This file contains the implementation of the ImageStore class.
+ * An image is stored as `imgDir + fan-out directories + sha256(bytes) + img_type`. A new image is written to a
+ * temporary file that is then renamed into place, so a reader never sees a partly written image. When the image is
+ * already stored, its modification time is refreshed instead: the ImageSweeper leaves recently written files alone,
+ * which keeps the file until the car referencing it has been added.
+ * An upload is written to `imgDir + "upload-<n>.tmp"` while it arrives. Every write refreshes its modification time, so
+ * the ImageSweeper only removes the temporary files of uploads that were abandoned.
+ * With an ImageWriter, an upload collects its bytes into chunks of `CHUNK_BYTES` and queues each chunk on its lane, and
+ * `commit` queues the move into place behind them. Until that move has run, the image path is listed in `pending`,
+ * which `await` consults before an image is read.
+ * `migrate` links each image into its new place before pointing its cars there, so every car references an existing
+ * file at every step. The old names are left to the ImageSweeper, which removes them once no car references them.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#include "carinfo-manager/imagestore.hpp"
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "carinfo-manager/hash.hpp"
+#include "carinfo-manager/log.hpp"
+
+/**
+ * @brief Constructs a new ImageStore object.
+ *
+ * @param imgDir The directory of the image files, ending with '/'.
+ * @param writer The ImageWriter running the writes of the uploads, or nullptr to write on the calling thread.
+ * @param fanout The number of directory levels below imgDir, at most MAX_FANOUT.
+ * @param pack The ImagePack storing the images, or nullptr to store them as files.
+ */
+ImageStore::ImageStore(const std::string &imgDir, ImageWriter *writer, size_t fanout, ImagePack *pack)
+	: imgDir(imgDir),
+	  fanout(fanout < MAX_FANOUT ? fanout : MAX_FANOUT),
+	  stored(0),
+	  deduplicated(0),
+	  uploads(0),
+	  writer(writer),
+	  pack(pack),
+	  commits(0) {}
+
+/**
+ * @brief Destroys the ImageStore object, waiting for the committed images to be in place.
+ */
+ImageStore::~ImageStore() {
+	std::unique_lock<std::mutex> lock(pending_mtx);
+	while (!pending.empty()) {
+		std::shared_future<int> done = pending.begin()->second.second;
+		lock.unlock();
+		done.wait();
+		lock.lock();
+	}
+}
+
+/**
+ * @brief Builds the path of a stored image.
+ *
+ * The image type is only kept if it looks like a file extension (a dot followed by at most 8 letters or digits), so
+ * that it cannot leave the image directory. Each fan-out level adds a directory named by the next two digits of the
+ * digest. With an ImagePack, the path is the one of the image in the pack.
+ *
+ * @param digest The SHA-256 of the image, in hex.
+ * @param img_type The file extension of the image, e.g. ".jpg".
+ * @return The path of the image file.
+ */
+std::string ImageStore::pathOf(const std::string &digest, const std::string &img_type) const {
+	bool valid_type = img_type.size() >= 2 && img_type.size() <= 9 && img_type[0] == '.';
+	for (size_t i = 1; valid_type && i < img_type.size(); i++)
+		valid_type = std::isalnum(static_cast<unsigned char>(img_type[i])) != 0;
+	if (pack != nullptr)
+		return pack->pathOf(digest + (valid_type ? img_type : ""));
+	std::string path = imgDir;
+	for (size_t level = 0; level < fanout && 2 * level + 2 <= digest.size(); level++)
+		path.append(digest, 2 * level, 2).push_back('/');
+	return path + digest + (valid_type ? img_type : "");
+}
+
+/**
+ * @brief Tells whether a file name is the name of a stored image, i.e. a SHA-256 in lowercase hex.
+ *
+ * @param name The file name without its extension.
+ * @return true if the name is 64 lowercase hex digits, false otherwise.
+ */
+bool ImageStore::isDigest(const std::string &name) {
+	if (name.size() != 64)
+		return false;
+	for (char c : name)
+		if (!std::isdigit(static_cast<unsigned char>(c)) && (c < 'a' || c > 'f'))
+			return false;
+	return true;
+}
+
+/**
+ * @brief Creates the fan-out directories of an image path.
+ *
+ * A failure is not reported here, the write into the directory fails instead.
+ *
+ * @param img_path The path of the image.
+ */
+void ImageStore::make_parent(const std::string &img_path) const {
+	if (fanout == 0)
+		return;
+	std::error_code ec;
+	std::filesystem::create_directories(std::filesystem::path(img_path).parent_path(), ec);
+}
+
+/**
+ * @brief Moves the stored images into the layout of this store.
+ *
+ * Every image file whose name is a digest and whose path differs from `pathOf` is hard linked, or copied if links are
+ * not supported, to its new path, or appended to the ImagePack of this store. When this store keeps its images as
+ * files, the images of `oldPack` are written out as files. The cars referencing the old path are patched to the new
+ * one, and the caller should save the cars afterwards. The old copies are left in place: the ImageSweeper removes the
+ * files and the compaction of the old pack drops the images once no car references them. Images no car references are
+ * not moved into or out of a pack, and images with other names, such as those stored before images were named by
+ * their hash, are not moved at all.
+ *
+ * @param carpool The CarPool whose cars reference the images.
+ * @param moved Set to the number of images moved.
+ * @param oldPack An ImagePack whose images are moved out, or nullptr.
+ * @return Returns 0 on success, else an error code:
+ *         - 0xF1: If an image cannot be moved or its cars cannot be patched. The other images are still moved.
+ *         - 0xFF: If an unknown exception occurs.
+ */
+int ImageStore::migrate(CarPool &carpool, size_t &moved, ImagePack *oldPack) {
+	namespace fs = std::filesystem;
+	moved = 0;
+	try {
+		std::unordered_map<std::string, std::vector<std::string>> cars_by_img;
+		carpool.forEachCar([&cars_by_img](const Car &car) { cars_by_img[car.getImagePath()].push_back(car.getId()); });
+
+		// collect the moves first, the directories change while the images are linked
+		std::vector<std::pair<std::string, std::string>> moves;
+		std::error_code ec;
+		fs::recursive_directory_iterator it(imgDir, ec), end;
+		for (; !ec && it != end; it.increment(ec)) {
+			if (!it->is_regular_file(ec) || !isDigest(it->path().stem().string()))
+				continue;
+			std::string img_path = it->path().generic_string();
+			std::string new_path = pathOf(it->path().stem().string(), it->path().extension().string());
+			if (new_path != img_path && (pack == nullptr || cars_by_img.count(img_path) != 0))
+				moves.emplace_back(img_path, new_path);
+		}
+		if (ec) {
+			MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[ImageStore Migrate] \n- Image Dir: " + imgDir + "\n- Status: 0xF1");
+			return 0xF1;
+		}
+		if (oldPack != nullptr && pack == nullptr)
+			oldPack->forEachImage([&](const std::string &img_path) {
+				if (cars_by_img.count(img_path) != 0)
+					moves.emplace_back(img_path, "");
+			});
+
+		int status = 0;
+		for (auto &move : moves) {
+			ec.clear();
+			bool placed = false;
+			if (move.second.empty()) {
+				const char *img_data = nullptr;
+				size_t img_size = 0;
+				int64_t mtime = 0;
+				std::shared_ptr<const void> img = oldPack->read(move.first, img_data, img_size, mtime);
+				placed = img && put(std::string(img_data, img_size), fs::path(move.first).extension().string(), move.second) == 0;
+			}
+			else if (pack != nullptr) {
+				uintmax_t img_size = fs::file_size(move.first, ec);
+				placed = !ec && pack->appendFile(move.second, move.first, size_t(img_size), false) == 0;
+			}
+			else {
+				make_parent(move.second);
+				if (!fs::exists(move.second, ec)) {
+					fs::create_hard_link(move.first, move.second, ec);
+					if (ec) {
+						ec.clear();
+						fs::copy_file(move.first, move.second, ec);
+					}
+				}
+				placed = !ec;
+			}
+			bool patched = placed;
+			auto cars = cars_by_img.find(move.first);
+			for (size_t i = 0; patched && cars != cars_by_img.end() && i < cars->second.size(); i++) {
+				CarPatch patch;
+				patch.img_path = move.second;
+				patched = carpool.patchCar(cars->second[i], patch) == 0;
+			}
+			if (!patched) {
+				status = 0xF1;
+				MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[ImageStore Migrate] \n- Image Path: " + move.first + "\n- New Image Path: " + move.second + "\n- Status: 0xF1");
+				continue;
+			}
+			moved++;
+		}
+		// the cars are saved by the caller, only once the images they point to are durable
+		if (pack != nullptr && moved != 0 && pack->flush() != 0)
+			status = 0xF1;
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::INFO, "[ImageStore Migrate] \n- Image Dir: " + imgDir + "\n- Fan-out: " + std::to_string(fanout) + "\n- Pack: " + (pack != nullptr ? "1" : "0") + "\n- Moved: " + std::to_string(moved) + "\n- Status: " + (status ? "0xF1" : "0"));
+		return status;
+	}
+	catch (...) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[ImageStore Migrate] \n- Image Dir: " + imgDir + "\n- Status: 0xFF");
+		return 0xFF;
+	}
+}
+
+/**
+ * @brief Refreshes the modification time of a stored image, which also tells whether it is stored.
+ *
+ * A file is refreshed under reuse_mtx, so `removeUnused` either removes it before, and it is stored again, or sees
+ * it refreshed and keeps it until its car is added.
+ *
+ * @param img_path The path of the image.
+ * @param img_size The size of the image in bytes.
+ * @return true if a file of this size exists at the path, false otherwise.
+ */
+bool ImageStore::refresh_existing(const std::string &img_path, size_t img_size) const {
+	namespace fs = std::filesystem;
+	if (pack != nullptr && pack->owns(img_path))
+		return pack->touch(img_path, img_size);
+	std::lock_guard<std::mutex> lock(reuse_mtx);
+	std::error_code ec;
+	fs::last_write_time(img_path, fs::file_time_type::clock::now(), ec);
+	return !ec && fs::file_size(img_path, ec) == img_size && !ec;
+}
+
+/**
+ * @brief Stores an image, unless the same bytes are already stored.
+ *
+ * @param img The bytes of the image.
+ * @param img_type The file extension of the image, e.g. ".jpg".
+ * @param img_path Set to the path of the stored image.
+ * @return Returns 0 on success, else an error code:
+ *         - 0xF0: If the image file cannot be written.
+ *         - 0xFF: If an unknown exception occurs.
+ */
+int ImageStore::put(const std::string &img, const std::string &img_type, std::string &img_path) {
+	namespace fs = std::filesystem;
+	try {
+		// hashed like an Upload, so both name the same bytes the same way
+		Hash hash;
+		hash.update(img.data(), img.size());
+		img_path = pathOf(hash.finish(), img_type);
+		std::error_code ec;
+		if (refresh_existing(img_path, img.size())) {
+			deduplicated++;
+			MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[ImageStore Put] \n- Image Path: " + img_path + "\n- Deduplicated: 1\n- Status: 0");
+			return 0;
+		}
+
+		if (pack != nullptr) {
+			if (pack->append(img_path, img.data(), img.size(), false) != 0) {
+				MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[ImageStore Put] \n- Image Path: " + img_path + "\n- Status: 0xF0");
+				return 0xF0;
+			}
+			stored++;
+			MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[ImageStore Put] \n- Image Path: " + img_path + "\n- Deduplicated: 0\n- Status: 0");
+			return 0;
+		}
+
+		// concurrent uploads of the same image write different temporary files, the last rename wins
+		make_parent(img_path);
+		std::ostringstream tmp_name;
+		tmp_name << img_path << ".tmp" << std::this_thread::get_id();
+		std::string tmp_path = tmp_name.str();
+		std::ofstream os(tmp_path, std::ios::binary | std::ios::trunc);
+		os.write(img.data(), img.size());
+		os.close();
+		ec.clear();
+		if (os)
+			fs::rename(tmp_path, img_path, ec);
+		if (!os || ec) {
+			fs::remove(tmp_path, ec);
+			MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[ImageStore Put] \n- Image Path: " + img_path + "\n- Status: 0xF0");
+			return 0xF0;
+		}
+		stored++;
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[ImageStore Put] \n- Image Path: " + img_path + "\n- Deduplicated: 0\n- Status: 0");
+		return 0;
+	}
+	catch (...) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[ImageStore Put] \n- Image Path: " + img_path + "\n- Status: 0xFF");
+		return 0xFF;
+	}
+}
+
+/**
+ * @brief Moves the temporary file of an upload into place, unless the same bytes are already stored.
+ *
+ * With an ImagePack the file is copied into the pack and removed.
+ *
+ * @param file The temporary file of the upload, completely written.
+ * @param img_path The path of the image.
+ * @param img_size The size of the image in bytes.
+ * @param sync Whether to flush the image and its directory entry to the disk.
+ * @return Returns 0 on success, else an error code:
+ *         - 0xF0: If the temporary file cannot be written, flushed or moved into place.
+ */
+int ImageStore::finish(Upload::File &file, const std::string &img_path, size_t img_size, bool sync) {
+	namespace fs = std::filesystem;
+	file.os.close();
+	std::error_code ec;
+	bool written = !file.failed && file.os;
+	if (written && refresh_existing(img_path, img_size)) {
+		fs::remove(file.tmp_path, ec);
+		deduplicated++;
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[ImageStore Commit] \n- Image Path: " + img_path + "\n- Size: " + std::to_string(img_size) + "\n- Deduplicated: 1\n- Status: 0");
+		return 0;
+	}
+	if (pack != nullptr) {
+		written = written && pack->appendFile(img_path, file.tmp_path, img_size, sync) == 0;
+		fs::remove(file.tmp_path, ec);
+		if (!written) {
+			MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[ImageStore Commit] \n- Image Path: " + img_path + "\n- Status: 0xF0");
+			return 0xF0;
+		}
+		stored++;
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[ImageStore Commit] \n- Image Path: " + img_path + "\n- Size: " + std::to_string(img_size) + "\n- Deduplicated: 0\n- Status: 0");
+		return 0;
+	}
+	if (written && sync)
+		written = ImageWriter::syncFile(file.tmp_path);
+	if (written) {
+		make_parent(img_path);
+		fs::rename(file.tmp_path, img_path, ec);
+	}
+	if (!written || ec) {
+		fs::remove(file.tmp_path, ec);
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[ImageStore Commit] \n- Image Path: " + img_path + "\n- Status: 0xF0");
+		return 0xF0;
+	}
+	if (sync && !ImageWriter::syncDirectory(fs::path(img_path).parent_path().string())) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[ImageStore Commit] \n- Image Path: " + img_path + "\n- Status: 0xF0");
+		return 0xF0;
+	}
+	stored++;
+	MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::DEBUG, "[ImageStore Commit] \n- Image Path: " + img_path + "\n- Size: " + std::to_string(img_size) + "\n- Deduplicated: 0\n- Status: 0");
+	return 0;
+}
+
+/**
+ * @brief Stores a received upload, unless the same bytes are already stored.
+ *
+ * The temporary file of the upload is renamed into place, or removed if the image is already stored. With an
+ * ImageWriter this runs on its I/O thread after the writes of the upload, and the call returns when the durability
+ * policy of the writer is met. Under `Durability::QUEUED` it returns 0 once the image is queued, and a later failure is
+ * only logged.
+ *
+ * @param upload The upload, completely received.
+ * @param img_type The file extension of the image, e.g. ".jpg".
+ * @param img_path Set to the path of the stored image.
+ * @return Returns 0 on success, else an error code:
+ *         - 0xF0: If the temporary file cannot be written or moved into place.
+ *         - 0xFF: If an unknown exception occurs.
+ */
+int ImageStore::commit(Upload &upload, const std::string &img_type, std::string &img_path) {
+	try {
+		img_path = pathOf(upload.hash.finish(), img_type);
+		upload.flush();
+		upload.committed = true;
+		if (writer == nullptr)
+			return finish(*upload.file, img_path, upload.length, false);
+
+		ImageWriter::Durability durability = writer->durability();
+		auto done = std::make_shared<std::promise<int>>();
+		std::shared_future<int> result = done->get_future().share();
+		uint64_t commit_no;
+		{
+			std::lock_guard<std::mutex> lock(pending_mtx);
+			commit_no = ++commits;
+			pending[img_path] = {commit_no, result};
+		}
+		writer->submit(upload.lane,
+					   0,
+					   [this, file = upload.file, img_path, img_size = upload.length, durability, done, commit_no]() {
+						   done->set_value(finish(*file, img_path, img_size, durability == ImageWriter::Durability::SYNCED));
+						   std::lock_guard<std::mutex> lock(pending_mtx);
+						   auto it = pending.find(img_path);
+						   if (it != pending.end() && it->second.first == commit_no)
+							   pending.erase(it);
+					   });
+		if (durability == ImageWriter::Durability::QUEUED)
+			return 0;
+		return result.get();
+	}
+	catch (...) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[ImageStore Commit] \n- Image Path: " + img_path + "\n- Status: 0xFF");
+		return 0xFF;
+	}
+}
+
+/**
+ * @brief Waits until a committed image is in place. Returns at once if the image is not being committed.
+ *
+ * @param img_path The path of the image.
+ */
+void ImageStore::await(const std::string &img_path) const {
+	std::shared_future<int> done;
+	{
+		std::lock_guard<std::mutex> lock(pending_mtx);
+		auto it = pending.find(img_path);
+		if (it == pending.end())
+			return;
+		done = it->second.second;
+	}
+	done.wait();
+}
+
+/**
+ * @brief Removes an image file that no car references and that was not written or reused during a grace period.
+ *
+ * The checks and the removal run under reuse_mtx, so a file that `put` or `commit` is reusing is kept. The caller
+ * must also keep the references of the carpool from changing, e.g. between the removeCar and addCar of an update.
+ *
+ * @param img_path The path of the image file.
+ * @param carpool The CarPool holding the image references.
+ * @param grace The grace period, in which the car of a newly stored image is expected to be added.
+ * @return true if the file was removed, false otherwise.
+ */
+bool ImageStore::removeUnused(const std::string &img_path, const CarPool &carpool, std::chrono::seconds grace) {
+	namespace fs = std::filesystem;
+	std::lock_guard<std::mutex> lock(reuse_mtx);
+	if (carpool.imageRefCount(img_path) != 0)
+		return false;
+	std::error_code ec;
+	auto mtime = fs::last_write_time(img_path, ec);
+	if (ec || fs::file_time_type::clock::now() - mtime < grace)
+		return false;
+	return fs::remove(img_path, ec);
+}
+
+/**
+ * @brief Retrieves the number of images written since the store was created.
+ *
+ * @return The number of uploads that were written to a new file.
+ */
+size_t ImageStore::storedCount() const {
+	return stored.load();
+}
+
+/**
+ * @brief Retrieves the number of uploads that were already stored.
+ *
+ * @return The number of uploads that cost no write.
+ */
+size_t ImageStore::deduplicatedCount() const {
+	return deduplicated.load();
+}
+
+/**
+ * @brief Starts an upload into a new temporary file of the store.
+ *
+ * @param store The ImageStore that will commit the upload.
+ */
+ImageStore::Upload::Upload(ImageStore &store)
+	: store(store), lane(store.uploads++), file(std::make_shared<File>()), length(0), committed(false) {
+	file->tmp_path = store.imgDir + "upload-" + std::to_string(lane) + ".tmp";
+	file->os.open(file->tmp_path, std::ios::binary | std::ios::trunc);
+	file->failed = !file->os;
+}
+
+/**
+ * @brief Ends the upload. The temporary file is removed unless the upload was committed.
+ */
+ImageStore::Upload::~Upload() {
+	if (committed)
+		return;
+	auto abandon = [file = file]() {
+		file->os.close();
+		std::error_code ec;
+		std::filesystem::remove(file->tmp_path, ec);
+	};
+	if (store.writer == nullptr)
+		abandon();
+	else
+		store.writer->submit(lane, 0, abandon);
+}
+
+/**
+ * @brief Appends a chunk of the image to the upload.
+ *
+ * With an ImageWriter the bytes are queued, and a write error is reported by a later call or by `commit`.
+ *
+ * @param bytes The bytes of the chunk.
+ * @param size The number of bytes.
+ * @return true if the chunk was accepted, false if the temporary file cannot be written.
+ */
+bool ImageStore::Upload::write(const char *bytes, size_t size) {
+	hash.update(bytes, size);
+	length += size;
+	if (store.writer == nullptr) {
+		file->os.write(bytes, size);
+		return bool(file->os);
+	}
+	chunk.append(bytes, size);
+	if (chunk.size() >= CHUNK_BYTES)
+		flush();
+	return !file->failed;
+}
+
+/**
+ * @brief Queues the collected bytes on the lane of the upload.
+ */
+void ImageStore::Upload::flush() {
+	if (chunk.empty() || store.writer == nullptr)
+		return;
+	auto bytes = std::make_shared<const std::string>(std::move(chunk));
+	chunk.clear();
+	store.writer->submit(lane, bytes->size(), [file = file, bytes]() {
+		if (file->failed)
+			return;
+		file->os.write(bytes->data(), bytes->size());
+		if (!file->os)
+			file->failed = true;
+	});
+}
+
+/**
+ * @brief Retrieves the number of bytes received so far.
+ *
+ * @return The size of the upload in bytes.
+ */
+size_t ImageStore::Upload::size() const {
+	return length;
+}
@@ -0,0 +1,163 @@
+/**
+ * @file src/ImageSweeper.cpp
+ * @brief Implementation of class ImageSweeper
+ *
+ * @details
+ * This file contains the implementation of the ImageSweeper class.
+ * The sweeper walks the image directory on a background thread. After every `batchSize` files it sleeps for
+ * `batchInterval`, and after a full pass it sleeps for `passInterval` before starting again, so images orphaned while
+ * the server runs are also collected. A file is removed when the carpool holds no reference to its path and it has
+ * not been written during the last `GRACE_PERIOD`. Both are checked once to skip the files in use cheaply, and again
+ * by `ImageStore::removeUnused` under the lock of the store right before the removal: a car whose update or rename
+ * drops the reference for a moment, or an upload reusing the file, keeps it. The car lock is shared while the
+ * references are read, which keeps the changes of the cars out but lets the queries run.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#include "carinfo-manager/imagesweeper.hpp"
+#include <filesystem>
+#include "carinfo-manager/log.hpp"
+
+/**
+ * @brief Constructs a new ImageSweeper object. The background thread is not started until `start` is called.
+ *
+ * @param carpool The CarPool holding the image references.
+ * @param store The ImageStore storing the images, which removes the files.
+ * @param carLock The lock held exclusively by every change of the cars.
+ * @param imgDir The directory of the image files.
+ * @param batchSize The number of files checked between two sleeps.
+ * @param batchInterval The sleep between two batches.
+ * @param passInterval The sleep between two full passes over the directory.
+ */
+ImageSweeper::ImageSweeper(const CarPool &carpool,
+						   ImageStore &store,
+						   std::shared_mutex &carLock,
+						   const std::string &imgDir,
+						   size_t batchSize,
+						   std::chrono::milliseconds batchInterval,
+						   std::chrono::milliseconds passInterval)
+	: carpool(carpool),
+	  store(store),
+	  carLock(carLock),
+	  imgDir(imgDir),
+	  batchSize(batchSize == 0 ? 1 : batchSize),
+	  batchInterval(batchInterval),
+	  passInterval(passInterval),
+	  stopping(false),
+	  removed(0) {}
+
+/**
+ * @brief Destroys the ImageSweeper object, stopping the background thread.
+ */
+ImageSweeper::~ImageSweeper() {
+	stop();
+}
+
+/**
+ * @brief Starts the background thread. Does nothing if it is already running.
+ */
+void ImageSweeper::start() {
+	std::lock_guard<std::mutex> lock(mtx);
+	if (worker.joinable())
+		return;
+	stopping = false;
+	worker = std::thread(&ImageSweeper::run, this);
+}
+
+/**
+ * @brief Stops the background thread and waits for it to exit.
+ */
+void ImageSweeper::stop() {
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stopping = true;
+	}
+	cv.notify_all();
+	if (worker.joinable())
+		worker.join();
+}
+
+/**
+ * @brief Retrieves the number of image files removed since the sweeper was created.
+ *
+ * @return The number of removed files.
+ */
+size_t ImageSweeper::removedCount() const {
+	return removed.load();
+}
+
+/**
+ * @brief Sleeps for the given duration or until the sweeper is stopped.
+ *
+ * @param duration The duration to sleep.
+ * @return True if the sweeper should keep running, false if it was stopped.
+ */
+bool ImageSweeper::wait(std::chrono::milliseconds duration) {
+	std::unique_lock<std::mutex> lock(mtx);
+	cv.wait_for(lock, duration, [this]() { return stopping; });
+	return !stopping;
+}
+
+/**
+ * @brief Walks the image directory and its subdirectories once, removing the files that are not referenced by any car.
+ */
+void ImageSweeper::sweep_pass() {
+	namespace fs = std::filesystem;
+	std::error_code ec;
+	size_t checked = 0, removed_in_pass = 0;
+	// the images may sit in fan-out directories, see ImageStore::pathOf
+	fs::recursive_directory_iterator it(imgDir, ec), end;
+	for (; !ec && it != end; it.increment(ec)) {
+		if (checked != 0 && checked % batchSize == 0 && !wait(batchInterval))
+			return;
+		checked++;
+		if (!it->is_regular_file(ec))
+			continue;
+		std::string fullPath = it->path().generic_string();
+		size_t refs;
+		{
+			std::shared_lock<std::shared_mutex> lock(carLock);
+			refs = carpool.imageRefCount(fullPath);
+		}
+		if (refs != 0)
+			continue;
+		auto mtime = fs::last_write_time(it->path(), ec);
+		if (ec || fs::file_time_type::clock::now() - mtime < GRACE_PERIOD) {
+			ec.clear();
+			continue;
+		}
+		// checked again with the cars and the store locked: the file may have been reused while we looked at it
+		bool unused;
+		{
+			std::shared_lock<std::shared_mutex> lock(carLock);
+			unused = store.removeUnused(fullPath, carpool, GRACE_PERIOD);
+		}
+		if (unused) {
+			removed++;
+			removed_in_pass++;
+			MyLogger::log("carinfo-manager-logger",
+						  MyLogger::LOG_LEVEL::DEBUG,
+						  "[ImageSweeper] Removed orphan image " + fullPath);
+		}
+		ec.clear();
+	}
+	if (ec)
+		MyLogger::log("carinfo-manager-logger",
+					  MyLogger::LOG_LEVEL::WARN,
+					  "[ImageSweeper] Cannot walk " + imgDir + ": " + ec.message());
+	MyLogger::log("carinfo-manager-logger",
+				  MyLogger::LOG_LEVEL::INFO,
+				  "[ImageSweeper] Pass finished\n- Checked: " + std::to_string(checked) +
+					  "\n- Removed: " + std::to_string(removed_in_pass));
+}
+
+/**
+ * @brief The body of the background thread.
+ */
+void ImageSweeper::run() {
+	do {
+		sweep_pass();
+	} while (wait(passInterval));
+}
@@ -0,0 +1,217 @@
+/**
+ * @file src/ImageWriter.cpp
+ * @brief Implementation of class ImageWriter
+ *
+ * @details
+ * This file contains the implementation of the ImageWriter class.
+ * Lane `i` is served by I/O thread `i`. A job counts against the queue budget from the time it is submitted until it
+ * has run; a job larger than the whole budget is still accepted once the queue is empty. A job submitted while the
+ * I/O threads are not running is run by the caller, so the order of a lane is kept either way.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#include "carinfo-manager/imagewriter.hpp"
+#include "carinfo-manager/log.hpp"
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @brief Constructs a new ImageWriter object. The I/O threads are not started until `start` is called.
+ *
+ * @param threadCount The number of I/O threads, and of lanes.
+ * @param queueBytes The byte budget of the queued jobs.
+ * @param durability When a stored image is acknowledged.
+ */
+ImageWriter::ImageWriter(size_t threadCount, size_t queueBytes, Durability durability)
+	: laneCount(threadCount == 0 ? 1 : threadCount),
+	  queueBytes(queueBytes),
+	  policy(durability),
+	  lanes(laneCount),
+	  queued(0),
+	  stopping(false),
+	  stalls(0) {}
+
+/**
+ * @brief Destroys the ImageWriter object, running the queued jobs first.
+ */
+ImageWriter::~ImageWriter() {
+	stop();
+}
+
+/**
+ * @brief Starts the I/O threads. Does nothing if they are already running.
+ */
+void ImageWriter::start() {
+	std::lock_guard<std::mutex> lock(mtx);
+	if (!workers.empty())
+		return;
+	stopping = false;
+	for (size_t lane = 0; lane < laneCount; lane++)
+		workers.emplace_back(&ImageWriter::run, this, lane);
+}
+
+/**
+ * @brief Runs the queued jobs, then stops the I/O threads and waits for them to exit.
+ */
+void ImageWriter::stop() {
+	std::vector<std::thread> exiting;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stopping = true;
+		exiting.swap(workers);
+	}
+	work.notify_all();
+	space.notify_all();
+	for (auto &worker : exiting)
+		worker.join();
+}
+
+/**
+ * @brief Queues a job on a lane. Blocks while the queued jobs exceed the byte budget.
+ *
+ * @param lane The lane of the job, taken modulo the number of lanes.
+ * @param bytes The number of bytes the job holds, counted against the budget.
+ * @param job The job. It must not throw.
+ */
+void ImageWriter::submit(size_t lane, size_t bytes, std::function<void()> job) {
+	std::unique_lock<std::mutex> lock(mtx);
+	if (workers.empty()) {
+		lock.unlock();
+		job();
+		return;
+	}
+	if (queued > 0 && queued + bytes > queueBytes) {
+		stalls++;
+		space.wait(lock, [&]() { return stopping || queued == 0 || queued + bytes <= queueBytes; });
+	}
+	queued += bytes;
+	lanes[lane % laneCount].push_back(Job{bytes, std::move(job)});
+	work.notify_all();
+}
+
+/**
+ * @brief Retrieves the number of I/O threads.
+ *
+ * @return The number of lanes, each served by one thread.
+ */
+size_t ImageWriter::threadCount() const {
+	return laneCount;
+}
+
+/**
+ * @brief Retrieves when a stored image is acknowledged.
+ *
+ * @return The durability policy of the writer.
+ */
+ImageWriter::Durability ImageWriter::durability() const {
+	return policy;
+}
+
+/**
+ * @brief Retrieves the number of bytes waiting to be written.
+ *
+ * @return The bytes of the queued and running jobs.
+ */
+size_t ImageWriter::queuedBytes() {
+	std::lock_guard<std::mutex> lock(mtx);
+	return queued;
+}
+
+/**
+ * @brief Retrieves the number of times a submitter had to wait for the queue.
+ *
+ * @return The number of submissions that found the queue full.
+ */
+size_t ImageWriter::stallCount() const {
+	return stalls.load();
+}
+
+/**
+ * @brief Runs the jobs of a lane until the writer stops and the lane is empty.
+ *
+ * @param lane The lane served by the calling thread.
+ */
+void ImageWriter::run(size_t lane) {
+	std::unique_lock<std::mutex> lock(mtx);
+	while (true) {
+		work.wait(lock, [&]() { return stopping || !lanes[lane].empty(); });
+		if (lanes[lane].empty())
+			break;
+		Job job = std::move(lanes[lane].front());
+		lanes[lane].pop_front();
+		lock.unlock();
+		try {
+			job.run();
+		}
+		catch (...) {
+			MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[ImageWriter Run] \n- Lane: " + std::to_string(lane) + "\n- Status: 0xFF");
+		}
+		lock.lock();
+		queued -= job.bytes;
+		space.notify_all();
+	}
+}
+
+/**
+ * @brief Flushes the contents of a file to the disk.
+ *
+ * @param path The path of the file.
+ * @return true if the file was flushed, false otherwise.
+ */
+bool ImageWriter::syncFile(const std::string &path) {
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(),
+							  GENERIC_WRITE,
+							  FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+							  nullptr,
+							  OPEN_EXISTING,
+							  FILE_ATTRIBUTE_NORMAL,
+							  nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	bool flushed = FlushFileBuffers(file) != 0;
+	CloseHandle(file);
+	return flushed;
+#else
+	int fd = ::open(path.c_str(), O_WRONLY);
+	if (fd < 0)
+		return false;
+	bool flushed = ::fsync(fd) == 0;
+	::close(fd);
+	return flushed;
+#endif
+}
+
+/**
+ * @brief Flushes the entries of a directory to the disk, so a file renamed into it survives a crash.
+ *
+ * On Windows the rename is recorded by the file system journal and there is nothing to flush.
+ *
+ * @param dir The path of the directory.
+ * @return true if the directory was flushed, false otherwise.
+ */
+bool ImageWriter::syncDirectory(const std::string &dir) {
+#ifdef _WIN32
+	(void)dir;
+	return true;
+#else
+	int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+	if (fd < 0)
+		return false;
+	bool flushed = ::fsync(fd) == 0;
+	::close(fd);
+	return flushed;
+#endif
+}
@@ -0,0 +1,231 @@
+/**
+ * @file src/JsonWriter.cpp
+ * @brief Implementation of class JsonWriter
+ *
+ * @details
+ * This file contains the implementation of the JsonWriter class.
+ * Strings are escaped like nlohmann::json does without ensure_ascii: the quote, the backslash and the control
+ * characters are escaped, any other byte, including those of UTF-8 sequences, is copied as it is. Runs of bytes that
+ * need no escape are appended at once.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#include "carinfo-manager/jsonwriter.hpp"
+#include <charconv>
+
+/**
+ * @brief Constructs a new JsonWriter object.
+ *
+ * @param out The string to append the JSON text to. It must outlive the writer.
+ * @param indent The number of spaces per level, 0 for compact text.
+ */
+JsonWriter::JsonWriter(std::string &out, size_t indent) : out(out), indent(indent), after_key(false) {}
+
+/**
+ * @brief Destroys the JsonWriter object.
+ */
+JsonWriter::~JsonWriter() {}
+
+/**
+ * @brief Opens an object.
+ *
+ * @return JsonWriter& The writer.
+ */
+JsonWriter &JsonWriter::beginObject() {
+	begin_container('{');
+	return *this;
+}
+
+/**
+ * @brief Closes the object opened last.
+ *
+ * @return JsonWriter& The writer.
+ */
+JsonWriter &JsonWriter::endObject() {
+	end_container('}');
+	return *this;
+}
+
+/**
+ * @brief Opens an array.
+ *
+ * @return JsonWriter& The writer.
+ */
+JsonWriter &JsonWriter::beginArray() {
+	begin_container('[');
+	return *this;
+}
+
+/**
+ * @brief Closes the array opened last.
+ *
+ * @return JsonWriter& The writer.
+ */
+JsonWriter &JsonWriter::endArray() {
+	end_container(']');
+	return *this;
+}
+
+/**
+ * @brief Writes the name of the next member of the open object.
+ *
+ * @param name The name of the member.
+ * @return JsonWriter& The writer.
+ */
+JsonWriter &JsonWriter::key(std::string_view name) {
+	begin_value();
+	appendString(out, name);
+	out += indent == 0 ? ":" : ": ";
+	after_key = true;
+	return *this;
+}
+
+/**
+ * @brief Writes a string.
+ *
+ * @param text The string.
+ * @return JsonWriter& The writer.
+ */
+JsonWriter &JsonWriter::value(std::string_view text) {
+	begin_value();
+	appendString(out, text);
+	return *this;
+}
+
+/**
+ * @brief Writes an integer.
+ *
+ * @param number The integer.
+ * @return JsonWriter& The writer.
+ */
+JsonWriter &JsonWriter::value(int64_t number) {
+	begin_value();
+	char buf[24];
+	auto result = std::to_chars(buf, buf + sizeof(buf), number);
+	out.append(buf, result.ptr);
+	return *this;
+}
+
+/**
+ * @brief Writes null.
+ *
+ * @return JsonWriter& The writer.
+ */
+JsonWriter &JsonWriter::null() {
+	begin_value();
+	out += "null";
+	return *this;
+}
+
+/**
+ * @brief Writes a value that is already JSON text. It is copied as it is, so it should be compact unless the text is.
+ *
+ * @param json The JSON text of the value.
+ * @return JsonWriter& The writer.
+ */
+JsonWriter &JsonWriter::raw(std::string_view json) {
+	begin_value();
+	out += json;
+	return *this;
+}
+
+/**
+ * @brief Appends a string as a quoted and escaped JSON string.
+ *
+ * @param out The string to append to.
+ * @param text The string to write.
+ */
+void JsonWriter::appendString(std::string &out, std::string_view text) {
+	static const char HEX[] = "0123456789abcdef";
+	out += '"';
+	size_t run = 0;  // start of the bytes not appended yet
+	for (size_t i = 0; i < text.size(); i++) {
+		unsigned char c = static_cast<unsigned char>(text[i]);
+		if (c >= 0x20 && c != '"' && c != '\\')
+			continue;
+		out.append(text.data() + run, i - run);
+		run = i + 1;
+		switch (c) {
+			case '"':
+				out += "\\\"";
+				break;
+			case '\\':
+				out += "\\\\";
+				break;
+			case '\b':
+				out += "\\b";
+				break;
+			case '\f':
+				out += "\\f";
+				break;
+			case '\n':
+				out += "\\n";
+				break;
+			case '\r':
+				out += "\\r";
+				break;
+			case '\t':
+				out += "\\t";
+				break;
+			default:
+				out += "\\u00";
+				out += HEX[c >> 4];
+				out += HEX[c & 0xF];
+				break;
+		}
+	}
+	out.append(text.data() + run, text.size() - run);
+	out += '"';
+}
+
+/**
+ * @brief Writes what comes before a value: nothing after a key, else the separator from the previous member.
+ */
+void JsonWriter::begin_value() {
+	if (after_key) {
+		after_key = false;
+		return;
+	}
+	if (empty.empty())
+		return;
+	if (!empty.back())
+		out += ',';
+	empty.back() = false;
+	newline();
+}
+
+/**
+ * @brief Opens a container.
+ *
+ * @param open The opening bracket.
+ */
+void JsonWriter::begin_container(char open) {
+	begin_value();
+	out += open;
+	empty.push_back(true);
+}
+
+/**
+ * @brief Closes the container opened last. An empty container is closed on the same line, like nlohmann::json does.
+ *
+ * @param close The closing bracket.
+ */
+void JsonWriter::end_container(char close) {
+	bool was_empty = empty.back();
+	empty.pop_back();
+	if (!was_empty)
+		newline();
+	out += close;
+}
+
+/**
+ * @brief Starts a new line indented to the depth of the open containers. Does nothing for compact text.
+ */
+void JsonWriter::newline() {
+	if (indent == 0)
+		return;
+	out += '\n';
+	out.append(empty.size() * indent, ' ');
+}
@@ -0,0 +1,124 @@
+/**
+ * @file src/MappedFile.cpp
+ * @brief Implementation of class MappedFile
+ *
+ * @details
+ * This file contains the implementation of the MappedFile class.
+ * The file handles are closed as soon as the view is mapped, the mapping itself keeps the file alive. An empty file is
+ * open but not mapped, since neither `mmap` nor `MapViewOfFile` accepts a zero length.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#include "carinfo-manager/mappedfile.hpp"
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @brief Constructs a new MappedFile object and maps the file.
+ *
+ * @param path The path of the file.
+ */
+MappedFile::MappedFile(const std::string &path) : addr(nullptr), length(0), opened(false) {
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(),
+							  GENERIC_READ,
+							  FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+							  nullptr,
+							  OPEN_EXISTING,
+							  FILE_ATTRIBUTE_NORMAL,
+							  nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return;
+	LARGE_INTEGER file_size;
+	if (GetFileSizeEx(file, &file_size)) {
+		length = static_cast<size_t>(file_size.QuadPart);
+		if (length == 0)
+			opened = true;
+		else {
+			HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (mapping != nullptr) {
+				addr = static_cast<const char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+				opened = addr != nullptr;
+				CloseHandle(mapping);
+			}
+		}
+	}
+	CloseHandle(file);
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return;
+	struct stat st;
+	if (::fstat(fd, &st) == 0) {
+		length = static_cast<size_t>(st.st_size);
+		if (length == 0)
+			opened = true;
+		else {
+			void *p = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p != MAP_FAILED) {
+				// responses read the file front to back
+				::madvise(p, length, MADV_SEQUENTIAL);
+				addr = static_cast<const char *>(p);
+				opened = true;
+			}
+		}
+	}
+	::close(fd);
+#endif
+	if (!opened)
+		length = 0;
+}
+
+/**
+ * @brief Destroys the MappedFile object and unmaps the file.
+ */
+MappedFile::~MappedFile() {
+	if (addr == nullptr)
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile(addr);
+#else
+	::munmap(const_cast<char *>(addr), length);
+#endif
+}
+
+/**
+ * @brief Tells whether the file is mapped.
+ *
+ * @return true if the file could be opened and mapped, false otherwise.
+ */
+bool MappedFile::isOpen() const {
+	return opened;
+}
+
+/**
+ * @brief Retrieves the mapped bytes.
+ *
+ * @return The first byte of the file, or nullptr if the file is empty or not mapped.
+ */
+const char *MappedFile::data() const {
+	return addr;
+}
+
+/**
+ * @brief Retrieves the size of the mapped file.
+ *
+ * @return The number of mapped bytes.
+ */
+size_t MappedFile::size() const {
+	return length;
+}
@@ -0,0 +1,311 @@
+/**
+ * @file src/Metrics.cpp
+ * @brief Implementation of class Metrics
+ *
+ * @details
+ * This file contains the implementation of the Metrics class.
+ * A shard is created the first time a thread records, and kept until the Metrics object is destroyed, so the counts
+ * of a thread that has exited are not lost. A counter of a shard has one writer, so it is bumped with a relaxed load
+ * and store instead of a read-modify-write; `render` may read a count one request old, which a scrape does not mind.
+ * A request runs from `begin`, called before httplib reads its body, to `end`, called once the response is written.
+ * A request whose response could not be written never ends; it is ended by the next `begin` on its thread.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#include "carinfo-manager/metrics.hpp"
+#include <bit>
+#include <cstdio>
+#include <sstream>
+
+namespace {
+
+// the status codes counted on their own, any other is counted as "other"
+constexpr int STATUS_CODES[Metrics::STATUSES - 1] = {200, 304, 400, 401, 403, 404, 409, 413, 424, 429, 500, 503};
+
+std::atomic<uint64_t> next_id{0};
+
+void bump(std::atomic<uint64_t> &counter, uint64_t amount = 1) {
+	counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+size_t status_index(int status) {
+	for (size_t i = 0; i < Metrics::STATUSES - 1; i++) {
+		if (STATUS_CODES[i] == status)
+			return i;
+	}
+	return Metrics::STATUSES - 1;
+}
+
+std::string format_value(double value) {
+	char buf[32];
+	std::snprintf(buf, sizeof(buf), "%.17g", value);
+	return buf;
+}
+
+std::string format_seconds(uint64_t us) {
+	char buf[32];
+	std::snprintf(
+		buf, sizeof(buf), "%llu.%06llu", (unsigned long long)(us / 1000000), (unsigned long long)(us % 1000000));
+	return buf;
+}
+
+}  // namespace
+
+/**
+ * @brief Constructs a new Metrics object, with no routes but the one counting the requests to other paths.
+ */
+Metrics::Metrics() : id(next_id++), routes{"other"} {}
+
+/**
+ * @brief Destroys the Metrics object.
+ */
+Metrics::~Metrics() {}
+
+/**
+ * @brief Registers a route. Must be called before the server starts.
+ *
+ * @param path The path of the route.
+ * @return true if the route was registered, false if it already was or there are too many routes.
+ */
+bool Metrics::addRoute(const std::string &path) {
+	if (routes.size() >= MAX_ROUTES || route_index.count(path) != 0)
+		return false;
+	route_index[path] = routes.size();
+	routes.push_back(path);
+	return true;
+}
+
+/**
+ * @brief Registers a timed operation. Must be called before the operation is first timed.
+ *
+ * @param name The name of the operation, used as the label of its histogram.
+ * @return size_t The index of the operation, to pass to `time`, or MAX_TIMERS if there are too many.
+ */
+size_t Metrics::addTimer(const std::string &name) {
+	if (timers.size() >= MAX_TIMERS)
+		return MAX_TIMERS;
+	timers.push_back(name);
+	return timers.size() - 1;
+}
+
+/**
+ * @brief Registers a gauge, a value that goes up and down. Must be called before the server starts.
+ *
+ * @param name The name of the gauge, with its labels if it has any, e.g. `name{label="value"}`.
+ * @param help The description of the gauge.
+ * @param read Reads the value when the metrics are rendered. It must be thread-safe.
+ */
+void Metrics::addGauge(const std::string &name, const std::string &help, std::function<double()> read) {
+	values.push_back(Value{name, help, false, std::move(read)});
+}
+
+/**
+ * @brief Registers a counter, a value that only goes up. Must be called before the server starts.
+ *
+ * @param name The name of the counter, with its labels if it has any, e.g. `name_total{label="value"}`.
+ * @param help The description of the counter.
+ * @param read Reads the value when the metrics are rendered. It must be thread-safe.
+ */
+void Metrics::addCounter(const std::string &name, const std::string &help, std::function<double()> read) {
+	values.push_back(Value{name, help, true, std::move(read)});
+}
+
+/**
+ * @brief Records the start of a request on the calling thread.
+ *
+ * @param path The path of the request.
+ */
+void Metrics::begin(const std::string &path) {
+	Shard &local = shard();
+	if (local.active != 0)
+		end(0);
+	auto it = route_index.find(path);
+	size_t route = it == route_index.end() ? 0 : it->second;
+	bump(local.routes[route].started);
+	local.active = route + 1;
+	local.began = std::chrono::steady_clock::now();
+}
+
+/**
+ * @brief Records the end of the request started last on the calling thread. Does nothing if it was already ended.
+ *
+ * @param status The status code of the response.
+ */
+void Metrics::end(int status) {
+	Shard &local = shard();
+	if (local.active == 0)
+		return;
+	RouteCell &cell = local.routes[local.active - 1];
+	local.active = 0;
+	bump(cell.statuses[status_index(status)]);
+	observe(cell.latency, std::chrono::steady_clock::now() - local.began);
+}
+
+/**
+ * @brief Records a run of a timed operation.
+ *
+ * @param timer The index of the operation, see `addTimer`.
+ * @param elapsed How long the operation took.
+ */
+void Metrics::time(size_t timer, std::chrono::steady_clock::duration elapsed) {
+	if (timer >= MAX_TIMERS)
+		return;
+	observe(shard().timers[timer], elapsed);
+}
+
+/**
+ * @brief Renders the metrics in the Prometheus text exposition format, version 0.0.4.
+ *
+ * @return std::string The metrics.
+ */
+std::string Metrics::render() const {
+	std::vector<RouteCell> route_sums(routes.size());
+	std::vector<Histogram> timer_sums(timers.size());
+	auto add = [](Histogram &sum, const Histogram &part) {
+		for (size_t b = 0; b < BUCKETS; b++)
+			bump(sum.buckets[b], part.buckets[b].load(std::memory_order_relaxed));
+		bump(sum.count, part.count.load(std::memory_order_relaxed));
+		bump(sum.sum_us, part.sum_us.load(std::memory_order_relaxed));
+	};
+	{
+		std::lock_guard<std::mutex> lock(shards_mtx);
+		for (const auto &local : shards) {
+			for (size_t r = 0; r < routes.size(); r++) {
+				bump(route_sums[r].started, local->routes[r].started.load(std::memory_order_relaxed));
+				for (size_t s = 0; s < STATUSES; s++)
+					bump(route_sums[r].statuses[s], local->routes[r].statuses[s].load(std::memory_order_relaxed));
+				add(route_sums[r].latency, local->routes[r].latency);
+			}
+			for (size_t t = 0; t < timers.size(); t++)
+				add(timer_sums[t], local->timers[t]);
+		}
+	}
+
+	std::ostringstream os;
+	auto histogram = [&](const std::string &name, const std::string &labels, const Histogram &sum) {
+		uint64_t cumulative = 0;
+		for (size_t b = 0; b + 1 < BUCKETS; b++) {
+			cumulative += sum.buckets[b].load();
+			os << name << "_bucket{" << labels << ",le=\"" << format_seconds(bucketBound(b)) << "\"} " << cumulative
+			   << "\n";
+		}
+		os << name << "_bucket{" << labels << ",le=\"+Inf\"} " << sum.count.load() << "\n";
+		os << name << "_sum{" << labels << "} " << format_seconds(sum.sum_us.load()) << "\n";
+		os << name << "_count{" << labels << "} " << sum.count.load() << "\n";
+	};
+
+	os << "# HELP carinfo_http_requests_total Requests answered, by route and status code.\n"
+	   << "# TYPE carinfo_http_requests_total counter\n";
+	for (size_t r = 0; r < routes.size(); r++) {
+		for (size_t s = 0; s < STATUSES; s++) {
+			uint64_t count = route_sums[r].statuses[s].load();
+			if (count == 0)
+				continue;
+			std::string code = s < STATUSES - 1 ? std::to_string(STATUS_CODES[s]) : "other";
+			os << "carinfo_http_requests_total{route=\"" << routes[r] << "\",code=\"" << code << "\"} " << count
+			   << "\n";
+		}
+	}
+	os << "# HELP carinfo_http_requests_in_flight Requests being served, by route.\n"
+	   << "# TYPE carinfo_http_requests_in_flight gauge\n";
+	for (size_t r = 0; r < routes.size(); r++) {
+		uint64_t started = route_sums[r].started.load(), ended = route_sums[r].latency.count.load();
+		// the counts of other threads may be a request behind each other
+		uint64_t in_flight = started > ended ? started - ended : 0;
+		os << "carinfo_http_requests_in_flight{route=\"" << routes[r] << "\"} " << in_flight << "\n";
+	}
+	os << "# HELP carinfo_http_request_duration_seconds Time from reading a request to writing its response.\n"
+	   << "# TYPE carinfo_http_request_duration_seconds histogram\n";
+	for (size_t r = 0; r < routes.size(); r++) {
+		if (route_sums[r].latency.count.load() != 0)
+			histogram("carinfo_http_request_duration_seconds", "route=\"" + routes[r] + "\"", route_sums[r].latency);
+	}
+	os << "# HELP carinfo_save_duration_seconds Time taken to save a data file.\n"
+	   << "# TYPE carinfo_save_duration_seconds histogram\n";
+	for (size_t t = 0; t < timers.size(); t++)
+		histogram("carinfo_save_duration_seconds", "file=\"" + timers[t] + "\"", timer_sums[t]);
+
+	// the series of a family must be rendered together, whatever the order they were registered in
+	std::vector<bool> rendered(values.size(), false);
+	for (size_t i = 0; i < values.size(); i++) {
+		if (rendered[i])
+			continue;
+		std::string family = values[i].name.substr(0, values[i].name.find('{'));
+		os << "# HELP " << family << " " << values[i].help << "\n"
+		   << "# TYPE " << family << " " << (values[i].counter ? "counter" : "gauge") << "\n";
+		for (size_t j = i; j < values.size(); j++) {
+			if (!rendered[j] && values[j].name.substr(0, values[j].name.find('{')) == family) {
+				os << values[j].name << " " << format_value(values[j].read()) << "\n";
+				rendered[j] = true;
+			}
+		}
+	}
+	return os.str();
+}
+
+/**
+ * @brief Gets the histogram bucket of a latency.
+ *
+ * @param us The latency in microseconds.
+ * @return size_t The index of the first bucket whose bound is at least the latency.
+ */
+size_t Metrics::bucketOf(uint64_t us) {
+	if (us <= 16)
+		return 0;
+	us--;  // a latency equal to a bound belongs to the bucket below it
+	size_t octave = static_cast<size_t>(std::bit_width(us)) - 1;
+	if (octave >= 26)
+		return BUCKETS - 1;
+	size_t sub = static_cast<size_t>((us - (uint64_t(1) << octave)) >> (octave - 2));
+	return (octave - 4) * 4 + sub + 1;
+}
+
+/**
+ * @brief Gets the upper bound of a histogram bucket.
+ *
+ * @param bucket The index of the bucket, less than BUCKETS - 1.
+ * @return uint64_t The bound in microseconds.
+ */
+uint64_t Metrics::bucketBound(size_t bucket) {
+	if (bucket == 0)
+		return 16;
+	size_t octave = (bucket - 1) / 4 + 4, sub = (bucket - 1) % 4;
+	return (uint64_t(1) << octave) + ((sub + 1) << (octave - 2));
+}
+
+/**
+ * @brief Gets the shard of the calling thread, creating it the first time.
+ *
+ * @return Shard& The shard.
+ */
+Metrics::Shard &Metrics::shard() {
+	// a thread records into few Metrics objects, the server has one
+	static thread_local std::vector<std::pair<uint64_t, Shard *>> local;
+	for (const auto &entry : local) {
+		if (entry.first == id)
+			return *entry.second;
+	}
+	auto created = std::make_unique<Shard>();
+	Shard *raw = created.get();
+	{
+		std::lock_guard<std::mutex> lock(shards_mtx);
+		shards.push_back(std::move(created));
+	}
+	local.emplace_back(id, raw);
+	return *raw;
+}
+
+/**
+ * @brief Adds a latency to a histogram.
+ *
+ * @param histogram The histogram, of the calling thread's shard.
+ * @param elapsed The latency.
+ */
+void Metrics::observe(Histogram &histogram, std::chrono::steady_clock::duration elapsed) {
+	uint64_t us = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+	bump(histogram.buckets[bucketOf(us)]);
+	bump(histogram.count);
+	bump(histogram.sum_us, us);
+}
@@ -0,0 +1,180 @@
+/**
+ * @file src/ParallelLoader.cpp
+ * @brief Implementation of class ParallelLoader
+ *
+ * @details
+ * This file contains the implementation of the ParallelLoader class.
+ * The data files of the pools are single JSON objects whose members are independent records.
+ * `splitRecords` scans the text once to find the boundaries of every member, so that the records can be parsed
+ * independently. `run` then hands contiguous chunks of records to worker threads and collects their status codes.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#include "carinfo-manager/parallelloader.hpp"
+#include <algorithm>
+#include <thread>
+
+namespace {
+
+size_t skip_whitespace(const std::string &text, size_t pos) {
+	while (pos < text.size() &&
+		   (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r'))
+		pos++;
+	return pos;
+}
+
+// returns the position just after the closing quote, or npos
+size_t skip_string(const std::string &text, size_t pos) {
+	for (pos++; pos < text.size(); pos++) {
+		if (text[pos] == '\\')
+			pos++;
+		else if (text[pos] == '"')
+			return pos + 1;
+	}
+	return std::string::npos;
+}
+
+// returns the position just after the value, or npos
+size_t skip_value(const std::string &text, size_t pos) {
+	if (pos >= text.size())
+		return std::string::npos;
+	if (text[pos] == '"')
+		return skip_string(text, pos);
+	if (text[pos] == '{' || text[pos] == '[') {
+		size_t depth = 0;
+		while (pos < text.size()) {
+			char ch = text[pos];
+			if (ch == '"') {
+				pos = skip_string(text, pos);
+				if (pos == std::string::npos)
+					return pos;
+				continue;
+			}
+			if (ch == '{' || ch == '[')
+				depth++;
+			else if (ch == '}' || ch == ']') {
+				if (--depth == 0)
+					return pos + 1;
+			}
+			pos++;
+		}
+		return std::string::npos;
+	}
+	while (pos < text.size() && text[pos] != ',' && text[pos] != '}' && text[pos] != ' ' &&
+		   text[pos] != '\t' && text[pos] != '\n' && text[pos] != '\r')
+		pos++;
+	return pos;
+}
+
+}  // namespace
+
+/**
+ * @brief Resolves the number of worker threads to use.
+ *
+ * @param requested The configured number of threads, 0 for one thread per hardware core.
+ * @return The number of threads to use, at least 1.
+ */
+size_t ParallelLoader::threadCount(size_t requested) {
+	if (requested != 0)
+		return requested;
+	size_t cores = std::thread::hardware_concurrency();
+	return cores == 0 ? 1 : cores;
+}
+
+/**
+ * @brief Splits the text of a top-level JSON object into its members.
+ *
+ * The text is only scanned for string, object and array boundaries; the records themselves are left to the caller
+ * to parse. The views in `records` point into `text`, which must outlive them.
+ *
+ * @param text The text of the JSON object.
+ * @param records The vector to append the records to.
+ * @return Returns 0 if the text is a well-formed object (or `null`, read as an empty object), else 1.
+ */
+int ParallelLoader::splitRecords(const std::string &text, std::vector<Record> &records) {
+	size_t pos = skip_whitespace(text, 0);
+	// an empty pool is saved as `null`
+	if (text.compare(pos, 4, "null") == 0)
+		return skip_whitespace(text, pos + 4) == text.size() ? 0 : 1;
+	if (pos >= text.size() || text[pos] != '{')
+		return 1;
+	pos = skip_whitespace(text, pos + 1);
+	if (pos < text.size() && text[pos] == '}')
+		return skip_whitespace(text, pos + 1) == text.size() ? 0 : 1;
+	while (pos < text.size()) {
+		if (text[pos] != '"')
+			return 1;
+		size_t key_end = skip_string(text, pos);
+		if (key_end == std::string::npos)
+			return 1;
+		Record record;
+		record.key = std::string_view(text).substr(pos, key_end - pos);
+		pos = skip_whitespace(text, key_end);
+		if (pos >= text.size() || text[pos] != ':')
+			return 1;
+		pos = skip_whitespace(text, pos + 1);
+		size_t value_end = skip_value(text, pos);
+		if (value_end == std::string::npos || value_end == pos)
+			return 1;
+		record.value = std::string_view(text).substr(pos, value_end - pos);
+		records.push_back(record);
+		pos = skip_whitespace(text, value_end);
+		if (pos < text.size() && text[pos] == ',') {
+			pos = skip_whitespace(text, pos + 1);
+			continue;
+		}
+		if (pos < text.size() && text[pos] == '}')
+			return skip_whitespace(text, pos + 1) == text.size() ? 0 : 1;
+		return 1;
+	}
+	return 1;
+}
+
+/**
+ * @brief Computes how many chunks `run` splits the records into.
+ *
+ * @param record_count The number of records.
+ * @param threads The number of threads available.
+ * @return The number of chunks, at least 1.
+ */
+size_t ParallelLoader::chunkCount(size_t record_count, size_t threads) {
+	size_t chunks = (record_count + MIN_CHUNK_SIZE - 1) / MIN_CHUNK_SIZE;
+	if (chunks > threads)
+		chunks = threads;
+	return chunks == 0 ? 1 : chunks;
+}
+
+/**
+ * @brief Runs a worker over contiguous chunks of records.
+ *
+ * The records [0, record_count) are split into `chunkCount(record_count, threads)` chunks. The first chunk runs on
+ * the calling thread and every other chunk on a thread of its own.
+ *
+ * @param record_count The number of records.
+ * @param threads The number of threads available.
+ * @param worker The worker, called with the chunk index and the record range [begin, end).
+ * @return Returns 0 if every worker returned 0, else the status code of the first failing chunk.
+ */
+int ParallelLoader::run(size_t record_count,
+						size_t threads,
+						const std::function<int(size_t chunk, size_t begin, size_t end)> &worker) {
+	size_t chunks = chunkCount(record_count, threads);
+	size_t chunk_size = (record_count + chunks - 1) / chunks;
+	std::vector<int> results(chunks, 0);
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < chunks; i++) {
+		size_t begin = std::min(record_count, i * chunk_size);
+		size_t end = std::min(record_count, begin + chunk_size);
+		workers.emplace_back([&, i, begin, end]() { results[i] = worker(i, begin, end); });
+	}
+	results[0] = worker(0, 0, std::min(record_count, chunk_size));
+	for (auto &t : workers)
+		t.join();
+	for (int result : results) {
+		if (result != 0)
+			return result;
+	}
+	return 0;
+}
@@ -0,0 +1,111 @@
+/**
+ * @file src/RateLimiter.cpp
+ * @brief Implementation of class RateLimiter
+ *
+ * @details
+ * This file contains the implementation of the RateLimiter class.
+ * A bucket is refilled lazily: `admit` adds the tokens earned since the bucket was last refilled, capped at `burst`.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#include "carinfo-manager/ratelimiter.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace {
+
+// smallest table size at which full buckets are dropped
+constexpr size_t MIN_PRUNE_AT = 1024;
+
+}  // namespace
+
+/**
+ * @brief Constructs a new RateLimiter object.
+ *
+ * @param rate The number of requests a client may send per second, more than 0.
+ * @param burst The number of requests a client may send at once, at least 1.
+ */
+RateLimiter::RateLimiter(double rate, double burst)
+	: rate(rate), burst(std::max(burst, 1.0)), prune_at(MIN_PRUNE_AT), admitted(0), limited(0) {}
+
+/**
+ * @brief Destroys the RateLimiter object.
+ */
+RateLimiter::~RateLimiter() {}
+
+/**
+ * @brief Takes a token from the bucket of a client.
+ *
+ * @param client The address of the client.
+ * @param retry_after Set to the time until the bucket has a token again, rounded up to a second, if it is empty.
+ * @return true if the request may go on, false if the client is over its rate.
+ */
+bool RateLimiter::admit(const std::string &client, std::chrono::seconds &retry_after) {
+	auto now = std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> lock(mtx);
+	if (buckets.size() >= prune_at)
+		prune(now);
+	auto it = buckets.find(client);
+	if (it == buckets.end())
+		it = buckets.emplace(client, Bucket{burst, now}).first;
+	Bucket &bucket = it->second;
+	double elapsed = std::chrono::duration<double>(now - bucket.refilled).count();
+	bucket.tokens = std::min(burst, bucket.tokens + elapsed * rate);
+	bucket.refilled = now;
+	if (bucket.tokens >= 1.0) {
+		bucket.tokens -= 1.0;
+		admitted++;
+		return true;
+	}
+	retry_after = std::chrono::seconds(static_cast<int64_t>(std::ceil((1.0 - bucket.tokens) / rate)));
+	limited++;
+	return false;
+}
+
+/**
+ * @brief Retrieves the number of clients with a bucket.
+ *
+ * @return The number of buckets in the table, including full ones not dropped yet.
+ */
+size_t RateLimiter::clientCount() {
+	std::lock_guard<std::mutex> lock(mtx);
+	return buckets.size();
+}
+
+/**
+ * @brief Retrieves the number of requests let through.
+ *
+ * @return The number of admitted requests.
+ */
+size_t RateLimiter::admittedCount() const {
+	return admitted.load();
+}
+
+/**
+ * @brief Retrieves the number of requests turned away.
+ *
+ * @return The number of requests over the rate of their client.
+ */
+size_t RateLimiter::limitedCount() const {
+	return limited.load();
+}
+
+/**
+ * @brief Drops the buckets that have filled up again, and sets the table size of the next pruning.
+ *
+ * @param now The current time.
+ */
+void RateLimiter::prune(std::chrono::steady_clock::time_point now) {
+	for (auto it = buckets.begin(); it != buckets.end();) {
+		double elapsed = std::chrono::duration<double>(now - it->second.refilled).count();
+		if (it->second.tokens + elapsed * rate >= burst)
+			it = buckets.erase(it);
+		else
+			++it;
+	}
+	// the active clients stay, so prune again only once the table has doubled
+	prune_at = std::max(MIN_PRUNE_AT, buckets.size() * 2);
+}
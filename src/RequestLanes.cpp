@@ -0,0 +1,178 @@
+/**
+ * @file src/RequestLanes.cpp
+ * @brief Implementation of class RequestLanes
+ *
+ * @details
+ * This file contains the implementation of the RequestLanes class.
+ * A request enters its lane if fewer than `workers` requests are running in it, waits if fewer than `queue` are
+ * waiting, and is rejected otherwise. The classification only looks at the path, and for /get_carinfo at whether a
+ * car ID is given, so it is done after httplib has read the form but before the handler runs.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#include "carinfo-manager/requestlanes.hpp"
+
+/**
+ * @brief Enters a lane, waiting for a place if the lane is busy.
+ *
+ * @param lanes The lanes.
+ * @param lane The lane of the request.
+ */
+RequestLanes::Ticket::Ticket(RequestLanes &lanes, Lane lane)
+	: lanes(lanes), lane(lane), admitted(lanes.enter(lane)) {}
+
+/**
+ * @brief Leaves the lane, letting a waiting request in.
+ */
+RequestLanes::Ticket::~Ticket() {
+	if (admitted)
+		lanes.leave(lane);
+}
+
+/**
+ * @brief Checks whether the request got a place in its lane.
+ *
+ * @return true if the request may run, false if the lane was full and it must be turned away.
+ */
+bool RequestLanes::Ticket::isAdmitted() const {
+	return admitted;
+}
+
+/**
+ * @brief Constructs a new RequestLanes object.
+ *
+ * @param budgets The budget of each lane, indexed by `Lane`.
+ */
+RequestLanes::RequestLanes(const std::array<Budget, LANE_COUNT> &budgets) {
+	for (size_t i = 0; i < LANE_COUNT; i++)
+		lanes[i].budget = budgets[i];
+}
+
+/**
+ * @brief Destroys the RequestLanes object.
+ */
+RequestLanes::~RequestLanes() {}
+
+/**
+ * @brief Classifies a request into a lane.
+ *
+ * @param req The request, with its form already read.
+ * @return Lane The lane of the request.
+ */
+RequestLanes::Lane RequestLanes::classify(const httplib::Request &req) {
+	const std::string &path = req.path;
+	if (path == "/get_carinfo")
+		return req.has_file("car_id") && !req.get_file_value("car_id").content.empty() ? Lane::POINT_READ
+																						: Lane::SCAN;
+	if (path == "/get_all_account")
+		return Lane::SCAN;
+	if (path == "/get_carimg" || path == "/add_car" || path == "/update_car" || path == "/patch_car")
+		return Lane::IMAGE;
+	if (path == "/remove_car" || path == "/batch" || path == "/change_password" || path == "/add_account" ||
+		path == "/remove_account" || path == "/update_account")
+		return Lane::MUTATION;
+	return Lane::POINT_READ;
+}
+
+/**
+ * @brief Gets the name of a lane, for logging.
+ *
+ * @param lane The lane.
+ * @return const char* The name of the lane.
+ */
+const char *RequestLanes::laneName(Lane lane) {
+	switch (lane) {
+		case Lane::POINT_READ:
+			return "point read";
+		case Lane::SCAN:
+			return "scan";
+		case Lane::MUTATION:
+			return "mutation";
+		default:
+			return "image";
+	}
+}
+
+/**
+ * @brief Gets the number of threads the limited lanes other than point reads can hold, running or waiting.
+ *
+ * @return size_t The number of threads.
+ */
+size_t RequestLanes::reservedThreads() const {
+	size_t threads = 0;
+	for (size_t i = 0; i < LANE_COUNT; i++) {
+		if (static_cast<Lane>(i) != Lane::POINT_READ && lanes[i].budget.workers != 0)
+			threads += lanes[i].budget.workers + lanes[i].budget.queue;
+	}
+	return threads;
+}
+
+/**
+ * @brief Gets the number of requests a lane has let in.
+ *
+ * @param lane The lane.
+ * @return size_t The number of requests run, including the running ones.
+ */
+size_t RequestLanes::servedCount(Lane lane) const {
+	return lanes[static_cast<size_t>(lane)].served.load();
+}
+
+/**
+ * @brief Gets the number of requests that had to wait in a lane.
+ *
+ * @param lane The lane.
+ * @return size_t The number of requests that found the lane busy and waited.
+ */
+size_t RequestLanes::queuedCount(Lane lane) const {
+	return lanes[static_cast<size_t>(lane)].queued.load();
+}
+
+/**
+ * @brief Gets the number of requests a lane has turned away.
+ *
+ * @param lane The lane.
+ * @return size_t The number of requests that found the lane and its queue full.
+ */
+size_t RequestLanes::rejectedCount(Lane lane) const {
+	return lanes[static_cast<size_t>(lane)].rejected.load();
+}
+
+/**
+ * @brief Takes a place in a lane, waiting for one if the lane is busy.
+ *
+ * @param lane The lane.
+ * @return true if a place was taken, false if the lane and its queue are full.
+ */
+bool RequestLanes::enter(Lane lane) {
+	State &state = lanes[static_cast<size_t>(lane)];
+	std::unique_lock<std::mutex> lock(mtx);
+	if (state.budget.workers != 0 && state.running >= state.budget.workers) {
+		if (state.waiting >= state.budget.queue) {
+			state.rejected++;
+			return false;
+		}
+		state.queued++;
+		state.waiting++;
+		state.freed.wait(lock, [&]() { return state.running < state.budget.workers; });
+		state.waiting--;
+	}
+	state.running++;
+	state.served++;
+	return true;
+}
+
+/**
+ * @brief Gives a place in a lane back.
+ *
+ * @param lane The lane.
+ */
+void RequestLanes::leave(Lane lane) {
+	State &state = lanes[static_cast<size_t>(lane)];
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		state.running--;
+	}
+	state.freed.notify_one();
+}
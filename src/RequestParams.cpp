@@ -0,0 +1,105 @@
+/**
+ * @file src/RequestParams.cpp
+ * @brief Implementation of class RequestParams
+ *
+ * @details
+ * This file contains the implementation of the RequestParams class.
+ * A request has about ten fields, so they are found by a linear scan comparing against the C string name, which needs
+ * no temporary std::string key the way `std::multimap::find` would.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#include "carinfo-manager/requestparams.hpp"
+#include <charconv>
+
+/**
+ * @brief Constructs a new RequestParams object.
+ *
+ * @param fields The multipart fields of the request, e.g. `req.files`.
+ */
+RequestParams::RequestParams(const httplib::MultipartFormDataMap &fields) : fields(fields) {}
+
+/**
+ * @brief Destroys the RequestParams object.
+ */
+RequestParams::~RequestParams() {}
+
+/**
+ * @brief Finds the value of a field.
+ *
+ * @param name The name of the field.
+ * @return A pointer to the value, or nullptr if the field is missing.
+ */
+const std::string *RequestParams::find(const char *name) const {
+	for (const auto &field : fields)
+		if (field.first == name)
+			return &field.second.content;
+	return nullptr;
+}
+
+/**
+ * @brief Checks that fields are present.
+ *
+ * @param names The names of the required fields.
+ * @return true if every field is present, false otherwise.
+ */
+bool RequestParams::contains(std::initializer_list<const char *> names) const {
+	for (const char *name : names)
+		if (find(name) == nullptr)
+			return false;
+	return true;
+}
+
+/**
+ * @brief Retrieves the value of a field.
+ *
+ * @param name The name of the field.
+ * @return The value of the field, or an empty string if the field is missing.
+ */
+const std::string &RequestParams::get(const char *name) const {
+	static const std::string empty;
+	const std::string *value = find(name);
+	return value ? *value : empty;
+}
+
+/**
+ * @brief Parses a field as a decimal integer.
+ *
+ * @param name The name of the field.
+ * @param value Set to the integer if the field is valid.
+ * @return true if the field is present and is an integer in the range of int, false otherwise.
+ */
+bool RequestParams::getInt(const char *name, int &value) const {
+	const std::string *text = find(name);
+	if (text == nullptr || text->empty())
+		return false;
+	int parsed = 0;
+	auto result = std::from_chars(text->data(), text->data() + text->size(), parsed);
+	if (result.ec != std::errc() || result.ptr != text->data() + text->size())
+		return false;
+	value = parsed;
+	return true;
+}
+
+/**
+ * @brief Parses a field as an account type, given by its integer value.
+ *
+ * @param name The name of the field.
+ * @param type Set to the account type if the field is valid.
+ * @return true if the field is present and names an account type, false otherwise.
+ */
+bool RequestParams::getAccountType(const char *name, Account::AccountType &type) const {
+	int value = 0;
+	if (!getInt(name, value))
+		return false;
+	switch (static_cast<Account::AccountType>(value)) {
+		case Account::AccountType::NONETYPE:
+		case Account::AccountType::ADMIN:
+		case Account::AccountType::USER:
+			type = static_cast<Account::AccountType>(value);
+			return true;
+	}
+	return false;
+}
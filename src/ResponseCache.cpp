@@ -0,0 +1,68 @@
+/**
+ * @file src/ResponseCache.cpp
+ * @brief Implementation of class ResponseCache
+ *
+ * @details
+ * This file contains the implementation of the ResponseCache class.
+ * The cache is a list ordered by recency plus a hash map from request key to list node. Entries are immutable and
+ * shared, so a caller keeps its entry even if it is replaced or evicted while the request is in flight.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#include "carinfo-manager/responsecache.hpp"
+
+/**
+ * @brief Constructs a new ResponseCache object.
+ *
+ * @param capacityBytes The byte budget of the cached bodies.
+ */
+ResponseCache::ResponseCache(size_t capacityBytes) : capacity(capacityBytes), bytes(0) {}
+
+/**
+ * @brief Destroys the ResponseCache object.
+ */
+ResponseCache::~ResponseCache() {}
+
+/**
+ * @brief Retrieves the cached response of a request.
+ *
+ * @param key The key of the request, naming the endpoint and its parameters.
+ * @return The cached ETag and body, or nullptr if the request is not cached.
+ */
+std::shared_ptr<const ResponseCache::Entry> ResponseCache::lookup(const std::string &key) {
+	std::lock_guard<std::mutex> lock(mtx);
+	auto it = entries.find(key);
+	if (it == entries.end())
+		return nullptr;
+	lru.splice(lru.begin(), lru, it->second);
+	return it->second->second;
+}
+
+/**
+ * @brief Caches the response of a request. A body larger than the whole budget is not cached.
+ *
+ * @param key The key of the request, naming the endpoint and its parameters.
+ * @param etag The ETag of the response.
+ * @param body The body of the response.
+ */
+void ResponseCache::store(const std::string &key, const std::string &etag, const std::string &body) {
+	std::lock_guard<std::mutex> lock(mtx);
+	auto it = entries.find(key);
+	if (it != entries.end()) {
+		bytes -= it->second->second->body.size();
+		lru.erase(it->second);
+		entries.erase(it);
+	}
+	if (body.size() > capacity)
+		return;
+	lru.emplace_front(key, std::make_shared<const Entry>(Entry{etag, body}));
+	entries[key] = lru.begin();
+	bytes += body.size();
+	while (bytes > capacity) {
+		bytes -= lru.back().second->body.size();
+		entries.erase(lru.back().first);
+		lru.pop_back();
+	}
+}
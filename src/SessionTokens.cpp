@@ -0,0 +1,199 @@
+/**
+ * @file src/SessionTokens.cpp
+ * @brief Implementation of class SessionTokens
+ *
+ * @details
+ * This file contains the implementation of the SessionTokens class.
+ * The signature is HMAC-SHA256 (RFC 2104) computed with the project's Hash class. The hashes of the padded key are
+ * computed once in the constructor, so signing a token costs two short SHA-256 runs on copies of them.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#include "carinfo-manager/sessiontokens.hpp"
+#include <random>
+
+namespace {
+
+int64_t now_ms() {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+			   std::chrono::system_clock::now().time_since_epoch())
+		.count();
+}
+
+std::string to_hex(const std::string &bytes) {
+	static const char digits[] = "0123456789abcdef";
+	std::string hex;
+	hex.reserve(bytes.size() * 2);
+	for (unsigned char c : bytes) {
+		hex.push_back(digits[c >> 4]);
+		hex.push_back(digits[c & 0x0F]);
+	}
+	return hex;
+}
+
+int hex_digit(char c) {
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+bool from_hex(const std::string &hex, std::string &bytes) {
+	if (hex.size() % 2 != 0)
+		return false;
+	bytes.clear();
+	bytes.reserve(hex.size() / 2);
+	for (size_t i = 0; i < hex.size(); i += 2) {
+		int high = hex_digit(hex[i]), low = hex_digit(hex[i + 1]);
+		if (high < 0 || low < 0)
+			return false;
+		bytes.push_back(static_cast<char>(high << 4 | low));
+	}
+	return true;
+}
+
+// compares in a time that does not depend on where the strings differ
+bool same_mac(const std::string &x, const std::string &y) {
+	if (x.size() != y.size())
+		return false;
+	unsigned char diff = 0;
+	for (size_t i = 0; i < x.size(); i++)
+		diff |= static_cast<unsigned char>(x[i] ^ y[i]);
+	return diff == 0;
+}
+
+}  // namespace
+
+/**
+ * @brief Constructs a new SessionTokens object.
+ *
+ * @param key The secret key the tokens are signed with. Tokens signed under another key are rejected.
+ * @param ttl How long an issued token stays valid.
+ */
+SessionTokens::SessionTokens(const std::string &key, std::chrono::seconds ttl)
+	: ttl(std::chrono::duration_cast<std::chrono::milliseconds>(ttl)), revoked_size(0) {
+	std::string block = key;
+	if (block.size() > 64) {
+		Hash key_hash;
+		key_hash.update(block.data(), block.size());
+		from_hex(key_hash.finish(), block);
+	}
+	block.resize(64, '\0');
+	std::string ipad(64, '\0'), opad(64, '\0');
+	for (size_t i = 0; i < 64; i++) {
+		ipad[i] = static_cast<char>(block[i] ^ 0x36);
+		opad[i] = static_cast<char>(block[i] ^ 0x5C);
+	}
+	inner_pad.update(ipad.data(), ipad.size());
+	outer_pad.update(opad.data(), opad.size());
+}
+
+/**
+ * @brief Destroys the SessionTokens object.
+ */
+SessionTokens::~SessionTokens() {}
+
+/**
+ * @brief Computes the HMAC of a message.
+ *
+ * @param message The message.
+ * @return std::string The HMAC as 64 hex digits.
+ */
+std::string SessionTokens::mac(const std::string &message) const {
+	Hash inner(inner_pad);
+	inner.update(message.data(), message.size());
+	std::string digest;
+	from_hex(inner.finish(), digest);
+	Hash outer(outer_pad);
+	outer.update(digest.data(), digest.size());
+	return outer.finish();
+}
+
+/**
+ * @brief Issues a token for an account.
+ *
+ * @param username The username of the account.
+ * @param type The account type, which the token vouches for until it expires.
+ * @return std::string The token.
+ */
+std::string SessionTokens::issue(const std::string &username, Account::AccountType type) const {
+	std::string message = to_hex(username) + "." + std::to_string(static_cast<int>(type)) + "." +
+						  std::to_string(now_ms() + ttl.count());
+	return message + "." + mac(message);
+}
+
+/**
+ * @brief Verifies a token. The account pool is not consulted: a valid signature vouches for the account, and accounts
+ * changed since the token was issued are caught by the revocation list.
+ *
+ * @param token The token.
+ * @param session Set to the session of the token if it is valid.
+ * @return true The token is valid.
+ * @return false The token is malformed, forged, expired or revoked.
+ */
+bool SessionTokens::verify(const std::string &token, Session &session) const {
+	size_t mac_dot = token.rfind('.');
+	if (mac_dot == std::string::npos || !same_mac(token.substr(mac_dot + 1), mac(token.substr(0, mac_dot)))) {
+		return false;
+	}
+	size_t type_dot = token.find('.');
+	size_t expiry_dot = token.find('.', type_dot + 1);
+	if (type_dot == mac_dot || expiry_dot == mac_dot || token.find('.', expiry_dot + 1) != mac_dot)
+		return false;
+	// the signature is ours, so the fields are well-formed
+	int64_t expiry = std::stoll(token.substr(expiry_dot + 1, mac_dot - expiry_dot - 1));
+	if (expiry <= now_ms() || !from_hex(token.substr(0, type_dot), session.username))
+		return false;
+	std::string type = token.substr(type_dot + 1, expiry_dot - type_dot - 1);
+	session.type = static_cast<Account::AccountType>(std::stoi(type));
+	if (revoked_size.load(std::memory_order_acquire) == 0)
+		return true;
+	std::lock_guard<std::mutex> lock(mtx);
+	auto it = revoked.find(session.username);
+	return it == revoked.end() || expiry > it->second;
+}
+
+/**
+ * @brief Revokes every token issued so far for an account. Tokens issued afterwards are valid.
+ *
+ * @param username The username of the account.
+ */
+void SessionTokens::revoke(const std::string &username) {
+	int64_t now = now_ms();
+	std::lock_guard<std::mutex> lock(mtx);
+	for (auto it = revoked.begin(); it != revoked.end();) {
+		// every token this revocation covers has expired by now
+		if (it->second <= now)
+			it = revoked.erase(it);
+		else
+			++it;
+	}
+	// a token issued before now expires by now + ttl, one issued later expires after it
+	revoked[username] = now + ttl.count();
+	revoked_size.store(revoked.size(), std::memory_order_release);
+}
+
+/**
+ * @brief Gets the number of accounts whose tokens are currently revoked.
+ *
+ * @return size_t The number of accounts.
+ */
+size_t SessionTokens::revokedCount() const {
+	return revoked_size.load();
+}
+
+/**
+ * @brief Generates a random key, for a server that is not configured with one. Its tokens do not survive a restart.
+ *
+ * @return std::string The key, 32 random bytes.
+ */
+std::string SessionTokens::randomKey() {
+	std::random_device device;
+	std::string key(32, '\0');
+	for (char &c : key)
+		c = static_cast<char>(device() & 0xFF);
+	return key;
+}
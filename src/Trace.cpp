@@ -0,0 +1,170 @@
+/**
+ * @file src/Trace.cpp
+ * @brief Implementation of class Trace
+ *
+ * @details
+ * This file contains the implementation of the Trace class.
+ * A ring is created the first time a thread records, with the size configured at that time, and kept until the
+ * process exits. Only its thread writes it: the span goes into the slot first and `written` is published after, so a
+ * reader knows which slots hold complete spans. A reader copies the slots, then reads `written` again and drops the
+ * spans the thread may have overwritten in the meantime.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#include "carinfo-manager/trace.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+class Ring {
+  public:
+	class Slot {
+	  public:
+		std::atomic<const char *> name{nullptr};
+		std::atomic<int64_t> begin{0};
+		std::atomic<int64_t> end{0};
+	};
+
+	size_t tid;
+	size_t capacity;
+	std::unique_ptr<Slot[]> slots;
+	std::atomic<uint64_t> written{0};
+
+	Ring(size_t tid, size_t capacity) : tid(tid), capacity(capacity), slots(new Slot[capacity]) {}
+};
+
+std::atomic<size_t> spans_per_thread{0};
+std::mutex rings_mtx;
+std::vector<std::unique_ptr<Ring>> rings;
+thread_local Ring *local_ring = nullptr;
+
+std::chrono::steady_clock::time_point epoch() {
+	static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	return start;
+}
+
+// µs with ns precision, the unit of the trace-event format
+std::string format_us(int64_t ns) {
+	char buf[32];
+	std::snprintf(buf, sizeof(buf), "%lld.%03lld", (long long)(ns / 1000), (long long)(ns % 1000));
+	return buf;
+}
+
+}  // namespace
+
+/**
+ * @brief Starts a span.
+ *
+ * @param name The name of the span, a string literal.
+ */
+Trace::Span::Span(const char *name) : name(name), begin(enabled() ? now() : -1) {}
+
+/**
+ * @brief Ends the span and records it.
+ */
+Trace::Span::~Span() {
+	if (begin >= 0)
+		record(name, begin, now());
+}
+
+/**
+ * @brief Sets how many spans each thread keeps. Rings already created keep their size, so this should be called
+ * before the threads start recording.
+ *
+ * @param spansPerThread The size of the ring of each thread, 0 to record nothing.
+ */
+void Trace::configure(size_t spansPerThread) {
+	epoch();
+	spans_per_thread.store(spansPerThread);
+}
+
+/**
+ * @brief Checks whether spans are recorded.
+ *
+ * @return true if spans are recorded, false otherwise.
+ */
+bool Trace::enabled() {
+	return spans_per_thread.load(std::memory_order_relaxed) != 0;
+}
+
+/**
+ * @brief Gets the current time of the trace clock.
+ *
+ * @return int64_t The time in ns since tracing was configured.
+ */
+int64_t Trace::now() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch()).count();
+}
+
+/**
+ * @brief Records a span into the ring of the calling thread.
+ *
+ * @param name The name of the span, a string literal.
+ * @param begin The start of the span, from `now`.
+ * @param end The end of the span, from `now`.
+ */
+void Trace::record(const char *name, int64_t begin, int64_t end) {
+	if (local_ring == nullptr) {
+		size_t capacity = spans_per_thread.load(std::memory_order_relaxed);
+		if (capacity == 0)
+			return;
+		std::lock_guard<std::mutex> lock(rings_mtx);
+		rings.push_back(std::make_unique<Ring>(rings.size() + 1, capacity));
+		local_ring = rings.back().get();
+	}
+	Ring &ring = *local_ring;
+	uint64_t index = ring.written.load(std::memory_order_relaxed);
+	Ring::Slot &slot = ring.slots[index % ring.capacity];
+	slot.name.store(name, std::memory_order_relaxed);
+	slot.begin.store(begin, std::memory_order_relaxed);
+	slot.end.store(end, std::memory_order_relaxed);
+	ring.written.store(index + 1, std::memory_order_release);
+}
+
+/**
+ * @brief Renders the spans kept by all threads as Chrome trace-event JSON. Each thread of the server is a thread of
+ * the trace, and each span a complete ("X") event.
+ *
+ * @return std::string The JSON object, with the events in `traceEvents`.
+ */
+std::string Trace::dumpChrome() {
+	std::vector<Ring *> all;
+	{
+		std::lock_guard<std::mutex> lock(rings_mtx);
+		for (const auto &ring : rings)
+			all.push_back(ring.get());
+	}
+	std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	bool first = true;
+	for (Ring *ring : all) {
+		uint64_t written = ring->written.load(std::memory_order_acquire);
+		uint64_t from = written - std::min<uint64_t>(written, ring->capacity);
+		std::vector<std::pair<const char *, std::pair<int64_t, int64_t>>> spans;
+		for (uint64_t i = from; i < written; i++) {
+			const Ring::Slot &slot = ring->slots[i % ring->capacity];
+			spans.push_back({slot.name.load(std::memory_order_relaxed),
+							 {slot.begin.load(std::memory_order_relaxed), slot.end.load(std::memory_order_relaxed)}});
+		}
+		// the slots of the spans written since, and of the one being written, may hold a mix of two spans
+		uint64_t now_written = ring->written.load(std::memory_order_acquire);
+		uint64_t intact = now_written + 1 > ring->capacity ? now_written + 1 - ring->capacity : 0;
+		for (uint64_t i = std::max(from, intact); i < written; i++) {
+			const auto &span = spans[i - from];
+			out += first ? "" : ",";
+			first = false;
+			out += "{\"name\":\"" + std::string(span.first) + "\",\"ph\":\"X\",\"pid\":1,\"tid\":" +
+				   std::to_string(ring->tid) + ",\"ts\":" + format_us(span.second.first) +
+				   ",\"dur\":" + format_us(span.second.second - span.second.first) + "}";
+		}
+	}
+	out += "]}";
+	return out;
+}
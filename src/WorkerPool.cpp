@@ -0,0 +1,227 @@
+/**
+ * @file src/WorkerPool.cpp
+ * @brief Implementation of class WorkerPool
+ *
+ * @details
+ * This file contains the implementation of the WorkerPool class.
+ * A worker takes the tasks of its own deque first, then steals from the other deques, starting with the next one so
+ * that the thieves spread out. Both take the oldest task of a deque, since a task is a connection waiting to be
+ * served. A worker finding nothing sleeps until a task is queued; `pending` counts the tasks not yet taken, and is only
+ * raised under `sleep_mtx`, so a wakeup is not lost between a worker's last look at the deques and its sleep. Only the
+ * accepting thread enqueues, so `sleep_mtx` is not contended on the way in, and the workers take it only to sleep.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#include "carinfo-manager/workerpool.hpp"
+#include "carinfo-manager/log.hpp"
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/**
+ * @brief Constructs a new WorkerPool object and starts its worker threads.
+ *
+ * @param threadCount The number of worker threads, at least one.
+ * @param maxQueued The most tasks waiting for a worker, 0 for no bound. A task beyond it is rejected, and httplib
+ * closes its connection.
+ * @param pinThreads Whether to pin worker `i` to CPU `i` modulo the number of CPUs.
+ */
+WorkerPool::WorkerPool(size_t threadCount, size_t maxQueued, bool pinThreads)
+	: maxQueued(maxQueued),
+	  next(0),
+	  pending(0),
+	  stopping(false),
+	  executed(0),
+	  steals(0),
+	  rejected(0) {
+	size_t count = threadCount == 0 ? 1 : threadCount;
+	for (size_t i = 0; i < count; i++)
+		workers.push_back(std::make_unique<Worker>());
+	size_t cpus = std::thread::hardware_concurrency();
+	for (size_t i = 0; i < count; i++) {
+		threads.emplace_back(&WorkerPool::run, this, i);
+		if (pinThreads && cpus != 0 && !pinThread(threads.back(), i % cpus))
+			MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::WARN, "[WorkerPool Pin] \n- Worker: " + std::to_string(i) + "\n- CPU: " + std::to_string(i % cpus) + "\n- Status: 0xFF");
+	}
+}
+
+/**
+ * @brief Destroys the WorkerPool object, running the queued tasks first.
+ */
+WorkerPool::~WorkerPool() {
+	shutdown();
+}
+
+/**
+ * @brief Queues a task on the deque of the next worker in turn.
+ *
+ * @param fn The task.
+ * @return true if the task was queued, false if the queue is full or the pool is stopping.
+ */
+bool WorkerPool::enqueue(std::function<void()> fn) {
+	{
+		std::lock_guard<std::mutex> lock(sleep_mtx);
+		if (stopping || (maxQueued != 0 && pending.load() >= maxQueued)) {
+			rejected++;
+			return false;
+		}
+		Worker &worker = *workers[next++ % workers.size()];
+		std::lock_guard<std::mutex> worker_lock(worker.mtx);
+		worker.tasks.push_back(std::move(fn));
+		pending++;
+	}
+	wake.notify_one();
+	return true;
+}
+
+/**
+ * @brief Runs the queued tasks, then stops the worker threads and waits for them to exit. Does nothing the second time.
+ */
+void WorkerPool::shutdown() {
+	{
+		std::lock_guard<std::mutex> lock(sleep_mtx);
+		if (stopping)
+			return;
+		stopping = true;
+	}
+	wake.notify_all();
+	for (auto &thread : threads)
+		thread.join();
+	MyLogger::log("carinfo-manager-logger",
+				  MyLogger::LOG_LEVEL::INFO,
+				  "Worker pool\n- threads: " + std::to_string(threads.size()) +
+					  "\n- tasks: " + std::to_string(executed.load()) +
+					  "\n- steals: " + std::to_string(steals.load()) +
+					  "\n- rejected: " + std::to_string(rejected.load()));
+}
+
+/**
+ * @brief Retrieves the number of worker threads.
+ *
+ * @return The number of worker threads, each owning one deque.
+ */
+size_t WorkerPool::threadCount() const {
+	return threads.size();
+}
+
+/**
+ * @brief Retrieves the number of tasks waiting for a worker.
+ *
+ * @return The number of queued tasks.
+ */
+size_t WorkerPool::queuedCount() const {
+	return pending.load();
+}
+
+/**
+ * @brief Retrieves the number of tasks run.
+ *
+ * @return The number of tasks the workers have finished.
+ */
+size_t WorkerPool::executedCount() const {
+	return executed.load();
+}
+
+/**
+ * @brief Retrieves the number of tasks a worker took from the deque of another.
+ *
+ * @return The number of stolen tasks.
+ */
+size_t WorkerPool::stealCount() const {
+	return steals.load();
+}
+
+/**
+ * @brief Retrieves the number of tasks rejected because the queue was full.
+ *
+ * @return The number of rejected tasks, i.e. of connections closed unanswered.
+ */
+size_t WorkerPool::rejectedCount() const {
+	return rejected.load();
+}
+
+/**
+ * @brief Pins a thread to a CPU.
+ *
+ * @param thread The thread.
+ * @param cpu The index of the CPU.
+ * @return true if the thread was pinned, false if it failed or is not supported on this platform.
+ */
+bool WorkerPool::pinThread(std::thread &thread, size_t cpu) {
+#ifdef _WIN32
+	if (cpu >= sizeof(DWORD_PTR) * 8)
+		return false;
+	return SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << cpu) != 0;
+#elif defined(__linux__)
+	if (cpu >= CPU_SETSIZE)
+		return false;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#else
+	(void)thread;
+	(void)cpu;
+	return false;
+#endif
+}
+
+/**
+ * @brief Takes the oldest task of the worker's own deque, or else steals the oldest task of another deque.
+ *
+ * @param self The index of the worker.
+ * @param task Set to the task taken.
+ * @return true if a task was taken, false if all deques are empty.
+ */
+bool WorkerPool::take(size_t self, std::function<void()> &task) {
+	for (size_t i = 0; i < workers.size(); i++) {
+		Worker &worker = *workers[(self + i) % workers.size()];
+		std::lock_guard<std::mutex> lock(worker.mtx);
+		if (worker.tasks.empty())
+			continue;
+		task = std::move(worker.tasks.front());
+		worker.tasks.pop_front();
+		pending--;
+		if (i != 0)
+			steals++;
+		return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Runs tasks until the pool stops and no task is left.
+ *
+ * @param self The index of the worker served by the calling thread.
+ */
+void WorkerPool::run(size_t self) {
+	std::function<void()> task;
+	while (true) {
+		if (take(self, task)) {
+			try {
+				task();
+			}
+			catch (...) {
+				MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "[WorkerPool Run] \n- Worker: " + std::to_string(self) + "\n- Status: 0xFF");
+			}
+			task = nullptr;
+			executed++;
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(sleep_mtx);
+		wake.wait(lock, [&]() { return stopping || pending.load() != 0; });
+		if (stopping && pending.load() == 0)
+			break;
+	}
+}
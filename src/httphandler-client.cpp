@@ -35,6 +35,105 @@ json ClientHttpHandler::parse_resp_content(const httplib::Response &resp) {
 	return resp_json_obj;
 }
 
+/**
+ * @brief Get the cache of the responses that can be revalidated
+ * 
+ * @return ResponseCache& The cache shared by every request of the client
+ */
+ResponseCache &ClientHttpHandler::response_cache() {
+	static ResponseCache cache(RESPONSE_CACHE_BYTES);
+	return cache;
+}
+
+/**
+ * @brief Get the session tokens issued to the client
+ * 
+ * @return SessionTokenStore& The tokens shared by every request of the client
+ */
+ClientHttpHandler::SessionTokenStore &ClientHttpHandler::session_tokens() {
+	static SessionTokenStore store;
+	return store;
+}
+
+/**
+ * @brief Remember the session token /login issued for an account
+ * 
+ * @param ip The IP address of the server
+ * @param port The port of the server
+ * @param acc The account
+ * @param token The token, or an empty string to forget the token of the account
+ */
+void ClientHttpHandler::store_session_token(const std::string &ip,
+											 int port,
+											 const Account &acc,
+											 const std::string &token) {
+	std::string key = ip + ":" + std::to_string(port) + "\n" + acc.getUsername();
+	SessionTokenStore &store = session_tokens();
+	std::lock_guard<std::mutex> lock(store.mtx);
+	if (token.empty())
+		store.tokens.erase(key);
+	else
+		store.tokens[key] = token;
+}
+
+/**
+ * @brief Add the session token of an account to a request
+ * 
+ * The server accepts the request by the token without checking the password. The username and password hash are sent
+ * as well, so the request still succeeds once the token has expired or been revoked.
+ * 
+ * @param items The multipart form data of the request
+ * @param ip The IP address of the server
+ * @param port The port of the server
+ * @param acc The account sending the request
+ */
+void ClientHttpHandler::add_session_token(httplib::MultipartFormDataItems &items,
+										   const std::string &ip,
+										   int port,
+										   const Account &acc) {
+	std::string key = ip + ":" + std::to_string(port) + "\n" + acc.getUsername();
+	SessionTokenStore &store = session_tokens();
+	std::lock_guard<std::mutex> lock(store.mtx);
+	auto it = store.tokens.find(key);
+	if (it != store.tokens.end())
+		items.push_back({"token", it->second, "", ""});
+}
+
+/**
+ * @brief Send a POST request, revalidating the cached response of the same request
+ * 
+ * If the request is cached, its ETag is sent in `If-None-Match`, and a 304 (Not Modified) answer is turned into a 200
+ * (OK) response with the cached body. A 200 response carrying an ETag is cached.
+ * 
+ * @param client The HTTP client connected to the server
+ * @param path The path of the request
+ * @param items The multipart form data of the request
+ * @param cache_key The key of the request, naming the endpoint and the parameters the response depends on
+ * @return httplib::Result The result of the request
+ */
+httplib::Result ClientHttpHandler::post_cached(httplib::Client &client,
+												const std::string &path,
+												const httplib::MultipartFormDataItems &items,
+												const std::string &cache_key) {
+	std::shared_ptr<const ResponseCache::Entry> cached = response_cache().lookup(cache_key);
+	httplib::Headers headers;
+	if (cached)
+		headers.emplace("If-None-Match", cached->etag);
+	httplib::Result res = client.Post(path, headers, items);
+	if (!res)
+		return res;
+	if (res->status == 304 && cached) {
+		res->status = 200;
+		res->body = cached->body;
+		MyLogger::log("carinfo-manager-logger",
+					  MyLogger::LOG_LEVEL::DEBUG,
+					  "[HTTP Revalidate] " + path + " not modified. \n- ETag: " + cached->etag);
+	}
+	else if (res->status == 200 && res->has_header("ETag"))
+		response_cache().store(cache_key, res->get_header_value("ETag"), res->body);
+	return res;
+}
+
 /**
  * @brief Verify the connection to the server
  * 
@@ -110,8 +209,12 @@ ClientHttpHandler::AccountVerifyResult ClientHttpHandler::handler_login(const st
 							  resp_json_obj["error"].get<std::string>());
 			return AccountVerifyResult::INVALID_RESPONSE;
 		}
-		else
+		else {
 			acc.setAccountType(Account::AccountType(resp_json_obj["account_type"].get<int>()));
+			// a server without session tokens answers without one
+			if (resp_json_obj.contains("token") && resp_json_obj["token"].is_string())
+				store_session_token(ip, port, acc, resp_json_obj["token"].get<std::string>());
+		}
 		MyLogger::log("carinfo-manager-logger",
 					  MyLogger::LOG_LEVEL::DEBUG,
 					  "[HTTP Login] Login to " + ip + ":" + std::to_string(port) +
@@ -174,7 +277,11 @@ ClientHttpHandler::HttpResult ClientHttpHandler::handler_get_carinfo(const std::
 											 {"car_owner", car_owner},
 											 {"car_color", car_color},
 											 {"car_type", car_type}};
-	httplib::Result res = client.Post("/get_carinfo", items);
+	add_session_token(items, ip, port, acc);
+	httplib::Result res = post_cached(client,
+									  "/get_carinfo",
+									  items,
+									  "/get_carinfo\n" + car_id + '\n' + car_owner + '\n' + car_color + '\n' + car_type);
 	if (!res) {
 		MyLogger::log("carinfo-manager-logger",
 					  MyLogger::LOG_LEVEL::ERROR,
@@ -233,7 +340,8 @@ ClientHttpHandler::HttpResult ClientHttpHandler::handler_get_carimg(const std::s
 	httplib::MultipartFormDataItems items = {{"username", acc.getUsername()},
 											 {"passwd_hash", acc.getPasswdHash()},
 											 {"car_img_path", car_img_path}};
-	httplib::Result res = client.Post("/get_carimg", items);
+	add_session_token(items, ip, port, acc);
+	httplib::Result res = post_cached(client, "/get_carimg", items, "/get_carimg\n" + car_img_path);
 	if (!res) {
 		MyLogger::log("carinfo-manager-logger",
 					  MyLogger::LOG_LEVEL::ERROR,
@@ -295,6 +403,7 @@ ClientHttpHandler::HttpResult ClientHttpHandler::handler_add_car(const std::stri
 											 {"car_year", std::to_string(car_year)},
 											 {"car_img", car_img},
 											 {"car_img_type", car_img_type}};
+	add_session_token(items, ip, port, acc);
 	httplib::Result res = client.Post("/add_car", items);
 	if (!res) {
 		MyLogger::log("carinfo-manager-logger",
@@ -338,6 +447,7 @@ ClientHttpHandler::HttpResult ClientHttpHandler::handler_remove_car(const std::s
 
 	httplib::MultipartFormDataItems items = {
 		{"username", acc.getUsername()}, {"passwd_hash", acc.getPasswdHash()}, {"car_id", car_id}};
+	add_session_token(items, ip, port, acc);
 	httplib::Result res = client.Post("/remove_car", items);
 	if (!res) {
 		MyLogger::log("carinfo-manager-logger",
@@ -404,6 +514,7 @@ ClientHttpHandler::HttpResult ClientHttpHandler::handler_update_car(
 											 {"new_car_year", std::to_string(new_car_year)},
 											 {"new_car_img", new_car_img},
 											 {"new_car_img_type", new_car_img_type}};
+	add_session_token(items, ip, port, acc);
 	httplib::Result res = client.Post("/update_car", items);
 	if (!res) {
 		MyLogger::log("carinfo-manager-logger",
@@ -421,6 +532,67 @@ ClientHttpHandler::HttpResult ClientHttpHandler::handler_update_car(
 	return HttpResult(resp.status, resp.body);
 }
 
+/**
+ * @brief Change some fields of a car by sending a request to the server
+ * 
+ * Only the fields set in `patch` are sent, and the image only if `new_car_img_type` is not empty, so the server keeps
+ * the other fields and the stored image.
+ * 
+ * @param ip The IP address of the server
+ * @param port The port of the server
+ * @param acc The account to be verified
+ * @param car_id The ID of the car
+ * @param patch The fields to change, `img_path` is ignored
+ * @param new_car_img The new image of the car
+ * @param new_car_img_type The type of the new image, empty to keep the image
+ * 
+ * @return HttpResult The result of the HTTP request
+ */
+ClientHttpHandler::HttpResult ClientHttpHandler::handler_patch_car(const std::string &ip,
+																   const int port,
+																   const Account &acc,
+																   const std::string &car_id,
+																   const CarPatch &patch,
+																   const std::string &new_car_img,
+																   const std::string &new_car_img_type) {
+	httplib::Client client(ip, port);
+	client.set_read_timeout(5);
+
+	httplib::MultipartFormDataItems items = {{"username", acc.getUsername()},
+											 {"passwd_hash", acc.getPasswdHash()},
+											 {"car_id", car_id}};
+	add_session_token(items, ip, port, acc);
+	if (patch.id)
+		items.push_back({"new_car_id", *patch.id});
+	if (patch.owner)
+		items.push_back({"new_car_owner", *patch.owner});
+	if (patch.type)
+		items.push_back({"new_car_type", *patch.type});
+	if (patch.color)
+		items.push_back({"new_car_color", *patch.color});
+	if (patch.year)
+		items.push_back({"new_car_year", std::to_string(*patch.year)});
+	if (!new_car_img_type.empty()) {
+		items.push_back({"new_car_img", new_car_img});
+		items.push_back({"new_car_img_type", new_car_img_type});
+	}
+	httplib::Result res = client.Post("/patch_car", items);
+	if (!res) {
+		MyLogger::log("carinfo-manager-logger",
+					  MyLogger::LOG_LEVEL::ERROR,
+					  "[HTTP Patch Car] Failed to connect to " + ip + ":" + std::to_string(port) +
+						  ". \n- Error: " + std::to_string((int)res.error()));
+		return HttpResult(0, std::to_string((int)(res.error())));
+	}
+	httplib::Response resp = res.value();
+	MyLogger::log("carinfo-manager-logger",
+				  MyLogger::LOG_LEVEL::DEBUG,
+				  "[HTTP Patch Car] Patch car from " + ip + ":" + std::to_string(port) +
+					  ". \n- Status Code: " + std::to_string(resp.status) +
+					  "\n- Response Body: " + resp.body);
+	return HttpResult(resp.status, resp.body);
+}
+
 /**
  * @brief Search an account by sending a request to the server
  * 
@@ -439,6 +611,7 @@ ClientHttpHandler::HttpResult ClientHttpHandler::handler_search_account(
 	httplib::MultipartFormDataItems items = {{"username", acc.getUsername()},
 											 {"passwd_hash", acc.getPasswdHash()},
 											 {"target_username", search_username}};
+	add_session_token(items, ip, port, acc);
 	httplib::Result res = client.Post("/get_accountinfo", items);
 	if (!res) {
 		MyLogger::log("carinfo-manager-logger",
@@ -495,6 +668,7 @@ ClientHttpHandler::HttpResult ClientHttpHandler::handler_get_all_accounts(const
 
 	httplib::MultipartFormDataItems items = {{"username", acc.getUsername()},
 											 {"passwd_hash", acc.getPasswdHash()}};
+	add_session_token(items, ip, port, acc);
 	httplib::Result res = client.Post("/get_all_account", items);
 	if (!res) {
 		MyLogger::log("carinfo-manager-logger",
@@ -562,6 +736,7 @@ ClientHttpHandler::HttpResult ClientHttpHandler::handler_add_account(
 		{"target_username", new_username},
 		{"target_passwd_hash", new_passwd_hash},
 		{"target_account_type", std::to_string((int)new_accounttype)}};
+	add_session_token(items, ip, port, acc);
 	httplib::Result res = client.Post("/add_account", items);
 	if (!res) {
 		MyLogger::log("carinfo-manager-logger",
@@ -604,6 +779,7 @@ ClientHttpHandler::HttpResult ClientHttpHandler::handler_remove_account(
 	httplib::MultipartFormDataItems items = {{"username", acc.getUsername()},
 											 {"passwd_hash", acc.getPasswdHash()},
 											 {"target_username", target_username}};
+	add_session_token(items, ip, port, acc);
 	httplib::Result res = client.Post("/remove_account", items);
 	if (!res) {
 		MyLogger::log("carinfo-manager-logger",
@@ -660,6 +836,7 @@ ClientHttpHandler::HttpResult ClientHttpHandler::handler_update_account(
 		{"new_username", new_username},
 		{"new_passw_hash", new_passwd_hash},
 		{"new_account_type", std::to_string((int)new_accounttype)}};
+	add_session_token(items, ip, port, acc);
 	httplib::Result res = client.Post("/update_account", items);
 	if (!res) {
 		MyLogger::log("carinfo-manager-logger",
@@ -713,12 +890,15 @@ ClientHttpHandler::HttpResult ClientHttpHandler::handler_change_password(
 		return HttpResult(0, std::to_string((int)(res.error())));
 	}
 	httplib::Response resp = res.value();
-	if (resp.status == 200)
+	if (resp.status == 200) {
+		// the server revokes the tokens of the account, the next login issues a new one
+		store_session_token(ip, port, acc, "");
 		MyLogger::log("carinfo-manager-logger",
 					  MyLogger::LOG_LEVEL::DEBUG,
 					  "[HTTP Change Password] Change password from " + ip + ":" +
 						  std::to_string(port) + ". \n- Status Code: " +
 						  std::to_string(resp.status) + "\n- Response Body: " + resp.body);
+	}
 	else
 		MyLogger::log("carinfo-manager-logger",
 					  MyLogger::LOG_LEVEL::ERROR,
@@ -14,36 +14,389 @@
  */
 
 #include "carinfo-manager/httphandler-server.hpp"
+#include <cctype>
+#include <chrono>
+#include <ctime>
+#include <filesystem>
 #include <sstream>
+#include <unordered_set>
 #include "carinfo-manager/base64.hpp"
+#include "carinfo-manager/hash.hpp"
 #include "carinfo-manager/log.hpp"
+#include "carinfo-manager/mappedfile.hpp"
+#include "carinfo-manager/requestparams.hpp"
+#include "carinfo-manager/trace.hpp"
 #include "json/json.hpp"
 
 using json = nlohmann::json;
 
+namespace {
+
+// whether a string is padded base64, which Base64::decode expects
+bool is_base64(const std::string &text) {
+	if (text.size() % 4 != 0)
+		return false;
+	size_t padding = 0;
+	while (padding < 2 && padding < text.size() && text[text.size() - 1 - padding] == '=')
+		padding++;
+	for (size_t i = 0; i < text.size() - padding; i++) {
+		char c = text[i];
+		if (!std::isalnum(static_cast<unsigned char>(c)) && c != '+' && c != '/')
+			return false;
+	}
+	return true;
+}
+
+}  // namespace
+
 /**
  * @brief Construct a new ServerHttpHandler object
  * 
  * @param accountpool The AccountPool object for managing user accounts
  * @param carpool The CarPool object for managing car information
  * @param imgDir The directory path for storing car images
+ * @param imgCacheBytes The memory budget of the image cache, 0 to disable it
+ * @param maxUploadBytes The largest body accepted by /add_car, /update_car and /patch_car
+ * @param imgWriter The ImageWriter storing uploaded images, or nullptr to store them on the request thread
+ * @param imgFanout The number of directory levels of the image directory, see ImageStore
+ * @param imgPack The ImagePack storing new images, or nullptr to store them as files
+ * @param sessions The SessionTokens issuing the tokens of /login, or nullptr to accept passwords only
+ * @param jsonIndent The indent of the JSON responses, 0 for compact JSON
+ * @param saveCars Persists the car data after a change, called with the cars locked so that no other change
+ *                 interleaves with the save, or nullptr to keep the changes in memory
+ */
+ServerHttpHandler::ServerHttpHandler(AccountPool &accountpool,
+									 CarPool &carpool,
+									 std::string imgDir,
+									 size_t imgCacheBytes,
+									 size_t maxUploadBytes,
+									 ImageWriter *imgWriter,
+									 size_t imgFanout,
+									 ImagePack *imgPack,
+									 SessionTokens *sessions,
+									 size_t jsonIndent,
+									 std::function<void()> saveCars)
+	: accountpool(accountpool),
+	  carpool(carpool),
+	  imgDir(imgDir),
+	  imgpack(imgPack),
+	  imagestore(imgDir, imgWriter, imgFanout, imgPack),
+	  imagecache(imgCacheBytes),
+	  maxUploadBytes(maxUploadBytes),
+	  etag_epoch(std::to_string(std::chrono::system_clock::now().time_since_epoch().count())),
+	  sessions(sessions),
+	  json_indent(jsonIndent),
+	  save_cars(std::move(saveCars)) {}
+
+/**
+ * @brief Get the image cache, e.g. to report its statistics
+ * 
+ * @return const ImageCache& The image cache of /get_carimg
+ */
+const ImageCache &ServerHttpHandler::imageCache() const {
+	return imagecache;
+}
+
+/**
+ * @brief Get the image store, e.g. to report its statistics
+ * 
+ * @return const ImageStore& The image store of the uploads
+ */
+const ImageStore &ServerHttpHandler::imageStore() const {
+	return imagestore;
+}
+
+/**
+ * @brief Get the image store, e.g. to remove the images no car references
+ * 
+ * @return ImageStore& The image store of the uploads
+ */
+ImageStore &ServerHttpHandler::imageStore() {
+	return imagestore;
+}
+
+/**
+ * @brief Get the lock held exclusively by every change of the cars and shared by the queries, e.g. to keep the image
+ * references still
+ * 
+ * @return std::shared_mutex& The car lock
+ */
+std::shared_mutex &ServerHttpHandler::carLock() {
+	return car_mtx;
+}
+
+/**
+ * @brief Read a multipart POST body, streaming the image part to an upload
+ * 
+ * The parts are read as they arrive. The image part goes chunk by chunk to the temporary file of `upload`, the other
+ * parts are collected into `fields` the way httplib fills `req.files`, and the image part is recorded there with an
+ * empty value. Reading stops as soon as the parts exceed the upload limit.
+ * 
+ * @param req The HTTP request object
+ * @param content_reader The reader of the request body
+ * @param img_field The name of the image part
+ * @param fields Set to the parts, the image part without its content
+ * @param upload Set to the upload of the image part, left empty if there is none
+ * @return int The HTTP status of the reading: 200 (OK), 400 (Bad Request) if the body is not a valid multipart body or
+ * the upload cannot be written, 413 (Payload Too Large) if it exceeds the upload limit
+ */
+int ServerHttpHandler::read_multipart(const httplib::Request &req,
+									  const httplib::ContentReader &content_reader,
+									  const std::string &img_field,
+									  httplib::MultipartFormDataMap &fields,
+									  std::optional<ImageStore::Upload> &upload) {
+	Trace::Span span("ServerHttpHandler::read_multipart");
+	if (!req.is_multipart_form_data())
+		return 400;
+	std::string *value = nullptr;
+	bool is_img = false;
+	size_t received = 0;
+	bool too_large = false;
+	bool read = content_reader(
+		[&](const httplib::MultipartFormData &part) {
+			is_img = part.name == img_field;
+			if (is_img)
+				upload.emplace(imagestore);
+			value = &fields.emplace(part.name, part)->second.content;
+			return true;
+		},
+		[&](const char *data, size_t length) {
+			received += length;
+			if (received > maxUploadBytes) {
+				too_large = true;
+				return false;
+			}
+			if (is_img)
+				return upload->write(data, length);
+			value->append(data, length);
+			return true;
+		});
+	// httplib itself rejects a body whose Content-Length is over the limit, see server-main
+	if (too_large || (!read && req.get_header_value_u64("Content-Length") > maxUploadBytes))
+		return 413;
+	return read ? 200 : 400;
+}
+
+/**
+ * @brief Open an image file for a response without copying it
+ *
+ * Images the cache accepts are served from the cache. Larger ones are mapped into memory, so their bytes go from the
+ * page cache to the socket without passing through a buffer of their own. Images of the pack are always served from
+ * the mapping of their segment, which costs no system call once the segment is mapped.
+ *
+ * @param img_path The path of the image file
+ * @param img_data Set to the first byte of the image
+ * @param img_size Set to the size of the image
+ * @return std::shared_ptr<const void> The owner of the bytes, which must outlive the response, or nullptr if the file
+ * cannot be read
+ */
+std::shared_ptr<const void> ServerHttpHandler::open_image(const std::string &img_path,
+														  const char *&img_data,
+														  size_t &img_size) const {
+	Trace::Span span("ServerHttpHandler::open_image");
+	if (imgpack != nullptr && imgpack->owns(img_path)) {
+		int64_t mtime = 0;
+		return imgpack->read(img_path, img_data, img_size, mtime);
+	}
+	std::error_code ec;
+	uintmax_t file_size = std::filesystem::file_size(img_path, ec);
+	if (ec)
+		return nullptr;
+	if (imagecache.accepts(file_size)) {
+		std::shared_ptr<const std::string> img = imagecache.get(img_path);
+		if (!img)
+			return nullptr;
+		img_data = img->data();
+		img_size = img->size();
+		return img;
+	}
+	auto img = std::make_shared<const MappedFile>(img_path);
+	if (!img->isOpen())
+		return nullptr;
+	img_data = img->data();
+	img_size = img->size();
+	return img;
+}
+
+/**
+ * @brief Get the indent to pass to nlohmann::json::dump for a response
+ * 
+ * @return int The indent of the JSON responses, -1 for compact JSON
+ */
+int ServerHttpHandler::dump_indent() const {
+	return json_indent == 0 ? -1 : int(json_indent);
+}
+
+/**
+ * @brief Persist the car data after a change. Must be called with car_mtx held, so that the save reads the cars and
+ * their dirty segments while no other change is under way, and two saves never write the same files at once.
+ */
+void ServerHttpHandler::persist_cars() {
+	if (save_cars)
+		save_cars();
+}
+
+/**
+ * @brief Compute the ETag of a car query
+ * 
+ * The ETag names the query and the version of the carpool, so it stays the same until a car is changed. The version
+ * is read before the query runs: a change racing with the query can only make the ETag older than the result, which
+ * costs the client one more download, never a stale result.
+ * 
+ * @param car_id The car ID of the query
+ * @param car_owner The car owner of the query
+ * @param car_color The car color of the query
+ * @param car_type The car type of the query
+ * @return std::string The quoted ETag
+ */
+std::string ServerHttpHandler::query_etag(const std::string &car_id,
+										  const std::string &car_owner,
+										  const std::string &car_color,
+										  const std::string &car_type) const {
+	std::string query = car_id + '\0' + car_owner + '\0' + car_color + '\0' + car_type;
+	return "\"" + etag_epoch + "-" + std::to_string(carpool.getVersion()) + "-" +
+		   Hash(query, "").getHash().substr(0, 16) + "\"";
+}
+
+/**
+ * @brief Compute the validators of an image file
+ * 
+ * Images stored by the ImageStore are named by the SHA-256 of their bytes, which is used as a strong ETag. Images with
+ * another name get a weak ETag from their size and modification time. Images of the pack take their modification time
+ * from their record.
+ * 
+ * @param img_path The path of the image file
+ * @param etag Set to the quoted ETag
+ * @param last_modified Set to the modification time of the file, as an HTTP date
+ * @return bool True if the file exists, false otherwise
  */
-ServerHttpHandler::ServerHttpHandler(AccountPool &accountpool, CarPool &carpool, std::string imgDir)
-	: accountpool(accountpool), carpool(carpool), imgDir(imgDir) {}
+bool ServerHttpHandler::image_validators(const std::string &img_path,
+										 std::string &etag,
+										 std::string &last_modified) const {
+	namespace fs = std::filesystem;
+	std::time_t mtime = 0;
+	uintmax_t file_size = 0;
+	fs::file_time_type file_time;
+	if (imgpack != nullptr && imgpack->owns(img_path)) {
+		const char *img_data = nullptr;
+		size_t img_size = 0;
+		int64_t img_mtime = 0;
+		if (!imgpack->read(img_path, img_data, img_size, img_mtime))
+			return false;
+		mtime = std::time_t(img_mtime);
+		file_size = img_size;
+	}
+	else {
+		std::error_code ec;
+		file_size = fs::file_size(img_path, ec);
+		if (ec)
+			return false;
+		file_time = fs::last_write_time(img_path, ec);
+		if (ec)
+			return false;
+		// file_clock has no portable conversion before clock_cast is available everywhere, go through both clocks' now
+		mtime = std::chrono::system_clock::to_time_t(
+			std::chrono::system_clock::now() + std::chrono::duration_cast<std::chrono::system_clock::duration>(
+												   file_time - fs::file_time_type::clock::now()));
+	}
+	std::tm tm{};
+#ifdef _WIN32
+	gmtime_s(&tm, &mtime);
+#else
+	gmtime_r(&mtime, &tm);
+#endif
+	char date[64];
+	std::strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	last_modified = date;
+
+	std::string stem = fs::path(img_path).stem().string();
+	bool is_digest = stem.size() == 64;
+	for (size_t i = 0; is_digest && i < stem.size(); i++)
+		is_digest = std::isxdigit(static_cast<unsigned char>(stem[i])) != 0;
+	if (is_digest)
+		etag = "\"" + stem + "\"";
+	else
+		etag = "W/\"" + std::to_string(file_size) + "-" +
+			   std::to_string(file_time.time_since_epoch().count()) + "\"";
+	return true;
+}
 
 /**
- * @brief Parse the POST body of an HTTP request
+ * @brief Check whether the client already holds the current representation
  * 
- * This function parses the POST body of an HTTP request and returns the content as a JSON object.
+ * `If-None-Match` is compared with the weak comparison of RFC 9110 and takes precedence. Otherwise `If-Modified-Since`
+ * matches when it repeats `last_modified` exactly, as clients send back the date they were given.
  * 
  * @param req The HTTP request object
- * @return json The parsed JSON object containing the POST body content
+ * @param etag The current ETag
+ * @param last_modified The current modification time as an HTTP date, empty if there is none
+ * @return bool True if the response can be 304 (Not Modified), false otherwise
  */
-json ServerHttpHandler::parse_post_body(const httplib::Request &req) const {
-	json j;
-	for (const auto &file : req.files)
-		j[file.first] = file.second.content;
-	return j;
+bool ServerHttpHandler::not_modified(const httplib::Request &req,
+									 const std::string &etag,
+									 const std::string &last_modified) const {
+	auto opaque = [](const std::string &tag) { return tag.compare(0, 2, "W/") == 0 ? tag.substr(2) : tag; };
+	if (req.has_header("If-None-Match")) {
+		std::string tags = req.get_header_value("If-None-Match");
+		size_t begin = 0;
+		while (begin < tags.size()) {
+			size_t end = tags.find(',', begin);
+			if (end == std::string::npos)
+				end = tags.size();
+			std::string tag = tags.substr(begin, end - begin);
+			tag.erase(0, tag.find_first_not_of(" \t"));
+			tag.erase(tag.find_last_not_of(" \t") + 1);
+			if (tag == "*" || opaque(tag) == opaque(etag))
+				return true;
+			begin = end + 1;
+		}
+		return false;
+	}
+	return !last_modified.empty() && req.get_header_value("If-Modified-Since") == last_modified;
+}
+
+/**
+ * @brief Check that a request carries credentials: a session token, or a username and a password hash
+ *
+ * @param params The parameters of the request
+ * @param session Set to the username given in the request, which `authenticate` replaces by the one of a valid token
+ * @return bool True if the request carries credentials, false otherwise
+ */
+bool ServerHttpHandler::read_credentials(const RequestParams &params, SessionTokens::Session &session) const {
+	session.username = params.get("username");
+	session.type = Account::AccountType::NONETYPE;
+	return (sessions && params.contains({"token"})) || params.contains({"username", "passwd_hash"});
+}
+
+/**
+ * @brief Authenticate the sender of a request
+ *
+ * A valid session token is accepted without looking the account up. Otherwise, e.g. once the token has expired or
+ * been revoked, the username and password hash are verified against the account pool, if the request carries them.
+ *
+ * @param params The parameters of the request, checked by `read_credentials`
+ * @param session Set to the authenticated account
+ * @param with_type Whether the account type is needed; a token carries it, a password costs another lookup
+ * @return AccountPool::AccountVerifyResult SUCCESS, or why the request is not authenticated
+ */
+AccountPool::AccountVerifyResult ServerHttpHandler::authenticate(const RequestParams &params,
+																 SessionTokens::Session &session,
+																 bool with_type) const {
+	Trace::Span span("ServerHttpHandler::authenticate");
+	if (sessions && params.contains({"token"})) {
+		SessionTokens::Session token_session;
+		if (sessions->verify(params.get("token"), token_session)) {
+			session = token_session;
+			return AccountPool::AccountVerifyResult::SUCCESS;
+		}
+	}
+	if (!params.contains({"username", "passwd_hash"}))
+		return AccountPool::AccountVerifyResult::WRONG_PASSWORD;
+	session.username = params.get("username");
+	auto result = accountpool.verifyAccount(session.username, params.get("passwd_hash"));
+	if (result == AccountPool::AccountVerifyResult::SUCCESS && with_type)
+		session.type = accountpool.getAccountType(session.username);
+	return result;
 }
 
 /**
@@ -57,6 +410,7 @@ json ServerHttpHandler::parse_post_body(const httplib::Request &req) const {
  */
 void ServerHttpHandler::handler_test_connection(const httplib::Request &req,
 												httplib::Response &res) const {
+	Trace::Span span("ServerHttpHandler::handler_test_connection");
 	std::string ip = req.remote_addr;
 	int port = req.remote_port;
 	res.set_content("Connection is OK", "text/plain");
@@ -74,10 +428,11 @@ void ServerHttpHandler::handler_test_connection(const httplib::Request &req,
  * @param res The HTTP response object to send back to the client.
  */
 void ServerHttpHandler::handler_login(const httplib::Request &req, httplib::Response &res) const {
+	Trace::Span span("ServerHttpHandler::handler_login");
 	std::string ip = req.remote_addr;
 	int port = req.remote_port;
-	json params = parse_post_body(req);
-	if (params.find("username") == params.end() || params.find("passwd_hash") == params.end()) {
+	RequestParams params(req.files);
+	if (!params.contains({"username", "passwd_hash"})) {
 		res.set_content("Bad Request", "text/plain");
 		res.status = 400;
 		MyLogger::log(
@@ -86,8 +441,8 @@ void ServerHttpHandler::handler_login(const httplib::Request &req, httplib::Resp
 			"[HTTP Login] from " + ip + ":" + std::to_string(port) + ". Status: 400 (Bad Request)");
 		return;
 	}
-	std::string username = std::string(params["username"]);
-	std::string passwd = std::string(params["passwd_hash"]);
+	const std::string &username = params.get("username");
+	const std::string &passwd = params.get("passwd_hash");
 
 	auto result = accountpool.verifyAccount(username, passwd);
 	if (result == AccountPool::AccountVerifyResult::SUCCESS) {
@@ -106,7 +461,9 @@ void ServerHttpHandler::handler_login(const httplib::Request &req, httplib::Resp
 			j["username"] = acc.getUsername();
 			j["passwd_hash"] = acc.getPasswdHash();
 			j["account_type"] = int(acc.getAccountType());
-			res.set_content(j.dump(4), "application/json");
+			if (sessions)
+				j["token"] = sessions->issue(acc.getUsername(), acc.getAccountType());
+			res.set_content(j.dump(dump_indent()), "application/json");
 			res.status = 200;
 			MyLogger::log("carinfo-manager-logger",
 						  MyLogger::LOG_LEVEL::INFO,
@@ -144,11 +501,11 @@ void ServerHttpHandler::handler_login(const httplib::Request &req, httplib::Resp
  */
 void ServerHttpHandler::handler_change_password(const httplib::Request &req,
 												httplib::Response &res) {
+	Trace::Span span("ServerHttpHandler::handler_change_password");
 	std::string ip = req.remote_addr;
 	int port = req.remote_port;
-	json params = parse_post_body(req);
-	if (params.find("username") == params.end() || params.find("old_passwd_hash") == params.end() ||
-		params.find("new_passwd_hash") == params.end()) {
+	RequestParams params(req.files);
+	if (!params.contains({"username", "old_passwd_hash", "new_passwd_hash"})) {
 		res.set_content("Bad Request", "text/plain");
 		res.status = 400;
 		MyLogger::log("carinfo-manager-logger",
@@ -157,9 +514,9 @@ void ServerHttpHandler::handler_change_password(const httplib::Request &req,
 						  ". Status: 400 (Bad Request)");
 		return;
 	}
-	std::string username = std::string(params["username"]);
-	std::string old_passwd_hash = std::string(params["old_passwd_hash"]);
-	std::string new_passwd_hash = std::string(params["new_passwd_hash"]);
+	const std::string &username = params.get("username");
+	const std::string &old_passwd_hash = params.get("old_passwd_hash");
+	const std::string &new_passwd_hash = params.get("new_passwd_hash");
 
 	try {
 		auto result = accountpool.verifyAccount(username, old_passwd_hash);
@@ -168,6 +525,9 @@ void ServerHttpHandler::handler_change_password(const httplib::Request &req,
 			Account new_acc = Account(username, new_passwd_hash, old_acc.getAccountType());
 			int status_code = accountpool.updateAccount(old_acc, new_acc);
 			if (status_code == 0) {
+				// sessions opened with the old password end with it
+				if (sessions)
+					sessions->revoke(username);
 				res.set_content("Password Changed", "text/plain");
 				res.status = 200;
 				MyLogger::log("carinfo-manager-logger",
@@ -228,17 +588,21 @@ void ServerHttpHandler::handler_change_password(const httplib::Request &req,
 /**
  * Handles the HTTP request for retrieving car information.
  *
+ * The response carries the ETag of the query. A request validated by it is answered with 304 (Not Modified) without
+ * running the query.
+ *
  * @param req The HTTP request object containing the request parameters.
  * @param res The HTTP response object to be sent back to the client.
  */
 void ServerHttpHandler::handler_get_carinfo(const httplib::Request &req,
 											httplib::Response &res) const {
+	Trace::Span span("ServerHttpHandler::handler_get_carinfo");
 	std::string ip = req.remote_addr;
 	int port = req.remote_port;
-	json params = parse_post_body(req);
-	if (params.find("username") == params.end() || params.find("passwd_hash") == params.end() ||
-		params.find("car_id") == params.end() || params.find("car_owner") == params.end() ||
-		params.find("car_color") == params.end() || params.find("car_type") == params.end()) {
+	RequestParams params(req.files);
+	SessionTokens::Session session;
+	if (!read_credentials(params, session) ||
+		!params.contains({"car_id", "car_owner", "car_color", "car_type"})) {
 		res.set_content("Bad Request", "text/plain");
 		res.status = 400;
 		MyLogger::log("carinfo-manager-logger",
@@ -247,18 +611,33 @@ void ServerHttpHandler::handler_get_carinfo(const httplib::Request &req,
 						  ". Status: 400 (Bad Request)");
 		return;
 	}
-	std::string username = std::string(params["username"]);
-	std::string passwd_hash = std::string(params["passwd_hash"]);
-	std::string car_id = std::string(params["car_id"]);
-	std::string car_owner = std::string(params["car_owner"]);
-	std::string car_color = std::string(params["car_color"]);
-	std::string car_type = std::string(params["car_type"]);
+	const std::string &username = session.username;
+	const std::string &passwd_hash = params.get("passwd_hash");
+	const std::string &car_id = params.get("car_id");
+	const std::string &car_owner = params.get("car_owner");
+	const std::string &car_color = params.get("car_color");
+	const std::string &car_type = params.get("car_type");
 	try {
-		auto result = accountpool.verifyAccount(username, passwd_hash);
+		auto result = authenticate(params, session);
 		if (result == AccountPool::AccountVerifyResult::SUCCESS) {
-			CarPool cars = carpool.getCar(car_id, car_color, car_owner, car_type);
-			std::ostringstream os;
-			int status_code = cars.save(os);
+			std::string etag = query_etag(car_id, car_owner, car_color, car_type);
+			res.set_header("ETag", etag);
+			if (not_modified(req, etag)) {
+				res.status = 304;
+				MyLogger::log("carinfo-manager-logger",
+							  MyLogger::LOG_LEVEL::INFO,
+							  "[HTTP Get Car Info] from " + ip + ":" + std::to_string(port) +
+								  ".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
+								  "\n- Status: 304 (Not Modified)");
+				return;
+			}
+			std::string body;
+			size_t found = 0;
+			int status_code;
+			{
+				std::shared_lock<std::shared_mutex> lock(car_mtx);
+				status_code = carpool.saveCar(car_id, car_color, car_owner, car_type, body, json_indent, found);
+			}
 			if (status_code != 0) {
 				std::string msg =
 					"Internal Server Error, status code: " + std::to_string(status_code);
@@ -272,13 +651,13 @@ void ServerHttpHandler::handler_get_carinfo(const httplib::Request &req,
 								  std::to_string(status_code));
 				return;
 			}
-			res.set_content(os.str(), "application/json");
+			res.set_content(std::move(body), "application/json");
 			res.status = 200;
 			MyLogger::log("carinfo-manager-logger",
 						  MyLogger::LOG_LEVEL::INFO,
 						  "[HTTP Get Car Info] from " + ip + ":" + std::to_string(port) +
 							  ".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
-							  "\n- Status: 200 (OK)");
+							  "\n- Found: " + std::to_string(found) + "\n- Status: 200 (OK)");
 		}
 		else if (result == AccountPool::AccountVerifyResult::ACCOUNT_NOT_FOUND ||
 				 result == AccountPool::AccountVerifyResult::WRONG_PASSWORD) {
@@ -311,24 +690,139 @@ void ServerHttpHandler::handler_get_carinfo(const httplib::Request &req,
 	}
 }
 
+/**
+ * Handles the HTTP request for retrieving many cars by their IDs.
+ *
+ * The field `car_ids` is a JSON array of at most MAX_CAR_IDS car IDs. The cars found are returned in the format of
+ * /get_carinfo, looked up by ID without running a query, and IDs without a car are left out. The response carries an
+ * ETag like the one of /get_carinfo.
+ *
+ * @param req The HTTP request object containing the request parameters.
+ * @param res The HTTP response object to be sent back to the client.
+ */
+void ServerHttpHandler::handler_get_cars(const httplib::Request &req, httplib::Response &res) const {
+	Trace::Span span("ServerHttpHandler::handler_get_cars");
+	std::string ip = req.remote_addr;
+	int port = req.remote_port;
+	RequestParams params(req.files);
+	SessionTokens::Session session;
+	json car_ids = json::parse(params.get("car_ids"), nullptr, false);
+	bool valid = car_ids.is_array() && car_ids.size() <= MAX_CAR_IDS;
+	for (size_t i = 0; valid && i < car_ids.size(); i++)
+		valid = car_ids[i].is_string();
+	if (!read_credentials(params, session) || !valid) {
+		res.set_content("Bad Request", "text/plain");
+		res.status = 400;
+		MyLogger::log("carinfo-manager-logger",
+					  MyLogger::LOG_LEVEL::WARN,
+					  "[HTTP Get Cars] from " + ip + ":" + std::to_string(port) +
+						  ". Status: 400 (Bad Request)");
+		return;
+	}
+	const std::string &username = session.username;
+	const std::string &passwd_hash = params.get("passwd_hash");
+	// each car once, in the order of the request
+	std::vector<std::string> ids;
+	std::unordered_set<std::string> seen;
+	for (const json &car_id : car_ids) {
+		if (seen.insert(car_id.get<std::string>()).second)
+			ids.push_back(car_id.get<std::string>());
+	}
+
+	try {
+		auto result = authenticate(params, session);
+		if (result == AccountPool::AccountVerifyResult::SUCCESS) {
+			std::string etag = query_etag(json(ids).dump(), "", "", "");
+			res.set_header("ETag", etag);
+			if (not_modified(req, etag)) {
+				res.status = 304;
+				MyLogger::log("carinfo-manager-logger",
+							  MyLogger::LOG_LEVEL::INFO,
+							  "[HTTP Get Cars] from " + ip + ":" + std::to_string(port) +
+								  ".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
+								  "\n- Car IDs: " + std::to_string(ids.size()) + "\n- Status: 304 (Not Modified)");
+				return;
+			}
+			std::string body;
+			size_t found = 0;
+			int status_code;
+			{
+				std::shared_lock<std::shared_mutex> lock(car_mtx);
+				status_code = carpool.saveById(ids, body, json_indent, found);
+			}
+			if (status_code != 0) {
+				std::string msg =
+					"Internal Server Error, status code: " + std::to_string(status_code);
+				res.set_content(msg, "text/plain");
+				res.status = 500;
+				MyLogger::log("carinfo-manager-logger",
+							  MyLogger::LOG_LEVEL::WARN,
+							  "[HTTP Get Cars] from " + ip + ":" + std::to_string(port) +
+								  ".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
+								  "\n- Status: 500 (Internal Server Error) \n- Status Code: " +
+								  std::to_string(status_code));
+				return;
+			}
+			res.set_content(std::move(body), "application/json");
+			res.status = 200;
+			MyLogger::log("carinfo-manager-logger",
+						  MyLogger::LOG_LEVEL::INFO,
+						  "[HTTP Get Cars] from " + ip + ":" + std::to_string(port) +
+							  ".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
+							  "\n- Car IDs: " + std::to_string(ids.size()) +
+							  "\n- Found: " + std::to_string(found) + "\n- Status: 200 (OK)");
+		}
+		else if (result == AccountPool::AccountVerifyResult::ACCOUNT_NOT_FOUND ||
+				 result == AccountPool::AccountVerifyResult::WRONG_PASSWORD) {
+			res.set_content("Forbidden", "text/plain");
+			res.status = 403;
+			MyLogger::log("carinfo-manager-logger",
+						  MyLogger::LOG_LEVEL::WARN,
+						  "[HTTP Get Cars] from " + ip + ":" + std::to_string(port) +
+							  ".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
+							  "\n- Status: 403 (Forbidden)");
+		}
+		else {
+			res.set_content("Internal Server Error", "text/plain");
+			res.status = 500;
+			MyLogger::log("carinfo-manager-logger",
+						  MyLogger::LOG_LEVEL::WARN,
+						  "[HTTP Get Cars] from " + ip + ":" + std::to_string(port) +
+							  ".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
+							  "\n- Status: 500 (Internal Server Error)");
+		}
+	}
+	catch (std::exception &e) {
+		res.set_content("Internal Server Error", "text/plain");
+		res.status = 500;
+		MyLogger::log("carinfo-manager-logger",
+					  MyLogger::LOG_LEVEL::WARN,
+					  "[HTTP Get Cars] from " + ip + ":" + std::to_string(port) +
+						  ".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
+						  "\n- Status: 500 (Internal Server Error) \n- Exception: " + e.what());
+	}
+}
+
 /**
  * Handles the HTTP request for retrieving a car image.
  *
  * This function is responsible for handling the POST request to retrieve a car image. It verifies the user's account
- * credentials, checks if the specified car image file exists, and returns the image content in base64 format if the
- * file is found. If the file is not found or if there is an error during the account verification process, appropriate
- * HTTP response status codes and content are set.ww
+ * credentials, checks if the specified car image file exists, and returns the image content if the file is found. A
+ * `Range` header is honoured, so an interrupted download can be resumed, and a request validated by the ETag or the
+ * modification time of the image is answered with 304 (Not Modified). If the file is not found or if there is an
+ * error during the account verification process, appropriate HTTP response status codes and content are set.
  *
  * @param req The HTTP request object containing the request parameters.
  * @param res The HTTP response object to be populated with the response data.
  */
 void ServerHttpHandler::handler_get_carimg(const httplib::Request &req,
 										   httplib::Response &res) const {
+	Trace::Span span("ServerHttpHandler::handler_get_carimg");
 	std::string ip = req.remote_addr;
 	int port = req.remote_port;
-	json params = parse_post_body(req);
-	if (params.find("username") == params.end() || params.find("passwd_hash") == params.end() ||
-		params.find("car_img_path") == params.end()) {
+	RequestParams params(req.files);
+	SessionTokens::Session session;
+	if (!read_credentials(params, session) || !params.contains({"car_img_path"})) {
 		res.set_content("Bad Request", "text/plain");
 		res.status = 400;
 		MyLogger::log("carinfo-manager-logger",
@@ -337,30 +831,64 @@ void ServerHttpHandler::handler_get_carimg(const httplib::Request &req,
 						  ". Status: 400 (Bad Request)");
 		return;
 	}
-	std::string username = std::string(params["username"]);
-	std::string passwd_hash = std::string(params["passwd_hash"]);
-	std::string car_img_path = std::string(params["car_img_path"]);
+	const std::string &username = session.username;
+	const std::string &passwd_hash = params.get("passwd_hash");
+	const std::string &car_img_path = params.get("car_img_path");
 
 	try {
-		auto result = accountpool.verifyAccount(username, passwd_hash);
+		auto result = authenticate(params, session);
 		if (result == AccountPool::AccountVerifyResult::SUCCESS) {
-			std::ifstream is(car_img_path, std::ios::binary);
-			if (is.is_open()) {
-				std::string img((std::istreambuf_iterator<char>(is)),
-								std::istreambuf_iterator<char>());
-				if (car_img_path.substr(car_img_path.size() - 4) == ".png")
-					res.set_content(img.c_str(), img.size(), "image/png");
-				else if (car_img_path.substr(car_img_path.size() - 4) == ".jpg")
-					res.set_content(img.c_str(), img.size(), "image/jpeg");
+			// an image acknowledged before it was written is read only once it is in place
+			imagestore.await(car_img_path);
+			// the sweeper removes unused images under the car lock, so the file is not removed while it is read
+			std::string etag, last_modified;
+			bool validated;
+			{
+				std::shared_lock<std::shared_mutex> lock(car_mtx);
+				validated = image_validators(car_img_path, etag, last_modified);
+			}
+			if (validated) {
+				res.set_header("ETag", etag);
+				res.set_header("Last-Modified", last_modified);
+				if (not_modified(req, etag, last_modified)) {
+					res.status = 304;
+					MyLogger::log("carinfo-manager-logger",
+								  MyLogger::LOG_LEVEL::INFO,
+								  "[HTTP Get Car Image] from " + ip + ":" + std::to_string(port) +
+									  ".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
+									  "\n- CarImgPath: " + car_img_path + "\n- Status: 304 (Not Modified)");
+					return;
+				}
+			}
+			const char *img_data = nullptr;
+			size_t img_size = 0;
+			std::shared_ptr<const void> img;
+			{
+				std::shared_lock<std::shared_mutex> lock(car_mtx);
+				img = open_image(car_img_path, img_data, img_size);
+			}
+			if (img) {
+				std::string content_type = "image/jpeg";
+				if (car_img_path.size() >= 4 && car_img_path.substr(car_img_path.size() - 4) == ".png")
+					content_type = "image/png";
+				// httplib sends only the requested ranges and answers 416 to unsatisfiable ones
+				res.set_header("Accept-Ranges", "bytes");
+				if (img_size == 0)
+					res.set_content("", content_type);
 				else
-					res.set_content(img.c_str(), img.size(), "image/jpeg");
-				res.status = 200;
-				is.close();
+					res.set_content_provider(
+						img_size,
+						content_type,
+						[img, img_data](size_t offset, size_t length, httplib::DataSink &sink) {
+							return sink.write(img_data + offset, length);
+						});
+				res.status = req.ranges.empty() ? 200 : 206;
 				MyLogger::log("carinfo-manager-logger",
 							  MyLogger::LOG_LEVEL::INFO,
 							  "[HTTP Get Car Image] from " + ip + ":" + std::to_string(port) +
 								  ".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
-								  "\n- CarImgPath: " + car_img_path + "\n- Status: 200 (OK)");
+								  "\n- CarImgPath: " + car_img_path + "\n- Status: " +
+								  (req.ranges.empty() ? "200 (OK)" : "206 (Partial Content)"));
 			}
 			else {
 				res.set_content("File Not Found", "text/plain");
@@ -412,20 +940,43 @@ void ServerHttpHandler::handler_get_carimg(const httplib::Request &req,
  * This function is responsible for processing the HTTP request to add a car to the system.
  * It retrieves the necessary parameters from the request, verifies the user account,
  * saves the car image to the appropriate location, creates a new Car object, and adds it to the car pool.
+ * The image is streamed to a temporary file while the request is read, see `read_multipart`.
  * The function sets the appropriate response content and status code based on the result of the operation.
  *
  * @param req The HTTP request object containing the necessary parameters.
  * @param res The HTTP response object to be modified based on the result of the operation.
+ * @param content_reader The reader of the request body.
  */
-void ServerHttpHandler::handler_add_car(const httplib::Request &req, httplib::Response &res) {
+void ServerHttpHandler::handler_add_car(const httplib::Request &req,
+										httplib::Response &res,
+										const httplib::ContentReader &content_reader) {
+	Trace::Span span("ServerHttpHandler::handler_add_car");
 	std::string ip = req.remote_addr;
 	int port = req.remote_port;
-	json params = parse_post_body(req);
-	if (params.find("username") == params.end() || params.find("passwd_hash") == params.end() ||
-		params.find("car_id") == params.end() || params.find("car_type") == params.end() ||
-		params.find("car_owner") == params.end() || params.find("car_color") == params.end() ||
-		params.find("car_year") == params.end() || params.find("car_img") == params.end() ||
-		params.find("car_img_type") == params.end()) {
+	httplib::MultipartFormDataMap fields;
+	std::optional<ImageStore::Upload> upload;
+	int read_status = read_multipart(req, content_reader, "car_img", fields, upload);
+	RequestParams params(fields);
+	if (read_status == 413) {
+		res.set_content("Payload Too Large", "text/plain");
+		res.status = 413;
+		MyLogger::log("carinfo-manager-logger",
+					  MyLogger::LOG_LEVEL::WARN,
+					  "[HTTP Add Car] from " + ip + ":" + std::to_string(port) +
+						  ". Status: 413 (Payload Too Large)");
+		return;
+	}
+	int car_year = 0;
+	SessionTokens::Session session;
+	if (read_status != 200 || !read_credentials(params, session) ||
+		!params.contains({"car_id",
+						  "car_type",
+						  "car_owner",
+						  "car_color",
+						  "car_year",
+						  "car_img",
+						  "car_img_type"}) ||
+		!params.getInt("car_year", car_year)) {
 		res.set_content("Bad Request", "text/plain");
 		res.status = 400;
 		MyLogger::log("carinfo-manager-logger",
@@ -435,34 +986,27 @@ void ServerHttpHandler::handler_add_car(const httplib::Request &req, httplib::Re
 		return;
 	}
 
-	std::string username = std::string(params["username"]);
-	std::string passwd_hash = std::string(params["passwd_hash"]);
-	std::string car_id = std::string(params["car_id"]);
-	std::string car_type = std::string(params["car_type"]);
-	std::string car_owner = std::string(params["car_owner"]);
-	std::string car_color = std::string(params["car_color"]);
-	int car_year = std::stoi(std::string(params["car_year"]));
-	std::string car_img = std::string(params["car_img"]);
-	std::string car_img_type = std::string(params["car_img_type"]);
+	const std::string &username = session.username;
+	const std::string &passwd_hash = params.get("passwd_hash");
+	const std::string &car_id = params.get("car_id");
+	const std::string &car_type = params.get("car_type");
+	const std::string &car_owner = params.get("car_owner");
+	const std::string &car_color = params.get("car_color");
+	const std::string &car_img_type = params.get("car_img_type");
 
 	try {
-		auto result = accountpool.verifyAccount(username, passwd_hash);
+		auto result = authenticate(params, session, true);
 		if (result == AccountPool::AccountVerifyResult::SUCCESS &&
-			accountpool.getAccountType(username) == Account::AccountType::ADMIN) {
-			std::string car_id_base64 = Base64::encode(
-				reinterpret_cast<const unsigned char *>(car_id.c_str()), car_id.size());
-			for (size_t i = 0; i < car_id_base64.size(); i++) {
-				if (car_id_base64[i] == '/')
-					car_id_base64[i] = '_';
-				if (car_id_base64[i] == '+')
-					car_id_base64[i] = '-';
+			session.type == Account::AccountType::ADMIN) {
+			std::string car_img_path;
+			int status_code = imagestore.commit(*upload, car_img_type, car_img_path);
+			if (status_code == 0) {
+				Car new_car = Car(car_id, car_type, car_owner, car_color, car_year, car_img_path);
+				std::lock_guard<std::shared_mutex> lock(car_mtx);
+				status_code = carpool.addCar(new_car);
+				if (status_code == 0)
+					persist_cars();
 			}
-			std::string car_img_path = imgDir + car_id_base64 + car_img_type;
-			std::ofstream os(car_img_path, std::ios::binary);
-			os.write(car_img.c_str(), car_img.size());
-			os.close();
-			Car new_car = Car(car_id, car_type, car_owner, car_color, car_year, car_img_path);
-			int status_code = carpool.addCar(new_car);
 			if (status_code == 0) {
 				res.set_content("Car Added", "text/plain");
 				res.status = 200;
@@ -475,6 +1019,15 @@ void ServerHttpHandler::handler_add_car(const httplib::Request &req, httplib::Re
 								  "\n- Car Year: " + std::to_string(car_year) +
 								  "\n- Car Img Path: " + car_img_path + "\n- Status: 200 (OK)");
 			}
+			else if (status_code == 0x72) {
+				res.set_content("Car Too Large", "text/plain");
+				res.status = 400;
+				MyLogger::log("carinfo-manager-logger",
+							  MyLogger::LOG_LEVEL::WARN,
+							  "[HTTP Add Car] from " + ip + ":" + std::to_string(port) +
+								  ".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
+								  "\n- Car Id: " + car_id + "\n- Status: 400 (Car Too Large)");
+			}
 			else {
 				std::string msg =
 					"Internal Server Error, status code: " + std::to_string(status_code);
@@ -536,11 +1089,12 @@ void ServerHttpHandler::handler_add_car(const httplib::Request &req, httplib::Re
  * @param res The HTTP response object to be modified.
  */
 void ServerHttpHandler::handler_remove_car(const httplib::Request &req, httplib::Response &res) {
+	Trace::Span span("ServerHttpHandler::handler_remove_car");
 	std::string ip = req.remote_addr;
 	int port = req.remote_port;
-	json params = parse_post_body(req);
-	if (params.find("username") == params.end() || params.find("passwd_hash") == params.end() ||
-		params.find("car_id") == params.end()) {
+	RequestParams params(req.files);
+	SessionTokens::Session session;
+	if (!read_credentials(params, session) || !params.contains({"car_id"})) {
 		res.set_content("Bad Request", "text/plain");
 		res.status = 400;
 		MyLogger::log("carinfo-manager-logger",
@@ -549,16 +1103,32 @@ void ServerHttpHandler::handler_remove_car(const httplib::Request &req, httplib:
 						  ". Status: 400 (Bad Request)");
 		return;
 	}
-	std::string username = std::string(params["username"]);
-	std::string passwd_hash = std::string(params["passwd_hash"]);
-	std::string car_id = std::string(params["car_id"]);
+	const std::string &username = session.username;
+	const std::string &passwd_hash = params.get("passwd_hash");
+	const std::string &car_id = params.get("car_id");
 
 	try {
-		auto result = accountpool.verifyAccount(username, passwd_hash);
+		auto result = authenticate(params, session, true);
 		if (result == AccountPool::AccountVerifyResult::SUCCESS &&
-			accountpool.getAccountType(username) == Account::AccountType::ADMIN) {
-			CarPool cars = carpool.getCarbyId(car_id);
-			if (cars.size() == 0) {
+			session.type == Account::AccountType::ADMIN) {
+			// the lookup, the 404 and the removal see the same cars
+			bool found = false, img_unused = false;
+			std::string car_img_path;
+			int status_code = 0;
+			{
+				std::lock_guard<std::shared_mutex> lock(car_mtx);
+				CarPool cars = carpool.getCarbyId(car_id);
+				found = cars.size() != 0;
+				if (found) {
+					car_img_path = cars.list()[0].getImagePath();
+					status_code = carpool.removeCar(car_id);
+				}
+				if (found && status_code == 0) {
+					persist_cars();
+					img_unused = carpool.imageRefCount(car_img_path) == 0;
+				}
+			}
+			if (!found) {
 				res.set_content("Car Not Found", "text/plain");
 				res.status = 404;
 				MyLogger::log("carinfo-manager-logger",
@@ -567,31 +1137,30 @@ void ServerHttpHandler::handler_remove_car(const httplib::Request &req, httplib:
 								  ".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
 								  "\n- Car Id: " + car_id + "\n- Status: 404 (Car Not Found)");
 			}
+			else if (status_code == 0) {
+				if (img_unused)
+					imagecache.invalidate(car_img_path);
+				res.set_content("Car Removed", "text/plain");
+				res.status = 200;
+				MyLogger::log("carinfo-manager-logger",
+							  MyLogger::LOG_LEVEL::INFO,
+							  "[HTTP Remove Car] from " + ip + ":" + std::to_string(port) +
+								  ".\n- Username: " + username +
+								  "\n- PasswdHash: " + passwd_hash + "\n- Car Id: " + car_id +
+								  "\n- Status: 200 (OK)");
+			}
 			else {
-				int status_code = carpool.removeCar(car_id);
-				if (status_code == 0) {
-					res.set_content("Car Removed", "text/plain");
-					res.status = 200;
-					MyLogger::log("carinfo-manager-logger",
-								  MyLogger::LOG_LEVEL::INFO,
-								  "[HTTP Remove Car] from " + ip + ":" + std::to_string(port) +
-									  ".\n- Username: " + username +
-									  "\n- PasswdHash: " + passwd_hash + "\n- Car Id: " + car_id +
-									  "\n- Status: 200 (OK)");
-				}
-				else {
-					std::string msg =
-						"Internal Server Error, status code: " + std::to_string(status_code);
-					res.set_content(msg, "text/plain");
-					res.status = 500;
-					MyLogger::log("carinfo-manager-logger",
-								  MyLogger::LOG_LEVEL::WARN,
-								  "[HTTP Remove Car] from " + ip + ":" + std::to_string(port) +
-									  ".\n- Username: " + username +
-									  "\n- PasswdHash: " + passwd_hash + "\n- Car Id: " + car_id +
-									  "\n- Status: 500 (Internal Server Error) \n- Status Code: " +
-									  std::to_string(status_code));
-				}
+				std::string msg =
+					"Internal Server Error, status code: " + std::to_string(status_code);
+				res.set_content(msg, "text/plain");
+				res.status = 500;
+				MyLogger::log("carinfo-manager-logger",
+							  MyLogger::LOG_LEVEL::WARN,
+							  "[HTTP Remove Car] from " + ip + ":" + std::to_string(port) +
+								  ".\n- Username: " + username +
+								  "\n- PasswdHash: " + passwd_hash + "\n- Car Id: " + car_id +
+								  "\n- Status: 500 (Internal Server Error) \n- Status Code: " +
+								  std::to_string(status_code));
 			}
 		}
 		else if (result == AccountPool::AccountVerifyResult::ACCOUNT_NOT_FOUND ||
@@ -629,20 +1198,43 @@ void ServerHttpHandler::handler_remove_car(const httplib::Request &req, httplib:
 /**
  * Handles the update car request.
  * 
+ * The new image is streamed to a temporary file while the request is read, see `read_multipart`.
+ * 
  * @param req The HTTP request object.
  * @param res The HTTP response object.
+ * @param content_reader The reader of the request body.
  */
-void ServerHttpHandler::handler_update_car(const httplib::Request &req, httplib::Response &res) {
+void ServerHttpHandler::handler_update_car(const httplib::Request &req,
+										   httplib::Response &res,
+										   const httplib::ContentReader &content_reader) {
+	Trace::Span span("ServerHttpHandler::handler_update_car");
 	std::string ip = req.remote_addr;
 	int port = req.remote_port;
-	json params = parse_post_body(req);
-	if (params.find("username") == params.end() || params.find("passwd_hash") == params.end() ||
-		params.find("original_car_id") == params.end() ||
-		params.find("new_car_id") == params.end() || params.find("new_car_type") == params.end() ||
-		params.find("new_car_owner") == params.end() ||
-		params.find("new_car_color") == params.end() ||
-		params.find("new_car_year") == params.end() || params.find("new_car_img") == params.end() ||
-		params.find("new_car_img_type") == params.end()) {
+	httplib::MultipartFormDataMap fields;
+	std::optional<ImageStore::Upload> upload;
+	int read_status = read_multipart(req, content_reader, "new_car_img", fields, upload);
+	RequestParams params(fields);
+	if (read_status == 413) {
+		res.set_content("Payload Too Large", "text/plain");
+		res.status = 413;
+		MyLogger::log("carinfo-manager-logger",
+					  MyLogger::LOG_LEVEL::WARN,
+					  "[HTTP Update Car] from " + ip + ":" + std::to_string(port) +
+						  ". Status: 413 (Payload Too Large)");
+		return;
+	}
+	int new_car_year = 0;
+	SessionTokens::Session session;
+	if (read_status != 200 || !read_credentials(params, session) ||
+		!params.contains({"original_car_id",
+						  "new_car_id",
+						  "new_car_type",
+						  "new_car_owner",
+						  "new_car_color",
+						  "new_car_year",
+						  "new_car_img",
+						  "new_car_img_type"}) ||
+		!params.getInt("new_car_year", new_car_year)) {
 		res.set_content("Bad Request", "text/plain");
 		res.status = 400;
 		MyLogger::log("carinfo-manager-logger",
@@ -651,23 +1243,43 @@ void ServerHttpHandler::handler_update_car(const httplib::Request &req, httplib:
 						  ". Status: 400 (Bad Request)");
 		return;
 	}
-	std::string username = std::string(params["username"]);
-	std::string passwd_hash = std::string(params["passwd_hash"]);
-	std::string original_car_id = std::string(params["original_car_id"]);
-	std::string new_car_id = std::string(params["new_car_id"]);
-	std::string new_car_type = std::string(params["new_car_type"]);
-	std::string new_car_owner = std::string(params["new_car_owner"]);
-	std::string new_car_color = std::string(params["new_car_color"]);
-	int new_car_year = std::stoi(std::string(params["new_car_year"]));
-	std::string new_car_img = std::string(params["new_car_img"]);
-	std::string new_car_img_type = std::string(params["new_car_img_type"]);
+	const std::string &username = session.username;
+	const std::string &passwd_hash = params.get("passwd_hash");
+	const std::string &original_car_id = params.get("original_car_id");
+	const std::string &new_car_id = params.get("new_car_id");
+	const std::string &new_car_type = params.get("new_car_type");
+	const std::string &new_car_owner = params.get("new_car_owner");
+	const std::string &new_car_color = params.get("new_car_color");
+	const std::string &new_car_img_type = params.get("new_car_img_type");
 
 	try {
-		auto result = accountpool.verifyAccount(username, passwd_hash);
+		auto result = authenticate(params, session, true);
 		if (result == AccountPool::AccountVerifyResult::SUCCESS &&
-			accountpool.getAccountType(username) == Account::AccountType::ADMIN) {
-			CarPool original_cars = carpool.getCarbyId(original_car_id);
-			if (original_cars.size() == 0) {
+			session.type == Account::AccountType::ADMIN) {
+			std::string new_car_img_path, original_img_path;
+			bool found = true, original_img_unused = false;
+			int status_code = imagestore.commit(*upload, new_car_img_type, new_car_img_path);
+			if (status_code == 0) {
+				Car new_car = Car(new_car_id,
+								  new_car_type,
+								  new_car_owner,
+								  new_car_color,
+								  new_car_year,
+								  new_car_img_path);
+				// the lookup, the 404 and the update see the same cars; a committed image left unused is swept
+				std::lock_guard<std::shared_mutex> lock(car_mtx);
+				CarPool original_cars = carpool.getCarbyId(original_car_id);
+				found = original_cars.size() != 0;
+				if (found) {
+					original_img_path = original_cars.list()[0].getImagePath();
+					status_code = carpool.updateCar(original_car_id, new_car);
+				}
+				if (found && status_code == 0) {
+					persist_cars();
+					original_img_unused = carpool.imageRefCount(original_img_path) == 0;
+				}
+			}
+			if (!found) {
 				res.set_content("Car Not Found", "text/plain");
 				res.status = 404;
 				MyLogger::log("carinfo-manager-logger",
@@ -680,57 +1292,48 @@ void ServerHttpHandler::handler_update_car(const httplib::Request &req, httplib:
 								  "\n- New Car Color: " + new_car_color + "\n- New Car Year: " +
 								  std::to_string(new_car_year) + "\n- Status: 404 (Car Not Found)");
 			}
+			else if (status_code == 0) {
+				if (original_img_unused)
+					imagecache.invalidate(original_img_path);
+				res.set_content("Car Updated", "text/plain");
+				res.status = 200;
+				MyLogger::log(
+					"carinfo-manager-logger",
+					MyLogger::LOG_LEVEL::INFO,
+					"[HTTP Update Car] from " + ip + ":" + std::to_string(port) +
+						".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
+						"\n- Original Car Id: " + original_car_id +
+						"\n- New Car Id: " + new_car_id + "\n- New Car Type: " + new_car_type +
+						"\n- New Car Owner: " + new_car_owner + "\n- New Car Color: " +
+						new_car_color + "\n- New Car Year: " + std::to_string(new_car_year) +
+						"\n- Status: 200 (OK)");
+			}
+			else if (status_code == 0x95) {
+				res.set_content("Car Too Large", "text/plain");
+				res.status = 400;
+				MyLogger::log("carinfo-manager-logger",
+							  MyLogger::LOG_LEVEL::WARN,
+							  "[HTTP Update Car] from " + ip + ":" + std::to_string(port) +
+								  ".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
+								  "\n- Original Car Id: " + original_car_id +
+								  "\n- New Car Id: " + new_car_id + "\n- Status: 400 (Car Too Large)");
+			}
 			else {
-				std::string new_car_id_base64 = Base64::encode(
-					reinterpret_cast<const unsigned char *>(new_car_id.c_str()), new_car_id.size());
-				for (size_t i = 0; i < new_car_id_base64.size(); i++) {
-					if (new_car_id_base64[i] == '/')
-						new_car_id_base64[i] = '_';
-					if (new_car_id_base64[i] == '+')
-						new_car_id_base64[i] = '-';
-				}
-				std::string new_car_img_path = imgDir + new_car_id_base64 + new_car_img_type;
-				std::ofstream os(new_car_img_path, std::ios::binary);
-				os.write(new_car_img.c_str(), new_car_img.size());
-				os.close();
-				Car new_car = Car(new_car_id,
-								  new_car_type,
-								  new_car_owner,
-								  new_car_color,
-								  new_car_year,
-								  new_car_img_path);
-				int status_code = carpool.updateCar(original_car_id, new_car);
-				if (status_code == 0) {
-					res.set_content("Car Updated", "text/plain");
-					res.status = 200;
-					MyLogger::log(
-						"carinfo-manager-logger",
-						MyLogger::LOG_LEVEL::INFO,
-						"[HTTP Update Car] from " + ip + ":" + std::to_string(port) +
-							".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
-							"\n- Original Car Id: " + original_car_id +
-							"\n- New Car Id: " + new_car_id + "\n- New Car Type: " + new_car_type +
-							"\n- New Car Owner: " + new_car_owner + "\n- New Car Color: " +
-							new_car_color + "\n- New Car Year: " + std::to_string(new_car_year) +
-							"\n- Status: 200 (OK)");
-				}
-				else {
-					std::string msg =
-						"Internal Server Error, status code: " + std::to_string(status_code);
-					res.set_content(msg, "text/plain");
-					res.status = 500;
-					MyLogger::log(
-						"carinfo-manager-logger",
-						MyLogger::LOG_LEVEL::WARN,
-						"[HTTP Update Car] from " + ip + ":" + std::to_string(port) +
-							".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
-							"\n- Original Car Id: " + original_car_id +
-							"\n- New Car Id: " + new_car_id + "\n- New Car Type: " + new_car_type +
-							"\n- New Car Owner: " + new_car_owner + "\n- New Car Color: " +
-							new_car_color + "\n- New Car Year: " + std::to_string(new_car_year) +
-							"\n- Status: 500 (Internal Server Error) \n- Status Code: " +
-							std::to_string(status_code));
-				}
+				std::string msg =
+					"Internal Server Error, status code: " + std::to_string(status_code);
+				res.set_content(msg, "text/plain");
+				res.status = 500;
+				MyLogger::log(
+					"carinfo-manager-logger",
+					MyLogger::LOG_LEVEL::WARN,
+					"[HTTP Update Car] from " + ip + ":" + std::to_string(port) +
+						".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
+						"\n- Original Car Id: " + original_car_id +
+						"\n- New Car Id: " + new_car_id + "\n- New Car Type: " + new_car_type +
+						"\n- New Car Owner: " + new_car_owner + "\n- New Car Color: " +
+						new_car_color + "\n- New Car Year: " + std::to_string(new_car_year) +
+						"\n- Status: 500 (Internal Server Error) \n- Status Code: " +
+						std::to_string(status_code));
 			}
 		}
 		else if (result == AccountPool::AccountVerifyResult::ACCOUNT_NOT_FOUND ||
@@ -776,6 +1379,472 @@ void ServerHttpHandler::handler_update_car(const httplib::Request &req, httplib:
 	}
 }
 
+/**
+ * Handles the patch car request, which changes only the fields it carries.
+ * 
+ * `car_id` names the car, and any of `new_car_id`, `new_car_type`, `new_car_owner`, `new_car_color`, `new_car_year`
+ * and `new_car_img` with `new_car_img_type` may be given. Fields that are not given keep their value, so changing the
+ * owner does not upload the image again. A new image is streamed like in `handler_update_car`. A new ID that belongs
+ * to another car is answered with 409 (Conflict), like in /batch.
+ * 
+ * @param req The HTTP request object.
+ * @param res The HTTP response object.
+ * @param content_reader The reader of the request body.
+ */
+void ServerHttpHandler::handler_patch_car(const httplib::Request &req,
+										  httplib::Response &res,
+										  const httplib::ContentReader &content_reader) {
+	Trace::Span span("ServerHttpHandler::handler_patch_car");
+	std::string ip = req.remote_addr;
+	int port = req.remote_port;
+	httplib::MultipartFormDataMap fields;
+	std::optional<ImageStore::Upload> upload;
+	int read_status = read_multipart(req, content_reader, "new_car_img", fields, upload);
+	RequestParams params(fields);
+	if (read_status == 413) {
+		res.set_content("Payload Too Large", "text/plain");
+		res.status = 413;
+		MyLogger::log("carinfo-manager-logger",
+					  MyLogger::LOG_LEVEL::WARN,
+					  "[HTTP Patch Car] from " + ip + ":" + std::to_string(port) +
+						  ". Status: 413 (Payload Too Large)");
+		return;
+	}
+	CarPatch patch;
+	int new_car_year = 0;
+	SessionTokens::Session session;
+	if (read_status != 200 || !read_credentials(params, session) || !params.contains({"car_id"}) ||
+		(params.contains({"new_car_year"}) && !params.getInt("new_car_year", new_car_year)) ||
+		params.contains({"new_car_img"}) != params.contains({"new_car_img_type"})) {
+		res.set_content("Bad Request", "text/plain");
+		res.status = 400;
+		MyLogger::log("carinfo-manager-logger",
+					  MyLogger::LOG_LEVEL::WARN,
+					  "[HTTP Patch Car] from " + ip + ":" + std::to_string(port) +
+						  ". Status: 400 (Bad Request)");
+		return;
+	}
+	const std::string &username = session.username;
+	const std::string &passwd_hash = params.get("passwd_hash");
+	const std::string &car_id = params.get("car_id");
+	// the changed fields, for the log
+	std::string changes;
+	auto patch_field = [&](const char *name, std::optional<std::string> &field) {
+		if (!params.contains({name}))
+			return;
+		field = params.get(name);
+		changes += std::string("\n- ") + name + ": " + *field;
+	};
+	patch_field("new_car_id", patch.id);
+	patch_field("new_car_type", patch.type);
+	patch_field("new_car_owner", patch.owner);
+	patch_field("new_car_color", patch.color);
+	if (params.contains({"new_car_year"})) {
+		patch.year = new_car_year;
+		changes += "\n- new_car_year: " + std::to_string(new_car_year);
+	}
+
+	try {
+		auto result = authenticate(params, session, true);
+		if (result == AccountPool::AccountVerifyResult::SUCCESS &&
+			session.type == Account::AccountType::ADMIN) {
+			int status_code = 0;
+			if (upload) {
+				std::string new_car_img_path;
+				status_code = imagestore.commit(*upload, params.get("new_car_img_type"), new_car_img_path);
+				patch.img_path = new_car_img_path;
+				changes += "\n- new_car_img_path: " + new_car_img_path;
+			}
+			std::string original_img_path;
+			bool original_img_unused = false;
+			if (status_code == 0) {
+				// the lookup, the 404 and the patch see the same cars; a committed image left unused is swept
+				std::lock_guard<std::shared_mutex> lock(car_mtx);
+				CarPool original_cars = carpool.getCarbyId(car_id);
+				status_code = original_cars.size() == 0 ? 0x92 : carpool.patchCar(car_id, patch);
+				if (status_code == 0) {
+					persist_cars();
+					original_img_path = original_cars.list()[0].getImagePath();
+					original_img_unused = patch.img_path && carpool.imageRefCount(original_img_path) == 0;
+				}
+			}
+			if (status_code == 0) {
+				if (original_img_unused)
+					imagecache.invalidate(original_img_path);
+				res.set_content("Car Patched", "text/plain");
+				res.status = 200;
+				MyLogger::log("carinfo-manager-logger",
+							  MyLogger::LOG_LEVEL::INFO,
+							  "[HTTP Patch Car] from " + ip + ":" + std::to_string(port) +
+								  ".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
+								  "\n- Car Id: " + car_id + changes + "\n- Status: 200 (OK)");
+			}
+			else if (status_code == 0x92) {
+				res.set_content("Car Not Found", "text/plain");
+				res.status = 404;
+				MyLogger::log("carinfo-manager-logger",
+							  MyLogger::LOG_LEVEL::WARN,
+							  "[HTTP Patch Car] from " + ip + ":" + std::to_string(port) +
+								  ".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
+								  "\n- Car Id: " + car_id + changes + "\n- Status: 404 (Car Not Found)");
+			}
+			else if (status_code == 0x93) {
+				res.set_content("Car ID Taken", "text/plain");
+				res.status = 409;
+				MyLogger::log("carinfo-manager-logger",
+							  MyLogger::LOG_LEVEL::WARN,
+							  "[HTTP Patch Car] from " + ip + ":" + std::to_string(port) +
+								  ".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
+								  "\n- Car Id: " + car_id + changes + "\n- Status: 409 (Conflict)");
+			}
+			else if (status_code == 0x95) {
+				res.set_content("Car Too Large", "text/plain");
+				res.status = 400;
+				MyLogger::log("carinfo-manager-logger",
+							  MyLogger::LOG_LEVEL::WARN,
+							  "[HTTP Patch Car] from " + ip + ":" + std::to_string(port) +
+								  ".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
+								  "\n- Car Id: " + car_id + changes + "\n- Status: 400 (Car Too Large)");
+			}
+			else {
+				std::string msg =
+					"Internal Server Error, status code: " + std::to_string(status_code);
+				res.set_content(msg, "text/plain");
+				res.status = 500;
+				MyLogger::log("carinfo-manager-logger",
+							  MyLogger::LOG_LEVEL::WARN,
+							  "[HTTP Patch Car] from " + ip + ":" + std::to_string(port) +
+								  ".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
+								  "\n- Car Id: " + car_id + changes +
+								  "\n- Status: 500 (Internal Server Error) \n- Status Code: " +
+								  std::to_string(status_code));
+			}
+		}
+		else if (result == AccountPool::AccountVerifyResult::ACCOUNT_NOT_FOUND ||
+				 result == AccountPool::AccountVerifyResult::WRONG_PASSWORD) {
+			res.set_content("Forbidden", "text/plain");
+			res.status = 403;
+			MyLogger::log("carinfo-manager-logger",
+						  MyLogger::LOG_LEVEL::WARN,
+						  "[HTTP Patch Car] from " + ip + ":" + std::to_string(port) +
+							  ".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
+							  "\n- Car Id: " + car_id + changes + "\n- Status: 403 (Forbidden)");
+		}
+		else {
+			res.set_content("Internal Server Error", "text/plain");
+			res.status = 500;
+			MyLogger::log("carinfo-manager-logger",
+						  MyLogger::LOG_LEVEL::WARN,
+						  "[HTTP Patch Car] from " + ip + ":" + std::to_string(port) +
+							  ".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
+							  "\n- Car Id: " + car_id + changes +
+							  "\n- Status: 500 (Internal Server Error)");
+		}
+	}
+	catch (std::exception &e) {
+		res.set_content("Internal Server Error", "text/plain");
+		res.status = 500;
+		MyLogger::log("carinfo-manager-logger",
+					  MyLogger::LOG_LEVEL::WARN,
+					  "[HTTP Patch Car] from " + ip + ":" + std::to_string(port) +
+						  ".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
+						  "\n- Car Id: " + car_id + changes +
+						  "\n- Status: 500 (Internal Server Error) \n- Exception: " + e.what());
+	}
+}
+
+/**
+ * Stores the image of one operation of a batch, see handler_batch: "car_img" of an add, or "new_car_img" of an
+ * update, as base64 with its type in the field of the same name ending in "_type". Called before the cars are locked,
+ * so that decoding and writing the images of a batch keeps no other request waiting.
+ *
+ * @param op The operation.
+ * @param img_path Set to the path of the stored image, if the operation has one.
+ * @return int The status of the image: 200 (OK, also if the operation has no image), 400 (Bad Request) or 500
+ * (Internal Server Error).
+ */
+int ServerHttpHandler::store_image(const json &op, std::optional<std::string> &img_path) {
+	Trace::Span span("ServerHttpHandler::store_image");
+	if (!op.is_object() || !op.contains("op") || !op["op"].is_string())
+		return 200;
+	std::string kind = op["op"].get<std::string>();
+	std::string name = kind == "add" ? "car_img" : kind == "update" ? "new_car_img" : "";
+	std::string type_name = name + "_type";
+	if (name.empty() || (!op.contains(name) && !op.contains(type_name)))
+		return 200;
+	if (!op.contains(name) || !op.contains(type_name) || !op[name].is_string() || !op[type_name].is_string())
+		return 400;
+	const std::string &img = op[name].get_ref<const std::string &>();
+	if (!is_base64(img))
+		return 400;
+	size_t img_size = 0;
+	std::string bytes = Base64::decode(img.data(), img.size(), img_size);
+	std::string path;
+	if (imagestore.put(bytes, op[type_name].get<std::string>(), path) != 0)
+		return 500;
+	img_path = path;
+	return 200;
+}
+
+/**
+ * Applies one operation of a batch, see handler_batch.
+ *
+ * @param op The operation.
+ * @param img_status The status of its image, see store_image.
+ * @param img_path The path of its stored image, if any.
+ * @param undo Appended with the change that reverts the operation, if it is applied, which returns the status code of
+ * the CarPool.
+ * @param released Appended with the image path the operation stopped using, if any.
+ * @return int The status of the operation: 200 (OK), 400 (Bad Request or Car Too Large), 404 (Car Not Found),
+ * 409 (Car ID Taken) or 500 (Internal Server Error).
+ */
+int ServerHttpHandler::apply_operation(const json &op,
+									   int img_status,
+									   const std::optional<std::string> &img_path,
+									   std::vector<std::function<int()>> &undo,
+									   std::vector<std::string> &released) {
+	Trace::Span span("ServerHttpHandler::apply_operation");
+	bool valid = op.is_object() && op.contains("op") && op["op"].is_string();
+	// reads an optional string field, an ill-typed field invalidates the operation
+	auto text = [&](const char *name) -> std::optional<std::string> {
+		if (!valid || !op.contains(name))
+			return std::nullopt;
+		if (!op[name].is_string()) {
+			valid = false;
+			return std::nullopt;
+		}
+		return op[name].get<std::string>();
+	};
+	auto number = [&](const char *name) -> std::optional<int> {
+		if (!valid || !op.contains(name))
+			return std::nullopt;
+		if (!op[name].is_number_integer()) {
+			valid = false;
+			return std::nullopt;
+		}
+		return op[name].get<int>();
+	};
+	std::string kind = valid ? op["op"].get<std::string>() : "";
+	std::optional<std::string> car_id = text("car_id");
+	if (!valid || !car_id)
+		return 400;
+
+	if (kind == "add") {
+		std::optional<std::string> type = text("car_type"), owner = text("car_owner"), color = text("car_color");
+		std::optional<int> year = number("car_year");
+		if (!valid || !type || !owner || !color || !year || !op.contains("car_img"))
+			return 400;
+		if (img_status != 200)
+			return img_status;
+		int status_code = carpool.addCar(Car(*car_id, *type, *owner, *color, *year, *img_path));
+		if (status_code == 0x70)
+			return 409;
+		if (status_code == 0x72)
+			return 400;
+		if (status_code != 0)
+			return 500;
+		undo.push_back([this, id = *car_id]() { return carpool.removeCar(id); });
+		return 200;
+	}
+	if (kind == "update") {
+		CarPatch patch;
+		patch.id = text("new_car_id");
+		patch.type = text("new_car_type");
+		patch.owner = text("new_car_owner");
+		patch.color = text("new_car_color");
+		patch.year = number("new_car_year");
+		patch.img_path = img_path;
+		if (!valid)
+			return 400;
+		if (img_status != 200)
+			return img_status;
+		CarPool original_cars = carpool.getCarbyId(*car_id);
+		if (original_cars.size() == 0)
+			return 404;
+		Car original = original_cars.list()[0];
+		int status_code = carpool.patchCar(*car_id, patch);
+		if (status_code == 0x92)
+			return 404;
+		if (status_code == 0x93)
+			return 409;
+		if (status_code == 0x95)
+			return 400;
+		if (status_code != 0)
+			return 500;
+		if (patch.img_path)
+			released.push_back(original.getImagePath());
+		// every field back to the original, under the ID the car has now
+		CarPatch revert;
+		revert.id = original.getId();
+		revert.type = original.getType();
+		revert.owner = original.getOwner();
+		revert.color = original.getColor();
+		revert.year = original.getYear();
+		revert.img_path = original.getImagePath();
+		undo.push_back([this, id = patch.id.value_or(*car_id), revert]() { return carpool.patchCar(id, revert); });
+		return 200;
+	}
+	if (kind == "remove") {
+		CarPool cars = carpool.getCarbyId(*car_id);
+		if (cars.size() == 0)
+			return 404;
+		Car original = cars.list()[0];
+		if (carpool.removeCar(*car_id) != 0)
+			return 500;
+		released.push_back(original.getImagePath());
+		undo.push_back([this, original]() { return carpool.addCar(original); });
+		return 200;
+	}
+	return 400;
+}
+
+/**
+ * Handles the HTTP request for applying a batch of car changes.
+ *
+ * The field `operations` is a JSON array of operations, applied in order. Each is an object whose `op` is
+ *     - "add": with `car_id`, `car_type`, `car_owner`, `car_color`, `car_year`, and the image as base64 in `car_img`
+ *       with its type in `car_img_type`, like /add_car;
+ *     - "update": with `car_id` and any of `new_car_id`, `new_car_type`, `new_car_owner`, `new_car_color`,
+ *       `new_car_year` and `new_car_img` with `new_car_img_type`, like /patch_car;
+ *     - "remove": with `car_id`, like /remove_car.
+ * The sender is authenticated once, and no other change of the cars interleaves with the batch. The field `mode` is
+ * "atomic", the default, to roll back the applied operations once one fails, or "best_effort" to attempt every
+ * operation. The images are decoded and stored before the cars are locked, only the changes of the cars and a single
+ * save of the whole batch, see server-main, run under the lock.
+ *
+ * The response lists the status of every operation: 200 (OK), 400 (Bad Request), 404 (Car Not Found), 409 (Car ID
+ * Taken), 500 (Internal Server Error), or 424 (Failed Dependency) for the operations of an atomic batch that are not
+ * applied because another one failed. The status of the response is 409 (Conflict) if an atomic batch is rolled back,
+ * or 500 (Internal Server Error) if the rollback fails; the cars are not saved then.
+ *
+ * @param req The HTTP request object.
+ * @param res The HTTP response object.
+ */
+void ServerHttpHandler::handler_batch(const httplib::Request &req, httplib::Response &res) {
+	Trace::Span span("ServerHttpHandler::handler_batch");
+	std::string ip = req.remote_addr;
+	int port = req.remote_port;
+	RequestParams params(req.files);
+	SessionTokens::Session session;
+	json operations = json::parse(params.get("operations"), nullptr, false);
+	std::string mode = params.contains({"mode"}) ? params.get("mode") : "atomic";
+	if (!read_credentials(params, session) || !operations.is_array() ||
+		(mode != "atomic" && mode != "best_effort")) {
+		res.set_content("Bad Request", "text/plain");
+		res.status = 400;
+		MyLogger::log("carinfo-manager-logger",
+					  MyLogger::LOG_LEVEL::WARN,
+					  "[HTTP Batch] from " + ip + ":" + std::to_string(port) +
+						  ". Status: 400 (Bad Request)");
+		return;
+	}
+	const std::string &username = session.username;
+	const std::string &passwd_hash = params.get("passwd_hash");
+	bool atomic = mode == "atomic";
+
+	try {
+		auto result = authenticate(params, session, true);
+		if (result == AccountPool::AccountVerifyResult::SUCCESS &&
+			session.type == Account::AccountType::ADMIN) {
+			std::vector<int> statuses(operations.size(), 424);
+			std::vector<int> img_statuses(operations.size());
+			std::vector<std::optional<std::string>> img_paths(operations.size());
+			for (size_t i = 0; i < operations.size(); i++)
+				img_statuses[i] = store_image(operations[i], img_paths[i]);
+			std::vector<std::function<int()>> undo;
+			std::vector<std::string> released, unused;
+			size_t applied = 0;
+			bool rolled_back = false, undo_failed = false;
+			{
+				std::lock_guard<std::shared_mutex> lock(car_mtx);
+				for (size_t i = 0; i < operations.size() && !rolled_back; i++) {
+					statuses[i] = apply_operation(operations[i], img_statuses[i], img_paths[i], undo, released);
+					if (statuses[i] == 200)
+						applied++;
+					else if (atomic) {
+						for (auto it = undo.rbegin(); it != undo.rend(); ++it) {
+							int status_code = (*it)();
+							if (status_code != 0) {
+								undo_failed = true;
+								MyLogger::log("carinfo-manager-logger",
+											  MyLogger::LOG_LEVEL::ERROR,
+											  "[HTTP Batch] Rollback failed, the cars are not saved\n- Status Code: " +
+												  std::to_string(status_code));
+							}
+						}
+						for (size_t j = 0; j < i; j++)
+							statuses[j] = 424;
+						rolled_back = true;
+						applied = 0;
+					}
+				}
+				if (applied != 0 && !undo_failed)
+					persist_cars();
+				for (const std::string &img_path : released) {
+					if (carpool.imageRefCount(img_path) == 0)
+						unused.push_back(img_path);
+				}
+			}
+			for (const std::string &img_path : unused)
+				imagecache.invalidate(img_path);
+
+			json results = json::array();
+			for (size_t i = 0; i < operations.size(); i++) {
+				json entry;
+				if (operations[i].is_object()) {
+					entry["op"] = operations[i].value("op", json());
+					entry["car_id"] = operations[i].value("car_id", json());
+				}
+				entry["status"] = statuses[i];
+				results.push_back(entry);
+			}
+			json j;
+			j["mode"] = mode;
+			j["applied"] = applied;
+			j["results"] = results;
+			res.set_content(j.dump(dump_indent()), "application/json");
+			res.status = undo_failed ? 500 : rolled_back ? 409 : 200;
+			MyLogger::log("carinfo-manager-logger",
+						  undo_failed ? MyLogger::LOG_LEVEL::ERROR
+									  : (rolled_back ? MyLogger::LOG_LEVEL::WARN : MyLogger::LOG_LEVEL::INFO),
+						  "[HTTP Batch] from " + ip + ":" + std::to_string(port) +
+							  ".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
+							  "\n- Mode: " + mode + "\n- Operations: " + std::to_string(operations.size()) +
+							  "\n- Applied: " + std::to_string(applied) + "\n- Status: " +
+							  (undo_failed ? "500 (Rollback Failed)" : rolled_back ? "409 (Rolled Back)" : "200 (OK)"));
+		}
+		else if (result == AccountPool::AccountVerifyResult::ACCOUNT_NOT_FOUND ||
+				 result == AccountPool::AccountVerifyResult::WRONG_PASSWORD ||
+				 result == AccountPool::AccountVerifyResult::SUCCESS) {
+			res.set_content("Forbidden", "text/plain");
+			res.status = 403;
+			MyLogger::log("carinfo-manager-logger",
+						  MyLogger::LOG_LEVEL::WARN,
+						  "[HTTP Batch] from " + ip + ":" + std::to_string(port) +
+							  ".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
+							  "\n- Status: 403 (Forbidden)");
+		}
+		else {
+			res.set_content("Internal Server Error", "text/plain");
+			res.status = 500;
+			MyLogger::log("carinfo-manager-logger",
+						  MyLogger::LOG_LEVEL::WARN,
+						  "[HTTP Batch] from " + ip + ":" + std::to_string(port) +
+							  ".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
+							  "\n- Status: 500 (Internal Server Error)");
+		}
+	}
+	catch (std::exception &e) {
+		res.set_content("Internal Server Error", "text/plain");
+		res.status = 500;
+		MyLogger::log("carinfo-manager-logger",
+					  MyLogger::LOG_LEVEL::WARN,
+					  "[HTTP Batch] from " + ip + ":" + std::to_string(port) +
+						  ".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
+						  "\n- Status: 500 (Internal Server Error) \n- Exception: " + e.what());
+	}
+}
+
 /**
  * Handles the request for retrieving account information.
  * 
@@ -784,11 +1853,12 @@ void ServerHttpHandler::handler_update_car(const httplib::Request &req, httplib:
  */
 void ServerHttpHandler::handler_get_accountinfo(const httplib::Request &req,
 												httplib::Response &res) const {
+	Trace::Span span("ServerHttpHandler::handler_get_accountinfo");
 	std::string ip = req.remote_addr;
 	int port = req.remote_port;
-	json params = parse_post_body(req);
-	if (params.find("username") == params.end() || params.find("passwd_hash") == params.end() ||
-		params.find("target_username") == params.end()) {
+	RequestParams params(req.files);
+	SessionTokens::Session session;
+	if (!read_credentials(params, session) || !params.contains({"target_username"})) {
 		res.set_content("Bad Request", "text/plain");
 		res.status = 400;
 		MyLogger::log("carinfo-manager-logger",
@@ -797,7 +1867,7 @@ void ServerHttpHandler::handler_get_accountinfo(const httplib::Request &req,
 						  ". Status: 400 (Bad Request)");
 		return;
 	}
-	if (std::string(params["target_username"]).empty()) {
+	if (params.get("target_username").empty()) {
 		res.set_content("Bad Request", "text/plain");
 		res.status = 400;
 		MyLogger::log("carinfo-manager-logger",
@@ -806,14 +1876,14 @@ void ServerHttpHandler::handler_get_accountinfo(const httplib::Request &req,
 						  ". Status: 400 (No Target Username)");
 		return;
 	}
-	std::string username = std::string(params["username"]);
-	std::string passwd_hash = std::string(params["passwd_hash"]);
-	std::string target_username = std::string(params["target_username"]);
+	const std::string &username = session.username;
+	const std::string &passwd_hash = params.get("passwd_hash");
+	const std::string &target_username = params.get("target_username");
 
 	try {
-		auto result = accountpool.verifyAccount(username, passwd_hash);
+		auto result = authenticate(params, session, true);
 		if (result == AccountPool::AccountVerifyResult::SUCCESS &&
-			accountpool.getAccountType(username) == Account::AccountType::ADMIN) {
+			session.type == Account::AccountType::ADMIN) {
 			AccountPool target_accs = accountpool.getAccountLike(target_username);
 			if (target_accs.empty()) {
 				res.set_content("Account Not Found", "text/plain");
@@ -826,10 +1896,10 @@ void ServerHttpHandler::handler_get_accountinfo(const httplib::Request &req,
 								  "\n- Status: 404 (Account Not Found)");
 			}
 			else {
-				std::stringstream ss;
-				int status_code = target_accs.save(ss);
+				std::string body;
+				int status_code = target_accs.save(body, json_indent);
 				if (status_code == 0) {
-					res.set_content(ss.str(), "application/json");
+					res.set_content(std::move(body), "application/json");
 					res.status = 200;
 					MyLogger::log(
 						"carinfo-manager-logger",
@@ -894,10 +1964,12 @@ void ServerHttpHandler::handler_get_accountinfo(const httplib::Request &req,
  */
 void ServerHttpHandler::handler_get_all_account(const httplib::Request &req,
 												httplib::Response &res) const {
+	Trace::Span span("ServerHttpHandler::handler_get_all_account");
 	std::string ip = req.remote_addr;
 	int port = req.remote_port;
-	json params = parse_post_body(req);
-	if (params.find("username") == params.end() || params.find("passwd_hash") == params.end()) {
+	RequestParams params(req.files);
+	SessionTokens::Session session;
+	if (!read_credentials(params, session)) {
 		res.set_content("Bad Request", "text/plain");
 		res.status = 400;
 		MyLogger::log("carinfo-manager-logger",
@@ -906,17 +1978,17 @@ void ServerHttpHandler::handler_get_all_account(const httplib::Request &req,
 						  ". Status: 400 (Bad Request)");
 		return;
 	}
-	std::string username = std::string(params["username"]);
-	std::string passwd_hash = std::string(params["passwd_hash"]);
+	const std::string &username = session.username;
+	const std::string &passwd_hash = params.get("passwd_hash");
 
 	try {
-		auto result = accountpool.verifyAccount(username, passwd_hash);
+		auto result = authenticate(params, session, true);
 		if (result == AccountPool::AccountVerifyResult::SUCCESS &&
-			accountpool.getAccountType(username) == Account::AccountType::ADMIN) {
-			std::stringstream ss;
-			int status_code = accountpool.save(ss);
+			session.type == Account::AccountType::ADMIN) {
+			std::string body;
+			int status_code = accountpool.save(body, json_indent);
 			if (status_code == 0) {
-				res.set_content(ss.str(), "application/json");
+				res.set_content(std::move(body), "application/json");
 				res.status = 200;
 				MyLogger::log("carinfo-manager-logger",
 							  MyLogger::LOG_LEVEL::INFO,
@@ -964,13 +2036,15 @@ void ServerHttpHandler::handler_get_all_account(const httplib::Request &req,
  * @param res The HTTP response object.
  */
 void ServerHttpHandler::handler_add_account(const httplib::Request &req, httplib::Response &res) {
+	Trace::Span span("ServerHttpHandler::handler_add_account");
 	std::string ip = req.remote_addr;
 	int port = req.remote_port;
-	json params = parse_post_body(req);
-	if (params.find("username") == params.end() || params.find("passwd_hash") == params.end() ||
-		params.find("target_username") == params.end() ||
-		params.find("target_passwd_hash") == params.end() ||
-		params.find("target_account_type") == params.end()) {
+	RequestParams params(req.files);
+	Account::AccountType target_account_type = Account::AccountType::NONETYPE;
+	SessionTokens::Session session;
+	if (!read_credentials(params, session) ||
+		!params.contains({"target_username", "target_passwd_hash", "target_account_type"}) ||
+		!params.getAccountType("target_account_type", target_account_type)) {
 		res.set_content("Bad Request", "text/plain");
 		res.status = 400;
 		MyLogger::log("carinfo-manager-logger",
@@ -979,19 +2053,18 @@ void ServerHttpHandler::handler_add_account(const httplib::Request &req, httplib
 						  ". Status: 400 (Bad Request)");
 		return;
 	}
-	std::string username = std::string(params["username"]);
-	std::string passwd_hash = std::string(params["passwd_hash"]);
-	std::string target_username = std::string(params["target_username"]);
-	std::string target_passwd_hash = std::string(params["target_passwd_hash"]);
-	int target_account_type = std::stoi(std::string(params["target_account_type"]));
+	const std::string &username = session.username;
+	const std::string &passwd_hash = params.get("passwd_hash");
+	const std::string &target_username = params.get("target_username");
+	const std::string &target_passwd_hash = params.get("target_passwd_hash");
 
 	try {
-		auto result = accountpool.verifyAccount(username, passwd_hash);
+		auto result = authenticate(params, session, true);
 		if (result == AccountPool::AccountVerifyResult::SUCCESS &&
-			accountpool.getAccountType(username) == Account::AccountType::ADMIN) {
+			session.type == Account::AccountType::ADMIN) {
 			Account new_acc = Account(target_username,
 									  target_passwd_hash,
-									  static_cast<Account::AccountType>(target_account_type));
+									  target_account_type);
 			int status_code = accountpool.addAccount(new_acc);
 			if (status_code == 0) {
 				res.set_content("Account Added", "text/plain");
@@ -1003,7 +2076,7 @@ void ServerHttpHandler::handler_add_account(const httplib::Request &req, httplib
 								  "\n- Target Username: " + target_username +
 								  "\n- Target PasswdHash: " + target_passwd_hash +
 								  "\n- Target Account Type: " +
-								  std::to_string(target_account_type) + "\n- Status: 200 (OK)");
+								  std::to_string(int(target_account_type)) + "\n- Status: 200 (OK)");
 			}
 			else {
 				std::string msg =
@@ -1017,7 +2090,7 @@ void ServerHttpHandler::handler_add_account(const httplib::Request &req, httplib
 						".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
 						"\n- Target Username: " + target_username +
 						"\n- Target PasswdHash: " + target_passwd_hash +
-						"\n- Target Account Type: " + std::to_string(target_account_type) +
+						"\n- Target Account Type: " + std::to_string(int(target_account_type)) +
 						"\n- Status: 500 (Internal Server Error) \n- Status Code: " +
 						std::to_string(status_code));
 			}
@@ -1032,7 +2105,7 @@ void ServerHttpHandler::handler_add_account(const httplib::Request &req, httplib
 							  ".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
 							  "\n- Target Username: " + target_username +
 							  "\n- Target PasswdHash: " + target_passwd_hash +
-							  "\n- Target Account Type: " + std::to_string(target_account_type) +
+							  "\n- Target Account Type: " + std::to_string(int(target_account_type)) +
 							  "\n- Status: 403 (Forbidden)");
 		}
 		else {
@@ -1044,7 +2117,7 @@ void ServerHttpHandler::handler_add_account(const httplib::Request &req, httplib
 							  ".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
 							  "\n- Target Username: " + target_username +
 							  "\n- Target PasswdHash: " + target_passwd_hash +
-							  "\n- Target Account Type: " + std::to_string(target_account_type) +
+							  "\n- Target Account Type: " + std::to_string(int(target_account_type)) +
 							  "\n- Status: 500 (Internal Server Error)");
 		}
 	}
@@ -1057,7 +2130,7 @@ void ServerHttpHandler::handler_add_account(const httplib::Request &req, httplib
 						  ".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
 						  "\n- Target Username: " + target_username +
 						  "\n- Target PasswdHash: " + target_passwd_hash +
-						  "\n- Target Account Type: " + std::to_string(target_account_type) +
+						  "\n- Target Account Type: " + std::to_string(int(target_account_type)) +
 						  "\n- Status: 500 (Internal Server Error) \n- Exception: " + e.what());
 	}
 }
@@ -1070,11 +2143,12 @@ void ServerHttpHandler::handler_add_account(const httplib::Request &req, httplib
  */
 void ServerHttpHandler::handler_remove_account(const httplib::Request &req,
 											   httplib::Response &res) {
+	Trace::Span span("ServerHttpHandler::handler_remove_account");
 	std::string ip = req.remote_addr;
 	int port = req.remote_port;
-	json params = parse_post_body(req);
-	if (params.find("username") == params.end() || params.find("passwd_hash") == params.end() ||
-		params.find("target_username") == params.end()) {
+	RequestParams params(req.files);
+	SessionTokens::Session session;
+	if (!read_credentials(params, session) || !params.contains({"target_username"})) {
 		res.set_content("Bad Request", "text/plain");
 		res.status = 400;
 		MyLogger::log("carinfo-manager-logger",
@@ -1083,14 +2157,14 @@ void ServerHttpHandler::handler_remove_account(const httplib::Request &req,
 						  ". Status: 400 (Bad Request)");
 		return;
 	}
-	std::string username = std::string(params["username"]);
-	std::string passwd_hash = std::string(params["passwd_hash"]);
-	std::string target_username = std::string(params["target_username"]);
+	const std::string &username = session.username;
+	const std::string &passwd_hash = params.get("passwd_hash");
+	const std::string &target_username = params.get("target_username");
 
 	try {
-		auto result = accountpool.verifyAccount(username, passwd_hash);
+		auto result = authenticate(params, session, true);
 		if (result == AccountPool::AccountVerifyResult::SUCCESS &&
-			accountpool.getAccountType(username) == Account::AccountType::ADMIN) {
+			session.type == Account::AccountType::ADMIN) {
 			Account target_acc = accountpool.getAccount(target_username);
 			if (target_acc == Account::NULL_ACCOUNT) {
 				res.set_content("Account Not Found", "text/plain");
@@ -1105,6 +2179,9 @@ void ServerHttpHandler::handler_remove_account(const httplib::Request &req,
 			else {
 				int status_code = accountpool.removeAccount(target_username);
 				if (status_code == 0) {
+					// the tokens issued to the account no longer vouch for it
+					if (sessions)
+						sessions->revoke(target_username);
 					res.set_content("Account Removed", "text/plain");
 					res.status = 200;
 					MyLogger::log(
@@ -1171,14 +2248,18 @@ void ServerHttpHandler::handler_remove_account(const httplib::Request &req,
  */
 void ServerHttpHandler::handler_update_account(const httplib::Request &req,
 											   httplib::Response &res) {
+	Trace::Span span("ServerHttpHandler::handler_update_account");
 	std::string ip = req.remote_addr;
 	int port = req.remote_port;
-	json params = parse_post_body(req);
-	if (params.find("username") == params.end() || params.find("passwd_hash") == params.end() ||
-		params.find("target_username") == params.end() ||
-		params.find("new_username") == params.end() ||
-		params.find("new_passwd_hash") == params.end() ||
-		params.find("new_account_type") == params.end()) {
+	RequestParams params(req.files);
+	Account::AccountType new_account_type = Account::AccountType::NONETYPE;
+	SessionTokens::Session session;
+	if (!read_credentials(params, session) ||
+		!params.contains({"target_username",
+						  "new_username",
+						  "new_passwd_hash",
+						  "new_account_type"}) ||
+		!params.getAccountType("new_account_type", new_account_type)) {
 		res.set_content("Bad Request", "text/plain");
 		res.status = 400;
 		MyLogger::log("carinfo-manager-logger",
@@ -1187,17 +2268,16 @@ void ServerHttpHandler::handler_update_account(const httplib::Request &req,
 						  ". Status: 400 (Bad Request)");
 		return;
 	}
-	std::string username = std::string(params["username"]);
-	std::string passwd_hash = std::string(params["passwd_hash"]);
-	std::string target_username = std::string(params["target_username"]);
-	std::string new_username = std::string(params["new_username"]);
-	std::string new_passwd_hash = std::string(params["new_passwd_hash"]);
-	int new_account_type = std::stoi(std::string(params["new_account_type"]));
+	const std::string &username = session.username;
+	const std::string &passwd_hash = params.get("passwd_hash");
+	const std::string &target_username = params.get("target_username");
+	const std::string &new_username = params.get("new_username");
+	const std::string &new_passwd_hash = params.get("new_passwd_hash");
 
 	try {
-		auto result = accountpool.verifyAccount(username, passwd_hash);
+		auto result = authenticate(params, session, true);
 		if (result == AccountPool::AccountVerifyResult::SUCCESS &&
-			accountpool.getAccountType(username) == Account::AccountType::ADMIN) {
+			session.type == Account::AccountType::ADMIN) {
 			Account target_acc = accountpool.getAccount(target_username);
 			if (target_acc == Account::NULL_ACCOUNT) {
 				res.set_content("Account Not Found", "text/plain");
@@ -1208,15 +2288,18 @@ void ServerHttpHandler::handler_update_account(const httplib::Request &req,
 								  ".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
 								  "\n- Target Username: " + target_username + "\n- New Username: " +
 								  new_username + "\n- New PasswdHash: " + new_passwd_hash +
-								  "\n- New Account Type: " + std::to_string(new_account_type) +
+								  "\n- New Account Type: " + std::to_string(int(new_account_type)) +
 								  "\n- Status: 404 (Account Not Found)");
 			}
 			else {
 				Account new_acc = Account(new_username,
 										  new_passwd_hash,
-										  static_cast<Account::AccountType>(new_account_type));
+										  new_account_type);
 				int status_code = accountpool.updateAccount(target_acc, new_acc);
 				if (status_code == 0) {
+					// the tokens issued to the account carry its old name and type
+					if (sessions)
+						sessions->revoke(target_username);
 					res.set_content("Account Updated", "text/plain");
 					res.status = 200;
 					MyLogger::log("carinfo-manager-logger",
@@ -1226,7 +2309,7 @@ void ServerHttpHandler::handler_update_account(const httplib::Request &req,
 									  passwd_hash + "\n- Target Username: " + target_username +
 									  "\n- New Username: " + new_username +
 									  "\n- New PasswdHash: " + new_passwd_hash +
-									  "\n- New Account Type: " + std::to_string(new_account_type) +
+									  "\n- New Account Type: " + std::to_string(int(new_account_type)) +
 									  "\n- Status: 200 (OK)");
 				}
 				else {
@@ -1241,7 +2324,7 @@ void ServerHttpHandler::handler_update_account(const httplib::Request &req,
 									  passwd_hash + "\n- Target Username: " + target_username +
 									  "\n- New Username: " + new_username +
 									  "\n- New PasswdHash: " + new_passwd_hash +
-									  "\n- New Account Type: " + std::to_string(new_account_type) +
+									  "\n- New Account Type: " + std::to_string(int(new_account_type)) +
 									  "\n- Status: 500 (Internal Server Error) \n- Status Code: " +
 									  std::to_string(status_code));
 				}
@@ -1257,7 +2340,7 @@ void ServerHttpHandler::handler_update_account(const httplib::Request &req,
 							  ".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
 							  "\n- Target Username: " + target_username + "\n- New Username: " +
 							  new_username + "\n- New PasswdHash: " + new_passwd_hash +
-							  "\n- New Account Type: " + std::to_string(new_account_type) +
+							  "\n- New Account Type: " + std::to_string(int(new_account_type)) +
 							  "\n- Status: 403 (Forbidden)");
 		}
 		else {
@@ -1269,7 +2352,7 @@ void ServerHttpHandler::handler_update_account(const httplib::Request &req,
 							  ".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
 							  "\n- Target Username: " + target_username + "\n- New Username: " +
 							  new_username + "\n- New PasswdHash: " + new_passwd_hash +
-							  "\n- New Account Type: " + std::to_string(new_account_type) +
+							  "\n- New Account Type: " + std::to_string(int(new_account_type)) +
 							  "\n- Status: 500 (Internal Server Error)");
 		}
 	}
@@ -1282,7 +2365,7 @@ void ServerHttpHandler::handler_update_account(const httplib::Request &req,
 						  ".\n- Username: " + username + "\n- PasswdHash: " + passwd_hash +
 						  "\n- Target Username: " + target_username + "\n- New Username: " +
 						  new_username + "\n- New PasswdHash: " + new_passwd_hash +
-						  "\n- New Account Type: " + std::to_string(new_account_type) +
+						  "\n- New Account Type: " + std::to_string(int(new_account_type)) +
 						  "\n- Status: 500 (Internal Server Error) \n- Exception: " + e.what());
 	}
 }
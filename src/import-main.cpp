@@ -0,0 +1,447 @@
+/**
+ * @file src/import-main.cpp
+ * @brief Implementation of the bulk import/export tool for the carinfo-manager project
+ *
+ * @details
+ * This file contains the main entry of the import/export tool.
+ *     - `import` streams cars from an NDJSON or CSV file into a CarPool, in batches that are added with
+ *       `CarPool::addCars`, merges in the existing cars that were not imported, and writes the result where the
+ *       server keeps its cars. With `--replace` the existing cars are dropped instead.
+ *     - `export` loads the server's cars and streams them out as NDJSON or CSV.
+ * The cars are kept where the server reads them, found next to the given car.json:
+ *     - in car.btree, if it exists (carBackend "btree"); a new tree is built in a temporary file and renamed over
+ *       it, so a crash leaves the old one.
+ *     - in the segmented layout, if car/manifest.json exists (carSegments); the segments are written as a new
+ *       generation that the manifest commits, so a crash leaves the old layout or the new one.
+ *     - else in car.json, written to a temporary file first and renamed over it, so a crash leaves the old one.
+ * NDJSON rows are the objects stored in car.json, one per line. CSV files start with a header naming the columns
+ * id, type, owner, color, year and img_path, in any order. The tool works offline: stop the server before importing.
+ *
+ * @author donghy23@mails.tsinghua.edu.cn
+ * @version 1.0
+ */
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include "carinfo-manager/btreestorage.hpp"
+#include "carinfo-manager/carpool.hpp"
+#include "carinfo-manager/log.hpp"
+#include "json/json.hpp"
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace {
+
+const size_t BATCH_SIZE = 65536;
+const size_t PROGRESS_INTERVAL = 100000;
+// buffer pool of car.btree, as the server's default bufferPoolBytes
+const size_t BUFFER_POOL_BYTES = 64 << 20;
+const vector<string> CSV_COLUMNS = {"id", "type", "owner", "color", "year", "img_path"};
+
+// where the server keeps its cars
+enum class CarLayout { JSON, SEGMENTS, BTREE };
+
+class CarFiles {
+  public:
+	CarLayout layout;
+	string json_path;     // car.json
+	string segment_dir;   // car/, ending with '/'
+	string btree_path;    // car.btree
+};
+
+class Progress {
+  private:
+	string action;
+	chrono::steady_clock::time_point start;
+	size_t rows;
+
+  public:
+	Progress(const string &action) : action(action), start(chrono::steady_clock::now()), rows(0) {}
+
+	void row() {
+		if (++rows % PROGRESS_INTERVAL == 0)
+			report("");
+	}
+
+	void report(const string &suffix) const {
+		double seconds =
+			chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		size_t rate = seconds > 0 ? size_t(rows / seconds) : rows;
+		MyLogger::log("carinfo-manager-logger",
+					  MyLogger::LOG_LEVEL::INFO,
+					  "[" + action + "] " + to_string(rows) + " rows, " + to_string(rate) +
+						  " rows/sec" + suffix);
+	}
+};
+
+/**
+ * @brief Reads one CSV record (RFC 4180: quoted fields may contain commas, quotes and line breaks).
+ *
+ * @return False at the end of the input.
+ */
+bool read_csv_record(istream &is, vector<string> &fields) {
+	fields.clear();
+	if (is.peek() == EOF)
+		return false;
+	string field;
+	bool quoted = false;
+	char ch;
+	while (is.get(ch)) {
+		if (quoted) {
+			if (ch == '"') {
+				if (is.peek() == '"') {
+					is.get(ch);
+					field += '"';
+				}
+				else
+					quoted = false;
+			}
+			else
+				field += ch;
+		}
+		else if (ch == '"')
+			quoted = true;
+		else if (ch == ',') {
+			fields.push_back(field);
+			field.clear();
+		}
+		else if (ch == '\n')
+			break;
+		else if (ch != '\r')
+			field += ch;
+	}
+	fields.push_back(field);
+	return true;
+}
+
+string csv_field(const string &value) {
+	if (value.find_first_of(",\"\r\n") == string::npos)
+		return value;
+	string quoted = "\"";
+	for (char ch : value) {
+		if (ch == '"')
+			quoted += '"';
+		quoted += ch;
+	}
+	return quoted + "\"";
+}
+
+/**
+ * @brief Writes a file through a temporary file in the same directory, renamed over the file once it is complete.
+ *
+ * @return False if the file cannot be written.
+ */
+bool replace_file(const string &path, const function<int(ostream &)> &write) {
+	string tmp_path =
+		path + "." + to_string(chrono::system_clock::now().time_since_epoch().count()) + ".tmp";
+	ofstream file(tmp_path, ios::binary | ios::trunc);
+	int status_code = write(file);
+	file.close();
+	error_code ec;
+	if (status_code == 0 && file)
+		filesystem::rename(tmp_path, path, ec);
+	if (status_code != 0 || !file || ec) {
+		filesystem::remove(tmp_path, ec);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Finds where the server keeps its cars, next to its car.json. The server reads car.json only to migrate it
+ * once car.btree or the segmented layout exists, so those are used whenever they do. Both cannot be in use at once.
+ *
+ * @return False if the layout is unknown.
+ */
+bool find_car_files(const string &car_json_path, CarFiles &files) {
+	filesystem::path dir = filesystem::path(car_json_path).parent_path();
+	files.json_path = car_json_path;
+	files.segment_dir = (dir / "car").string() + "/";
+	files.btree_path = (dir / "car.btree").string();
+	error_code ec;
+	bool segmented = filesystem::exists(files.segment_dir + "manifest.json", ec);
+	bool stored = filesystem::exists(files.btree_path, ec);
+	if (segmented && stored) {
+		MyLogger::log("carinfo-manager-logger",
+					  MyLogger::LOG_LEVEL::ERROR,
+					  "Found both " + files.btree_path + " and " + files.segment_dir +
+						  ", remove the one the server does not use");
+		return false;
+	}
+	files.layout = stored ? CarLayout::BTREE : segmented ? CarLayout::SEGMENTS : CarLayout::JSON;
+	return true;
+}
+
+/**
+ * @brief Loads the cars the server keeps. A missing car.json holds no cars.
+ *
+ * @return False if the cars cannot be loaded.
+ */
+bool load_cars(const CarFiles &files, CarPool &carpool) {
+	int status_code = 0;
+	string source = files.json_path;
+	if (files.layout == CarLayout::BTREE) {
+		source = files.btree_path;
+		auto storage = make_unique<BTreeStorage>();
+		status_code = storage->open(files.btree_path, BUFFER_POOL_BYTES);
+		if (status_code == 0)
+			status_code = carpool.attachStorage(std::move(storage));
+	}
+	else if (files.layout == CarLayout::SEGMENTS) {
+		source = files.segment_dir;
+		status_code = carpool.loadSegments(files.segment_dir, 0);
+	}
+	else {
+		ifstream car_file(files.json_path, ios::binary);
+		if (car_file.is_open())
+			status_code = carpool.load(car_file, 0);
+	}
+	if (status_code != 0) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "Cannot load " + source);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Writes the cars where the server keeps them.
+ *
+ * @return False if the cars cannot be written.
+ */
+bool save_cars(const CarFiles &files, CarPool &carpool) {
+	string target = files.json_path;
+	bool ok = false;
+	if (files.layout == CarLayout::BTREE) {
+		// attaching an empty tree writes the cars into it
+		target = files.btree_path;
+		string tmp_path = files.btree_path + "." +
+						  to_string(chrono::system_clock::now().time_since_epoch().count()) + ".tmp";
+		auto storage = make_unique<BTreeStorage>();
+		error_code ec;
+		ok = storage->open(tmp_path, BUFFER_POOL_BYTES) == 0 &&
+			 carpool.attachStorage(std::move(storage)) == 0 && carpool.flushStorage() == 0;
+		if (ok)
+			filesystem::rename(tmp_path, files.btree_path, ec);
+		// the flushed tree leaves an empty journal behind
+		error_code wal_ec;
+		filesystem::remove(tmp_path + ".wal", wal_ec);
+		if (!ok || ec) {
+			filesystem::remove(tmp_path, ec);
+			ok = false;
+		}
+	}
+	else if (files.layout == CarLayout::SEGMENTS) {
+		target = files.segment_dir;
+		ifstream manifest_file(files.segment_dir + "manifest.json");
+		json manifest = json::parse(manifest_file, nullptr, false);
+		ok = manifest.is_object() && manifest.contains("segments") &&
+			 manifest["segments"].is_number_unsigned() &&
+			 carpool.setSegments(manifest["segments"]) == 0 &&
+			 carpool.saveSegments(files.segment_dir) == 0;
+	}
+	else
+		ok = replace_file(files.json_path, [&](ostream &os) { return carpool.save(os); });
+	MyLogger::log("carinfo-manager-logger",
+				  ok ? MyLogger::LOG_LEVEL::INFO : MyLogger::LOG_LEVEL::ERROR,
+				  (ok ? "Wrote " : "Cannot write ") + target);
+	return ok;
+}
+
+int import_cars(const string &format, istream &is, const string &car_json_path, bool replace) {
+	CarFiles files;
+	if (!find_car_files(car_json_path, files))
+		return 1;
+	CarPool carpool;
+	vector<Car> batch;
+	batch.reserve(BATCH_SIZE);
+	size_t line_no = 0, rejected = 0, duplicated = 0;
+	Progress progress("Import");
+
+	auto flush_batch = [&]() {
+		size_t before = carpool.size(), count = batch.size();
+		carpool.addCars(std::move(batch));
+		duplicated += count - (carpool.size() - before);
+		batch.clear();
+		batch.reserve(BATCH_SIZE);
+	};
+	auto reject = [&](const string &reason) {
+		rejected++;
+		MyLogger::log("carinfo-manager-logger",
+					  MyLogger::LOG_LEVEL::WARN,
+					  "[Import] Line " + to_string(line_no) + " rejected: " + reason);
+	};
+
+	if (format == "ndjson") {
+		string line;
+		while (getline(is, line)) {
+			line_no++;
+			if (line.find_first_not_of(" \t\r") == string::npos)
+				continue;
+			Car car;
+			int status_code = CarPool::parseCar(line, car);
+			if (status_code != 0) {
+				reject("status code " + to_string(status_code));
+				continue;
+			}
+			if (!CarPool::carFits(car)) {
+				reject("car too large");
+				continue;
+			}
+			batch.push_back(car);
+			progress.row();
+			if (batch.size() == BATCH_SIZE)
+				flush_batch();
+		}
+	}
+	else {
+		vector<string> fields;
+		map<string, size_t> column;
+		if (!read_csv_record(is, fields)) {
+			MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "Empty CSV input");
+			return 1;
+		}
+		line_no++;
+		for (size_t i = 0; i < fields.size(); i++)
+			column[fields[i]] = i;
+		for (const string &name : CSV_COLUMNS) {
+			if (column.find(name) == column.end()) {
+				MyLogger::log("carinfo-manager-logger",
+							  MyLogger::LOG_LEVEL::ERROR,
+							  "CSV header has no column " + name);
+				return 1;
+			}
+		}
+		while (read_csv_record(is, fields)) {
+			line_no++;
+			if (fields.size() == 1 && fields[0].empty())
+				continue;
+			if (fields.size() != column.size()) {
+				reject("expected " + to_string(column.size()) + " fields");
+				continue;
+			}
+			int year;
+			try {
+				size_t used;
+				year = stoi(fields[column["year"]], &used);
+				if (used != fields[column["year"]].size())
+					throw invalid_argument("year");
+			}
+			catch (...) {
+				reject("invalid year");
+				continue;
+			}
+			Car car(fields[column["id"]],
+					fields[column["type"]],
+					fields[column["owner"]],
+					fields[column["color"]],
+					year,
+					fields[column["img_path"]]);
+			if (!CarPool::carFits(car)) {
+				reject("car too large");
+				continue;
+			}
+			batch.push_back(car);
+			progress.row();
+			if (batch.size() == BATCH_SIZE)
+				flush_batch();
+		}
+	}
+	flush_batch();
+	progress.report(", " + to_string(carpool.size()) + " cars, " + to_string(duplicated) +
+					" duplicate IDs skipped, " + to_string(rejected) + " rows rejected");
+
+	// an imported car replaces the existing car of the same ID, the other existing cars are kept
+	if (!replace) {
+		CarPool existing;
+		if (!load_cars(files, existing)) {
+			MyLogger::log(
+				"carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "Use --replace to overwrite the cars");
+			return 1;
+		}
+		size_t imported = carpool.size(), existing_count = existing.size();
+		carpool.addCars(existing.list());
+		MyLogger::log("carinfo-manager-logger",
+					  MyLogger::LOG_LEVEL::INFO,
+					  "[Import] Merged the existing cars: " +
+						  to_string(existing_count - (carpool.size() - imported)) + " cars replaced, " +
+						  to_string(carpool.size() - imported) + " kept");
+	}
+	return save_cars(files, carpool) ? 0 : 1;
+}
+
+int export_cars(const string &format, const string &car_json_path, ostream &os) {
+	CarFiles files;
+	CarPool carpool;
+	if (!find_car_files(car_json_path, files) || !load_cars(files, carpool))
+		return 1;
+
+	Progress progress("Export");
+	if (format == "csv") {
+		for (size_t i = 0; i < CSV_COLUMNS.size(); i++)
+			os << (i ? "," : "") << CSV_COLUMNS[i];
+		os << "\n";
+	}
+	carpool.forEachCar([&](const Car &car) {
+		if (format == "ndjson") {
+			os << "{\"id\":" << json(car.getId()).dump() << ",\"type\":" << json(car.getType()).dump()
+			   << ",\"owner\":" << json(car.getOwner()).dump()
+			   << ",\"color\":" << json(car.getColor()).dump() << ",\"year\":" << car.getYear()
+			   << ",\"img_path\":" << json(car.getImagePath()).dump() << "}\n";
+		}
+		else {
+			os << csv_field(car.getId()) << "," << csv_field(car.getType()) << ","
+			   << csv_field(car.getOwner()) << "," << csv_field(car.getColor()) << ","
+			   << car.getYear() << "," << csv_field(car.getImagePath()) << "\n";
+		}
+		progress.row();
+	});
+	os.flush();
+	progress.report("");
+	return os ? 0 : 1;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+	bool replace = argc == 6 && string(argv[1]) == "import" && string(argv[5]) == "--replace";
+	if ((argc != 5 && !replace) || (string(argv[1]) != "import" && string(argv[1]) != "export") ||
+		(string(argv[2]) != "ndjson" && string(argv[2]) != "csv")) {
+		cout << "Usage: " << argv[0] << " import <ndjson|csv> <input_file|-> <car_json_file> [--replace]"
+			 << endl;
+		cout << "       " << argv[0] << " export <ndjson|csv> <car_json_file> <output_file|->"
+			 << endl;
+		return 1;
+	}
+	string action = argv[1], format = argv[2];
+	// the console log would end up in the exported data
+	bool to_stdout = action == "export" && string(argv[4]) == "-";
+	MyLogger::registerLogger("carinfo-manager-logger",
+							 MyLogger::LOG_LEVEL::INFO,
+							 to_stdout ? 0 : MyLogger::LOG_TYPE::CONSOLE);
+
+	if (action == "import") {
+		if (string(argv[3]) == "-")
+			return import_cars(format, cin, argv[4], replace);
+		ifstream input(argv[3], ios::binary);
+		if (!input.is_open()) {
+			MyLogger::log(
+				"carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, string("Cannot open ") + argv[3]);
+			return 1;
+		}
+		return import_cars(format, input, argv[4], replace);
+	}
+	if (string(argv[4]) == "-")
+		return export_cars(format, argv[3], cout);
+	ofstream output(argv[4], ios::binary);
+	if (!output.is_open()) {
+		MyLogger::log(
+			"carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, string("Cannot open ") + argv[4]);
+		return 1;
+	}
+	return export_cars(format, argv[3], output);
+}
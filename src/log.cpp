@@ -15,6 +15,7 @@
  */
 
 #include "carinfo-manager/log.hpp"
+#include "carinfo-manager/trace.hpp"
 #include "spdlog/sinks/rotating_file_sink.h"
 #include "spdlog/sinks/stdout_sinks.h"
 #include "spdlog/spdlog.h"
@@ -83,6 +84,7 @@ void MyLogger::registerLogger(const std::string &name,
  * @return void
  */
 void MyLogger::log(const std::string &name, const uint8_t level, const std::string &msg) {
+	Trace::Span span("MyLogger::log");
 	auto logger = spdlog::get(name);
 	if (logger == nullptr)
 		return;
@@ -10,21 +10,50 @@
  * @version 1.0
  */
 
+#include <chrono>
 #include <filesystem>
 #include <fstream>
+#include <future>
 #include <iostream>
-#include <set>
+#include <memory>
 #include "carinfo-manager/accountpool.hpp"
+#include "carinfo-manager/btreestorage.hpp"
 #include "carinfo-manager/carpool.hpp"
+#include "carinfo-manager/fragmentcache.hpp"
 #include "carinfo-manager/hash.hpp"
 #include "carinfo-manager/httphandler-server.hpp"
+#include "carinfo-manager/imagepack.hpp"
+#include "carinfo-manager/imagestore.hpp"
+#include "carinfo-manager/imagesweeper.hpp"
+#include "carinfo-manager/imagewriter.hpp"
 #include "carinfo-manager/log.hpp"
+#include "carinfo-manager/metrics.hpp"
+#include "carinfo-manager/parallelloader.hpp"
+#include "carinfo-manager/ratelimiter.hpp"
+#include "carinfo-manager/requestlanes.hpp"
+#include "carinfo-manager/sessiontokens.hpp"
+#include "carinfo-manager/trace.hpp"
+#include "carinfo-manager/workerpool.hpp"
 #include "cpp-httplib/httplib.h"
 #include "json/json.hpp"
 
 using namespace std;
 using json = nlohmann::json;
 
+namespace {
+
+// the routes of the server, also the names of their request spans
+const char *const ROUTES[] = {"/test_connection", "/login", "/change_password", "/get_carinfo", "/get_cars",
+							  "/get_carimg", "/add_car", "/remove_car", "/update_car", "/patch_car", "/batch",
+							  "/get_accountinfo", "/get_all_account", "/add_account", "/remove_account",
+							  "/update_account", "/metrics", "/trace"};
+
+// trace clock readings of the request being served by the calling thread, -1 if not taken
+thread_local int64_t request_began = -1;
+thread_local int64_t handler_ended = -1;
+
+}  // namespace
+
 int main(int argc, char *argv[]) {
 	if (argc != 2) {
 		cout << "Usage: " << argv[0] << " <config_json_file_path>" << endl;
@@ -61,110 +90,747 @@ int main(int argc, char *argv[]) {
 	string dataDir = string(config_json_obj["dataDir"]);
 	string ip = string(config_json_obj["ip"]);
 	int port = int(config_json_obj["port"]);
+	// optional settings
+	bool optional_config_ok = true;
+	auto optional_unsigned = [&](const string &key, size_t default_value) -> size_t {
+		if (config_json_obj.find(key) == config_json_obj.end())
+			return default_value;
+		if (!config_json_obj[key].is_number_unsigned()) {
+			optional_config_ok = false;
+			return default_value;
+		}
+		return size_t(config_json_obj[key]);
+	};
+	auto optional_bool = [&](const string &key, bool default_value) -> bool {
+		if (config_json_obj.find(key) == config_json_obj.end())
+			return default_value;
+		if (!config_json_obj[key].is_boolean()) {
+			optional_config_ok = false;
+			return default_value;
+		}
+		return bool(config_json_obj[key]);
+	};
+	// number of threads used to load each data file, 0 for one per hardware core
+	size_t loadThreads = optional_unsigned("loadThreads", 0);
+	// orphan image sweeping: files checked per batch, pause between batches and between passes
+	size_t imgSweepBatch = optional_unsigned("imgSweepBatch", 256);
+	size_t imgSweepIntervalMs = optional_unsigned("imgSweepIntervalMs", 100);
+	size_t imgSweepPassSec = optional_unsigned("imgSweepPassSec", 600);
+	// memory budget of the image cache of /get_carimg, 0 to disable it
+	size_t imgCacheBytes = optional_unsigned("imgCacheBytes", 64 << 20);
+	// largest request body, which bounds the image of /add_car, /update_car and /patch_car
+	size_t maxUploadBytes = optional_unsigned("maxUploadBytes", 32 << 20);
+	// I/O threads writing uploaded images, 0 to write on the request threads, and the bytes they may have queued
+	size_t imgWriteThreads = optional_unsigned("imgWriteThreads", 2);
+	size_t imgWriteQueueBytes = optional_unsigned("imgWriteQueueBytes", 64 << 20);
+	// directory levels of the image store, each named by two hex digits of the image hash. A flat directory is fastest
+	// on file systems with hashed directories such as ext4 and NTFS; 1 or 2 helps where large directories are slow
+	size_t imgFanout = optional_unsigned("imgFanout", 0);
+	// "file" stores each image in its own file, "pack" appends them to segment files of imgPackSegmentBytes, a segment
+	// is compacted once more than imgPackDeadPercent of it is unreferenced, checked every imgPackCompactSec
+	string imgBackend = "file";
+	if (config_json_obj.find("imgBackend") != config_json_obj.end()) {
+		if (config_json_obj["imgBackend"].is_string())
+			imgBackend = string(config_json_obj["imgBackend"]);
+		else
+			optional_config_ok = false;
+	}
+	size_t imgPackSegmentBytes = optional_unsigned("imgPackSegmentBytes", 64 << 20);
+	size_t imgPackDeadPercent = optional_unsigned("imgPackDeadPercent", 50);
+	size_t imgPackCompactSec = optional_unsigned("imgPackCompactSec", 600);
+	// when an uploaded image is acknowledged: "queued", "written" or "synced" to the disk
+	ImageWriter::Durability imgDurability = ImageWriter::Durability::WRITTEN;
+	if (config_json_obj.find("imgDurability") != config_json_obj.end()) {
+		string durability;
+		if (config_json_obj["imgDurability"].is_string())
+			durability = string(config_json_obj["imgDurability"]);
+		if (durability == "queued")
+			imgDurability = ImageWriter::Durability::QUEUED;
+		else if (durability == "synced")
+			imgDurability = ImageWriter::Durability::SYNCED;
+		else if (durability != "written")
+			optional_config_ok = false;
+	}
+	// number of segment files of the car data, 0 to keep everything in car.json
+	size_t carSegments = optional_unsigned("carSegments", 0);
+	// "memory" keeps the cars in memory, "btree" keeps them in car.btree with a buffer pool of bufferPoolBytes
+	string carBackend = "memory";
+	if (config_json_obj.find("carBackend") != config_json_obj.end()) {
+		if (config_json_obj["carBackend"].is_string())
+			carBackend = string(config_json_obj["carBackend"]);
+		else
+			optional_config_ok = false;
+	}
+	size_t bufferPoolBytes = optional_unsigned("bufferPoolBytes", 64 << 20);
+	// key signing the session tokens of /login, a random one per run if empty, and their lifetime. Requests carrying a
+	// valid token skip the password check; the tokens of an account are revoked when it is updated or removed
+	string sessionKey;
+	if (config_json_obj.find("sessionKey") != config_json_obj.end()) {
+		if (config_json_obj["sessionKey"].is_string())
+			sessionKey = string(config_json_obj["sessionKey"]);
+		else
+			optional_config_ok = false;
+	}
+	size_t sessionTtlSec = optional_unsigned("sessionTtlSec", 3600);
+	// spaces per level of the JSON responses, 0 for compact JSON
+	size_t jsonIndent = optional_unsigned("jsonIndent", 0);
+	// byte budget of the cached compact JSON of the cars, 0 to serialize every car every time
+	size_t carFragmentCacheBytes = optional_unsigned("carFragmentCacheBytes", 32 << 20);
+	// whether to serve /metrics, which is unauthenticated, so it is off unless enabled
+	bool enableMetrics = optional_bool("enableMetrics", false);
+	// whether to serve /trace, which is unauthenticated, so it is off unless enabled, and the spans of the request
+	// stages each thread keeps for it, 0 to record none. No spans are recorded while /trace is off
+	bool enableTrace = optional_bool("enableTrace", false);
+	size_t traceSpans = optional_unsigned("traceSpans", 1024);
+	// budgets of the request lanes, see RequestLanes: requests running at once in a lane, 0 for no limit, and requests
+	// waiting for them, beyond which a request is answered 503
+	size_t laneReadWorkers = optional_unsigned("laneReadWorkers", 0);
+	size_t laneReadQueue = optional_unsigned("laneReadQueue", 0);
+	size_t laneScanWorkers = optional_unsigned("laneScanWorkers", 2);
+	size_t laneScanQueue = optional_unsigned("laneScanQueue", 2);
+	size_t laneWriteWorkers = optional_unsigned("laneWriteWorkers", 2);
+	size_t laneWriteQueue = optional_unsigned("laneWriteQueue", 8);
+	size_t laneImageWorkers = optional_unsigned("laneImageWorkers", 4);
+	size_t laneImageQueue = optional_unsigned("laneImageQueue", 4);
+	RequestLanes lanes({RequestLanes::Budget{laneReadWorkers, laneReadQueue},
+						RequestLanes::Budget{laneScanWorkers, laneScanQueue},
+						RequestLanes::Budget{laneWriteWorkers, laneWriteQueue},
+						RequestLanes::Budget{laneImageWorkers, laneImageQueue}});
+	// Retry-After of the 503 of a full lane, in seconds
+	size_t shedRetryAfterSec = optional_unsigned("shedRetryAfterSec", 1);
+	// requests per second each client address may send, 0 for no limit, and how many it may send at once, 0 for one
+	// second's worth; a client over its rate is answered 429
+	size_t rateLimitPerSec = optional_unsigned("rateLimitPerSec", 0);
+	size_t rateLimitBurst = optional_unsigned("rateLimitBurst", 0);
+	if (rateLimitBurst == 0)
+		rateLimitBurst = rateLimitPerSec;
+	// threads serving the connections, 0 for httplib's default on top of the threads the lanes other than point reads
+	// can hold, connections waiting for one beyond which new ones are closed, 0 for no bound, and whether to pin each
+	// thread to a CPU
+	size_t workerThreads = optional_unsigned("workerThreads", 0);
+	size_t workerQueueMax = optional_unsigned("workerQueueMax", 0);
+	bool workerAffinity = optional_bool("workerAffinity", false);
+	if (workerThreads == 0)
+		workerThreads = CPPHTTPLIB_THREAD_POOL_COUNT + lanes.reservedThreads();
+	if ((carBackend != "memory" && carBackend != "btree") || (carBackend == "btree" && carSegments != 0) ||
+		imgFanout > ImageStore::MAX_FANOUT || (imgBackend != "file" && imgBackend != "pack") || sessionTtlSec == 0)
+		optional_config_ok = false;
+	if (!optional_config_ok) {
+		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "Invalid config file");
+		return 1;
+	}
+
+	Trace::configure(enableTrace ? traceSpans : 0);
 
 	// print config
-	MyLogger::log(
-		"carinfo-manager-logger",
-		MyLogger::LOG_LEVEL::INFO,
-		"Using config:\n- dataDir: " + dataDir + "\n- ip: " + ip + "\n- port: " + to_string(port));
+	MyLogger::log("carinfo-manager-logger",
+				  MyLogger::LOG_LEVEL::INFO,
+				  "Using config:\n- dataDir: " + dataDir + "\n- ip: " + ip +
+					  "\n- port: " + to_string(port) + "\n- loadThreads: " + to_string(loadThreads) +
+					  "\n- carSegments: " + to_string(carSegments) + "\n- carBackend: " + carBackend +
+					  "\n- imgBackend: " + imgBackend + "\n- workerThreads: " + to_string(workerThreads) +
+					  "\n- enableMetrics: " + (enableMetrics ? "true" : "false") +
+					  "\n- enableTrace: " + (enableTrace ? "true" : "false"));
 
-	// load data
+	// load data, accounts and cars at the same time
+	auto load_start = chrono::steady_clock::now();
 	AccountPool accountpool;
 	CarPool carpool;
-	ifstream account_file(dataDir + "account.json");
-	if (accountpool.load(account_file) != 0) {
+	future<int> account_load = async(launch::async, [&]() {
+		ifstream account_file(dataDir + "account.json");
+		return accountpool.load(account_file, loadThreads);
+	});
+	string carDir = dataDir + "car/";
+	// the segmented layout holds the latest car data whenever it exists, even if carSegments was set back to 0
+	bool car_segmented = ifstream(carDir + "manifest.json").is_open();
+	// so does car.btree, even if carBackend was switched back to "memory"; car.json is only read without either
+	bool car_stored = ifstream(dataDir + "car.btree").is_open();
+	if (car_segmented && car_stored) {
+		MyLogger::log("carinfo-manager-logger",
+					  MyLogger::LOG_LEVEL::ERROR,
+					  "Found both " + dataDir + "car.btree and " + carDir +
+						  "manifest.json, remove the car data not in use");
+		return 1;
+	}
+	int car_load_status = 0;
+	BTreeStorage *car_storage = nullptr;
+	if (car_segmented)
+		car_load_status = carpool.loadSegments(carDir, loadThreads);
+	else if (car_stored && carBackend != "btree") {
+		// copy the stored cars into memory
+		CarPool stored;
+		auto storage = make_unique<BTreeStorage>();
+		car_load_status = storage->open(dataDir + "car.btree", bufferPoolBytes);
+		if (car_load_status == 0)
+			car_load_status = stored.attachStorage(std::move(storage));
+		if (car_load_status == 0)
+			car_load_status = carpool.addCars(stored.list());
+	}
+	else if (!car_stored) {
+		ifstream car_file(dataDir + "car.json");
+		car_load_status = carpool.load(car_file, loadThreads);
+		car_file.close();
+	}
+	if (car_load_status == 0 && carBackend == "btree") {
+		auto storage = make_unique<BTreeStorage>();
+		car_storage = storage.get();
+		car_load_status = storage->open(dataDir + "car.btree", bufferPoolBytes);
+		if (car_load_status == 0)
+			car_load_status = carpool.attachStorage(std::move(storage));
+		if (car_load_status != 0 && !car_stored) {
+			// drop the half-written tree, else the next start would take it for the cars
+			error_code ec;
+			filesystem::remove(dataDir + "car.btree", ec);
+			filesystem::remove(dataDir + "car.btree.wal", ec);
+		}
+	}
+	if (account_load.get() != 0) {
 		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "Cannot load account data");
 		return 1;
 	}
-	account_file.close();
-	ifstream car_file(dataDir + "car.json");
-	if (carpool.load(car_file) != 0) {
+	if (car_load_status == 0xE2) {
+		MyLogger::log("carinfo-manager-logger",
+					  MyLogger::LOG_LEVEL::ERROR,
+					  "A car is too large for " + dataDir + "car.btree, shorten or remove it before migrating");
+		return 1;
+	}
+	if (car_load_status != 0) {
 		MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "Cannot load car data");
 		return 1;
 	}
-	car_file.close();
-
-	// modify img files
-	set<string> imgFiles;
-	for (auto &car : carpool.list())
-		imgFiles.insert(car.getImagePath());
-	for (auto &file : filesystem::directory_iterator(dataDir + "img/")) {
-		if (file.is_regular_file()) {
-			string fullPath = file.path().string();
-			if (imgFiles.find(fullPath) == imgFiles.end())
-				filesystem::remove(fullPath);
+	carpool.setFragmentCache(carFragmentCacheBytes);
+	auto load_ms =
+		chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - load_start);
+	MyLogger::log("carinfo-manager-logger",
+				  MyLogger::LOG_LEVEL::INFO,
+				  "Data loaded in " + to_string(load_ms.count()) + " ms\n- accounts: " +
+					  to_string(accountpool.size()) + "\n- cars: " + to_string(carpool.size()) +
+					  "\n- threads: " + to_string(ParallelLoader::threadCount(loadThreads)));
+	if (car_stored && car_storage != nullptr)
+		MyLogger::log("carinfo-manager-logger",
+					  MyLogger::LOG_LEVEL::INFO,
+					  "Using car storage " + dataDir + "car.btree");
+	else if (car_storage != nullptr && !car_segmented)
+		MyLogger::log("carinfo-manager-logger",
+					  MyLogger::LOG_LEVEL::INFO,
+					  "Migrated car.json to " + dataDir + "car.btree");
+
+	// switch to the segmented layout, migrating car.json or re-partitioning the segments if needed
+	if (carSegments != 0 && carpool.segmentCount() != carSegments) {
+		if (carpool.setSegments(carSegments) != 0 || carpool.saveSegments(carDir) != 0) {
+			MyLogger::log(
+				"carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "Cannot write segmented car data");
+			return 1;
+		}
+		MyLogger::log("carinfo-manager-logger",
+					  MyLogger::LOG_LEVEL::INFO,
+					  string(car_segmented ? "Re-partitioned car data into "
+										   : car_stored ? "Migrated car.btree to "
+														: "Migrated car.json to ") +
+						  to_string(carSegments) + " segments in " + carDir);
+	}
+	// replaces car.json through a temporary file, so that a crash leaves the old one
+	auto replace_car_json = [&]() {
+		string tmp_path = dataDir + "car.json.tmp";
+		ofstream car_file(tmp_path, ios::binary | ios::trunc);
+		bool written = carpool.save(car_file) == 0;
+		car_file.close();
+		error_code ec;
+		written = written && car_file && ImageWriter::syncFile(tmp_path);
+		if (written)
+			filesystem::rename(tmp_path, dataDir + "car.json", ec);
+		written = written && !ec && ImageWriter::syncDirectory(dataDir);
+		if (!written)
+			filesystem::remove(tmp_path, ec);
+		return written;
+	};
+	// leave the segmented layout once its car data is written where the config keeps it: car.btree, written when it
+	// was attached, or car.json. The manifest goes last, so that a crash before leaves the segmented layout in use
+	if (car_segmented && carSegments == 0) {
+		bool migrated = car_storage != nullptr || (carpool.setSegments(0) == 0 && replace_car_json());
+		error_code ec;
+		if (!migrated || !filesystem::remove(carDir + "manifest.json", ec)) {
+			MyLogger::log("carinfo-manager-logger",
+						  MyLogger::LOG_LEVEL::ERROR,
+						  "Cannot migrate the segmented car data in " + carDir);
+			return 1;
+		}
+		filesystem::remove_all(carDir, ec);
+		MyLogger::log("carinfo-manager-logger",
+					  MyLogger::LOG_LEVEL::INFO,
+					  "Migrated segmented car data in " + carDir + " to " + dataDir +
+						  (car_storage != nullptr ? "car.btree" : "car.json"));
+	}
+	// likewise leave car.btree once its car data is written to the segments, above, or to car.json
+	if (car_stored && car_storage == nullptr) {
+		bool migrated = carSegments != 0 || replace_car_json();
+		error_code ec;
+		if (!migrated || !filesystem::remove(dataDir + "car.btree", ec)) {
+			MyLogger::log("carinfo-manager-logger",
+						  MyLogger::LOG_LEVEL::ERROR,
+						  "Cannot migrate the car data in " + dataDir + "car.btree");
+			return 1;
+		}
+		filesystem::remove(dataDir + "car.btree.wal", ec);
+		if (carSegments == 0)
+			MyLogger::log("carinfo-manager-logger",
+						  MyLogger::LOG_LEVEL::INFO,
+						  "Migrated car.btree to " + dataDir + "car.json");
+	}
+	// request counts and latencies, save timings and the statistics of the parts of the server, served by /metrics
+	Metrics metrics;
+	size_t cars_timer = metrics.addTimer("cars");
+	size_t accounts_timer = metrics.addTimer("accounts");
+	// persist the car data after a change: only the dirty segments, or the whole car.json
+	auto save_cars = [&]() {
+		auto save_start = chrono::steady_clock::now();
+		size_t dirty = carpool.dirtySegmentCount();
+		if (car_storage != nullptr)
+			carpool.flushStorage();
+		else if (carSegments != 0)
+			carpool.saveSegments(carDir);
+		else {
+			ofstream car_file(dataDir + "car.json");
+			carpool.save(car_file);
+			car_file.close();
+		}
+		auto save_elapsed = chrono::steady_clock::now() - save_start;
+		metrics.time(cars_timer, save_elapsed);
+		auto save_us = chrono::duration_cast<chrono::microseconds>(save_elapsed);
+		MyLogger::log("carinfo-manager-logger",
+					  MyLogger::LOG_LEVEL::DEBUG,
+					  "Car data saved in " + to_string(save_us.count()) + " us\n- segments written: " +
+						  (carSegments != 0 ? to_string(dirty) : string("all")));
+		if (car_storage != nullptr)
+			MyLogger::log("carinfo-manager-logger",
+						  MyLogger::LOG_LEVEL::DEBUG,
+						  "Car storage buffer pool\n- hits: " + to_string(car_storage->hitCount()) +
+							  "\n- misses: " + to_string(car_storage->missCount()) +
+							  "\n- frames: " + to_string(car_storage->frameCount()));
+	};
+
+	// persist the account data after a change
+	auto save_accounts = [&]() {
+		auto save_start = chrono::steady_clock::now();
+		ofstream account_file(dataDir + "account.json");
+		accountpool.save(account_file);
+		account_file.close();
+		metrics.time(accounts_timer, chrono::steady_clock::now() - save_start);
+	};
+
+	// open the image pack, also after switching back to files, to move its images out and compact it away
+	string packDir = dataDir + "imgpack/";
+	unique_ptr<ImagePack> img_pack;
+	if (imgBackend == "pack" || filesystem::exists(packDir)) {
+		img_pack = make_unique<ImagePack>(
+			carpool, packDir, imgPackSegmentBytes, imgPackDeadPercent, chrono::seconds(imgPackCompactSec));
+		if (img_pack->open() != 0) {
+			MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::ERROR, "Cannot open image pack");
+			return 1;
 		}
 	}
+	ImagePack *store_pack = imgBackend == "pack" ? img_pack.get() : nullptr;
+
+	// move the images into the configured layout and backend, img-layout.json records the current ones
+	string layout_path = dataDir + "img-layout.json";
+	bool layout_known = false;
+	ifstream layout_file(layout_path);
+	if (layout_file.is_open()) {
+		json layout_obj = json::parse(layout_file, nullptr, false);
+		layout_known = layout_obj.is_object() && layout_obj.contains("fanout") &&
+					   layout_obj["fanout"].is_number_unsigned() && size_t(layout_obj["fanout"]) == imgFanout &&
+					   layout_obj.value("backend", json("file")) == json(imgBackend);
+		layout_file.close();
+	}
+	if (!layout_known) {
+		size_t moved = 0;
+		auto migrate_start = chrono::steady_clock::now();
+		int migrate_status =
+			ImageStore(dataDir + "img/", nullptr, imgFanout, store_pack).migrate(carpool, moved, img_pack.get());
+		if (moved != 0)
+			save_cars();
+		if (migrate_status == 0)
+			ofstream(layout_path) << json({{"fanout", imgFanout}, {"backend", imgBackend}}).dump(4);
+		auto migrate_ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() -
+																	  migrate_start);
+		MyLogger::log("carinfo-manager-logger",
+					  migrate_status == 0 ? MyLogger::LOG_LEVEL::INFO : MyLogger::LOG_LEVEL::ERROR,
+					  "Migrated images to fan-out " + to_string(imgFanout) + ", backend " + imgBackend + " in " +
+						  to_string(migrate_ms.count()) + " ms\n- moved: " + to_string(moved) +
+						  "\n- status: " + to_string(migrate_status));
+	}
+	if (img_pack)
+		img_pack->start();
+
+	// write uploaded images on dedicated I/O threads
+	unique_ptr<ImageWriter> img_writer;
+	if (imgWriteThreads != 0) {
+		img_writer = make_unique<ImageWriter>(imgWriteThreads, imgWriteQueueBytes, imgDurability);
+		img_writer->start();
+	}
+
+	SessionTokens sessions(sessionKey.empty() ? SessionTokens::randomKey() : sessionKey,
+						   chrono::seconds(sessionTtlSec));
 
 	// config server
 	httplib::Server svr;
-	ServerHttpHandler handler(accountpool, carpool, dataDir + "img/");
+	svr.set_payload_max_length(maxUploadBytes);
+	WorkerPool *worker_pool = nullptr;  // owned by the server while it listens
+	svr.new_task_queue = [&]() {
+		worker_pool = new WorkerPool(workerThreads, workerQueueMax, workerAffinity);
+		return worker_pool;
+	};
+	ServerHttpHandler handler(accountpool,
+							  carpool,
+							  dataDir + "img/",
+							  imgCacheBytes,
+							  maxUploadBytes,
+							  img_writer.get(),
+							  imgFanout,
+							  store_pack,
+							  &sessions,
+							  jsonIndent,
+							  save_cars);
+
+	// remove orphan img files in the background
+	ImageSweeper sweeper(carpool,
+						 handler.imageStore(),
+						 handler.carLock(),
+						 dataDir + "img/",
+						 imgSweepBatch,
+						 chrono::milliseconds(imgSweepIntervalMs),
+						 chrono::seconds(imgSweepPassSec));
+	sweeper.start();
+	unique_ptr<RateLimiter> rate_limiter;
+	if (rateLimitPerSec != 0)
+		rate_limiter = make_unique<RateLimiter>(double(rateLimitPerSec), double(rateLimitBurst));
+	// run each request in its lane, or turn it away if its client is over its rate or the lane is full
+	auto in_lane = [&](const httplib::Request &req, httplib::Response &res, const function<void()> &serve) {
+		if (request_began >= 0)
+			Trace::record("read request", request_began, Trace::now());
+		chrono::seconds retry_after;
+		if (rate_limiter && !rate_limiter->admit(req.remote_addr, retry_after)) {
+			res.status = 429;
+			res.set_header("Retry-After", to_string(retry_after.count()));
+			res.set_content("Too Many Requests", "text/plain");
+			MyLogger::log("carinfo-manager-logger",
+						  MyLogger::LOG_LEVEL::WARN,
+						  "[HTTP Rate Limit] from " + req.remote_addr + ":" + to_string(req.remote_port) +
+							  ".\n- Path: " + req.path + "\n- Status: 429 (Too Many Requests)");
+			return;
+		}
+		RequestLanes::Lane lane = RequestLanes::classify(req);
+		int64_t wait_began = request_began >= 0 ? Trace::now() : -1;
+		RequestLanes::Ticket ticket(lanes, lane);
+		if (wait_began >= 0)
+			Trace::record("lane wait", wait_began, Trace::now());
+		if (!ticket.isAdmitted()) {
+			res.status = 503;
+			res.set_header("Retry-After", to_string(shedRetryAfterSec));
+			res.set_content("Service Unavailable", "text/plain");
+			MyLogger::log("carinfo-manager-logger",
+						  MyLogger::LOG_LEVEL::WARN,
+						  "[HTTP Request Lanes] from " + req.remote_addr + ":" + to_string(req.remote_port) +
+							  ".\n- Path: " + req.path + "\n- Lane: " + RequestLanes::laneName(lane) +
+							  "\n- Status: 503 (Service Unavailable)");
+			return;
+		}
+		serve();
+		if (request_began >= 0)
+			handler_ended = Trace::now();
+	};
+	// a request is timed from before its body is read until its response is written
+	// and traced as a span named by its route, with spans for reading it, waiting in its lane and writing the response
+	for (const char *path : ROUTES)
+		metrics.addRoute(path);
+	svr.set_pre_routing_handler([&](const httplib::Request &req, httplib::Response &) {
+		metrics.begin(req.path);
+		request_began = Trace::enabled() ? Trace::now() : -1;
+		return httplib::Server::HandlerResponse::Unhandled;
+	});
+	svr.set_logger([&](const httplib::Request &req, const httplib::Response &res) {
+		metrics.end(res.status);
+		if (request_began < 0)
+			return;
+		int64_t now = Trace::now();
+		if (handler_ended >= 0)
+			Trace::record("write response", handler_ended, now);
+		const char *route = "other";
+		for (const char *path : ROUTES) {
+			if (req.path == path)
+				route = path;
+		}
+		Trace::record(route, request_began, now);
+		request_began = handler_ended = -1;
+	});
+	metrics.addGauge("carinfo_cars", "Cars in the car pool.", [&]() {
+		std::shared_lock<std::shared_mutex> lock(handler.carLock());
+		return double(carpool.size());
+	});
+	metrics.addGauge("carinfo_accounts", "Accounts in the account pool.", [&]() { return double(accountpool.size()); });
+	for (size_t i = 0; i < RequestLanes::LANE_COUNT; i++) {
+		auto lane = static_cast<RequestLanes::Lane>(i);
+		string label = string("{lane=\"") + RequestLanes::laneName(lane) + "\"}";
+		metrics.addCounter("carinfo_lane_served_total" + label, "Requests let into a request lane.", [&, lane]() {
+			return double(lanes.servedCount(lane));
+		});
+		metrics.addCounter("carinfo_lane_queued_total" + label, "Requests that waited in a request lane.", [&, lane]() {
+			return double(lanes.queuedCount(lane));
+		});
+		metrics.addCounter("carinfo_lane_shed_total" + label, "Requests answered 503, their lane full.", [&, lane]() {
+			return double(lanes.rejectedCount(lane));
+		});
+	}
+	metrics.addCounter("carinfo_rate_limited_total", "Requests answered 429 as their client was over its rate.", [&]() {
+		return double(rate_limiter ? rate_limiter->limitedCount() : 0);
+	});
+	metrics.addGauge("carinfo_worker_threads", "Threads serving the connections.", [&]() {
+		return double(worker_pool ? worker_pool->threadCount() : 0);
+	});
+	metrics.addGauge("carinfo_worker_queued", "Connections waiting for a worker thread.", [&]() {
+		return double(worker_pool ? worker_pool->queuedCount() : 0);
+	});
+	metrics.addCounter("carinfo_worker_steals_total", "Connections a worker took from another's deque.", [&]() {
+		return double(worker_pool ? worker_pool->stealCount() : 0);
+	});
+	metrics.addCounter("carinfo_worker_rejected_total", "Connections closed as the worker queue was full.", [&]() {
+		return double(worker_pool ? worker_pool->rejectedCount() : 0);
+	});
+	const ImageCache &img_cache = handler.imageCache();
+	metrics.addCounter("carinfo_image_cache_hits_total", "Image cache hits.", [&]() {
+		return double(img_cache.hitCount());
+	});
+	metrics.addCounter("carinfo_image_cache_misses_total", "Image cache misses.", [&]() {
+		return double(img_cache.missCount());
+	});
+	metrics.addCounter("carinfo_image_cache_evictions_total", "Images evicted from the image cache.", [&]() {
+		return double(img_cache.evictionCount());
+	});
+	metrics.addGauge("carinfo_image_cache_bytes", "Bytes held by the image cache.", [&]() {
+		return double(img_cache.byteCount());
+	});
+	const FragmentCache *fragment_cache = carpool.fragmentCache();
+	metrics.addCounter("carinfo_car_json_cache_hits_total", "Cars written from their cached JSON.", [&]() {
+		return double(fragment_cache ? fragment_cache->hitCount() : 0);
+	});
+	metrics.addCounter("carinfo_car_json_cache_misses_total", "Cars serialized as their JSON was not cached.", [&]() {
+		return double(fragment_cache ? fragment_cache->missCount() : 0);
+	});
+	metrics.addCounter("carinfo_car_json_cache_evictions_total", "Cars evicted from the car JSON cache.", [&]() {
+		return double(fragment_cache ? fragment_cache->evictionCount() : 0);
+	});
+	metrics.addGauge("carinfo_car_json_cache_hit_ratio", "Share of the cars written from their cached JSON.", [&]() {
+		size_t hits = fragment_cache ? fragment_cache->hitCount() : 0;
+		size_t misses = fragment_cache ? fragment_cache->missCount() : 0;
+		return hits + misses == 0 ? 0.0 : double(hits) / double(hits + misses);
+	});
+	metrics.addGauge("carinfo_car_json_cache_bytes", "Bytes held by the car JSON cache.", [&]() {
+		return double(fragment_cache ? fragment_cache->byteCount() : 0);
+	});
+	metrics.addGauge("carinfo_car_json_cache_entries", "Cars whose JSON is cached.", [&]() {
+		return double(fragment_cache ? fragment_cache->entryCount() : 0);
+	});
+	const ImageStore &img_store = handler.imageStore();
+	metrics.addCounter("carinfo_images_stored_total", "Uploaded images written to the image store.", [&]() {
+		return double(img_store.storedCount());
+	});
+	metrics.addCounter("carinfo_images_deduplicated_total", "Uploaded images already in the image store.", [&]() {
+		return double(img_store.deduplicatedCount());
+	});
+	metrics.addCounter("carinfo_images_swept_total", "Orphan image files removed.", [&]() {
+		return double(sweeper.removedCount());
+	});
+	if (img_writer) {
+		metrics.addGauge("carinfo_image_writer_queued_bytes", "Bytes queued on the image writer.", [&]() {
+			return double(img_writer->queuedBytes());
+		});
+		metrics.addCounter("carinfo_image_writer_stalls_total", "Uploads that waited for the image writer.", [&]() {
+			return double(img_writer->stallCount());
+		});
+	}
+	if (img_pack) {
+		metrics.addGauge("carinfo_image_pack_images", "Images in the image pack.", [&]() {
+			return double(img_pack->imageCount());
+		});
+		metrics.addGauge("carinfo_image_pack_bytes", "Bytes of the image pack segments.", [&]() {
+			return double(img_pack->byteCount());
+		});
+		metrics.addCounter("carinfo_image_pack_compactions_total", "Image pack segments compacted.", [&]() {
+			return double(img_pack->compactionCount());
+		});
+	}
+	if (car_storage != nullptr) {
+		metrics.addCounter("carinfo_buffer_pool_hits_total", "Car storage pages found in the buffer pool.", [&]() {
+			return double(car_storage->hitCount());
+		});
+		metrics.addCounter("carinfo_buffer_pool_misses_total", "Car storage pages read from car.btree.", [&]() {
+			return double(car_storage->missCount());
+		});
+	}
+	metrics.addGauge("carinfo_revoked_sessions", "Accounts whose session tokens are revoked.", [&]() {
+		return double(sessions.revokedCount());
+	});
 	svr.Get("/test_connection", [&](const httplib::Request &req, httplib::Response &res) {
-		handler.handler_test_connection(req, res);
+		in_lane(req, res, [&]() {
+			handler.handler_test_connection(req, res);
+		});
 	});
 	svr.Post("/test_connection", [&](const httplib::Request &req, httplib::Response &res) {
-		handler.handler_test_connection(req, res);
+		in_lane(req, res, [&]() {
+			handler.handler_test_connection(req, res);
+		});
 	});
 	svr.Post("/login", [&](const httplib::Request &req, httplib::Response &res) {
-		handler.handler_login(req, res);
+		in_lane(req, res, [&]() {
+			handler.handler_login(req, res);
+		});
 	});
 	svr.Post("/change_password", [&](const httplib::Request &req, httplib::Response &res) {
-		handler.handler_change_password(req, res);
-		ofstream account_file(dataDir + "account.json");
-		accountpool.save(account_file);
-		account_file.close();
+		in_lane(req, res, [&]() {
+			handler.handler_change_password(req, res);
+			save_accounts();
+		});
 	});
 	svr.Post("/get_carinfo", [&](const httplib::Request &req, httplib::Response &res) {
-		handler.handler_get_carinfo(req, res);
+		in_lane(req, res, [&]() {
+			handler.handler_get_carinfo(req, res);
+		});
 	});
-	svr.Post("/get_carimg", [&](const httplib::Request &req, httplib::Response &res) {
-		handler.handler_get_carimg(req, res);
+	svr.Post("/get_cars", [&](const httplib::Request &req, httplib::Response &res) {
+		in_lane(req, res, [&]() {
+			handler.handler_get_cars(req, res);
+		});
 	});
-	svr.Post("/add_car", [&](const httplib::Request &req, httplib::Response &res) {
-		handler.handler_add_car(req, res);
-		ofstream car_file(dataDir + "car.json");
-		carpool.save(car_file);
-		car_file.close();
+	svr.Post("/get_carimg", [&](const httplib::Request &req, httplib::Response &res) {
+		in_lane(req, res, [&]() {
+			handler.handler_get_carimg(req, res);
+		});
 	});
+	svr.Post("/add_car",
+			 [&](const httplib::Request &req,
+				 httplib::Response &res,
+				 const httplib::ContentReader &content_reader) {
+				 in_lane(req, res, [&]() {
+					 handler.handler_add_car(req, res, content_reader);
+				 });
+			 });
 	svr.Post("/remove_car", [&](const httplib::Request &req, httplib::Response &res) {
-		handler.handler_remove_car(req, res);
-		ofstream car_file(dataDir + "car.json");
-		carpool.save(car_file);
-		car_file.close();
+		in_lane(req, res, [&]() {
+			handler.handler_remove_car(req, res);
+		});
 	});
-	svr.Post("/update_car", [&](const httplib::Request &req, httplib::Response &res) {
-		handler.handler_update_car(req, res);
-		ofstream car_file(dataDir + "car.json");
-		carpool.save(car_file);
-		car_file.close();
+	svr.Post("/update_car",
+			 [&](const httplib::Request &req,
+				 httplib::Response &res,
+				 const httplib::ContentReader &content_reader) {
+				 in_lane(req, res, [&]() {
+					 handler.handler_update_car(req, res, content_reader);
+				 });
+			 });
+	svr.Post("/patch_car",
+			 [&](const httplib::Request &req,
+				 httplib::Response &res,
+				 const httplib::ContentReader &content_reader) {
+				 in_lane(req, res, [&]() {
+					 handler.handler_patch_car(req, res, content_reader);
+				 });
+			 });
+	svr.Post("/batch", [&](const httplib::Request &req, httplib::Response &res) {
+		in_lane(req, res, [&]() {
+			handler.handler_batch(req, res);
+		});
 	});
 	svr.Post("/get_accountinfo", [&](const httplib::Request &req, httplib::Response &res) {
-		handler.handler_get_accountinfo(req, res);
+		in_lane(req, res, [&]() {
+			handler.handler_get_accountinfo(req, res);
+		});
 	});
 	svr.Post("/get_all_account", [&](const httplib::Request &req, httplib::Response &res) {
-		handler.handler_get_all_account(req, res);
+		in_lane(req, res, [&]() {
+			handler.handler_get_all_account(req, res);
+		});
 	});
 	svr.Post("/add_account", [&](const httplib::Request &req, httplib::Response &res) {
-		handler.handler_add_account(req, res);
-		ofstream account_file(dataDir + "account.json");
-		accountpool.save(account_file);
-		account_file.close();
+		in_lane(req, res, [&]() {
+			handler.handler_add_account(req, res);
+			save_accounts();
+		});
 	});
 	svr.Post("/remove_account", [&](const httplib::Request &req, httplib::Response &res) {
-		handler.handler_remove_account(req, res);
-		ofstream account_file(dataDir + "account.json");
-		accountpool.save(account_file);
-		account_file.close();
+		in_lane(req, res, [&]() {
+			handler.handler_remove_account(req, res);
+			save_accounts();
+		});
 	});
 	svr.Post("/update_account", [&](const httplib::Request &req, httplib::Response &res) {
-		handler.handler_update_account(req, res);
-		ofstream account_file(dataDir + "account.json");
-		accountpool.save(account_file);
-		account_file.close();
+		in_lane(req, res, [&]() {
+			handler.handler_update_account(req, res);
+			save_accounts();
+		});
 	});
+	if (enableMetrics) {
+		svr.Get("/metrics", [&](const httplib::Request &req, httplib::Response &res) {
+			in_lane(req, res, [&]() {
+				res.set_content(metrics.render(), "text/plain; version=0.0.4");
+			});
+		});
+	}
+	if (enableTrace) {
+		svr.Get("/trace", [&](const httplib::Request &req, httplib::Response &res) {
+			in_lane(req, res, [&]() {
+				res.set_content(Trace::dumpChrome(), "application/json");
+			});
+		});
+	}
 
 	// start server
 	MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::INFO, "Server started");
 	svr.listen(ip.c_str(), port);
+	sweeper.stop();
+	if (img_writer) {
+		img_writer->stop();
+		MyLogger::log("carinfo-manager-logger",
+					  MyLogger::LOG_LEVEL::INFO,
+					  "Image writer\n- threads: " + to_string(img_writer->threadCount()) +
+						  "\n- stalls: " + to_string(img_writer->stallCount()));
+	}
+	if (img_pack) {
+		img_pack->stop();
+		MyLogger::log("carinfo-manager-logger",
+					  MyLogger::LOG_LEVEL::INFO,
+					  "Image pack\n- images: " + to_string(img_pack->imageCount()) +
+						  "\n- segments: " + to_string(img_pack->segmentCount()) +
+						  "\n- bytes: " + to_string(img_pack->byteCount()) +
+						  "\n- compactions: " + to_string(img_pack->compactionCount()) +
+						  "\n- reclaimed bytes: " + to_string(img_pack->reclaimedBytes()));
+	}
+	string lane_stats;
+	for (size_t i = 0; i < RequestLanes::LANE_COUNT; i++) {
+		auto lane = static_cast<RequestLanes::Lane>(i);
+		lane_stats += "\n- " + string(RequestLanes::laneName(lane)) + ": served " + to_string(lanes.servedCount(lane)) +
+					  ", queued " + to_string(lanes.queuedCount(lane)) + ", rejected " +
+					  to_string(lanes.rejectedCount(lane));
+	}
+	MyLogger::log("carinfo-manager-logger", MyLogger::LOG_LEVEL::INFO, "Request lanes" + lane_stats);
+	if (rate_limiter)
+		MyLogger::log("carinfo-manager-logger",
+					  MyLogger::LOG_LEVEL::INFO,
+					  "Rate limiter\n- admitted: " + to_string(rate_limiter->admittedCount()) +
+						  "\n- limited: " + to_string(rate_limiter->limitedCount()) +
+						  "\n- clients: " + to_string(rate_limiter->clientCount()));
+	const ImageCache &imgcache = handler.imageCache();
+	MyLogger::log("carinfo-manager-logger",
+				  MyLogger::LOG_LEVEL::INFO,
+				  "Image cache\n- hits: " + to_string(imgcache.hitCount()) +
+					  "\n- misses: " + to_string(imgcache.missCount()) +
+					  "\n- evictions: " + to_string(imgcache.evictionCount()) +
+					  "\n- bytes: " + to_string(imgcache.byteCount()));
+	if (const FragmentCache *fragcache = carpool.fragmentCache())
+		MyLogger::log("carinfo-manager-logger",
+					  MyLogger::LOG_LEVEL::INFO,
+					  "Car JSON cache\n- hits: " + to_string(fragcache->hitCount()) +
+						  "\n- misses: " + to_string(fragcache->missCount()) +
+						  "\n- evictions: " + to_string(fragcache->evictionCount()) +
+						  "\n- bytes: " + to_string(fragcache->byteCount()));
 	return 0;
 }